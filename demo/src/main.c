@@ -167,7 +167,7 @@ static int filter_thrd(void* arg)
     struct context* ctx = (struct context*) arg;
     /* Fill in input envmap struct */
     struct envmap em_in;
-    em_in.channels = ctx->in->channels;
+    em_in.format = ctx->in->channels == 4 ? EM_FORMAT_R8G8B8A8 : EM_FORMAT_R8G8B8;
     em_in.data = ctx->in->data;
     em_in.width = ctx->in->width;
     em_in.height = ctx->in->height;
@@ -50,14 +50,30 @@ enum envmap_type {
     EM_TYPE_UNKNOWN
 };
 
+/* Pixel formats, channels are stored in rgb(a) order and alpha is never read */
+enum envmap_format {
+    /* 8 bit unsigned normalized */
+    EM_FORMAT_R8G8B8 = 0,
+    EM_FORMAT_R8G8B8A8,
+    /* IEEE half floats */
+    EM_FORMAT_RGB16F,
+    EM_FORMAT_RGBA16F,
+    /* IEEE floats */
+    EM_FORMAT_RGB32F,
+    EM_FORMAT_RGBA32F,
+    /* 8 bit sRGB encoded, decoded to linear on load and encoded back on store */
+    EM_FORMAT_SRGB8,
+    EM_FORMAT_SRGB8_A8
+};
+
 struct envmap {
     /* Type */
     enum envmap_type type;
     /* Image dimensions */
     uint32_t width, height;
-    /* Number of color channels */
-    uint8_t channels;
-    /* Raw image data */
+    /* Pixel format */
+    enum envmap_format format;
+    /* Raw image data, float formats must be aligned to their channel size */
     GLOBAL uint8_t* data;
 };
 
@@ -88,18 +104,127 @@ enum envmap_type envmap_detect_type(int width, int height);
 void envmap_vec_to_texel_coord(PRIVATE float* u, PRIVATE float* v, PRIVATE uint8_t* face_idx, enum envmap_type em_type, PRIVATE const float* vec);
 /* Notice: faceSize should not be equal to one! */
 float envmap_warp_fixup_factor(float face_size);
-/* U and V should be center adressing and in [-1.0+invSize..1.0-invSize] range */
+/* U and V should be center adressing and in [-1.0+invSize..1.0-invSize] range, latlong maps are never warped */
 void envmap_texel_coord_to_vec(PRIVATE float* out3f, enum envmap_type em_type, float u, float v, uint8_t face_id);
 void envmap_texel_coord_to_vec_warp(PRIVATE float* out3f, enum envmap_type em_type, float u, float v, uint8_t face_id, float warp_fixup);
-/* Calculates face size in pixels using envmap type and dimensions */
+/* Fills in the u, v and normal axes of the given cube face, a direction is u * basis[0] + v * basis[1] + basis[2] */
+void envmap_cube_face_basis(PRIVATE float basis[3][3], uint8_t face_id);
+/*
+ * Calculates face size in pixels using envmap type and dimensions.
+ * Latlong maps are handled as a single face, as high as the image and twice as wide.
+ */
 uint32_t envmap_face_size(struct envmap* em);
+/* Image dimensions of a cube map layout with the given face size */
+void envmap_cube_dims(PRIVATE uint32_t* width, PRIVATE uint32_t* height, enum envmap_type em_type, uint32_t face_size);
+/* Face width in pixels, equal to the face size for cube maps */
+uint32_t envmap_face_width(struct envmap* em);
+/* Number of faces, 6 for cube maps and 1 for latlong maps */
+uint32_t envmap_face_count(struct envmap* em);
 /* Sampling function */
 void envmap_sample(PRIVATE float col[3], PRIVATE struct envmap* em, PRIVATE float vec[3]);
+/* Bilinear sampling, cube maps filter across face edges and corners and latlong maps across the seam and the poles */
+void envmap_sample_bilinear(PRIVATE float col[3], PRIVATE struct envmap* em, PRIVATE const float vec[3]);
 /* Set pixel in envmap */
 void envmap_setpixel(PRIVATE struct envmap* em, uint32_t x, uint32_t y, enum cubemap_face face, PRIVATE float val[3]);
 /* Get pixel ptr in envmap data */
 GLOBAL uint8_t* envmap_pixel_ptr(PRIVATE struct envmap* em, uint32_t x, uint32_t y, enum cubemap_face face);
 
+/*
+ * Pixel format utils
+ */
+/* Number of stored channels */
+uint32_t envmap_format_channels(enum envmap_format fmt);
+/* Bytes per pixel */
+uint32_t envmap_format_size(enum envmap_format fmt);
+/* Loads the rgb value of a pixel */
+void envmap_texel_load(PRIVATE float col[3], GLOBAL const uint8_t* src, enum envmap_format fmt);
+/* Stores an rgb value into a pixel, 8 bit formats are clamped to [0, 1] and alpha is written opaque.
+ * Linear 8 bit formats truncate, sRGB formats round to the nearest code. */
+void envmap_texel_store(GLOBAL uint8_t* dst, enum envmap_format fmt, PRIVATE const float val[3]);
+#ifndef OPENCL_MODE
+/* IEEE half float conversions, float_to_half rounds to nearest even */
+float half_to_float(uint16_t h);
+uint16_t float_to_half(float f);
+#endif
+
+/*
+ * Resolved views
+ */
+#ifndef OPENCL_MODE
+#include <stddef.h>
+/*
+ * Layout of an envmap resolved once, so per texel access is plain pointer arithmetic.
+ * Strides are in bytes and negative for faces stored flipped.
+ */
+struct envmap_view {
+    enum envmap_type type;
+    enum envmap_format format;
+    uint32_t face_size, face_width, face_count;
+    /* Address of pixel (0, 0) of every face */
+    uint8_t* face_base[6];
+    ptrdiff_t pixel_stride[6];
+    ptrdiff_t row_stride[6];
+};
+
+/* The view stays valid as long as the envmap data does */
+void envmap_view_init(struct envmap_view* view, struct envmap* em);
+/* Same nearest texel lookup as envmap_sample */
+void envmap_view_sample(float col[3], const struct envmap_view* view, const float vec[3]);
+/* Same bilinear lookup as envmap_sample_bilinear */
+void envmap_view_sample_bilinear(float col[3], const struct envmap_view* view, const float vec[3]);
+/* Bilinear lookups of n normalized directions given as x, y and z planes into r, g and b planes, cube faces are found with SIMD */
+void envmap_view_sample_bilinear_row(float* col[3], const struct envmap_view* view, const float* dir[3], size_t n);
+
+/* Loads n texels of a face row starting at (x, y) into separate r, g and b planes, 4 byte texels take a SIMD path */
+void envmap_view_load_row(float* dst[3], const struct envmap_view* view, uint32_t x, uint32_t y, int face, size_t n);
+/* Double precision variant, 8 bit linear codes are converted in double precision */
+void envmap_view_load_row_d(double* dst[3], const struct envmap_view* view, uint32_t x, uint32_t y, int face, size_t n);
+
+static inline uint8_t* envmap_view_pixel_ptr(const struct envmap_view* view, uint32_t x, uint32_t y, int face)
+{
+    return view->face_base[face] + (ptrdiff_t)y * view->row_stride[face] + (ptrdiff_t)x * view->pixel_stride[face];
+}
+
+static inline void envmap_view_setpixel(const struct envmap_view* view, uint32_t x, uint32_t y, int face, const float val[3])
+{
+    envmap_texel_store(envmap_view_pixel_ptr(view, x, y, face), view->format, val);
+}
+#endif
+
+/*
+ * Mip chains
+ */
+#ifndef OPENCL_MODE
+/* Enough levels for faces up to 32768 texels */
+#define ENVMAP_MAX_MIPS 16
+
+/* Level 0 is the source map itself, the data of the others is owned by the chain */
+struct envmap_mips {
+    uint32_t num_levels;
+    struct envmap levels[ENVMAP_MAX_MIPS];
+};
+
+/*
+ * Builds the chain of em down to faces of a single texel (a single row for latlong maps), keeping its layout and format.
+ * Every texel is the solid angle weighted average of the source texels it covers. Odd sizes round down and weigh
+ * the partially covered texels by their coverage, so a texel never gathers from outside of its own face.
+ */
+void envmap_build_mips(struct envmap_mips* mips, struct envmap* em);
+void envmap_mips_free(struct envmap_mips* mips);
+#endif
+
+/*
+ * Layout conversion
+ */
+#ifndef OPENCL_MODE
+/*
+ * Converts src into the layout, format and size described by dst, whose data is provided by the caller.
+ * Cube maps of equal face size are copied texel for texel, every other combination is resampled
+ * with the bilinear sampler. Areas of cross layouts outside of the faces are left untouched.
+ */
+void envmap_convert(struct envmap* dst, struct envmap* src);
+#endif
+
 /*
  * Math utils
  */
@@ -0,0 +1,84 @@
+/*********************************************************************************************************************/
+/*                                                  /===-_---~~~~~~~~~------____                                     */
+/*                                                 |===-~___                _,-'                                     */
+/*                  -==\\                         `//~\\   ~~~~`---.___.-~~                                          */
+/*              ______-==|                         | |  \\           _-~`                                            */
+/*        __--~~~  ,-/-==\\                        | |   `\        ,'                                                */
+/*     _-~       /'    |  \\                      / /      \      /                                                  */
+/*   .'        /       |   \\                   /' /        \   /'                                                   */
+/*  /  ____  /         |    \`\.__/-~~ ~ \ _ _/'  /          \/'                                                     */
+/* /-'~    ~~~~~---__  |     ~-/~         ( )   /'        _--~`                                                      */
+/*                   \_|      /        _)   ;  ),   __--~~                                                           */
+/*                     '~~--_/      _-~/-  / \   '-~ \                                                               */
+/*                    {\__--_/}    / \\_>- )<__\      \                                                              */
+/*                    /'   (_/  _-~  | |__>--<__|      |                                                             */
+/*                   |0  0 _/) )-~     | |__>--<__|     |                                                            */
+/*                   / /~ ,_/       / /__>---<__/      |                                                             */
+/*                  o o _//        /-~_>---<__-~      /                                                              */
+/*                  (^(~          /~_>---<__-      _-~                                                               */
+/*                 ,/|           /__>--<__/     _-~                                                                  */
+/*              ,//('(          |__>--<__|     /                  .----_                                             */
+/*             ( ( '))          |__>--<__|    |                 /' _---_~\                                           */
+/*          `-)) )) (           |__>--<__|    |               /'  /     ~\`\                                         */
+/*         ,/,'//( (             \__>--<__\    \            /'  //        ||                                         */
+/*       ,( ( ((, ))              ~-__>--<_~-_  ~--____---~' _/'/        /'                                          */
+/*     `~/  )` ) ,/|                 ~-_~>--<_/-__       __-~ _/                                                     */
+/*   ._-~//( )/ )) `                    ~~-'_/_/ /~~~~~~~__--~                                                       */
+/*    ;'( ')/ ,)(                              ~~~~~~~~~~                                                            */
+/*   ' ') '( (/                                                                                                      */
+/*     '   '  `                                                                                                      */
+/*********************************************************************************************************************/
+#ifndef _ENVMAP_FILE_H_
+#define _ENVMAP_FILE_H_
+
+#include <stddef.h>
+#include "envmap.h"
+
+/*
+ * Raw envmap container, all fields in host (little endian) byte order.
+ * A header and a table of num_levels level entries are followed by the image data of every level,
+ * each starting at a multiple of the alignment so a mapping of the file can be used in place.
+ */
+#define ENVMAP_FILE_MAGIC "EMPROCMF"
+#define ENVMAP_FILE_VERSION 1
+/* Alignment of the level data written, the usual page size */
+#define ENVMAP_FILE_ALIGN 4096
+
+struct envmap_file_header {
+    char magic[8];
+    uint32_t version;
+    /* Layout and format shared by all levels */
+    uint32_t type;
+    uint32_t format;
+    uint32_t num_levels;
+    uint32_t alignment;
+    uint32_t reserved;
+};
+
+struct envmap_file_level {
+    /* Image data in the layout of the file, offsets are from the start of the file */
+    uint64_t offset;
+    uint64_t size;
+    uint32_t width, height;
+    uint32_t face_size, face_width;
+    /* Pixel (0, 0) of every face and the byte steps to the next pixel and row, unused faces are zero */
+    uint64_t face_offset[6];
+    int64_t pixel_stride[6];
+    int64_t row_stride[6];
+};
+
+/* A mapped container */
+struct envmap_file {
+    /* Levels point into a private copy on write mapping, release them with envmap_file_close only */
+    struct envmap_mips mips;
+    void* map;
+    size_t map_sz;
+};
+
+/* Maps the file at path and validates it, returns 1 on success and 0 on failure */
+int envmap_file_open(struct envmap_file* file, const char* path);
+void envmap_file_close(struct envmap_file* file);
+/* Writes every level of mips to path, a single map is written as a chain of one level. Returns 1 on success and 0 on failure */
+int envmap_file_write(const char* path, struct envmap_mips* mips);
+
+#endif /* ! _ENVMAP_FILE_H_ */
@@ -33,10 +33,33 @@
 
 #include "envmap.h"
 
+/* Progress callback, may be invoked from the library worker threads but never concurrently */
 typedef void(*filter_progress_fn)(void* userdata);
 
+/*
+ * Irradiance of em_in into em_out. The output layout, face size and format are taken from em_out alone,
+ * small irradiance maps of large sources only pay for their own texels.
+ */
 void irradiance_filter(struct envmap* em_out, struct envmap* em_in, filter_progress_fn progress_fn, void* userdata);
+/* Same convolution as irradiance_filter on an OpenCL device, with the same kernel and source level */
 void irradiance_filter_gpu(struct envmap* em_out, struct envmap* em_in, filter_progress_fn progress_fn, void* userdata);
 void irradiance_filter_sh(struct envmap* em_out, struct envmap* em_in, filter_progress_fn progress_fn, void* userdata);
+/*
+ * Prefiltered GGX radiance for the split sum approximation, level i of mips_out holds roughness i / (num_levels - 1).
+ * The output levels are described and allocated by the caller and may differ in size, layout and format from em_in.
+ * Progress is reported once per output tile of every level.
+ */
+void radiance_filter_ggx(struct envmap_mips* mips_out, struct envmap* em_in, filter_progress_fn progress_fn, void* userdata);
+
+/* Texel formats of the environment BRDF table, two channels holding (scale, bias) */
+enum brdf_lut_format {
+    BRDF_LUT_RG16F = 0,
+    BRDF_LUT_RG32F
+};
+/*
+ * Split sum environment BRDF of GGX for the radiance filter above, the applied specular is F0 * scale + bias.
+ * Columns sample NdotV and rows roughness over (0, 1] at texel centers, out holds width * height texels.
+ */
+void brdf_lut_ggx(void* out, uint32_t width, uint32_t height, enum brdf_lut_format format, uint32_t num_samples);
 
 #endif /* ! _FILTER_H_ */
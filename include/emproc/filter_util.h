@@ -31,10 +31,69 @@
 #ifndef _FILTER_UTIL_H_
 #define _FILTER_UTIL_H_
 
-#include <stdlib.h>
 #include "envmap.h"
+#ifndef OPENCL_MODE
+#include <stdlib.h>
+#endif
+
+/* Alignment in bytes of the index memory and of every plane of the SoA layout */
+#define NSA_PLANE_ALIGN 64
+
+/* Memory layout of the normal/solid angle index */
+enum nsa_layout {
+    /* Interleaved {x, y, z, solid_angle} records */
+    NSA_LAYOUT_AOS,
+    /* Separate x, y, z and solid_angle planes, each one aligned and padded to NSA_PLANE_ALIGN */
+    NSA_LAYOUT_SOA,
+    /*
+     * Single face octant of {u, v, n, solid_angle} records for cube maps.
+     * Every other texel is a signed permutation of these, expanded when rows are fetched.
+     */
+    NSA_LAYOUT_SYMMETRIC,
+    /* No stored index, rows are generated on the fly and memory use stays O(face row) */
+    NSA_LAYOUT_NONE
+};
+
+size_t normal_solid_angle_index_sz(size_t face_sz, enum nsa_layout layout);
+void   normal_solid_angle_index_build(void* mem, size_t face_sz, enum envmap_type em_type, enum nsa_layout layout);
+/* Distance in floats between two consecutive planes of a NSA_LAYOUT_SOA index */
+size_t normal_solid_angle_index_plane_stride(size_t face_sz);
+/* Allocates index memory aligned to NSA_PLANE_ALIGN, release with normal_solid_angle_index_free */
+void*  normal_solid_angle_index_alloc(size_t face_sz, enum nsa_layout layout);
+void   normal_solid_angle_index_free(void* mem);
+/*
+ * Fills planes with the x, y, z and solid angle arrays of a single face row.
+ * SoA rows are returned in place, other layouts are expanded into scratch that must hold 4 * face_sz floats.
+ */
+void   normal_solid_angle_index_row(const float* planes[4], const void* idx, size_t face_sz, enum nsa_layout layout, int face, size_t row, float* scratch);
+
+/*
+ * Generates the x, y, z and solid angle arrays of a cube face row without an index, into planes of 4 * face_sz floats.
+ * Per row terms are computed once and neighbouring texels share their solid angle boundary terms.
+ * Directions match the built index exactly, solid angles differ only by float rounding of the area terms
+ * and projected SH coefficients stay within 1e-6 of the indexed path.
+ */
+void normal_solid_angle_row_generate(float* planes, size_t face_sz, int face, size_t row);
+/*
+ * Generates the x, y, z and solid angle arrays of a latlong map row into planes of 4 * width floats.
+ * Solid angles are exact per row bands, sin(phi) integrated over the row, and sum up to 4 * pi.
+ */
+void normal_solid_angle_latlong_row_generate(float* planes, size_t width, size_t height, size_t row);
+/* Fetches the {x, y, z, solid_angle} entry of a single texel from a NSA_LAYOUT_SYMMETRIC index */
+void normal_solid_angle_index_symmetric_fetch(PRIVATE float nsa[4], GLOBAL const float* idx, uint32_t face_sz, uint8_t face, uint32_t x, uint32_t y);
+/* Fetches the {x, y, z, solid_angle} entry of a single texel from an index of any layout, idx is ignored for NSA_LAYOUT_NONE */
+void normal_solid_angle_index_fetch(PRIVATE float nsa[4], GLOBAL const float* idx, enum nsa_layout layout, uint32_t plane_stride, uint32_t face_sz, uint8_t face, uint32_t x, uint32_t y);
 
-float normal_solid_angle_index_sz(size_t face_sz);
-void  normal_solid_angle_index_build(void* mem, size_t face_sz, enum envmap_type em_type);
+/*
+ * Process wide cache of built indices, keyed by face size, envmap type and layout.
+ * Acquired indices are shared and read only, every acquire must be paired with a release.
+ * NSA_LAYOUT_NONE stores nothing and acquires 0, an index that cannot be cached is built for the caller alone.
+ */
+const float* normal_solid_angle_index_acquire(size_t face_sz, enum envmap_type em_type, enum nsa_layout layout);
+void normal_solid_angle_index_release(const float* idx);
+/* Memory budget in bytes for cached indices, unreferenced ones are evicted least recently used first */
+void normal_solid_angle_index_cache_budget(size_t bytes);
+/* Evicts every unreferenced cached index */
+void normal_solid_angle_index_cache_clear(void);
 
 #endif /* ! _FILTER_UTIL_H_ */
@@ -33,12 +33,80 @@
 
 #include "sh.h"
 #include "envmap.h"
+#include "filter_util.h"
 
+/* Coefficients of the highest supported order, enough storage for any of them */
 #define SH_COEFF_NUM 25
 
-void sh_eval_basis5(double* sh_basis, GLOBAL const float* dir);
-void sh_coeffs(double sh_coeffs[SH_COEFF_NUM][3], struct envmap* em, float* nsa_idx);
-void sh_coeffs_gpu(double sh_coeffs[SH_COEFF_NUM][3], struct envmap* em, float* nsa_idx);
-void sh_irradiance(float irr[3], double sh_rgb[SH_COEFF_NUM][3], float dir[3]);
+/* Expansion orders named after their highest band, values are band counts */
+enum sh_order {
+    SH_ORDER_L1 = 2,
+    SH_ORDER_L2 = 3,
+    SH_ORDER_L3 = 4,
+    SH_ORDER_L4 = 5
+};
+
+/* Coefficients per channel of an order */
+#define SH_COEFF_COUNT(order) ((order) * (order))
+
+#ifdef OPENCL_MODE
+/*
+ * Order the projection kernels are specialized for. It is left undefined while the kernel
+ * sources are preprocessed and the host passes it as a device build option.
+ */
+#define SH_KERNEL_COEFF_NUM SH_COEFF_COUNT(SH_KERNEL_ORDER)
+#endif
+
+/* Arithmetic precision of the SH projection */
+enum sh_precision {
+    /* Double precision basis, products and sums */
+    SH_PRECISION_DOUBLE,
+    /*
+     * Single precision basis and products, twice the SIMD lanes of the double path.
+     * Sums are pairwise within a batch and Kahan compensated across batches, partial sums
+     * of row chunks are combined in double. Coefficients stay within 1e-6 of the double path.
+     */
+    SH_PRECISION_FLOAT
+};
+
+/*
+ * Every order has its own unrolled evaluator, these write SH_COEFF_COUNT(order) values.
+ * sh_eval_basis5 and sh_eval_basis5f are the L4 evaluators.
+ */
+void sh_eval_basis(double* sh_basis, enum sh_order order, const float* dir);
+void sh_eval_basisf(float* sh_basis, enum sh_order order, const float* dir);
+void sh_eval_basis5(double* sh_basis, const float* dir);
+void sh_eval_basis5f(float* sh_basis, const float* dir);
+/*
+ * Projects em into the SH_COEFF_COUNT(order) coefficients of sh_coeffs, cube maps read
+ * their texel directions from nsa_idx while latlong maps ignore it and generate them
+ */
+void sh_coeffs(double sh_coeffs[][3], enum sh_order order, struct envmap* em, const float* nsa_idx, enum nsa_layout nsa_layout, enum sh_precision precision);
+void sh_coeffs_gpu(double sh_coeffs[][3], enum sh_order order, struct envmap* em, const float* nsa_idx, enum nsa_layout nsa_layout, enum sh_precision precision);
+/* Band 3 of the irradiance transfer is zero, L3 expansions reconstruct like L2 ones */
+void sh_irradiance(float irr[3], double sh_rgb[][3], enum sh_order order, float dir[3]);
+
+#ifndef OPENCL_MODE
+#include <stddef.h>
+/* Number of directions the library feeds to the batched routines at once */
+#define SH_BATCH_SZ 64
+/*
+ * Batched variants over n directions given as separate x, y and z arrays.
+ * Basis output is basis major, sh_basis[i * n + k] holds basis function i of direction k.
+ * Irradiance output is interleaved rgb, irr[k * 3 + c].
+ * Vector kernels (SSE2, AVX2, AVX-512) are picked at runtime with a scalar fallback.
+ */
+void sh_eval_basis_batch(double* sh_basis, enum sh_order order, const float* x, const float* y, const float* z, size_t n);
+void sh_eval_basisf_batch(float* sh_basis, enum sh_order order, const float* x, const float* y, const float* z, size_t n);
+void sh_irradiance_batch(float* irr, double sh_rgb[][3], enum sh_order order, const float* x, const float* y, const float* z, size_t n);
+void sh_irradiancef_batch(float* irr, float sh_rgb[][3], enum sh_order order, const float* x, const float* y, const float* z, size_t n);
+/*
+ * Ramamoorthi-Hanrahan quadratic form of the L2 irradiance, channel c at normal n is (n, 1)^T m[c] (n, 1).
+ * Built from the first 9 coefficients of an expansion of any order, it reproduces sh_irradiance of its L2 part.
+ */
+void sh_irradiance_matrices(float m[3][4][4], double sh_rgb[][3]);
+/* Evaluates the quadratic forms for n normals, output is interleaved rgb like sh_irradiance_batch */
+void sh_irradiance_quadratic_batch(float* irr, float m[3][4][4], const float* x, const float* y, const float* z, size_t n);
+#endif
 
 #endif /* ! _SH_H_ */
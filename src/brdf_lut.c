@@ -0,0 +1,196 @@
+#include <emproc/filter.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "thread_pool.h"
+#include "ggx_sampling.h"
+
+/* GCC only, clang ignores the optimize attribute that keeps the vector kernels free of contractions */
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define BRDF_SIMD_X86
+#endif
+
+/*
+ * Samples are accumulated into this many interleaved partial sums, sample i into lane i % BRDF_LANES,
+ * every ISA splits them into vectors of its own width so all of them sum in the same order
+ */
+#define BRDF_LANES 16
+
+typedef void(*brdf_texel_fn)(float sums[2], const float* hx, const float* hz, size_t n, float n_dot_v, float k);
+
+/*======================================================================
+ * Sample kernels
+ *======================================================================*/
+/*
+ * Split sum (scale, bias) of one texel, for a view direction (sqrt(1 - NdotV^2), 0, NdotV) and the half vectors
+ * (hx, *, hz) of the row roughness. Samples reflecting below the horizon contribute zero. The arrays hold n samples
+ * padded to a multiple of BRDF_LANES, the padding is masked out by count.
+ */
+static void brdf_texel_scalar(float sums[2], const float* hx, const float* hz, size_t n, float n_dot_v, float k)
+{
+    const float v_x = sqrtf(1.0f - n_dot_v * n_dot_v);
+    /* Smith G1 of the view folded with the 1 / NdotV of the pdf conversion */
+    const float vis_v = 1.0f / (n_dot_v * (1.0f - k) + k);
+    float scale[BRDF_LANES] = {0}, bias[BRDF_LANES] = {0};
+    for (size_t i = 0; i < n; ++i) {
+        const float v_dot_h = v_x * hx[i] + n_dot_v * hz[i];
+        const float n_dot_l = 2.0f * v_dot_h * hz[i] - n_dot_v;
+        if (n_dot_l > 0.0f) {
+            const float g_vis = vis_v * n_dot_l * v_dot_h / ((n_dot_l * (1.0f - k) + k) * hz[i]);
+            const float c = 1.0f - v_dot_h;
+            const float fc = c * c * c * c * c;
+            scale[i % BRDF_LANES] += (1.0f - fc) * g_vis;
+            bias[i % BRDF_LANES] += fc * g_vis;
+        }
+    }
+    for (size_t half = BRDF_LANES / 2; half > 0; half /= 2) {
+        for (size_t l = 0; l < half; ++l) {
+            scale[l] += scale[l + half];
+            bias[l] += bias[l + half];
+        }
+    }
+    sums[0] = scale[0];
+    sums[1] = bias[0];
+}
+
+#ifdef BRDF_SIMD_X86
+/* Same operations per lane as the scalar kernel with contraction disabled, so every ISA produces identical tables */
+#define BRDF_DEFINE_TEXEL_KERNEL(name, isa, lanes)                                               \
+typedef float   name##_vf __attribute__((vector_size(lanes * sizeof(float))));                  \
+typedef int32_t name##_vi __attribute__((vector_size(lanes * sizeof(int32_t))));                \
+__attribute__((target(isa), optimize("fp-contract=off")))                                        \
+static void name(float sums[2], const float* hx, const float* hz, size_t n, float n_dot_v, float k) \
+{                                                                                                \
+    enum { vecs = BRDF_LANES / lanes };                                                          \
+    const float v_x = sqrtf(1.0f - n_dot_v * n_dot_v);                                           \
+    const float vis_v = 1.0f / (n_dot_v * (1.0f - k) + k);                                       \
+    const name##_vf zero = {0};                                                                  \
+    name##_vi lane;                                                                              \
+    for (int l = 0; l < lanes; ++l)                                                              \
+        lane[l] = l;                                                                             \
+    name##_vf scale[vecs], bias[vecs];                                                           \
+    for (int j = 0; j < vecs; ++j) {                                                             \
+        scale[j] = zero;                                                                         \
+        bias[j] = zero;                                                                          \
+    }                                                                                            \
+    for (size_t i = 0; i < n; i += BRDF_LANES) {                                                 \
+        const int32_t left = n - i < BRDF_LANES ? (int32_t)(n - i) : BRDF_LANES;                 \
+        for (int j = 0; j < vecs; ++j) {                                                         \
+            name##_vf hxv, hzv;                                                                  \
+            memcpy(&hxv, hx + i + j * lanes, sizeof(hxv));                                       \
+            memcpy(&hzv, hz + i + j * lanes, sizeof(hzv));                                       \
+            const name##_vf v_dot_h = v_x * hxv + n_dot_v * hzv;                                 \
+            const name##_vf n_dot_l = 2.0f * v_dot_h * hzv - n_dot_v;                            \
+            const name##_vi above = (n_dot_l > zero) & (lane < left - j * lanes);                \
+            const name##_vf g_vis = vis_v * n_dot_l * v_dot_h / ((n_dot_l * (1.0f - k) + k) * hzv); \
+            const name##_vf c = 1.0f - v_dot_h;                                                  \
+            const name##_vf fc = c * c * c * c * c;                                              \
+            scale[j] += (name##_vf)((name##_vi)((1.0f - fc) * g_vis) & above);                   \
+            bias[j] += (name##_vf)((name##_vi)(fc * g_vis) & above);                             \
+        }                                                                                        \
+    }                                                                                            \
+    float s[BRDF_LANES], b[BRDF_LANES];                                                          \
+    memcpy(s, scale, sizeof(s));                                                                 \
+    memcpy(b, bias, sizeof(b));                                                                  \
+    for (size_t half = BRDF_LANES / 2; half > 0; half /= 2) {                                    \
+        for (size_t l = 0; l < half; ++l) {                                                      \
+            s[l] += s[l + half];                                                                 \
+            b[l] += b[l + half];                                                                 \
+        }                                                                                        \
+    }                                                                                            \
+    sums[0] = s[0];                                                                              \
+    sums[1] = b[0];                                                                              \
+}
+
+BRDF_DEFINE_TEXEL_KERNEL(brdf_texel_sse2,   "sse2",    4)
+BRDF_DEFINE_TEXEL_KERNEL(brdf_texel_avx2,   "avx2",    8)
+BRDF_DEFINE_TEXEL_KERNEL(brdf_texel_avx512, "avx512f", 16)
+#endif
+
+static brdf_texel_fn brdf_texel_select(void)
+{
+#ifdef BRDF_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return brdf_texel_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return brdf_texel_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return brdf_texel_sse2;
+#endif
+    return brdf_texel_scalar;
+}
+
+/*======================================================================
+ * Table generation
+ *======================================================================*/
+struct brdf_lut_job {
+    uint8_t* out;
+    enum brdf_lut_format format;
+    uint32_t width, height;
+    uint32_t num_samples;
+    brdf_texel_fn texel;
+};
+
+static void brdf_lut_rows(size_t first, size_t last, void* userdata)
+{
+    const struct brdf_lut_job* job = userdata;
+    const uint32_t num_samples = job->num_samples;
+    /* Half vectors padded to whole lane groups with the normal, the kernels mask the padding out by count */
+    const size_t padded = (num_samples + BRDF_LANES - 1) / BRDF_LANES * BRDF_LANES;
+    float* hx = malloc(2 * padded * sizeof(float));
+    if (!hx)
+        return;
+    float* hz = hx + padded;
+    for (size_t i = num_samples; i < padded; ++i) {
+        hx[i] = 0.0f;
+        hz[i] = 1.0f;
+    }
+
+    for (size_t y = first; y < last; ++y) {
+        /* Half vectors of the GGX lobe only depend on the row roughness */
+        const float roughness = (y + 0.5f) / job->height;
+        const float alpha = roughness * roughness;
+        const float a2 = alpha * alpha;
+        /* Smith visibility remapping for image based lighting */
+        const float k = alpha * 0.5f;
+        for (uint32_t i = 0; i < num_samples; ++i) {
+            float h[3];
+            ggx_sample_half_vector(h, i, num_samples, a2);
+            hx[i] = h[0];
+            hz[i] = h[2];
+        }
+
+        for (uint32_t x = 0; x < job->width; ++x) {
+            const float n_dot_v = (x + 0.5f) / job->width;
+            float sums[2];
+            job->texel(sums, hx, hz, num_samples, n_dot_v, k);
+            const float scale = sums[0] / num_samples;
+            const float bias = sums[1] / num_samples;
+
+            const size_t idx = ((size_t)y * job->width + x) * 2;
+            if (job->format == BRDF_LUT_RG16F) {
+                const uint16_t h[2] = { float_to_half(scale), float_to_half(bias) };
+                memcpy(job->out + idx * sizeof(uint16_t), h, sizeof(h));
+            } else {
+                const float f[2] = { scale, bias };
+                memcpy(job->out + idx * sizeof(float), f, sizeof(f));
+            }
+        }
+    }
+    free(hx);
+}
+
+void brdf_lut_ggx(void* out, uint32_t width, uint32_t height, enum brdf_lut_format format, uint32_t num_samples)
+{
+    struct brdf_lut_job job;
+    job.out = out;
+    job.format = format;
+    job.width = width;
+    job.height = height;
+    job.num_samples = num_samples > 0 ? num_samples : 1;
+    job.texel = brdf_texel_select();
+    /* Rows only depend on their roughness, chunks stay around a few hundred thousand samples */
+    const size_t grain = 262144 / ((size_t)width * job.num_samples);
+    parallel_for(height, grain > 0 ? grain : 1, brdf_lut_rows, &job);
+}
@@ -1,12 +1,15 @@
 #include <emproc/envmap.h>
 #ifndef OPENCL_MODE
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
+#include "thread_pool.h"
 #define GLOBAL_CONSTANT const
 #else
 #define fabsf fabs
 #define fmaxf fmax
+#define floorf floor
 #define sqrtf sqrt
 #define cosf cos
 #define sinf sin
@@ -72,6 +75,314 @@ static float vec3_dot(const float a[3], const float b[3]) { return a[0] * b[0] +
 #define vec3_dot(x, y) dot(vload3(0, x), vload3(0, y))
 #endif
 
+/*======================================================================
+ * Pixel formats
+ *======================================================================*/
+#ifndef OPENCL_MODE
+union f32_bits {
+    uint32_t u;
+    float f;
+};
+
+float half_to_float(uint16_t h)
+{
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t exp = (h >> 10) & 0x1f;
+    const uint32_t mant = h & 0x3ff;
+    union f32_bits r;
+    if (exp == 0) {
+        /* Zero or subnormal, mant * 2^-24 */
+        r.f = (float)mant * (1.0f / 16777216.0f);
+        r.u |= sign;
+    } else if (exp == 31) {
+        /* Inf or NaN */
+        r.u = sign | 0x7f800000 | (mant << 13);
+    } else {
+        /* Rebias exponent */
+        r.u = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    return r.f;
+}
+
+uint16_t float_to_half(float f)
+{
+    union f32_bits v;
+    v.f = f;
+    const uint16_t sign = (v.u >> 16) & 0x8000;
+    const uint32_t absu = v.u & 0x7fffffff;
+    /* Inf or NaN */
+    if (absu >= 0x7f800000)
+        return sign | 0x7c00 | (absu > 0x7f800000 ? 0x200 : 0);
+    /* Rounds to infinity, 65520 and above */
+    if (absu >= 0x477ff000)
+        return sign | 0x7c00;
+    /* Subnormal or zero, adding 0.5 aligns the half subnormal ulp to the float one and rounds to nearest even */
+    if (absu < 0x38800000) {
+        union f32_bits t;
+        t.u = absu;
+        t.f += 0.5f;
+        return sign | (uint16_t)(t.u - 0x3f000000);
+    }
+    /* Normal, rebias exponent and round mantissa to nearest even */
+    const uint32_t mant_odd = (absu >> 13) & 1;
+    return sign | (uint16_t)((absu + 0xc8000fff + mant_odd) >> 13);
+}
+
+static float load_f16(GLOBAL const uint8_t* p, int i) { uint16_t h; memcpy(&h, p + 2 * i, 2); return half_to_float(h); }
+static float load_f32(GLOBAL const uint8_t* p, int i) { float f; memcpy(&f, p + 4 * i, 4); return f; }
+static void store_f16(GLOBAL uint8_t* p, int i, float v) { const uint16_t h = float_to_half(v); memcpy(p + 2 * i, &h, 2); }
+static void store_f32(GLOBAL uint8_t* p, int i, float v) { memcpy(p + 4 * i, &v, 4); }
+#else
+#define load_f16(p, i) vload_half(i, (GLOBAL const half*)(p))
+#define load_f32(p, i) (((GLOBAL const float*)(p))[i])
+#define store_f16(p, i, v) vstore_half_rte(v, i, (GLOBAL half*)(p))
+#define store_f32(p, i, v) (((GLOBAL float*)(p))[i] = (v))
+#endif
+
+/* Every 8 bit code decoded to linear, a single table load per channel */
+static GLOBAL_CONSTANT float unorm8_decode_linear[256] = {
+    0.0f, 0.00392156886f, 0.00784313772f, 0.0117647061f, 0.0156862754f, 0.0196078438f, 0.0235294122f, 0.0274509806f,
+    0.0313725509f, 0.0352941193f, 0.0392156877f, 0.0431372561f, 0.0470588244f, 0.0509803928f, 0.0549019612f, 0.0588235296f,
+    0.0627451017f, 0.0666666701f, 0.0705882385f, 0.0745098069f, 0.0784313753f, 0.0823529437f, 0.0862745121f, 0.0901960805f,
+    0.0941176489f, 0.0980392173f, 0.101960786f, 0.105882354f, 0.109803922f, 0.113725491f, 0.117647059f, 0.121568628f,
+    0.125490203f, 0.129411772f, 0.13333334f, 0.137254909f, 0.141176477f, 0.145098045f, 0.149019614f, 0.152941182f,
+    0.156862751f, 0.160784319f, 0.164705887f, 0.168627456f, 0.172549024f, 0.176470593f, 0.180392161f, 0.184313729f,
+    0.188235298f, 0.192156866f, 0.196078435f, 0.200000003f, 0.203921571f, 0.20784314f, 0.211764708f, 0.215686277f,
+    0.219607845f, 0.223529413f, 0.227450982f, 0.23137255f, 0.235294119f, 0.239215687f, 0.243137255f, 0.247058824f,
+    0.250980407f, 0.254901975f, 0.258823544f, 0.262745112f, 0.266666681f, 0.270588249f, 0.274509817f, 0.278431386f,
+    0.282352954f, 0.286274523f, 0.290196091f, 0.294117659f, 0.298039228f, 0.301960796f, 0.305882365f, 0.309803933f,
+    0.313725501f, 0.31764707f, 0.321568638f, 0.325490206f, 0.329411775f, 0.333333343f, 0.337254912f, 0.34117648f,
+    0.345098048f, 0.349019617f, 0.352941185f, 0.356862754f, 0.360784322f, 0.36470589f, 0.368627459f, 0.372549027f,
+    0.376470596f, 0.380392164f, 0.384313732f, 0.388235301f, 0.392156869f, 0.396078438f, 0.400000006f, 0.403921574f,
+    0.407843143f, 0.411764711f, 0.41568628f, 0.419607848f, 0.423529416f, 0.427450985f, 0.431372553f, 0.435294122f,
+    0.43921569f, 0.443137258f, 0.447058827f, 0.450980395f, 0.454901963f, 0.458823532f, 0.4627451f, 0.466666669f,
+    0.470588237f, 0.474509805f, 0.478431374f, 0.482352942f, 0.486274511f, 0.490196079f, 0.494117647f, 0.498039216f,
+    0.501960814f, 0.505882382f, 0.509803951f, 0.513725519f, 0.517647088f, 0.521568656f, 0.525490224f, 0.529411793f,
+    0.533333361f, 0.53725493f, 0.541176498f, 0.545098066f, 0.549019635f, 0.552941203f, 0.556862772f, 0.56078434f,
+    0.564705908f, 0.568627477f, 0.572549045f, 0.576470613f, 0.580392182f, 0.58431375f, 0.588235319f, 0.592156887f,
+    0.596078455f, 0.600000024f, 0.603921592f, 0.607843161f, 0.611764729f, 0.615686297f, 0.619607866f, 0.623529434f,
+    0.627451003f, 0.631372571f, 0.635294139f, 0.639215708f, 0.643137276f, 0.647058845f, 0.650980413f, 0.654901981f,
+    0.65882355f, 0.662745118f, 0.666666687f, 0.670588255f, 0.674509823f, 0.678431392f, 0.68235296f, 0.686274529f,
+    0.690196097f, 0.694117665f, 0.698039234f, 0.701960802f, 0.70588237f, 0.709803939f, 0.713725507f, 0.717647076f,
+    0.721568644f, 0.725490212f, 0.729411781f, 0.733333349f, 0.737254918f, 0.741176486f, 0.745098054f, 0.749019623f,
+    0.752941191f, 0.75686276f, 0.760784328f, 0.764705896f, 0.768627465f, 0.772549033f, 0.776470602f, 0.78039217f,
+    0.784313738f, 0.788235307f, 0.792156875f, 0.796078444f, 0.800000012f, 0.80392158f, 0.807843149f, 0.811764717f,
+    0.815686285f, 0.819607854f, 0.823529422f, 0.827450991f, 0.831372559f, 0.835294127f, 0.839215696f, 0.843137264f,
+    0.847058833f, 0.850980401f, 0.854901969f, 0.858823538f, 0.862745106f, 0.866666675f, 0.870588243f, 0.874509811f,
+    0.87843138f, 0.882352948f, 0.886274517f, 0.890196085f, 0.894117653f, 0.898039222f, 0.90196079f, 0.905882359f,
+    0.909803927f, 0.913725495f, 0.917647064f, 0.921568632f, 0.925490201f, 0.929411769f, 0.933333337f, 0.937254906f,
+    0.941176474f, 0.945098042f, 0.949019611f, 0.952941179f, 0.956862748f, 0.960784316f, 0.964705884f, 0.968627453f,
+    0.972549021f, 0.97647059f, 0.980392158f, 0.984313726f, 0.988235295f, 0.992156863f, 0.996078432f, 1.0f
+};
+
+static GLOBAL_CONSTANT float unorm8_decode_srgb[256] = {
+    0.0f, 0.000303526991f, 0.000607053982f, 0.000910580973f, 0.00121410796f, 0.00151763496f, 0.00182116195f, 0.00212468882f,
+    0.00242821593f, 0.0027317428f, 0.00303526991f, 0.00334653584f, 0.00367650739f, 0.00402471703f, 0.00439144205f, 0.00477695325f,
+    0.00518151652f, 0.00560539169f, 0.00604883302f, 0.00651209056f, 0.00699541019f, 0.00749903219f, 0.00802319311f, 0.00856812578f,
+    0.00913405884f, 0.00972121768f, 0.010329823f, 0.0109600937f, 0.0116122449f, 0.012286488f, 0.0129830325f, 0.0137020834f,
+    0.0144438436f, 0.0152085144f, 0.0159962941f, 0.0168073755f, 0.0176419541f, 0.01850022f, 0.0193823613f, 0.0202885624f,
+    0.0212190095f, 0.0221738853f, 0.0231533665f, 0.0241576321f, 0.0251868591f, 0.0262412224f, 0.0273208916f, 0.02842604f,
+    0.0295568351f, 0.0307134446f, 0.0318960324f, 0.0331047662f, 0.0343398079f, 0.0356013142f, 0.0368894488f, 0.0382043719f,
+    0.0395462364f, 0.0409151986f, 0.0423114114f, 0.043735031f, 0.045186203f, 0.0466650873f, 0.0481718257f, 0.0497065671f,
+    0.0512694567f, 0.0528606474f, 0.054480277f, 0.0561284907f, 0.0578054301f, 0.0595112368f, 0.0612460524f, 0.0630100146f,
+    0.064803265f, 0.0666259378f, 0.0684781671f, 0.0703600943f, 0.0722718537f, 0.0742135718f, 0.0761853829f, 0.078187421f,
+    0.0802198201f, 0.0822827071f, 0.0843762085f, 0.0865004584f, 0.0886555836f, 0.0908417106f, 0.0930589661f, 0.0953074694f,
+    0.097587347f, 0.0998987257f, 0.102241732f, 0.104616486f, 0.107023105f, 0.10946171f, 0.111932427f, 0.114435375f,
+    0.116970666f, 0.119538426f, 0.122138776f, 0.124771819f, 0.127437681f, 0.130136475f, 0.13286832f, 0.135633335f,
+    0.138431609f, 0.141263291f, 0.144128472f, 0.147027269f, 0.149959788f, 0.152926147f, 0.155926466f, 0.158960834f,
+    0.162029371f, 0.165132195f, 0.168269396f, 0.171441108f, 0.174647406f, 0.177888423f, 0.18116425f, 0.18447499f,
+    0.187820777f, 0.191201687f, 0.194617838f, 0.198069319f, 0.20155625f, 0.205078736f, 0.208636865f, 0.212230757f,
+    0.215860501f, 0.219526201f, 0.223227963f, 0.226965874f, 0.230740055f, 0.23455058f, 0.238397568f, 0.242281124f,
+    0.246201321f, 0.25015828f, 0.254152089f, 0.258182853f, 0.262250662f, 0.266355604f, 0.270497799f, 0.274677306f,
+    0.278894275f, 0.283148736f, 0.287440836f, 0.291770637f, 0.296138257f, 0.300543785f, 0.304987311f, 0.309468925f,
+    0.313988715f, 0.318546772f, 0.323143214f, 0.327778101f, 0.332451522f, 0.337163627f, 0.341914415f, 0.346704066f,
+    0.351532608f, 0.356400132f, 0.361306787f, 0.366252601f, 0.371237695f, 0.376262128f, 0.38132602f, 0.386429429f,
+    0.391572475f, 0.396755219f, 0.401977777f, 0.407240212f, 0.412542611f, 0.417885065f, 0.423267663f, 0.428690493f,
+    0.434153646f, 0.439657182f, 0.445201188f, 0.450785786f, 0.456411034f, 0.462076992f, 0.467783809f, 0.473531485f,
+    0.479320168f, 0.48514995f, 0.491020858f, 0.496932983f, 0.502886474f, 0.50888133f, 0.514917672f, 0.520995557f,
+    0.527115107f, 0.533276379f, 0.539479494f, 0.545724452f, 0.55201143f, 0.558340371f, 0.564711511f, 0.571124852f,
+    0.577580452f, 0.584078431f, 0.590618849f, 0.597201765f, 0.603827357f, 0.610495567f, 0.617206573f, 0.623960376f,
+    0.630757153f, 0.637596846f, 0.644479692f, 0.651405632f, 0.658374846f, 0.665387273f, 0.672443151f, 0.679542482f,
+    0.686685324f, 0.693871737f, 0.701101899f, 0.708375752f, 0.715693474f, 0.723055124f, 0.730460763f, 0.73791039f,
+    0.745404184f, 0.752942204f, 0.760524511f, 0.768151164f, 0.775822222f, 0.783537805f, 0.791297913f, 0.799102724f,
+    0.806952238f, 0.814846575f, 0.822785735f, 0.830769897f, 0.838799f, 0.846873224f, 0.854992628f, 0.863157213f,
+    0.871367097f, 0.8796224f, 0.887923121f, 0.896269381f, 0.904661179f, 0.913098633f, 0.921581864f, 0.930110872f,
+    0.938685715f, 0.947306514f, 0.955973327f, 0.964686275f, 0.973445296f, 0.982250571f, 0.991102099f, 1.0f
+};
+
+/* Linear values halfway, in sRGB space, between consecutive sRGB codes, code k + 1 starts at entry k */
+static GLOBAL_CONSTANT float srgb8_encode_thresholds[255] = {
+    0.000151763496f, 0.000455290487f, 0.000758817478f, 0.00106234441f, 0.0013658714f, 0.00166939839f, 0.00197292538f, 0.00227645249f,
+    0.00257997937f, 0.00288350624f, 0.00318830088f, 0.00350925932f, 0.00384831498f, 0.00420574797f, 0.00458183279f, 0.00497683743f,
+    0.00539102405f, 0.00582465064f, 0.00627796957f, 0.00675122766f, 0.00724466844f, 0.00775853032f, 0.00829304848f, 0.00884845294f,
+    0.00942497049f, 0.0100228256f, 0.010642237f, 0.011283421f, 0.0119465925f, 0.0126319602f, 0.0133397318f, 0.0140701123f,
+    0.0148233026f, 0.0155995032f, 0.0163989104f, 0.0172217153f, 0.0180681143f, 0.0189382937f, 0.0198324434f, 0.0207507443f,
+    0.0216933824f, 0.0226605386f, 0.0236523896f, 0.0246691145f, 0.0257108882f, 0.0267778821f, 0.0278702695f, 0.0289882198f,
+    0.0301319025f, 0.0313014798f, 0.0324971229f, 0.0337189883f, 0.0349672437f, 0.0362420455f, 0.0375435539f, 0.0388719253f,
+    0.04022732f, 0.041609887f, 0.0430197865f, 0.0444571637f, 0.0459221713f, 0.0474149622f, 0.0489356853f, 0.0504844859f,
+    0.0520615056f, 0.0536668971f, 0.055300802f, 0.0569633618f, 0.0586547181f, 0.0603750125f, 0.0621243827f, 0.0639029741f,
+    0.0657109171f, 0.0675483495f, 0.0694154128f, 0.0713122338f, 0.0732389539f, 0.0751957074f, 0.0771826133f, 0.0791998208f,
+    0.0812474415f, 0.0833256245f, 0.085434489f, 0.0875741541f, 0.089744769f, 0.091946438f, 0.0941793025f, 0.0964434743f,
+    0.098739095f, 0.101066269f, 0.10342513f, 0.105815805f, 0.108238399f, 0.110693045f, 0.113179862f, 0.115698971f,
+    0.118250482f, 0.120834522f, 0.123451203f, 0.126100644f, 0.128782958f, 0.131498262f, 0.134246677f, 0.137028307f,
+    0.13984327f, 0.142691687f, 0.145573661f, 0.148489311f, 0.151438728f, 0.15442206f, 0.157439381f, 0.160490826f,
+    0.163576499f, 0.166696489f, 0.169850931f, 0.173039913f, 0.176263571f, 0.179521978f, 0.182815254f, 0.186143503f,
+    0.189506829f, 0.192905352f, 0.196339145f, 0.199808344f, 0.203313038f, 0.206853345f, 0.210429341f, 0.214041144f,
+    0.217688844f, 0.22137256f, 0.225092396f, 0.228848428f, 0.232640758f, 0.236469507f, 0.240334779f, 0.244236633f,
+    0.248175204f, 0.252150565f, 0.256162852f, 0.260212123f, 0.264298469f, 0.268422037f, 0.272582889f, 0.276781112f,
+    0.281016797f, 0.285290092f, 0.289601028f, 0.293949723f, 0.298336297f, 0.30276081f, 0.30722335f, 0.311724037f,
+    0.31626296f, 0.32084018f, 0.325455844f, 0.330109984f, 0.334802747f, 0.339534163f, 0.344304383f, 0.349113464f,
+    0.353961498f, 0.358848572f, 0.363774776f, 0.368740231f, 0.373744965f, 0.378789127f, 0.383872777f, 0.388996005f,
+    0.3941589f, 0.399361521f, 0.404604018f, 0.40988642f, 0.415208817f, 0.420571357f, 0.425974041f, 0.431417018f,
+    0.436900347f, 0.442424119f, 0.447988421f, 0.453593314f, 0.459238917f, 0.464925289f, 0.470652521f, 0.476420701f,
+    0.482229918f, 0.488080233f, 0.493971765f, 0.499904543f, 0.505878687f, 0.511894286f, 0.517951429f, 0.524050117f,
+    0.530190527f, 0.536372721f, 0.542596757f, 0.548862696f, 0.555170655f, 0.561520696f, 0.567912877f, 0.574347317f,
+    0.580824137f, 0.587343335f, 0.593904972f, 0.600509226f, 0.607156098f, 0.613845706f, 0.62057811f, 0.62735337f,
+    0.634171605f, 0.641032875f, 0.647937238f, 0.654884815f, 0.661875665f, 0.668909788f, 0.675987363f, 0.683108449f,
+    0.690273106f, 0.697481334f, 0.704733372f, 0.712029159f, 0.719368815f, 0.72675246f, 0.734180033f, 0.741651773f,
+    0.749167681f, 0.756727815f, 0.764332294f, 0.77198112f, 0.779674411f, 0.787412286f, 0.795194745f, 0.803021908f,
+    0.810893834f, 0.818810523f, 0.826772213f, 0.834778786f, 0.842830479f, 0.850927293f, 0.859069228f, 0.867256522f,
+    0.875489056f, 0.883767068f, 0.892090559f, 0.900459588f, 0.908874214f, 0.917334557f, 0.925840616f, 0.934392571f,
+    0.942990363f, 0.951634169f, 0.960324049f, 0.969060004f, 0.977842152f, 0.986670554f, 0.995545268f
+};
+
+uint32_t envmap_format_channels(enum envmap_format fmt)
+{
+    switch (fmt) {
+        case EM_FORMAT_R8G8B8A8:
+        case EM_FORMAT_SRGB8_A8:
+        case EM_FORMAT_RGBA16F:
+        case EM_FORMAT_RGBA32F:
+            return 4;
+        default:
+            return 3;
+    }
+}
+
+uint32_t envmap_format_size(enum envmap_format fmt)
+{
+    switch (fmt) {
+        case EM_FORMAT_R8G8B8:   return 3;
+        case EM_FORMAT_R8G8B8A8: return 4;
+        case EM_FORMAT_SRGB8:    return 3;
+        case EM_FORMAT_SRGB8_A8: return 4;
+        case EM_FORMAT_RGB16F:   return 6;
+        case EM_FORMAT_RGBA16F:  return 8;
+        case EM_FORMAT_RGB32F:   return 12;
+        case EM_FORMAT_RGBA32F:  return 16;
+        default:
+            assert(0 && "Not implemented");
+            return 0;
+    }
+}
+
+void envmap_texel_load(PRIVATE float col[3], GLOBAL const uint8_t* src, enum envmap_format fmt)
+{
+    switch (fmt) {
+        case EM_FORMAT_RGB16F:
+        case EM_FORMAT_RGBA16F:
+            col[0] = load_f16(src, 0);
+            col[1] = load_f16(src, 1);
+            col[2] = load_f16(src, 2);
+            break;
+        case EM_FORMAT_RGB32F:
+        case EM_FORMAT_RGBA32F:
+            col[0] = load_f32(src, 0);
+            col[1] = load_f32(src, 1);
+            col[2] = load_f32(src, 2);
+            break;
+#ifdef OPENCL_MODE
+        case EM_FORMAT_R8G8B8A8:
+        case EM_FORMAT_SRGB8_A8: {
+            /* Whole texel in a single load */
+            const uchar4 t = vload4(0, src);
+            GLOBAL_CONSTANT float* lut = fmt == EM_FORMAT_SRGB8_A8 ? unorm8_decode_srgb : unorm8_decode_linear;
+            col[0] = lut[t.x];
+            col[1] = lut[t.y];
+            col[2] = lut[t.z];
+            break;
+        }
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        case EM_FORMAT_R8G8B8A8:
+        case EM_FORMAT_SRGB8_A8: {
+            /* Whole texel in a single 32 bit load */
+            uint32_t t;
+            memcpy(&t, src, sizeof(t));
+            const float* lut = fmt == EM_FORMAT_SRGB8_A8 ? unorm8_decode_srgb : unorm8_decode_linear;
+            col[0] = lut[t & 0xff];
+            col[1] = lut[(t >> 8) & 0xff];
+            col[2] = lut[(t >> 16) & 0xff];
+            break;
+        }
+#else
+        case EM_FORMAT_SRGB8_A8:
+#endif
+        case EM_FORMAT_SRGB8:
+            col[0] = unorm8_decode_srgb[src[0]];
+            col[1] = unorm8_decode_srgb[src[1]];
+            col[2] = unorm8_decode_srgb[src[2]];
+            break;
+        default:
+            col[0] = unorm8_decode_linear[src[0]];
+            col[1] = unorm8_decode_linear[src[1]];
+            col[2] = unorm8_decode_linear[src[2]];
+            break;
+    }
+}
+
+/* Clamps to the 8 bit range and truncates like the float to integer conversion did */
+static uint8_t unorm8_store(float v)
+{
+    return v <= 0.0f ? 0 : v >= 1.0f ? 255 : (uint8_t)(v * 255.0f);
+}
+
+/* Binary search of the encode thresholds, clamps like unorm8_store and maps NaN to 0 */
+static uint8_t srgb8_store(float v)
+{
+    uint32_t code = 0;
+    for (uint32_t step = 128; step > 0; step >>= 1)
+        if (v >= srgb8_encode_thresholds[code + step - 1])
+            code += step;
+    return (uint8_t)code;
+}
+
+void envmap_texel_store(GLOBAL uint8_t* dst, enum envmap_format fmt, PRIVATE const float val[3])
+{
+    switch (fmt) {
+        case EM_FORMAT_RGB16F:
+        case EM_FORMAT_RGBA16F:
+            store_f16(dst, 0, val[0]);
+            store_f16(dst, 1, val[1]);
+            store_f16(dst, 2, val[2]);
+            if (fmt == EM_FORMAT_RGBA16F)
+                store_f16(dst, 3, 1.0f);
+            break;
+        case EM_FORMAT_RGB32F:
+        case EM_FORMAT_RGBA32F:
+            store_f32(dst, 0, val[0]);
+            store_f32(dst, 1, val[1]);
+            store_f32(dst, 2, val[2]);
+            if (fmt == EM_FORMAT_RGBA32F)
+                store_f32(dst, 3, 1.0f);
+            break;
+        case EM_FORMAT_SRGB8:
+        case EM_FORMAT_SRGB8_A8:
+            dst[0] = srgb8_store(val[0]);
+            dst[1] = srgb8_store(val[1]);
+            dst[2] = srgb8_store(val[2]);
+            if (fmt == EM_FORMAT_SRGB8_A8)
+                dst[3] = 255;
+            break;
+        default:
+            dst[0] = unorm8_store(val[0]);
+            dst[1] = unorm8_store(val[1]);
+            dst[2] = unorm8_store(val[2]);
+            if (fmt == EM_FORMAT_R8G8B8A8)
+                dst[3] = 255;
+            break;
+    }
+}
+
 /*======================================================================
  * Cubemap helpers
  *======================================================================*/
@@ -227,6 +538,43 @@ static void cm_texel_coord_to_vec(PRIVATE float* out3f, float u, float v, uint8_
     out3f[2] *= inv_len;
 }
 
+/*
+ * Moves texel (x, y) of a face, lying at most one texel outside of it past a single edge,
+ * onto the neighbour face across that edge. The running direction of the shared edge
+ * is compared on both faces to tell whether the coordinate along it flips.
+ */
+static void cm_texel_wrap(PRIVATE int* face, PRIVATE int* x, PRIVATE int* y, int face_size)
+{
+    int edge, depth, along;
+    if (*x < 0) {
+        edge = CM_EDGE_LEFT; depth = -1 - *x; along = *y;
+    } else if (*x >= face_size) {
+        edge = CM_EDGE_RIGHT; depth = *x - face_size; along = *y;
+    } else if (*y < 0) {
+        edge = CM_EDGE_TOP; depth = -1 - *y; along = *x;
+    } else if (*y >= face_size) {
+        edge = CM_EDGE_BOTTOM; depth = *y - face_size; along = *x;
+    } else {
+        return;
+    }
+
+    const int nface = cm_face_neighbours[*face][edge][0];
+    const int nedge = cm_face_neighbours[*face][edge][1];
+    /* Left and right edges run along v, top and bottom along u */
+    const int axis = edge <= CM_EDGE_RIGHT ? 1 : 0;
+    const int naxis = nedge <= CM_EDGE_RIGHT ? 1 : 0;
+    if (vec3_dot(cm_face_uv_vectors[*face][axis], cm_face_uv_vectors[nface][naxis]) < 0.0f)
+        along = face_size - 1 - along;
+
+    *face = nface;
+    switch (nedge) {
+        case CM_EDGE_LEFT:   *x = depth;                 *y = along;                 break;
+        case CM_EDGE_RIGHT:  *x = face_size - 1 - depth; *y = along;                 break;
+        case CM_EDGE_TOP:    *x = along;                 *y = depth;                 break;
+        case CM_EDGE_BOTTOM: *x = along;                 *y = face_size - 1 - depth; break;
+    }
+}
+
 /*======================================================================
  * Cross sampling
  *======================================================================*/
@@ -247,15 +595,15 @@ static size_t hcross_face_offset(int face, size_t face_size)
     return hcross_face_map[face][1] * face_size * stride + hcross_face_map[face][0] * face_size;
 }
 
-static GLOBAL uint8_t* hcross_pixel_ptr(GLOBAL uint8_t* base, uint32_t x, uint32_t y, int face_size, enum cubemap_face face, int channels)
+static GLOBAL uint8_t* hcross_pixel_ptr(GLOBAL uint8_t* base, uint32_t x, uint32_t y, int face_size, enum cubemap_face face, int bpp)
 {
     size_t stride = 4 * face_size;
-    size_t offset = (hcross_face_offset(face, face_size) + y * stride + x) * channels;
+    size_t offset = (hcross_face_offset(face, face_size) + y * stride + x) * bpp;
     GLOBAL uint8_t* data = base + offset;
     return data;
 }
 
-static void sample_hcross_map(float col[3], GLOBAL uint8_t* base, int face_size, int channels, PRIVATE const float vec[3])
+static void sample_hcross_map(float col[3], GLOBAL uint8_t* base, int face_size, enum envmap_format fmt, PRIVATE const float vec[3])
 {
     float u, v;
     uint8_t face_idx;
@@ -264,20 +612,66 @@ static void sample_hcross_map(float col[3], GLOBAL uint8_t* base, int face_size,
     int x = u * (face_size - 1);
     int y = v * (face_size - 1);
     size_t stride = 4 * face_size;
-    size_t offset = (hcross_face_offset(face_idx, face_size) + y * stride + x) * channels;
+    size_t offset = (hcross_face_offset(face_idx, face_size) + y * stride + x) * envmap_format_size(fmt);
     GLOBAL uint8_t* data = base + offset;
-    col[0] = data[0] / 255.0f;
-    col[1] = data[1] / 255.0f;
-    col[2] = data[2] / 255.0f;
+    envmap_texel_load(col, data, fmt);
 }
 
-static void hcross_setpixel(GLOBAL uint8_t* base, uint32_t face_size, uint8_t channels, uint32_t x, uint32_t y, enum cubemap_face face, float val[3])
+static void hcross_setpixel(GLOBAL uint8_t* base, uint32_t face_size, enum envmap_format fmt, uint32_t x, uint32_t y, enum cubemap_face face, float val[3])
 {
     size_t stride = 4 * face_size;
-    GLOBAL uint8_t* dst = base + (hcross_face_offset(face, face_size) + y * stride + x) * channels;
-    dst[0] = val[0] * 255.0f;
-    dst[1] = val[1] * 255.0f;
-    dst[2] = val[2] * 255.0f;
+    GLOBAL uint8_t* dst = base + (hcross_face_offset(face, face_size) + y * stride + x) * envmap_format_size(fmt);
+    envmap_texel_store(dst, fmt, val);
+}
+
+/*
+ * Vertical cross, -Z hangs below -Y and is stored rotated by 180 degrees
+ * so that its edges line up with the faces above it.
+ */
+static GLOBAL_CONSTANT int vcross_face_map[6][2] = {
+    {2, 1}, /* Pos X */
+    {0, 1}, /* Neg X */
+    {1, 0}, /* Pos Y */
+    {1, 2}, /* Neg Y */
+    {1, 1}, /* Pos Z */
+    {1, 3}  /* Neg Z */
+};
+
+/* In pixels */
+static size_t vcross_face_offset(int face, size_t face_size)
+{
+    size_t stride = 3 * face_size;
+    return vcross_face_map[face][1] * face_size * stride + vcross_face_map[face][0] * face_size;
+}
+
+static GLOBAL uint8_t* vcross_pixel_ptr(GLOBAL uint8_t* base, uint32_t x, uint32_t y, int face_size, enum cubemap_face face, int bpp)
+{
+    if (face == CM_FACE_NEG_Z) {
+        x = face_size - 1 - x;
+        y = face_size - 1 - y;
+    }
+    size_t stride = 3 * face_size;
+    size_t offset = (vcross_face_offset(face, face_size) + y * stride + x) * bpp;
+    GLOBAL uint8_t* data = base + offset;
+    return data;
+}
+
+static void sample_vcross_map(float col[3], GLOBAL uint8_t* base, int face_size, enum envmap_format fmt, PRIVATE const float vec[3])
+{
+    float u, v;
+    uint8_t face_idx;
+    cm_vec_to_texel_coord(&u, &v, &face_idx, vec);
+
+    int x = u * (face_size - 1);
+    int y = v * (face_size - 1);
+    GLOBAL uint8_t* data = vcross_pixel_ptr(base, x, y, face_size, face_idx, envmap_format_size(fmt));
+    envmap_texel_load(col, data, fmt);
+}
+
+static void vcross_setpixel(GLOBAL uint8_t* base, uint32_t face_size, enum envmap_format fmt, uint32_t x, uint32_t y, enum cubemap_face face, float val[3])
+{
+    GLOBAL uint8_t* dst = vcross_pixel_ptr(base, x, y, face_size, face, envmap_format_size(fmt));
+    envmap_texel_store(dst, fmt, val);
 }
 
 /*======================================================================
@@ -289,14 +683,14 @@ static size_t vstrip_face_offset(int face, size_t face_size)
     return face_size * face_size * face;
 }
 
-static GLOBAL uint8_t* vstrip_pixel_ptr(GLOBAL uint8_t* base, uint32_t x, uint32_t y, int face_size, enum cubemap_face face, int channels)
+static GLOBAL uint8_t* vstrip_pixel_ptr(GLOBAL uint8_t* base, uint32_t x, uint32_t y, int face_size, enum cubemap_face face, int bpp)
 {
-    size_t offset = (vstrip_face_offset(face, face_size) + y * face_size + x) * channels;
+    size_t offset = (vstrip_face_offset(face, face_size) + y * face_size + x) * bpp;
     GLOBAL uint8_t* data = base + offset;
     return data;
 }
 
-static void sample_vstrip_map(float col[3], GLOBAL uint8_t* base, int face_size, int channels, PRIVATE const float vec[3])
+static void sample_vstrip_map(float col[3], GLOBAL uint8_t* base, int face_size, enum envmap_format fmt, PRIVATE const float vec[3])
 {
     float u, v;
     uint8_t face_idx;
@@ -304,19 +698,142 @@ static void sample_vstrip_map(float col[3], GLOBAL uint8_t* base, int face_size,
 
     int x = u * (face_size - 1);
     int y = v * (face_size - 1);
-    size_t offset = (vstrip_face_offset(face_idx, face_size) + y * face_size + x) * channels;
+    size_t offset = (vstrip_face_offset(face_idx, face_size) + y * face_size + x) * envmap_format_size(fmt);
     GLOBAL uint8_t* data = base + offset;
-    col[0] = data[0] / 255.0f;
-    col[1] = data[1] / 255.0f;
-    col[2] = data[2] / 255.0f;
+    envmap_texel_load(col, data, fmt);
 }
 
-static void vstrip_setpixel(GLOBAL uint8_t* base, uint32_t face_size, uint8_t channels, uint32_t x, uint32_t y, enum cubemap_face face, float val[3])
+static void vstrip_setpixel(GLOBAL uint8_t* base, uint32_t face_size, enum envmap_format fmt, uint32_t x, uint32_t y, enum cubemap_face face, float val[3])
 {
-    GLOBAL uint8_t* dst = base + (vstrip_face_offset(face, face_size) + y * face_size + x) * channels;
-    dst[0] = val[0] * 255.0f;
-    dst[1] = val[1] * 255.0f;
-    dst[2] = val[2] * 255.0f;
+    GLOBAL uint8_t* dst = base + (vstrip_face_offset(face, face_size) + y * face_size + x) * envmap_format_size(fmt);
+    envmap_texel_store(dst, fmt, val);
+}
+
+/*======================================================================
+ * Latlong sampling
+ *======================================================================*/
+/*
+ * Columns span theta = atan2(x, z) from -pi to pi with +Z at the center,
+ * rows span phi = acos(y) from 0 (+Y) at the top to pi (-Y) at the bottom.
+ */
+/* u and v are in [0.0 .. 1.0] range. */
+static void latlong_vec_to_texel_coord(PRIVATE float* u, PRIVATE float* v, PRIVATE const float* vec)
+{
+    float theta, phi;
+    vec_to_sc(&theta, &phi, vec);
+    *u = theta * inv_pi_half + 0.5f;
+    *v = phi * inv_pi;
+}
+
+/* u and v should be center adressing and in [-1.0 .. 1.0] range */
+static void latlong_texel_coord_to_vec(PRIVATE float* out3f, float u, float v)
+{
+    sc_to_vec(out3f, u * pi, (v + 1.0f) * pi_half);
+}
+
+static GLOBAL uint8_t* latlong_pixel_ptr(GLOBAL uint8_t* base, uint32_t x, uint32_t y, uint32_t width, int bpp)
+{
+    return base + ((size_t)y * width + x) * bpp;
+}
+
+static void sample_latlong_map(float col[3], GLOBAL uint8_t* base, uint32_t width, uint32_t height, enum envmap_format fmt, PRIVATE const float vec[3])
+{
+    float u, v;
+    latlong_vec_to_texel_coord(&u, &v, vec);
+
+    uint32_t x = u * width;
+    uint32_t y = v * height;
+    x = x < width ? x : width - 1;
+    y = y < height ? y : height - 1;
+    GLOBAL uint8_t* data = latlong_pixel_ptr(base, x, y, width, envmap_format_size(fmt));
+    envmap_texel_load(col, data, fmt);
+}
+
+static void latlong_setpixel(GLOBAL uint8_t* base, uint32_t width, enum envmap_format fmt, uint32_t x, uint32_t y, float val[3])
+{
+    GLOBAL uint8_t* dst = latlong_pixel_ptr(base, x, y, width, envmap_format_size(fmt));
+    envmap_texel_store(dst, fmt, val);
+}
+
+/*======================================================================
+ * Bilinear sampling
+ *======================================================================*/
+/* The four texels around a direction, in (x0, y0), (x1, y0), (x0, y1), (x1, y1) order */
+struct bilinear_taps {
+    int face[4], x[4], y[4];
+    float w[4];
+    /* Tap that fell past a cube corner and has no texel of its own, -1 if none */
+    int corner;
+    /* Set when all taps lie on the face of the first one */
+    int interior;
+};
+
+/* Taps around the texture coordinate (u, v) in [0.0 .. 1.0] of a face */
+static void bilinear_taps_at(PRIVATE struct bilinear_taps* t, enum envmap_type type, int face_size, int face_width, float u, float v, int face_idx)
+{
+    /* Texel centers sit at half integer coordinates */
+    const float s = u * face_width - 0.5f;
+    const float r = v * face_size - 0.5f;
+    const float sf = floorf(s);
+    const float rf = floorf(r);
+    const float fx = s - sf;
+    const float fy = r - rf;
+    const int x0 = (int)sf;
+    const int y0 = (int)rf;
+
+    /* Most lookups stay within a face and skip the edge handling */
+    t->interior = x0 >= 0 && y0 >= 0 && x0 + 1 < face_width && y0 + 1 < face_size;
+    t->corner = -1;
+    for (int i = 0; i < 4; ++i) {
+        int x = x0 + (i & 1);
+        int y = y0 + (i >> 1);
+        int face = face_idx;
+        if (t->interior) {
+            /* In place */
+        } else if (type == EM_TYPE_LATLONG) {
+            /* Rows past a pole continue on the opposite meridian, columns wrap around */
+            if (y < 0 || y >= face_size) {
+                y = y < 0 ? 0 : face_size - 1;
+                x += face_width / 2;
+            }
+            x = (x + face_width) % face_width;
+        } else {
+            const int xout = x < 0 || x >= face_size;
+            const int yout = y < 0 || y >= face_size;
+            if (xout && yout)
+                t->corner = i;
+            else
+                cm_texel_wrap(&face, &x, &y, face_size);
+        }
+        t->face[i] = face;
+        t->x[i] = x;
+        t->y[i] = y;
+        t->w[i] = ((i & 1) ? fx : 1.0f - fx) * ((i >> 1) ? fy : 1.0f - fy);
+    }
+}
+
+static void bilinear_taps_find(PRIVATE struct bilinear_taps* t, enum envmap_type type, int face_size, int face_width, PRIVATE const float vec[3])
+{
+    float u, v;
+    uint8_t face_idx;
+    envmap_vec_to_texel_coord(&u, &v, &face_idx, type, vec);
+    bilinear_taps_at(t, type, face_size, face_width, u, v, face_idx);
+}
+
+/* Blends the loaded taps, a corner tap takes the average of the three texels meeting there */
+static void bilinear_taps_blend(PRIVATE float col[3], PRIVATE const struct bilinear_taps* t, PRIVATE float tap[4][3])
+{
+    if (t->corner >= 0) {
+        for (int c = 0; c < 3; ++c) {
+            float sum = 0.0f;
+            for (int i = 0; i < 4; ++i)
+                if (i != t->corner)
+                    sum += tap[i][c];
+            tap[t->corner][c] = sum * (1.0f / 3.0f);
+        }
+    }
+    for (int c = 0; c < 3; ++c)
+        col[c] = t->w[0] * tap[0][c] + t->w[1] * tap[1][c] + t->w[2] * tap[2][c] + t->w[3] * tap[3][c];
 }
 
 /*======================================================================
@@ -331,6 +848,10 @@ void envmap_vec_to_texel_coord(PRIVATE float* u, PRIVATE float* v, PRIVATE uint8
         case EM_TYPE_VSTRIP:
             cm_vec_to_texel_coord(u, v, face_idx, vec);
             break;
+        case EM_TYPE_LATLONG:
+            *face_idx = 0;
+            latlong_vec_to_texel_coord(u, v, vec);
+            break;
         default:
             assert(0 && "Not implemented");
             break;
@@ -346,6 +867,9 @@ void envmap_texel_coord_to_vec(PRIVATE float* out3f, enum envmap_type em_type, f
         case EM_TYPE_VSTRIP:
             cm_texel_coord_to_vec(out3f, u, v, face_id);
             break;
+        case EM_TYPE_LATLONG:
+            latlong_texel_coord_to_vec(out3f, u, v);
+            break;
         default:
             assert(0 && "Not implemented");
             break;
@@ -369,11 +893,23 @@ float envmap_warp_fixup_factor(float face_size)
 /* u and v should be center adressing and in [-1.0+invSize..1.0-invSize] range. */
 void envmap_texel_coord_to_vec_warp(PRIVATE float* out3f, enum envmap_type em_type, float u, float v, uint8_t face_id, float warp_fixup)
 {
-    u = (warp_fixup * u*u*u) + u;
-    v = (warp_fixup * v*v*v) + v;
+    /* Latlong maps have no face edges to fix up */
+    if (em_type != EM_TYPE_LATLONG) {
+        u = (warp_fixup * u*u*u) + u;
+        v = (warp_fixup * v*v*v) + v;
+    }
     envmap_texel_coord_to_vec(out3f, em_type, u, v, face_id);
 }
 
+void envmap_cube_face_basis(PRIVATE float basis[3][3], uint8_t face_id)
+{
+    for (int i = 0; i < 3; ++i) {
+        basis[i][0] = cm_face_uv_vectors[face_id][i][0];
+        basis[i][1] = cm_face_uv_vectors[face_id][i][1];
+        basis[i][2] = cm_face_uv_vectors[face_id][i][2];
+    }
+}
+
 uint32_t envmap_face_size(struct envmap* em)
 {
     switch(em->type) {
@@ -383,20 +919,59 @@ uint32_t envmap_face_size(struct envmap* em)
             return em->width / 3.0f;
         case EM_TYPE_VSTRIP:
             return em->height / 6.0f;
+        case EM_TYPE_LATLONG:
+            return em->height;
+        default:
+            assert(0 && "Not implemented");
+            break;
+    }
+}
+
+void envmap_cube_dims(PRIVATE uint32_t* width, PRIVATE uint32_t* height, enum envmap_type em_type, uint32_t face_size)
+{
+    switch(em_type) {
+        case EM_TYPE_HCROSS:
+            *width = 4 * face_size;
+            *height = 3 * face_size;
+            break;
+        case EM_TYPE_VCROSS:
+            *width = 3 * face_size;
+            *height = 4 * face_size;
+            break;
+        case EM_TYPE_VSTRIP:
+            *width = face_size;
+            *height = 6 * face_size;
+            break;
         default:
             assert(0 && "Not implemented");
             break;
     }
 }
 
+uint32_t envmap_face_width(struct envmap* em)
+{
+    return em->type == EM_TYPE_LATLONG ? em->width : envmap_face_size(em);
+}
+
+uint32_t envmap_face_count(struct envmap* em)
+{
+    return em->type == EM_TYPE_LATLONG ? 1 : 6;
+}
+
 void envmap_sample(PRIVATE float col[3], struct envmap* em, PRIVATE float vec[3])
 {
     switch(em->type) {
         case EM_TYPE_HCROSS:
-            sample_hcross_map(col, em->data, envmap_face_size(em), em->channels, vec);
+            sample_hcross_map(col, em->data, envmap_face_size(em), em->format, vec);
+            break;
+        case EM_TYPE_VCROSS:
+            sample_vcross_map(col, em->data, envmap_face_size(em), em->format, vec);
             break;
         case EM_TYPE_VSTRIP:
-            sample_vstrip_map(col, em->data, envmap_face_size(em), em->channels, vec);
+            sample_vstrip_map(col, em->data, envmap_face_size(em), em->format, vec);
+            break;
+        case EM_TYPE_LATLONG:
+            sample_latlong_map(col, em->data, em->width, em->height, em->format, vec);
             break;
         default:
             assert(0 && "Not implemented");
@@ -404,14 +979,31 @@ void envmap_sample(PRIVATE float col[3], struct envmap* em, PRIVATE float vec[3]
     }
 }
 
+void envmap_sample_bilinear(PRIVATE float col[3], PRIVATE struct envmap* em, PRIVATE const float vec[3])
+{
+    struct bilinear_taps t;
+    bilinear_taps_find(&t, em->type, envmap_face_size(em), envmap_face_width(em), vec);
+    float tap[4][3];
+    for (int i = 0; i < 4; ++i)
+        if (i != t.corner)
+            envmap_texel_load(tap[i], envmap_pixel_ptr(em, t.x[i], t.y[i], t.face[i]), em->format);
+    bilinear_taps_blend(col, &t, tap);
+}
+
 void envmap_setpixel(PRIVATE struct envmap* em, uint32_t x, uint32_t y, enum cubemap_face face, PRIVATE float val[3])
 {
     switch(em->type) {
         case EM_TYPE_HCROSS:
-            hcross_setpixel(em->data, envmap_face_size(em), em->channels, x, y, face, val);
+            hcross_setpixel(em->data, envmap_face_size(em), em->format, x, y, face, val);
+            break;
+        case EM_TYPE_VCROSS:
+            vcross_setpixel(em->data, envmap_face_size(em), em->format, x, y, face, val);
             break;
         case EM_TYPE_VSTRIP:
-            vstrip_setpixel(em->data, envmap_face_size(em), em->channels, x, y, face, val);
+            vstrip_setpixel(em->data, envmap_face_size(em), em->format, x, y, face, val);
+            break;
+        case EM_TYPE_LATLONG:
+            latlong_setpixel(em->data, em->width, em->format, x, y, val);
             break;
         default:
             assert(0 && "Not implemented");
@@ -423,15 +1015,400 @@ GLOBAL uint8_t* envmap_pixel_ptr(PRIVATE struct envmap* em, uint32_t x, uint32_t
 {
     switch(em->type) {
         case EM_TYPE_HCROSS:
-            return hcross_pixel_ptr(em->data, x, y, envmap_face_size(em), face, em->channels);
+            return hcross_pixel_ptr(em->data, x, y, envmap_face_size(em), face, envmap_format_size(em->format));
+        case EM_TYPE_VCROSS:
+            return vcross_pixel_ptr(em->data, x, y, envmap_face_size(em), face, envmap_format_size(em->format));
         case EM_TYPE_VSTRIP:
-            return vstrip_pixel_ptr(em->data, x, y, envmap_face_size(em), face, em->channels);
+            return vstrip_pixel_ptr(em->data, x, y, envmap_face_size(em), face, envmap_format_size(em->format));
+        case EM_TYPE_LATLONG:
+            return latlong_pixel_ptr(em->data, x, y, em->width, envmap_format_size(em->format));
         default:
             assert(0 && "Not implemented");
             break;
     }
 }
 
+/*======================================================================
+ * Resolved views
+ *======================================================================*/
+#ifndef OPENCL_MODE
+void envmap_view_init(struct envmap_view* view, struct envmap* em)
+{
+    memset(view, 0, sizeof(*view));
+    view->type = em->type;
+    view->format = em->format;
+    view->face_size = envmap_face_size(em);
+    view->face_width = envmap_face_width(em);
+    view->face_count = envmap_face_count(em);
+    const ptrdiff_t bpp = envmap_format_size(em->format);
+    const size_t fs = view->face_size;
+    for (uint32_t face = 0; face < view->face_count; ++face) {
+        view->pixel_stride[face] = bpp;
+        switch (em->type) {
+            case EM_TYPE_HCROSS:
+                view->face_base[face] = em->data + hcross_face_offset(face, fs) * bpp;
+                view->row_stride[face] = 4 * fs * bpp;
+                break;
+            case EM_TYPE_VCROSS:
+                view->face_base[face] = em->data + vcross_face_offset(face, fs) * bpp;
+                view->row_stride[face] = 3 * fs * bpp;
+                if (face == CM_FACE_NEG_Z) {
+                    /* Stored rotated by 180 degrees, walk it backwards from its last pixel */
+                    view->face_base[face] += (fs - 1) * view->row_stride[face] + (fs - 1) * bpp;
+                    view->row_stride[face] = -view->row_stride[face];
+                    view->pixel_stride[face] = -bpp;
+                }
+                break;
+            case EM_TYPE_VSTRIP:
+                view->face_base[face] = em->data + vstrip_face_offset(face, fs) * bpp;
+                view->row_stride[face] = fs * bpp;
+                break;
+            case EM_TYPE_LATLONG:
+                view->face_base[face] = em->data;
+                view->row_stride[face] = (ptrdiff_t)em->width * bpp;
+                break;
+            default:
+                assert(0 && "Not implemented");
+                break;
+        }
+    }
+}
+
+/*
+ * Row loads of 4 byte 8 bit texels, every texel is read as a single 32 bit word, its channels are
+ * split off with vector masks and shifts and decoded through a table, little endian only.
+ */
+typedef void(*rgbx_row_load_fn)(float* dst[3], const uint8_t* src, const float* lut, size_t n, size_t first);
+typedef void(*rgbx_row_load_d_fn)(double* dst[3], const uint8_t* src, const double* lut, size_t n, size_t first);
+
+struct rgbx_row_loads {
+    rgbx_row_load_fn load;
+    rgbx_row_load_d_fn load_d;
+};
+
+/* Double decode tables, linear codes keep their exact quotient and sRGB ones widen the float table */
+static double unorm8_decode_linear_d[256];
+static double unorm8_decode_srgb_d[256];
+
+static void rgbx_row_load_scalar(float* dst[3], const uint8_t* src, const float* lut, size_t n, size_t first)
+{
+    for (size_t k = first; k < n; ++k) {
+        dst[0][k] = lut[src[4 * k + 0]];
+        dst[1][k] = lut[src[4 * k + 1]];
+        dst[2][k] = lut[src[4 * k + 2]];
+    }
+}
+
+static void rgbx_row_load_d_scalar(double* dst[3], const uint8_t* src, const double* lut, size_t n, size_t first)
+{
+    for (size_t k = first; k < n; ++k) {
+        dst[0][k] = lut[src[4 * k + 0]];
+        dst[1][k] = lut[src[4 * k + 1]];
+        dst[2][k] = lut[src[4 * k + 2]];
+    }
+}
+
+static const struct rgbx_row_loads rgbx_row_loads_scalar = { rgbx_row_load_scalar, rgbx_row_load_d_scalar };
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RGBX_SIMD_X86
+/* Codes of a channel are unpacked a register at a time and gathered from the table lane by lane */
+#define RGBX_DEFINE_ROW_LOAD(name, isa, T, lanes)                                             \
+typedef uint32_t name##_vu __attribute__((vector_size(lanes * sizeof(uint32_t))));           \
+typedef T        name##_vt __attribute__((vector_size(lanes * sizeof(T))));                  \
+__attribute__((target(isa)))                                                                  \
+static void name(T* dst[3], const uint8_t* src, const T* lut, size_t n, size_t first)         \
+{                                                                                             \
+    size_t k = first;                                                                         \
+    for (; k + lanes <= n; k += lanes) {                                                      \
+        name##_vu t;                                                                          \
+        memcpy(&t, src + 4 * k, sizeof(t));                                                   \
+        for (int c = 0; c < 3; ++c) {                                                         \
+            const name##_vu b = (t >> (8 * c)) & 0xff;                                        \
+            name##_vt f;                                                                      \
+            for (int l = 0; l < lanes; ++l)                                                   \
+                f[l] = lut[b[l]];                                                             \
+            memcpy(dst[c] + k, &f, sizeof(f));                                                \
+        }                                                                                     \
+    }                                                                                         \
+    for (; k < n; ++k) {                                                                      \
+        dst[0][k] = lut[src[4 * k + 0]];                                                      \
+        dst[1][k] = lut[src[4 * k + 1]];                                                      \
+        dst[2][k] = lut[src[4 * k + 2]];                                                      \
+    }                                                                                         \
+}
+/* Double loads take half the lanes, a register of doubles */
+#define RGBX_DEFINE_ROW_LOADS(sfx, isa, lanes)                                                \
+RGBX_DEFINE_ROW_LOAD(rgbx_row_load_##sfx, isa, float, lanes)                                  \
+RGBX_DEFINE_ROW_LOAD(rgbx_row_load_d_##sfx, isa, double, lanes / 2)                           \
+static const struct rgbx_row_loads rgbx_row_loads_##sfx = { rgbx_row_load_##sfx, rgbx_row_load_d_##sfx };
+RGBX_DEFINE_ROW_LOADS(sse2,   "sse2",    4)
+RGBX_DEFINE_ROW_LOADS(avx2,   "avx2",    8)
+RGBX_DEFINE_ROW_LOADS(avx512, "avx512f", 16)
+#endif
+
+static const struct rgbx_row_loads* rgbx_row_loads_select(void)
+{
+#ifdef RGBX_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return &rgbx_row_loads_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return &rgbx_row_loads_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return &rgbx_row_loads_sse2;
+#endif
+    return &rgbx_row_loads_scalar;
+}
+
+static const struct rgbx_row_loads* rgbx_row_loads_resolved = 0;
+static tp_once_flag rgbx_row_loads_once = TP_ONCE_INIT;
+
+/* Also fills the double decode tables, both are needed by the same loads */
+static void rgbx_row_loads_resolve(void)
+{
+    for (int c = 0; c < 256; ++c) {
+        unorm8_decode_linear_d[c] = c / 255.0;
+        unorm8_decode_srgb_d[c] = (double)unorm8_decode_srgb[c];
+    }
+    rgbx_row_loads_resolved = rgbx_row_loads_select();
+}
+
+static const struct rgbx_row_loads* rgbx_row_loads_get(void)
+{
+    tp_once(&rgbx_row_loads_once, rgbx_row_loads_resolve);
+    return rgbx_row_loads_resolved;
+}
+
+/* 4 byte texels of 8 bit formats take the word loads, wider and 3 byte texels load one at a time */
+void envmap_view_load_row(float* dst[3], const struct envmap_view* view, uint32_t x, uint32_t y, int face, size_t n)
+{
+    const uint8_t* src = envmap_view_pixel_ptr(view, x, y, face);
+    const ptrdiff_t stride = view->pixel_stride[face];
+    if ((view->format == EM_FORMAT_R8G8B8A8 || view->format == EM_FORMAT_SRGB8_A8) && stride == 4) {
+        const float* lut = view->format == EM_FORMAT_SRGB8_A8 ? unorm8_decode_srgb : unorm8_decode_linear;
+        rgbx_row_loads_get()->load(dst, src, lut, n, 0);
+        return;
+    }
+    for (size_t k = 0; k < n; ++k, src += stride) {
+        float col[3];
+        envmap_texel_load(col, src, view->format);
+        dst[0][k] = col[0];
+        dst[1][k] = col[1];
+        dst[2][k] = col[2];
+    }
+}
+
+void envmap_view_load_row_d(double* dst[3], const struct envmap_view* view, uint32_t x, uint32_t y, int face, size_t n)
+{
+    const uint8_t* src = envmap_view_pixel_ptr(view, x, y, face);
+    const ptrdiff_t stride = view->pixel_stride[face];
+    const struct rgbx_row_loads* loads = rgbx_row_loads_get();
+    const double* lut = 0;
+    switch (view->format) {
+        case EM_FORMAT_R8G8B8:
+        case EM_FORMAT_R8G8B8A8:
+            lut = unorm8_decode_linear_d;
+            break;
+        case EM_FORMAT_SRGB8:
+        case EM_FORMAT_SRGB8_A8:
+            lut = unorm8_decode_srgb_d;
+            break;
+        default:
+            break;
+    }
+    if (lut && stride == 4) {
+        loads->load_d(dst, src, lut, n, 0);
+        return;
+    }
+    for (size_t k = 0; k < n; ++k, src += stride) {
+        if (lut) {
+            dst[0][k] = lut[src[0]];
+            dst[1][k] = lut[src[1]];
+            dst[2][k] = lut[src[2]];
+        } else {
+            float col[3];
+            envmap_texel_load(col, src, view->format);
+            dst[0][k] = (double)col[0];
+            dst[1][k] = (double)col[1];
+            dst[2][k] = (double)col[2];
+        }
+    }
+}
+
+void envmap_view_sample(float col[3], const struct envmap_view* view, const float vec[3])
+{
+    float u, v;
+    uint8_t face_idx;
+    uint32_t x, y;
+    if (view->type == EM_TYPE_LATLONG) {
+        face_idx = 0;
+        latlong_vec_to_texel_coord(&u, &v, vec);
+        x = u * view->face_width;
+        y = v * view->face_size;
+        x = x < view->face_width ? x : view->face_width - 1;
+        y = y < view->face_size ? y : view->face_size - 1;
+    } else {
+        cm_vec_to_texel_coord(&u, &v, &face_idx, vec);
+        x = u * (view->face_size - 1);
+        y = v * (view->face_size - 1);
+    }
+    envmap_texel_load(col, envmap_view_pixel_ptr(view, x, y, face_idx), view->format);
+}
+
+static void envmap_view_taps_load(float tap[4][3], const struct envmap_view* view, const struct bilinear_taps* t)
+{
+    if (t->interior) {
+        /* Quad of texels around the first one */
+        const uint8_t* p = envmap_view_pixel_ptr(view, t->x[0], t->y[0], t->face[0]);
+        const ptrdiff_t ps = view->pixel_stride[t->face[0]];
+        const ptrdiff_t rs = view->row_stride[t->face[0]];
+        envmap_texel_load(tap[0], p, view->format);
+        envmap_texel_load(tap[1], p + ps, view->format);
+        envmap_texel_load(tap[2], p + rs, view->format);
+        envmap_texel_load(tap[3], p + rs + ps, view->format);
+    } else {
+        for (int i = 0; i < 4; ++i)
+            if (i != t->corner)
+                envmap_texel_load(tap[i], envmap_view_pixel_ptr(view, t->x[i], t->y[i], t->face[i]), view->format);
+    }
+}
+
+void envmap_view_sample_bilinear(float col[3], const struct envmap_view* view, const float vec[3])
+{
+    struct bilinear_taps t;
+    bilinear_taps_find(&t, view->type, view->face_size, view->face_width, vec);
+    float tap[4][3];
+    envmap_view_taps_load(tap, view, &t);
+    bilinear_taps_blend(col, &t, tap);
+}
+
+/*
+ * Cube face coordinates of rows of directions, the face axis is picked and projected
+ * with vector masks and selects to exactly the results of cm_vec_to_texel_coord.
+ */
+typedef void(*cm_coord_row_fn)(float* u, float* v, int32_t* face, const float* x, const float* y, const float* z, size_t n, size_t first);
+
+static void cm_coord_row_scalar(float* u, float* v, int32_t* face, const float* x, const float* y, const float* z, size_t n, size_t first)
+{
+    for (size_t k = first; k < n; ++k) {
+        const float vec[3] = { x[k], y[k], z[k] };
+        uint8_t face_idx;
+        cm_vec_to_texel_coord(u + k, v + k, &face_idx, vec);
+        face[k] = face_idx;
+    }
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CM_SIMD_X86
+/*
+ * Every face axis coordinate is a single component of the direction divided by its largest magnitude,
+ * the table dot products of the scalar path only flip its sign. Negative faces follow their positive one.
+ */
+#define CM_DEFINE_COORD_ROW(name, isa, lanes)                                                 \
+typedef float   name##_vf __attribute__((vector_size(lanes * sizeof(float))));               \
+typedef int32_t name##_vi __attribute__((vector_size(lanes * sizeof(int32_t))));             \
+__attribute__((target(isa)))                                                                  \
+static void name(float* u, float* v, int32_t* face, const float* x, const float* y, const float* z, size_t n, size_t first) \
+{                                                                                             \
+    const int32_t sign = (int32_t)0x80000000u;                                                \
+    size_t k = first;                                                                         \
+    for (; k + lanes <= n; k += lanes) {                                                      \
+        name##_vf vx, vy, vz;                                                                 \
+        memcpy(&vx, x + k, sizeof(vx));                                                       \
+        memcpy(&vy, y + k, sizeof(vy));                                                       \
+        memcpy(&vz, z + k, sizeof(vz));                                                       \
+        const name##_vf ax = (name##_vf)((name##_vi)vx & ~sign);                              \
+        const name##_vf ay = (name##_vf)((name##_vi)vy & ~sign);                              \
+        const name##_vf az = (name##_vf)((name##_vi)vz & ~sign);                              \
+        const name##_vi gt_xy = ax > ay;                                                      \
+        const name##_vf max_xy = (name##_vf)(((name##_vi)ax & gt_xy) | ((name##_vi)ay & ~gt_xy)); \
+        const name##_vi gt_z = max_xy > az;                                                   \
+        const name##_vf max = (name##_vf)(((name##_vi)max_xy & gt_z) | ((name##_vi)az & ~gt_z)); \
+        const name##_vi on_x = max == ax;                                                     \
+        const name##_vi on_y = ~on_x & (max == ay);                                           \
+        const name##_vi on_z = ~(on_x | on_y);                                                \
+        const name##_vi px = vx >= 0.0f;                                                      \
+        const name##_vi py = vy >= 0.0f;                                                      \
+        const name##_vi pz = vz >= 0.0f;                                                      \
+        const name##_vf inv = 1.0f / max;                                                     \
+        const name##_vi fx = (name##_vi)(vx * inv);                                           \
+        const name##_vi fy = (name##_vi)(vy * inv);                                           \
+        const name##_vi fz = (name##_vi)(vz * inv);                                           \
+        const name##_vi fu = (on_x & (fz ^ (px & sign))) | (on_y & fx) | (on_z & (fx ^ (~pz & sign))); \
+        const name##_vi fv = (on_y & (fz ^ (~py & sign))) | (~on_y & (fy ^ sign));            \
+        const name##_vi axis = (on_y & 1) | (on_z & 2);                                       \
+        const name##_vi positive = (on_x & px) | (on_y & py) | (on_z & pz);                   \
+        const name##_vf su = ((name##_vf)fu + 1.0f) * 0.5f;                                   \
+        const name##_vf sv = ((name##_vf)fv + 1.0f) * 0.5f;                                   \
+        const name##_vi f = axis * 2 + 1 + positive;                                          \
+        memcpy(u + k, &su, sizeof(su));                                                       \
+        memcpy(v + k, &sv, sizeof(sv));                                                       \
+        memcpy(face + k, &f, sizeof(f));                                                      \
+    }                                                                                         \
+    cm_coord_row_scalar(u, v, face, x, y, z, n, k);                                           \
+}
+CM_DEFINE_COORD_ROW(cm_coord_row_sse2,   "sse2",    4)
+CM_DEFINE_COORD_ROW(cm_coord_row_avx2,   "avx2",    8)
+CM_DEFINE_COORD_ROW(cm_coord_row_avx512, "avx512f", 16)
+#endif
+
+static cm_coord_row_fn cm_coord_row_select(void)
+{
+#ifdef CM_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return cm_coord_row_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return cm_coord_row_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return cm_coord_row_sse2;
+#endif
+    return cm_coord_row_scalar;
+}
+
+static cm_coord_row_fn cm_coord_row_resolved = 0;
+static tp_once_flag cm_coord_row_once = TP_ONCE_INIT;
+
+static void cm_coord_row_resolve(void)
+{
+    cm_coord_row_resolved = cm_coord_row_select();
+}
+
+/* Directions are mapped to texture coordinates in batches of this many */
+#define VIEW_ROW_BATCH_SZ 64
+
+void envmap_view_sample_bilinear_row(float* col[3], const struct envmap_view* view, const float* dir[3], size_t n)
+{
+    tp_once(&cm_coord_row_once, cm_coord_row_resolve);
+    const cm_coord_row_fn cm_coord_row = cm_coord_row_resolved;
+    for (size_t beg = 0; beg < n; beg += VIEW_ROW_BATCH_SZ) {
+        const size_t m = n - beg < VIEW_ROW_BATCH_SZ ? n - beg : VIEW_ROW_BATCH_SZ;
+        float u[VIEW_ROW_BATCH_SZ], v[VIEW_ROW_BATCH_SZ];
+        int32_t face[VIEW_ROW_BATCH_SZ];
+        if (view->type == EM_TYPE_LATLONG) {
+            for (size_t k = 0; k < m; ++k) {
+                const float vec[3] = { dir[0][beg + k], dir[1][beg + k], dir[2][beg + k] };
+                latlong_vec_to_texel_coord(u + k, v + k, vec);
+                face[k] = 0;
+            }
+        } else {
+            cm_coord_row(u, v, face, dir[0] + beg, dir[1] + beg, dir[2] + beg, m, 0);
+        }
+        for (size_t k = 0; k < m; ++k) {
+            struct bilinear_taps t;
+            bilinear_taps_at(&t, view->type, view->face_size, view->face_width, u[k], v[k], face[k]);
+            float tap[4][3], c[3];
+            envmap_view_taps_load(tap, view, &t);
+            bilinear_taps_blend(c, &t, tap);
+            col[0][beg + k] = c[0];
+            col[1][beg + k] = c[1];
+            col[2][beg + k] = c[2];
+        }
+    }
+}
+#endif
+
 /* Theta is horizontal, and phi is vertical angles */
 void sc_to_vec(PRIVATE float vec[3], float theta, float phi)
 {
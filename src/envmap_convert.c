@@ -0,0 +1,135 @@
+#include <emproc/envmap.h>
+#include <string.h>
+#include <math.h>
+#include "thread_pool.h"
+
+/* Side of the square tiles handed to the workers, a tile row of the widest format stays within a few cache lines */
+#define CONVERT_TILE_SZ 32
+
+struct convert_job {
+    struct envmap_view src, dst;
+    uint32_t tiles_x, tiles_y;
+    /* Set when texels do not map one to one and the source has to be sampled */
+    int resample;
+};
+
+/* Copies a tile between equally sized faces, rows of matching formats and forward strides are plain memcpys */
+static void convert_copy_tile(const struct convert_job* job, uint32_t face, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    const struct envmap_view* src = &job->src;
+    const struct envmap_view* dst = &job->dst;
+    const ptrdiff_t bpp = envmap_format_size(dst->format);
+    const int raw = src->format == dst->format && src->pixel_stride[face] == bpp && dst->pixel_stride[face] == bpp;
+    for (uint32_t y = y0; y < y1; ++y) {
+        const uint8_t* src_ptr = envmap_view_pixel_ptr(src, x0, y, face);
+        uint8_t* dst_ptr = envmap_view_pixel_ptr(dst, x0, y, face);
+        if (raw) {
+            memcpy(dst_ptr, src_ptr, (x1 - x0) * bpp);
+            continue;
+        }
+        for (uint32_t x = x0; x < x1; ++x, src_ptr += src->pixel_stride[face], dst_ptr += dst->pixel_stride[face]) {
+            float col[3];
+            envmap_texel_load(col, src_ptr, src->format);
+            envmap_texel_store(dst_ptr, dst->format, col);
+        }
+    }
+}
+
+/*
+ * Fills a tile by sampling the source at the direction of every destination texel center. Directions of a
+ * tile row are generated into x, y and z planes and looked up together, per column and per row terms are shared.
+ */
+static void convert_resample_tile(const struct convert_job* job, uint32_t face, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+    const struct envmap_view* dst = &job->dst;
+    const int latlong = dst->type == EM_TYPE_LATLONG;
+    const size_t n = x1 - x0;
+    const float inv_w = 2.0f / dst->face_width;
+    const float inv_h = 2.0f / dst->face_size;
+
+    /* Same terms as envmap_texel_coord_to_vec, cube faces take u along their first basis vector and latlong maps theta */
+    float basis[3][3];
+    float col_u[CONVERT_TILE_SZ], col_sin[CONVERT_TILE_SZ], col_cos[CONVERT_TILE_SZ];
+    if (!latlong)
+        envmap_cube_face_basis(basis, face);
+    for (size_t k = 0; k < n; ++k) {
+        col_u[k] = (x0 + k + 0.5f) * inv_w - 1.0f;
+        if (latlong) {
+            col_sin[k] = sinf(col_u[k] * pi);
+            col_cos[k] = cosf(col_u[k] * pi);
+        }
+    }
+
+    float dir[3][CONVERT_TILE_SZ], col[3][CONVERT_TILE_SZ];
+    const float* dir_planes[3] = { dir[0], dir[1], dir[2] };
+    float* col_planes[3] = { col[0], col[1], col[2] };
+    for (uint32_t y = y0; y < y1; ++y) {
+        const float v = (y + 0.5f) * inv_h - 1.0f;
+        if (latlong) {
+            const float phi = (v + 1.0f) * pi_half;
+            const float sin_phi = sinf(phi);
+            const float cos_phi = cosf(phi);
+            for (size_t k = 0; k < n; ++k) {
+                dir[0][k] = col_sin[k] * sin_phi;
+                dir[1][k] = cos_phi;
+                dir[2][k] = col_cos[k] * sin_phi;
+            }
+        } else {
+            for (size_t k = 0; k < n; ++k) {
+                const float u = col_u[k];
+                const float dx = basis[0][0] * u + basis[1][0] * v + basis[2][0];
+                const float dy = basis[0][1] * u + basis[1][1] * v + basis[2][1];
+                const float dz = basis[0][2] * u + basis[1][2] * v + basis[2][2];
+                const float inv_len = 1.0f / sqrtf(dx * dx + dy * dy + dz * dz);
+                dir[0][k] = dx * inv_len;
+                dir[1][k] = dy * inv_len;
+                dir[2][k] = dz * inv_len;
+            }
+        }
+        envmap_view_sample_bilinear_row(col_planes, &job->src, dir_planes, n);
+
+        uint8_t* dst_ptr = envmap_view_pixel_ptr(dst, x0, y, face);
+        for (size_t k = 0; k < n; ++k, dst_ptr += dst->pixel_stride[face]) {
+            const float c[3] = { col[0][k], col[1][k], col[2][k] };
+            envmap_texel_store(dst_ptr, dst->format, c);
+        }
+    }
+}
+
+static void convert_tiles(size_t first, size_t last, void* userdata)
+{
+    const struct convert_job* job = userdata;
+    const size_t tiles_per_face = job->tiles_x * job->tiles_y;
+    for (size_t tile = first; tile < last; ++tile) {
+        const uint32_t face = tile / tiles_per_face;
+        const uint32_t tx = (tile % tiles_per_face) % job->tiles_x;
+        const uint32_t ty = (tile % tiles_per_face) / job->tiles_x;
+        const uint32_t x0 = tx * CONVERT_TILE_SZ;
+        const uint32_t y0 = ty * CONVERT_TILE_SZ;
+        const uint32_t x1 = x0 + CONVERT_TILE_SZ < job->dst.face_width ? x0 + CONVERT_TILE_SZ : job->dst.face_width;
+        const uint32_t y1 = y0 + CONVERT_TILE_SZ < job->dst.face_size ? y0 + CONVERT_TILE_SZ : job->dst.face_size;
+        if (job->resample)
+            convert_resample_tile(job, face, x0, y0, x1, y1);
+        else
+            convert_copy_tile(job, face, x0, y0, x1, y1);
+    }
+}
+
+void envmap_convert(struct envmap* dst, struct envmap* src)
+{
+    struct convert_job job;
+    envmap_view_init(&job.src, src);
+    envmap_view_init(&job.dst, dst);
+    job.tiles_x = (job.dst.face_width + CONVERT_TILE_SZ - 1) / CONVERT_TILE_SZ;
+    job.tiles_y = (job.dst.face_size + CONVERT_TILE_SZ - 1) / CONVERT_TILE_SZ;
+    /* Cube maps address their faces the same way in every layout, latlong maps only match themselves */
+    const int src_latlong = src->type == EM_TYPE_LATLONG;
+    const int dst_latlong = dst->type == EM_TYPE_LATLONG;
+    job.resample = src_latlong != dst_latlong
+                || job.src.face_size != job.dst.face_size
+                || job.src.face_width != job.dst.face_width;
+
+    /* Copies are cheap per texel, hand them out in bigger chunks */
+    const size_t grain = job.resample ? 1 : 8;
+    parallel_for(job.dst.face_count * job.tiles_x * job.tiles_y, grain, convert_tiles, &job);
+}
@@ -0,0 +1,219 @@
+#include <emproc/envmap_file.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*======================================================================
+ * Platform wrappers
+ *======================================================================*/
+/* Maps a whole file copy on write, so the library can also write into the levels without touching the file */
+#ifdef _WIN32
+static void* file_map(const char* path, size_t* size)
+{
+    HANDLE fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (fh == INVALID_HANDLE_VALUE)
+        return 0;
+    LARGE_INTEGER sz;
+    void* map = 0;
+    if (GetFileSizeEx(fh, &sz) && sz.QuadPart > 0) {
+        HANDLE mh = CreateFileMappingA(fh, 0, PAGE_WRITECOPY, 0, 0, 0);
+        if (mh) {
+            map = MapViewOfFile(mh, FILE_MAP_COPY, 0, 0, 0);
+            *size = (size_t)sz.QuadPart;
+            CloseHandle(mh);
+        }
+    }
+    CloseHandle(fh);
+    return map;
+}
+
+static void file_unmap(void* map, size_t size)
+{
+    (void) size;
+    UnmapViewOfFile(map);
+}
+#else
+static void* file_map(const char* path, size_t* size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    void* map = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(0, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            map = 0;
+        *size = (size_t)st.st_size;
+    }
+    close(fd);
+    return map;
+}
+
+static void file_unmap(void* map, size_t size)
+{
+    munmap(map, size);
+}
+#endif
+
+/*======================================================================
+ * Reader
+ *======================================================================*/
+/*
+ * Checks that a level table entry describes an image of its own layout that lies within the file,
+ * and that its face table matches the view the library builds for that image
+ */
+static int envmap_file_level_valid(const struct envmap_file_header* hdr, const struct envmap_file_level* lvl, uint8_t* map, size_t file_sz)
+{
+    struct envmap em;
+    em.type = hdr->type;
+    em.format = hdr->format;
+    em.width = lvl->width;
+    em.height = lvl->height;
+    if (lvl->width == 0 || lvl->height == 0)
+        return 0;
+    if (lvl->size != (uint64_t)lvl->width * lvl->height * envmap_format_size(em.format))
+        return 0;
+    if (lvl->offset % hdr->alignment != 0 || lvl->offset > file_sz || lvl->size > file_sz - lvl->offset)
+        return 0;
+    if (em.type != EM_TYPE_LATLONG) {
+        uint32_t w, h;
+        envmap_cube_dims(&w, &h, em.type, envmap_face_size(&em));
+        if (w != lvl->width || h != lvl->height)
+            return 0;
+    }
+
+    em.data = map + lvl->offset;
+    struct envmap_view view;
+    envmap_view_init(&view, &em);
+    if (lvl->face_size != view.face_size || lvl->face_width != view.face_width)
+        return 0;
+    for (uint32_t face = 0; face < 6; ++face) {
+        const uint64_t face_offset = face < view.face_count ? lvl->offset + (uint64_t)(view.face_base[face] - em.data) : 0;
+        if (lvl->face_offset[face] != face_offset
+         || lvl->pixel_stride[face] != view.pixel_stride[face]
+         || lvl->row_stride[face] != view.row_stride[face])
+            return 0;
+    }
+    return 1;
+}
+
+int envmap_file_open(struct envmap_file* file, const char* path)
+{
+    memset(file, 0, sizeof(*file));
+    file->map = file_map(path, &file->map_sz);
+    if (!file->map)
+        return 0;
+
+    const uint8_t* base = file->map;
+    struct envmap_file_header hdr;
+    int valid = file->map_sz >= sizeof(hdr);
+    if (valid) {
+        memcpy(&hdr, base, sizeof(hdr));
+        valid = memcmp(hdr.magic, ENVMAP_FILE_MAGIC, sizeof(hdr.magic)) == 0
+             && hdr.version == ENVMAP_FILE_VERSION
+             && hdr.type < EM_TYPE_UNKNOWN
+             && hdr.format <= EM_FORMAT_SRGB8_A8
+             && hdr.num_levels > 0 && hdr.num_levels <= ENVMAP_MAX_MIPS
+             && hdr.alignment > 0
+             && file->map_sz - sizeof(hdr) >= hdr.num_levels * sizeof(struct envmap_file_level);
+    }
+    for (uint32_t i = 0; valid && i < hdr.num_levels; ++i) {
+        struct envmap_file_level lvl;
+        memcpy(&lvl, base + sizeof(hdr) + i * sizeof(lvl), sizeof(lvl));
+        valid = envmap_file_level_valid(&hdr, &lvl, file->map, file->map_sz);
+        struct envmap* em = &file->mips.levels[i];
+        em->type = hdr.type;
+        em->format = hdr.format;
+        em->width = lvl.width;
+        em->height = lvl.height;
+        em->data = (uint8_t*)file->map + lvl.offset;
+    }
+    if (!valid) {
+        envmap_file_close(file);
+        return 0;
+    }
+    file->mips.num_levels = hdr.num_levels;
+    return 1;
+}
+
+void envmap_file_close(struct envmap_file* file)
+{
+    if (file->map)
+        file_unmap(file->map, file->map_sz);
+    memset(file, 0, sizeof(*file));
+}
+
+/*======================================================================
+ * Writer
+ *======================================================================*/
+static uint64_t envmap_file_align(uint64_t offset)
+{
+    return (offset + ENVMAP_FILE_ALIGN - 1) / ENVMAP_FILE_ALIGN * ENVMAP_FILE_ALIGN;
+}
+
+int envmap_file_write(const char* path, struct envmap_mips* mips)
+{
+    if (mips->num_levels == 0 || mips->num_levels > ENVMAP_MAX_MIPS)
+        return 0;
+    struct envmap_file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, ENVMAP_FILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = ENVMAP_FILE_VERSION;
+    hdr.type = mips->levels[0].type;
+    hdr.format = mips->levels[0].format;
+    hdr.num_levels = mips->num_levels;
+    hdr.alignment = ENVMAP_FILE_ALIGN;
+
+    /* Level table, data follows in level order */
+    struct envmap_file_level lvls[ENVMAP_MAX_MIPS];
+    memset(lvls, 0, sizeof(lvls));
+    uint64_t offset = envmap_file_align(sizeof(hdr) + hdr.num_levels * sizeof(lvls[0]));
+    for (uint32_t i = 0; i < hdr.num_levels; ++i) {
+        struct envmap* em = &mips->levels[i];
+        struct envmap_view view;
+        envmap_view_init(&view, em);
+        lvls[i].offset = offset;
+        lvls[i].size = (uint64_t)em->width * em->height * envmap_format_size(em->format);
+        lvls[i].width = em->width;
+        lvls[i].height = em->height;
+        lvls[i].face_size = view.face_size;
+        lvls[i].face_width = view.face_width;
+        for (uint32_t face = 0; face < view.face_count; ++face) {
+            lvls[i].face_offset[face] = offset + (uint64_t)(view.face_base[face] - em->data);
+            lvls[i].pixel_stride[face] = view.pixel_stride[face];
+            lvls[i].row_stride[face] = view.row_stride[face];
+        }
+        offset = envmap_file_align(offset + lvls[i].size);
+    }
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return 0;
+    int ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+          && fwrite(lvls, sizeof(lvls[0]), hdr.num_levels, f) == hdr.num_levels;
+    uint64_t pos = sizeof(hdr) + hdr.num_levels * sizeof(lvls[0]);
+    static const uint8_t zeros[256] = {0};
+    for (uint32_t i = 0; ok && i < hdr.num_levels; ++i) {
+        /* Pad up to the aligned start of the level */
+        while (ok && pos < lvls[i].offset) {
+            const size_t n = lvls[i].offset - pos < sizeof(zeros) ? (size_t)(lvls[i].offset - pos) : sizeof(zeros);
+            ok = fwrite(zeros, 1, n, f) == n;
+            pos += n;
+        }
+        ok = ok && fwrite(mips->levels[i].data, 1, (size_t)lvls[i].size, f) == (size_t)lvls[i].size;
+        pos += lvls[i].size;
+    }
+    ok = fclose(f) == 0 && ok;
+    return ok;
+}
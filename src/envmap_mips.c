@@ -0,0 +1,272 @@
+#include <emproc/envmap.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "thread_pool.h"
+
+/* GCC only, clang ignores the optimize attribute that keeps the vector kernels free of contractions */
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define MIP_SIMD_X86
+#endif
+
+/* Source texels a destination texel can touch along one axis, the ratio between levels stays within [2, 3] */
+#define MIP_MAX_TAPS 4
+
+/* Range of source texels covering a destination texel along one axis */
+struct mip_footprint {
+    uint32_t first, count;
+    /* Covered fraction of every texel of the range */
+    float cover[MIP_MAX_TAPS];
+};
+
+typedef void(*mip_accumulate_fn)(float* acc[4], float* const src[3], const float* w, size_t n);
+
+/*======================================================================
+ * Row kernels
+ *======================================================================*/
+/* Adds the weighted rgb of a source row into the accumulator planes, the fourth plane sums the weights */
+static void mip_accumulate_scalar(float* acc[4], float* const src[3], const float* w, size_t n, size_t first)
+{
+    for (size_t k = first; k < n; ++k) {
+        acc[0][k] += w[k] * src[0][k];
+        acc[1][k] += w[k] * src[1][k];
+        acc[2][k] += w[k] * src[2][k];
+        acc[3][k] += w[k];
+    }
+}
+
+static void mip_accumulate_row_scalar(float* acc[4], float* const src[3], const float* w, size_t n)
+{
+    mip_accumulate_scalar(acc, src, w, n, 0);
+}
+
+#ifdef MIP_SIMD_X86
+/* Contraction into FMAs is disabled so every kernel matches the scalar path bit for bit */
+#define MIP_DEFINE_ACCUMULATE_KERNEL(name, isa, lanes)                                         \
+typedef float name##_vf __attribute__((vector_size(lanes * sizeof(float))));                  \
+__attribute__((target(isa), optimize("fp-contract=off")))                                      \
+static void name(float* acc[4], float* const src[3], const float* w, size_t n)                 \
+{                                                                                              \
+    size_t k = 0;                                                                              \
+    for (; k + lanes <= n; k += lanes) {                                                       \
+        name##_vf wv, sv, av;                                                                  \
+        memcpy(&wv, w + k, sizeof(wv));                                                        \
+        for (int c = 0; c < 3; ++c) {                                                          \
+            memcpy(&sv, src[c] + k, sizeof(sv));                                               \
+            memcpy(&av, acc[c] + k, sizeof(av));                                               \
+            av += wv * sv;                                                                     \
+            memcpy(acc[c] + k, &av, sizeof(av));                                               \
+        }                                                                                      \
+        memcpy(&av, acc[3] + k, sizeof(av));                                                   \
+        av += wv;                                                                              \
+        memcpy(acc[3] + k, &av, sizeof(av));                                                   \
+    }                                                                                          \
+    mip_accumulate_scalar(acc, src, w, n, k);                                                  \
+}
+
+MIP_DEFINE_ACCUMULATE_KERNEL(mip_accumulate_row_sse2,   "sse2",    4)
+MIP_DEFINE_ACCUMULATE_KERNEL(mip_accumulate_row_avx2,   "avx2",    8)
+MIP_DEFINE_ACCUMULATE_KERNEL(mip_accumulate_row_avx512, "avx512f", 16)
+#endif
+
+static mip_accumulate_fn mip_accumulate_select(void)
+{
+#ifdef MIP_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return mip_accumulate_row_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return mip_accumulate_row_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return mip_accumulate_row_sse2;
+#endif
+    return mip_accumulate_row_scalar;
+}
+
+/*======================================================================
+ * Level reduction
+ *======================================================================*/
+static void mip_footprints_build(struct mip_footprint* fp, uint32_t src_n, uint32_t dst_n)
+{
+    for (uint32_t i = 0; i < dst_n; ++i) {
+        /* Span of the destination texel in source texel units */
+        const double beg = (double)i * src_n / dst_n;
+        const double end = (double)(i + 1) * src_n / dst_n;
+        fp[i].first = (uint32_t)beg;
+        fp[i].count = 0;
+        for (uint32_t s = fp[i].first; s < end && fp[i].count < MIP_MAX_TAPS; ++s) {
+            const double lo = s > beg ? s : beg;
+            const double hi = s + 1 < end ? s + 1 : end;
+            fp[i].cover[fp[i].count++] = (float)(hi - lo);
+        }
+    }
+}
+
+/* Solid angles of the texels of a source row, scaled by the covered fraction of the row */
+static void mip_weight_row(float* w, const struct envmap_view* src, uint32_t y, float cover)
+{
+    if (src->type == EM_TYPE_LATLONG) {
+        /* Every texel of a row spans the same band */
+        const float phi0 = pi * y / src->face_size;
+        const float phi1 = pi * (y + 1) / src->face_size;
+        const float sa = two_pi / src->face_width * (cosf(phi0) - cosf(phi1)) * cover;
+        for (uint32_t x = 0; x < src->face_width; ++x)
+            w[x] = sa;
+    } else {
+        const float texel_size = 1.0f / src->face_size;
+        const float v = 2.0f * ((y + 0.5f) * texel_size) - 1.0f;
+        for (uint32_t x = 0; x < src->face_width; ++x) {
+            const float u = 2.0f * ((x + 0.5f) * texel_size) - 1.0f;
+            w[x] = texel_solid_angle(u, v, texel_size) * cover;
+        }
+    }
+}
+
+struct mip_job {
+    struct envmap_view src, dst;
+    /* Float copy of the destination the next level is reduced from, if any */
+    struct envmap_view dst_float;
+    int keep_float;
+    const struct mip_footprint* fx;
+    const struct mip_footprint* fy;
+    mip_accumulate_fn accumulate;
+};
+
+/* Linear 8 bit levels round to nearest, the truncating envmap_texel_store would darken every level by half a code */
+static void mip_texel_store(uint8_t* dst, enum envmap_format fmt, const float val[3])
+{
+    if (fmt == EM_FORMAT_R8G8B8 || fmt == EM_FORMAT_R8G8B8A8) {
+        for (int c = 0; c < 3; ++c) {
+            const float v = val[c] * 255.0f + 0.5f;
+            dst[c] = !(v > 0.0f) ? 0 : v >= 255.0f ? 255 : (uint8_t)v;
+        }
+        if (fmt == EM_FORMAT_R8G8B8A8)
+            dst[3] = 255;
+        return;
+    }
+    envmap_texel_store(dst, fmt, val);
+}
+
+static void mip_rows(size_t first, size_t last, void* userdata)
+{
+    const struct mip_job* job = userdata;
+    const size_t src_w = job->src.face_width;
+    const size_t dst_w = job->dst.face_width;
+
+    /* Weight rows, one decoded rgb source row and the accumulator planes */
+    float* scratch = malloc((MIP_MAX_TAPS * src_w + 3 * src_w + 4 * src_w) * sizeof(float));
+    float* weights = scratch;
+    float* src_planes[3] = { weights + MIP_MAX_TAPS * src_w, weights + (MIP_MAX_TAPS + 1) * src_w, weights + (MIP_MAX_TAPS + 2) * src_w };
+    float* acc[4];
+    for (int c = 0; c < 4; ++c)
+        acc[c] = weights + (MIP_MAX_TAPS + 3 + c) * src_w;
+
+    for (size_t ydst = first; ydst < last; ++ydst) {
+        /* Weights only depend on the position within a face, they are shared by all faces */
+        const struct mip_footprint* fy = &job->fy[ydst];
+        for (uint32_t t = 0; t < fy->count; ++t)
+            mip_weight_row(weights + t * src_w, &job->src, fy->first + t, fy->cover[t]);
+
+        for (uint32_t face = 0; face < job->dst.face_count; ++face) {
+            /* Vertical pass, weighted sums of the covered source rows */
+            for (int c = 0; c < 4; ++c)
+                memset(acc[c], 0, src_w * sizeof(float));
+            for (uint32_t t = 0; t < fy->count; ++t) {
+                envmap_view_load_row(src_planes, &job->src, 0, fy->first + t, face, src_w);
+                job->accumulate(acc, src_planes, weights + t * src_w, src_w);
+            }
+
+            /* Horizontal pass, normalized by the total weight */
+            uint8_t* dst_ptr = envmap_view_pixel_ptr(&job->dst, 0, ydst, face);
+            for (size_t x = 0; x < dst_w; ++x, dst_ptr += job->dst.pixel_stride[face]) {
+                const struct mip_footprint* fx = &job->fx[x];
+                float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                for (uint32_t t = 0; t < fx->count; ++t)
+                    for (int c = 0; c < 4; ++c)
+                        sum[c] += fx->cover[t] * acc[c][fx->first + t];
+                const float inv_w = 1.0f / sum[3];
+                const float val[3] = { sum[0] * inv_w, sum[1] * inv_w, sum[2] * inv_w };
+                mip_texel_store(dst_ptr, job->dst.format, val);
+                if (job->keep_float)
+                    envmap_texel_store(envmap_view_pixel_ptr(&job->dst_float, x, ydst, face), job->dst_float.format, val);
+            }
+        }
+    }
+    free(scratch);
+}
+
+static void mip_reduce(struct envmap* dst, struct envmap* dst_float, struct envmap* src, mip_accumulate_fn accumulate)
+{
+    struct mip_job job;
+    envmap_view_init(&job.src, src);
+    envmap_view_init(&job.dst, dst);
+    job.keep_float = dst_float != 0;
+    if (job.keep_float)
+        envmap_view_init(&job.dst_float, dst_float);
+    job.accumulate = accumulate;
+
+    struct mip_footprint* fp = malloc((job.dst.face_width + job.dst.face_size) * sizeof(*fp));
+    mip_footprints_build(fp, job.src.face_width, job.dst.face_width);
+    mip_footprints_build(fp + job.dst.face_width, job.src.face_size, job.dst.face_size);
+    job.fx = fp;
+    job.fy = fp + job.dst.face_width;
+
+    /* Around a few thousand source texels per chunk */
+    size_t grain = 4096 / (job.src.face_width * job.dst.face_count);
+    parallel_for(job.dst.face_size, grain > 0 ? grain : 1, mip_rows, &job);
+    free(fp);
+}
+
+/*======================================================================
+ * Public interface
+ *======================================================================*/
+void envmap_build_mips(struct envmap_mips* mips, struct envmap* em)
+{
+    memset(mips, 0, sizeof(*mips));
+    mips->levels[0] = *em;
+    mips->num_levels = 1;
+
+    const mip_accumulate_fn accumulate = mip_accumulate_select();
+    const size_t bpp = envmap_format_size(em->format);
+    /* Levels of other formats are reduced from a float copy of the previous level, so their rounding does not build up */
+    const int keep_float = em->format != EM_FORMAT_RGB32F && em->format != EM_FORMAT_RGBA32F;
+    struct envmap prev_float, cur_float;
+    memset(&prev_float, 0, sizeof(prev_float));
+    memset(&cur_float, 0, sizeof(cur_float));
+    uint32_t face_size = envmap_face_size(em);
+    uint32_t width = em->width;
+    while (face_size > 1 && mips->num_levels < ENVMAP_MAX_MIPS) {
+        struct envmap* src = &mips->levels[mips->num_levels - 1];
+        struct envmap* dst = &mips->levels[mips->num_levels];
+        face_size /= 2;
+        dst->type = em->type;
+        dst->format = em->format;
+        if (em->type == EM_TYPE_LATLONG) {
+            width = width > 1 ? width / 2 : 1;
+            dst->width = width;
+            dst->height = face_size;
+        } else {
+            envmap_cube_dims(&dst->width, &dst->height, em->type, face_size);
+        }
+        /* Cleared so the unused areas of cross layouts hold no garbage */
+        dst->data = calloc((size_t)dst->width * dst->height, bpp);
+        if (keep_float) {
+            cur_float = *dst;
+            cur_float.format = EM_FORMAT_RGB32F;
+            cur_float.data = calloc((size_t)dst->width * dst->height, envmap_format_size(cur_float.format));
+        }
+        mip_reduce(dst, keep_float ? &cur_float : 0, prev_float.data ? &prev_float : src, accumulate);
+        free(prev_float.data);
+        prev_float = cur_float;
+        ++mips->num_levels;
+    }
+    free(prev_float.data);
+}
+
+void envmap_mips_free(struct envmap_mips* mips)
+{
+    /* Level 0 belongs to the caller */
+    for (uint32_t i = 1; i < mips->num_levels; ++i)
+        free(mips->levels[i].data);
+    memset(mips, 0, sizeof(*mips));
+}
@@ -8,69 +8,191 @@
 #include <math.h>
 #include <time.h>
 #include <stdio.h>
+#include "thread_pool.h"
+#include "ggx_sampling.h"
+#include "irradiance_kernel.h"
 
-static float vec3_dot(const float a[3], const float b[3]) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+/* Largest full normal/solid angle index irradiance_filter_sh will use, 64MB */
+#define NSA_FULL_INDEX_MAX_SZ (64u * 1024u * 1024u)
 
-void irradiance_filter(struct envmap* em_out, struct envmap* em_in, filter_progress_fn progress_fn, void* userdata)
+/* Face rows handed to a worker at once, keeps chunks around a few thousand texels */
+static size_t filter_row_grain(size_t face_sz)
 {
-    const size_t face_sz = envmap_face_size(em_in);
+    const size_t grain = 4096 / face_sz;
+    return grain > 0 ? grain : 1;
+}
+
+/* Serializes progress callbacks coming from the worker pool */
+static tp_mutex progress_lock = TP_MUTEX_INIT;
+
+static void filter_report_progress(filter_progress_fn progress_fn, void* userdata)
+{
+    if (!progress_fn)
+        return;
+    tp_mutex_lock(&progress_lock);
+    progress_fn(userdata);
+    tp_mutex_unlock(&progress_lock);
+}
+
+/*======================================================================
+ * Brute force convolution
+ *======================================================================*/
+/* Convolves the input map around dir with the kernel rotated into its frame */
+static void irradiance_convolve(float dst[3], const struct envmap_view* em_in, const struct irradiance_kernel* kern, const float dir[3])
+{
+    float frame[3][3];
+    irradiance_kernel_frame(frame, dir);
+    float tot[3] = {0.0f, 0.0f, 0.0f};
+    for (size_t s = 0; s < IRRADIANCE_KERNEL_SZ; ++s) {
+        /* Rotate sample direction into the texel frame */
+        const float* d = kern->dir[s];
+        float cdir[3];
+        cdir[0] = frame[0][0] * d[0] + frame[1][0] * d[1] + frame[2][0] * d[2];
+        cdir[1] = frame[0][1] * d[0] + frame[1][1] * d[1] + frame[2][1] * d[2];
+        cdir[2] = frame[0][2] * d[0] + frame[1][2] * d[1] + frame[2][2] * d[2];
+        /* Sample for color in the given direction and add it to the sum */
+        float col[3];
+        envmap_view_sample_bilinear(col, em_in, cdir);
+        const float c = kern->weight[s];
+        tot[0] += c * col[0];
+        tot[1] += c * col[1];
+        tot[2] += c * col[2];
+    }
+    /* Divide by the total of samples */
+    dst[0] = tot[0] * kern->inv_total_weight;
+    dst[1] = tot[1] * kern->inv_total_weight;
+    dst[2] = tot[2] * kern->inv_total_weight;
+}
+
+/* Side of the square output tiles handed to the workers, neighbouring texels share most of their source footprint */
+#define IRRADIANCE_TILE_SZ 16
+
+struct irradiance_job {
+    struct envmap_view em_out;
+    struct envmap_view em_in;
+    const struct irradiance_kernel* kern;
+    size_t face_sz;
+    size_t face_w;
+    size_t tiles_x;
+    size_t tiles_y;
+    filter_progress_fn progress_fn;
+    void* userdata;
+};
+
+/* Convolves the tiles [first, last), tiles of all faces are numbered consecutively in row major order */
+static void irradiance_tiles(size_t first, size_t last, void* userdata)
+{
+    struct irradiance_job* job = userdata;
+    const size_t face_sz = job->face_sz;
+    const size_t face_w = job->face_w;
+    const size_t tiles_per_face = job->tiles_x * job->tiles_y;
     const float texel_size = 1.0f / (float)face_sz;
+    const float texel_width = 1.0f / (float)face_w;
     const float warp = envmap_warp_fixup_factor(face_sz);
-    for (int face = 0; face < 6; ++face) {
+    for (size_t tile = first; tile < last; ++tile) {
+        const int face = tile / tiles_per_face;
+        const size_t ybeg = (tile % tiles_per_face) / job->tiles_x * IRRADIANCE_TILE_SZ;
+        const size_t xbeg = (tile % tiles_per_face) % job->tiles_x * IRRADIANCE_TILE_SZ;
+        const size_t yend = ybeg + IRRADIANCE_TILE_SZ < face_sz ? ybeg + IRRADIANCE_TILE_SZ : face_sz;
+        const size_t xend = xbeg + IRRADIANCE_TILE_SZ < face_w ? xbeg + IRRADIANCE_TILE_SZ : face_w;
         /* Iterate through dest pixels */
-        for (size_t ydst = 0; ydst < face_sz; ++ydst) {
+        for (size_t ydst = ybeg; ydst < yend; ++ydst) {
             /* Map value to [-1, 1], offset by 0.5 to point to texel center */
             float v = 2.0f * ((ydst + 0.5f) * texel_size) - 1.0f;
-            for (size_t xdst = 0; xdst < face_sz; ++xdst) {
+            for (size_t xdst = xbeg; xdst < xend; ++xdst) {
                 /* Current destination pixel location */
                 /* Map value to [-1, 1], offset by 0.5 to point to texel center */
-                float u = 2.0f * ((xdst + 0.5f) * texel_size) - 1.0f;
-                //float solid_angle = texel_solid_angle(u, v, texel_size);
+                float u = 2.0f * ((xdst + 0.5f) * texel_width) - 1.0f;
 
                 /* Get sampling vector for the above u, v set */
                 float dir[3];
-                envmap_texel_coord_to_vec_warp(dir, em_in->type, u, v, face, warp);
-                /* */
-                float theta, phi;
-                vec_to_sc(&theta, &phi, dir);
+                envmap_texel_coord_to_vec_warp(dir, job->em_out.type, u, v, face, warp);
 
                 /* Full convolution */
-                float total_weight = 0;
-                float tot[3] = {0.0f, 0.0f, 0.0f};
-                float step = pi_half / 16.0f;
-                float bound = pi_half;
-                for (float k = -bound; k <= bound; k += step) {
-                    for (float l = -bound; l <= bound; l += step) {
-                        /* Current angle values */
-                        float ctheta = theta + k;
-                        float cphi = phi + l;
-                        /* Get 3D vector from angles */
-                        float cdir[3];
-                        sc_to_vec(cdir, ctheta, cphi);
-                        /* Get dot product between normal and current direction */
-                        float c = fabsf(vec3_dot(dir, cdir));
-                        /* Sample for color in the given direction and add it to the sum */
-                        float col[3];
-                        envmap_sample(col, em_in, cdir);
-                        tot[0] += c * col[0];
-                        tot[1] += c * col[1];
-                        tot[2] += c * col[2];
-                        total_weight += c;
-                    }
-                }
-                /* Divide by the total of samples */
                 float dst[3];
-                dst[0] = tot[0] / total_weight;
-                dst[1] = tot[1] / total_weight;
-                dst[2] = tot[2] / total_weight;
-                envmap_setpixel(em_out, xdst, ydst, face, dst);
-
-                /* If progress function given call it */
-                if (progress_fn)
-                    progress_fn(userdata);
+                irradiance_convolve(dst, &job->em_in, job->kern, dir);
+                envmap_view_setpixel(&job->em_out, xdst, ydst, face, dst);
+            }
+        }
+        /* If progress function given call it */
+        filter_report_progress(job->progress_fn, job->userdata);
+    }
+}
+
+void irradiance_filter(struct envmap* em_out, struct envmap* em_in, filter_progress_fn progress_fn, void* userdata)
+{
+    struct irradiance_kernel* kern = malloc(sizeof(*kern));
+    irradiance_kernel_build(kern);
+
+    struct irradiance_source src;
+    irradiance_source_init(&src, em_in, envmap_face_size(em_out));
+
+    /* One tile per chunk, each tile already holds hundreds of full convolutions. Output texels follow em_out alone */
+    struct irradiance_job job;
+    envmap_view_init(&job.em_out, em_out);
+    envmap_view_init(&job.em_in, src.em);
+    job.kern = kern;
+    job.face_sz = job.em_out.face_size;
+    job.face_w = job.em_out.face_width;
+    job.tiles_x = (job.face_w + IRRADIANCE_TILE_SZ - 1) / IRRADIANCE_TILE_SZ;
+    job.tiles_y = (job.face_sz + IRRADIANCE_TILE_SZ - 1) / IRRADIANCE_TILE_SZ;
+    job.progress_fn = progress_fn;
+    job.userdata = userdata;
+    parallel_for(job.em_out.face_count * job.tiles_x * job.tiles_y, 1, irradiance_tiles, &job);
+    irradiance_source_free(&src, em_in);
+    free(kern);
+}
+
+struct sh_irradiance_job {
+    struct envmap_view em_out;
+    /* L2 irradiance as one quadratic form per channel */
+    float m[3][4][4];
+    const float* nsa_idx;
+    enum nsa_layout nsa_layout;
+    enum envmap_type em_type;
+    size_t face_sz;
+    size_t face_w;
+    filter_progress_fn progress_fn;
+    void* userdata;
+};
+
+/* Reconstructs irradiance for the face rows [first, last), rows of all faces are numbered consecutively */
+static void sh_irradiance_rows(size_t first, size_t last, void* userdata)
+{
+    struct sh_irradiance_job* job = userdata;
+    const size_t face_sz = job->face_sz;
+    const size_t face_w = job->face_w;
+    const int latlong = job->em_type == EM_TYPE_LATLONG;
+    float* scratch = !latlong && job->nsa_layout == NSA_LAYOUT_SOA ? 0 : malloc(4 * face_w * sizeof(float));
+    for (size_t row = first; row < last; ++row) {
+        const int face = row / face_sz;
+        const size_t ydst = row % face_sz;
+        const float* nsa[4];
+        if (latlong) {
+            normal_solid_angle_latlong_row_generate(scratch, face_w, face_sz, ydst);
+            for (int i = 0; i < 4; ++i)
+                nsa[i] = scratch + i * face_w;
+        } else {
+            normal_solid_angle_index_row(nsa, job->nsa_idx, face_sz, job->nsa_layout, face, ydst, scratch);
+        }
+        if (job->em_out.format == EM_FORMAT_RGB32F && job->em_out.pixel_stride[face] == 3 * sizeof(float)) {
+            /* Packed float rows are written in place */
+            float* dst = (float*)envmap_view_pixel_ptr(&job->em_out, 0, ydst, face);
+            sh_irradiance_quadratic_batch(dst, job->m, nsa[0], nsa[1], nsa[2], face_w);
+        } else {
+            for (size_t xbeg = 0; xbeg < face_w; xbeg += SH_BATCH_SZ) {
+                const size_t n = face_w - xbeg < SH_BATCH_SZ ? face_w - xbeg : SH_BATCH_SZ;
+                float dst[SH_BATCH_SZ * 3];
+                sh_irradiance_quadratic_batch(dst, job->m, nsa[0] + xbeg, nsa[1] + xbeg, nsa[2] + xbeg, n);
+                uint8_t* dst_ptr = envmap_view_pixel_ptr(&job->em_out, xbeg, ydst, face);
+                for (size_t k = 0; k < n; ++k, dst_ptr += job->em_out.pixel_stride[face])
+                    envmap_texel_store(dst_ptr, job->em_out.format, dst + k * 3);
             }
         }
+        /* If progress function given call it */
+        filter_report_progress(job->progress_fn, job->userdata);
     }
+    free(scratch);
 }
 
 void irradiance_filter_sh(struct envmap* em_out, struct envmap* em_in, filter_progress_fn progress_fn, void* userdata)
@@ -80,37 +202,228 @@ void irradiance_filter_sh(struct envmap* em_out, struct envmap* em_in, filter_pr
     time_t start, end;
     time(&start);
 
-    /* Allocate and build normal/solid angle index */
-    float* nsa_idx = malloc(normal_solid_angle_index_sz(face_sz));
-    normal_solid_angle_index_build(nsa_idx, face_sz, em_in->type);
+    /* Fetch normal/solid angle index, planar so batches stream contiguous lanes,
+     * or a single face octant when the full planes would take too much memory.
+     * Latlong rows are cheap to generate and need no index */
+    const int latlong = em_in->type == EM_TYPE_LATLONG;
+    const enum nsa_layout nsa_layout = latlong ? NSA_LAYOUT_NONE
+                                     : normal_solid_angle_index_sz(face_sz, NSA_LAYOUT_SOA) <= NSA_FULL_INDEX_MAX_SZ
+                                     ? NSA_LAYOUT_SOA : NSA_LAYOUT_SYMMETRIC;
+    const float* nsa_idx = latlong ? 0 : normal_solid_angle_index_acquire(face_sz, em_in->type, nsa_layout);
+    /* The cosine lobe is band limited enough for L2, which keeps reconstruction a quadratic form */
+    const enum sh_order order = SH_ORDER_L2;
     double sh_rgb[SH_COEFF_NUM][3];
     memset(sh_rgb, 0, sizeof(sh_rgb));
     /* Compute spherical harmonic coefficients. */
 #ifndef SH_COEFFS_GPU
-    sh_coeffs(sh_rgb, em_in, nsa_idx);
+    sh_coeffs(sh_rgb, order, em_in, nsa_idx, nsa_layout, SH_PRECISION_DOUBLE);
 #else
-    sh_coeffs_gpu(sh_rgb, em_in, nsa_idx);
+    sh_coeffs_gpu(sh_rgb, order, em_in, nsa_idx, nsa_layout, SH_PRECISION_DOUBLE);
 #endif
 
     time(&end);
     unsigned long long msecs = 1000 * difftime(end, start);
     printf("SH coef calculation time: %llu:%llu:%llu\n", (msecs / 1000) / 60, (msecs / 1000) % 60, msecs % 1000);
 
-    /* Compute irradiance using sh data */
-    float* nsa_ptr = nsa_idx;
-    for (int face = 0; face < 6; ++face) {
-        for (size_t ydst = 0; ydst < face_sz; ++ydst) {
-            for (size_t xdst = 0; xdst < face_sz; ++xdst) {
-                float dst[3];
-                sh_irradiance(dst, sh_rgb, nsa_ptr);
-                envmap_setpixel(em_out, xdst, ydst, face, dst);
-                /* Advance index pointer */
-                nsa_ptr += 4;
-                /* If progress function given call it */
-                if (progress_fn)
-                    progress_fn(userdata);
+    /* Compute irradiance using sh data, over the texels of em_out */
+    struct sh_irradiance_job job;
+    envmap_view_init(&job.em_out, em_out);
+    sh_irradiance_matrices(job.m, sh_rgb);
+    job.em_type = em_out->type;
+    job.face_sz = job.em_out.face_size;
+    job.face_w = job.em_out.face_width;
+    /* Cube outputs of the input face size reuse its index, other cube sizes generate their rows */
+    const int same_faces = !latlong && job.em_type != EM_TYPE_LATLONG && job.face_sz == face_sz;
+    job.nsa_idx = same_faces ? nsa_idx : 0;
+    job.nsa_layout = same_faces ? nsa_layout : NSA_LAYOUT_NONE;
+    job.progress_fn = progress_fn;
+    job.userdata = userdata;
+    parallel_for(job.em_out.face_count * job.face_sz, filter_row_grain(job.face_w), sh_irradiance_rows, &job);
+    normal_solid_angle_index_release(nsa_idx);
+}
+
+/*======================================================================
+ * GGX radiance
+ *======================================================================*/
+/*
+ * Importance samples per texel, the source mip selection filters away most of the noise fewer samples would leave.
+ * Lobes below roughness 0.5 read from mips close to the output resolution and take proportionally fewer.
+ */
+#define RADIANCE_GGX_SAMPLES 64
+#define RADIANCE_GGX_MIN_SAMPLES 16
+#define RADIANCE_TILE_SZ 16
+
+/* Light directions of the GGX lobe around a normal equal to the view direction, in the same local frame as the irradiance kernel */
+struct radiance_kernel {
+    float dir[RADIANCE_GGX_SAMPLES][3];
+    float weight[RADIANCE_GGX_SAMPLES];
+    /* Source mip level every sample reads from */
+    float lod[RADIANCE_GGX_SAMPLES];
+    size_t count;
+    float inv_total_weight;
+};
+
+/*
+ * Filtered importance sampling, every sample reads the source mip whose texels cover about
+ * the solid angle the sample stands for, 1 / (count * pdf), but never one finer than the output.
+ */
+static void radiance_kernel_build(struct radiance_kernel* kern, float roughness, const struct envmap_view* src, uint32_t num_src_levels, uint32_t out_face_size)
+{
+    /* Average solid angle of a texel of the full resolution source */
+    const float src_texel_sa = 4.0f * pi / ((float)src->face_count * src->face_width * src->face_size);
+    const float max_lod = (float)(num_src_levels - 1);
+    float min_lod = log2f((float)src->face_size / out_face_size);
+    min_lod = min_lod > 0.0f ? (min_lod < max_lod ? min_lod : max_lod) : 0.0f;
+
+    kern->count = 0;
+    float total_weight = 0.0f;
+    if (roughness <= 0.0f) {
+        /* Perfect mirror */
+        kern->dir[0][0] = 0.0f;
+        kern->dir[0][1] = 0.0f;
+        kern->dir[0][2] = 1.0f;
+        kern->weight[0] = 1.0f;
+        kern->lod[0] = min_lod;
+        kern->count = 1;
+        kern->inv_total_weight = 1.0f;
+        return;
+    }
+
+    const float alpha = roughness * roughness;
+    const float a2 = alpha * alpha;
+    uint32_t num_samples = (uint32_t)(2.0f * RADIANCE_GGX_SAMPLES * roughness);
+    num_samples = num_samples > RADIANCE_GGX_MIN_SAMPLES ? (num_samples < RADIANCE_GGX_SAMPLES ? num_samples : RADIANCE_GGX_SAMPLES) : RADIANCE_GGX_MIN_SAMPLES;
+    for (uint32_t i = 0; i < num_samples; ++i) {
+        /* Half vector of the GGX distribution */
+        float h[3];
+        ggx_sample_half_vector(h, i, num_samples, a2);
+        const float cos_theta = h[2];
+        /* Reflect the view direction, the normal, around it */
+        const float l[3] = { 2.0f * cos_theta * h[0], 2.0f * cos_theta * h[1], 2.0f * cos_theta * h[2] - 1.0f };
+        const float n_dot_l = l[2];
+        if (n_dot_l <= 0.0f)
+            continue;
+        /* With the view along the normal, pdf = D * NdotH / (4 * VdotH) = D / 4 */
+        const float d_den = cos_theta * cos_theta * (a2 - 1.0f) + 1.0f;
+        const float pdf = a2 / (pi * d_den * d_den) * 0.25f;
+        const float sample_solid_angle = 1.0f / (num_samples * pdf);
+        float lod = 0.5f * log2f(sample_solid_angle / src_texel_sa);
+        lod = lod > min_lod ? (lod < max_lod ? lod : max_lod) : min_lod;
+
+        const size_t s = kern->count++;
+        kern->dir[s][0] = l[0];
+        kern->dir[s][1] = l[1];
+        kern->dir[s][2] = l[2];
+        kern->weight[s] = n_dot_l;
+        kern->lod[s] = lod;
+        total_weight += n_dot_l;
+    }
+    kern->inv_total_weight = 1.0f / total_weight;
+}
+
+struct radiance_job {
+    struct envmap_view em_out;
+    /* Views of every source mip level */
+    struct envmap_view em_in[ENVMAP_MAX_MIPS];
+    const struct radiance_kernel* kern;
+    size_t tiles_x;
+    size_t tiles_y;
+    filter_progress_fn progress_fn;
+    void* userdata;
+};
+
+/* Weighted sum of the kernel samples around dir, blending the two source mips around each sample lod */
+static void radiance_convolve(float dst[3], const struct radiance_job* job, const float dir[3])
+{
+    const struct radiance_kernel* kern = job->kern;
+    float frame[3][3];
+    irradiance_kernel_frame(frame, dir);
+    float tot[3] = {0.0f, 0.0f, 0.0f};
+    for (size_t s = 0; s < kern->count; ++s) {
+        const float* d = kern->dir[s];
+        float cdir[3];
+        cdir[0] = frame[0][0] * d[0] + frame[1][0] * d[1] + frame[2][0] * d[2];
+        cdir[1] = frame[0][1] * d[0] + frame[1][1] * d[1] + frame[2][1] * d[2];
+        cdir[2] = frame[0][2] * d[0] + frame[1][2] * d[1] + frame[2][2] * d[2];
+        const size_t lod0 = (size_t)kern->lod[s];
+        const float frac = kern->lod[s] - (float)lod0;
+        float col[3];
+        envmap_view_sample_bilinear(col, &job->em_in[lod0], cdir);
+        if (frac > 0.0f) {
+            float col1[3];
+            envmap_view_sample_bilinear(col1, &job->em_in[lod0 + 1], cdir);
+            col[0] += (col1[0] - col[0]) * frac;
+            col[1] += (col1[1] - col[1]) * frac;
+            col[2] += (col1[2] - col[2]) * frac;
+        }
+        const float c = kern->weight[s];
+        tot[0] += c * col[0];
+        tot[1] += c * col[1];
+        tot[2] += c * col[2];
+    }
+    dst[0] = tot[0] * kern->inv_total_weight;
+    dst[1] = tot[1] * kern->inv_total_weight;
+    dst[2] = tot[2] * kern->inv_total_weight;
+}
+
+static void radiance_tiles(size_t first, size_t last, void* userdata)
+{
+    struct radiance_job* job = userdata;
+    const struct envmap_view* out = &job->em_out;
+    const size_t tiles_per_face = job->tiles_x * job->tiles_y;
+    const float texel_size = 1.0f / (float)out->face_size;
+    const float texel_width = 1.0f / (float)out->face_width;
+    for (size_t tile = first; tile < last; ++tile) {
+        const int face = tile / tiles_per_face;
+        const size_t ybeg = (tile % tiles_per_face) / job->tiles_x * RADIANCE_TILE_SZ;
+        const size_t xbeg = (tile % tiles_per_face) % job->tiles_x * RADIANCE_TILE_SZ;
+        const size_t yend = ybeg + RADIANCE_TILE_SZ < out->face_size ? ybeg + RADIANCE_TILE_SZ : out->face_size;
+        const size_t xend = xbeg + RADIANCE_TILE_SZ < out->face_width ? xbeg + RADIANCE_TILE_SZ : out->face_width;
+        for (size_t ydst = ybeg; ydst < yend; ++ydst) {
+            const float v = 2.0f * ((ydst + 0.5f) * texel_size) - 1.0f;
+            uint8_t* dst_ptr = envmap_view_pixel_ptr(out, xbeg, ydst, face);
+            for (size_t xdst = xbeg; xdst < xend; ++xdst, dst_ptr += out->pixel_stride[face]) {
+                const float u = 2.0f * ((xdst + 0.5f) * texel_width) - 1.0f;
+                float dir[3], dst[3];
+                envmap_texel_coord_to_vec(dir, out->type, u, v, face);
+                radiance_convolve(dst, job, dir);
+                envmap_texel_store(dst_ptr, out->format, dst);
             }
         }
+        filter_report_progress(job->progress_fn, job->userdata);
+    }
+}
+
+void radiance_filter_ggx(struct envmap_mips* mips_out, struct envmap* em_in, filter_progress_fn progress_fn, void* userdata)
+{
+    /* Source chain for the lod selection, kept in float so the many taps per texel skip the format decode */
+    struct envmap em_src = *em_in;
+    if (em_in->format != EM_FORMAT_RGB32F) {
+        em_src.format = EM_FORMAT_RGB32F;
+        em_src.data = malloc((size_t)em_src.width * em_src.height * envmap_format_size(em_src.format));
+        envmap_convert(&em_src, em_in);
+    }
+    struct envmap_mips src;
+    envmap_build_mips(&src, &em_src);
+
+    struct radiance_job job;
+    for (uint32_t i = 0; i < src.num_levels; ++i)
+        envmap_view_init(&job.em_in[i], &src.levels[i]);
+    job.progress_fn = progress_fn;
+    job.userdata = userdata;
+
+    struct radiance_kernel* kern = malloc(sizeof(*kern));
+    job.kern = kern;
+    for (uint32_t level = 0; level < mips_out->num_levels; ++level) {
+        const float roughness = mips_out->num_levels > 1 ? (float)level / (mips_out->num_levels - 1) : 0.0f;
+        envmap_view_init(&job.em_out, &mips_out->levels[level]);
+        radiance_kernel_build(kern, roughness, &job.em_in[0], src.num_levels, job.em_out.face_size);
+        job.tiles_x = (job.em_out.face_width + RADIANCE_TILE_SZ - 1) / RADIANCE_TILE_SZ;
+        job.tiles_y = (job.em_out.face_size + RADIANCE_TILE_SZ - 1) / RADIANCE_TILE_SZ;
+        parallel_for(job.em_out.face_count * job.tiles_x * job.tiles_y, 1, radiance_tiles, &job);
     }
-    free(nsa_idx);
+    free(kern);
+    envmap_mips_free(&src);
+    if (em_src.data != em_in->data)
+        free(em_src.data);
 }
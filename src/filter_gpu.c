@@ -4,12 +4,30 @@
 #include <string.h>
 #include "cl_helper.h"
 #include "gpufilter.h"
+#include "irradiance_kernel.h"
 
 void irradiance_filter_gpu(struct envmap* em_out, struct envmap* em_in, filter_progress_fn progress_fn, void* userdata)
 {
-    /* Sizes */
-    uint8_t bytes_per_channel = sizeof(unsigned char);
-    size_t data_sz = bytes_per_channel * em_in->channels * em_in->width * em_in->height;
+    /* Same kernel table and source level as irradiance_filter, each direction packed with its weight */
+    struct irradiance_kernel* kern = malloc(sizeof(*kern));
+    irradiance_kernel_build(kern);
+    const size_t kern_data_sz = 4 * IRRADIANCE_KERNEL_SZ * sizeof(float);
+    float* kern_data = malloc(kern_data_sz);
+    for (size_t s = 0; s < IRRADIANCE_KERNEL_SZ; ++s) {
+        kern_data[4 * s + 0] = kern->dir[s][0];
+        kern_data[4 * s + 1] = kern->dir[s][1];
+        kern_data[4 * s + 2] = kern->dir[s][2];
+        kern_data[4 * s + 3] = kern->weight[s];
+    }
+    const float inv_total_weight = kern->inv_total_weight;
+    free(kern);
+    struct irradiance_source src;
+    irradiance_source_init(&src, em_in, envmap_face_size(em_out));
+    struct envmap* em_src = src.em;
+
+    /* Sizes, the output layout, face size and format are independent of the input ones */
+    const size_t in_data_sz = (size_t)envmap_format_size(em_src->format) * em_src->width * em_src->height;
+    const size_t out_data_sz = (size_t)envmap_format_size(em_out->format) * em_out->width * em_out->height;
 
     /* Platform and device ids used to create the context */
     cl_int err;
@@ -18,7 +36,7 @@ void irradiance_filter_gpu(struct envmap* em_out, struct envmap* em_in, filter_p
     err = cl_choose_platform_and_device(&ctx_pid, &ctx_did);
     if (!err) {
         printf("No OpenCL valid platform/device pair found!\n");
-        return;
+        goto cleanup_src;
     }
 
     /* Create context */
@@ -29,7 +47,7 @@ void irradiance_filter_gpu(struct envmap* em_out, struct envmap* em_in, filter_p
     cl_context ctx = clCreateContext(ctx_props, 1, &ctx_did, 0, 0, &err);
     if (err != CL_SUCCESS) {
         printf("Could not create OpenCL context!\n");
-        return;
+        goto cleanup_src;
     }
 
     /* Create program */
@@ -54,26 +72,44 @@ void irradiance_filter_gpu(struct envmap* em_out, struct envmap* em_in, filter_p
     cl_check_error(err, "Creating Command Queue");
 
     /* Create input and output array in device memory */
-    cl_mem in_dev_mem = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, data_sz, em_in->data, &err);
-    cl_mem out_dev_mem = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR, data_sz, em_out->data, &err);
+    cl_mem in_dev_mem = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, in_data_sz, em_src->data, &err);
+    cl_mem kern_dev_mem = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, kern_data_sz, kern_data, &err);
+    cl_mem out_dev_mem = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR, out_data_sz, em_out->data, &err);
 
     /* Enqueue kernel */
-    int face_size = em_in->width / 4;
+    const unsigned int in_width = em_src->width;
+    const unsigned int in_height = em_src->height;
+    const unsigned int in_type = em_src->type;
+    const unsigned int in_format = em_src->format;
+    const unsigned int out_width = em_out->width;
+    const unsigned int out_height = em_out->height;
+    const unsigned int out_type = em_out->type;
+    const unsigned int out_format = em_out->format;
     err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &out_dev_mem);
     err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &in_dev_mem);
-    err |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &face_size);
+    err |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &in_width);
+    err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &in_height);
+    err |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &in_type);
+    err |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &in_format);
+    err |= clSetKernelArg(kernel, 6, sizeof(unsigned int), &out_width);
+    err |= clSetKernelArg(kernel, 7, sizeof(unsigned int), &out_height);
+    err |= clSetKernelArg(kernel, 8, sizeof(unsigned int), &out_type);
+    err |= clSetKernelArg(kernel, 9, sizeof(unsigned int), &out_format);
+    err |= clSetKernelArg(kernel, 10, sizeof(cl_mem), &kern_dev_mem);
+    err |= clSetKernelArg(kernel, 11, sizeof(float), &inv_total_weight);
     cl_check_error(err, "Setting kernel arguments");
 
-    for (unsigned int i = 0; i < 6; ++i) {
+    const unsigned int face_count = envmap_face_count(em_out);
+    for (unsigned int i = 0; i < face_count; ++i) {
         /* Set face id argument */
-        err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &i);
-        /* Execute the kernel over the entire range of our 2D input data set
+        err |= clSetKernelArg(kernel, 12, sizeof(unsigned int), &i);
+        /* Execute the kernel over the entire range of our 2D output face
            letting the OpenCL runtime choose the work-group size */
-        size_t work_size[2] = {face_size, face_size};
+        size_t work_size[2] = {envmap_face_size(em_out), envmap_face_width(em_out)};
         err = clEnqueueNDRangeKernel(cmd_queue, kernel, 2, 0, work_size, 0, 0, 0, 0);
         cl_check_error(err, "Enqueueing kernel");
         /* Read back the result from the compute device */
-        err = clEnqueueReadBuffer(cmd_queue, out_dev_mem, CL_TRUE, 0, data_sz, em_out->data, 0, 0, 0);
+        err = clEnqueueReadBuffer(cmd_queue, out_dev_mem, CL_TRUE, 0, out_data_sz, em_out->data, 0, 0, 0);
         cl_check_error(err, "Reading back result");
         /* Wait for current face to finish */
         clFinish(cmd_queue);
@@ -83,6 +119,7 @@ void irradiance_filter_gpu(struct envmap* em_out, struct envmap* em_in, filter_p
     }
 
     /* Free device resources */
+    clReleaseMemObject(kern_dev_mem);
     clReleaseMemObject(out_dev_mem);
     clReleaseMemObject(in_dev_mem);
 
@@ -92,4 +129,7 @@ void irradiance_filter_gpu(struct envmap* em_out, struct envmap* em_in, filter_p
 cleanup_prog:
     clReleaseProgram(prog);
     clReleaseContext(ctx);
+cleanup_src:
+    irradiance_source_free(&src, em_in);
+    free(kern_data);
 }
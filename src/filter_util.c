@@ -1,9 +1,196 @@
 #include <emproc/filter_util.h>
+#ifndef OPENCL_MODE
+#include <stdint.h>
+#include <math.h>
+#include "thread_pool.h"
+#endif
 
-void normal_solid_angle_index_build(void* mem, size_t face_sz, enum envmap_type em_type)
+/*======================================================================
+ * Symmetric index
+ *======================================================================*/
+/*
+ * Texel directions of all faces are signed permutations of (u, v, 1) and the solid angle
+ * only depends on |u| and |v|, so a face octant with |u| <= |v| describes the whole cube.
+ * Entries are stored for folded coordinates (a, b), a <= b, at index b * (b + 1) / 2 + a.
+ */
+/* Number of folded coordinates of a face axis */
+static uint32_t nsa_fold_count(uint32_t face_sz)
+{
+    return (face_sz + 1) / 2;
+}
+
+/* Folds a texel coordinate onto the non negative half of its face axis */
+static uint32_t nsa_fold(uint32_t c, uint32_t face_sz, PRIVATE float* sign)
+{
+    if (2 * c + 1 < face_sz) {
+        *sign = -1.0f;
+        c = face_sz - 1 - c;
+    } else {
+        *sign = 1.0f;
+    }
+    return c - (face_sz - nsa_fold_count(face_sz));
+}
+
+/* Expands the folded entry e of a texel with the given signs into its face direction */
+static void nsa_symmetric_expand(PRIVATE float nsa[4], GLOBAL const float* e, int swapped, float su, float sv, PRIVATE float basis[3][3])
+{
+    const float cu = su * (swapped ? e[1] : e[0]);
+    const float cv = sv * (swapped ? e[0] : e[1]);
+    nsa[0] = basis[0][0] * cu + basis[1][0] * cv + basis[2][0] * e[2];
+    nsa[1] = basis[0][1] * cu + basis[1][1] * cv + basis[2][1] * e[2];
+    nsa[2] = basis[0][2] * cu + basis[1][2] * cv + basis[2][2] * e[2];
+    nsa[3] = e[3];
+}
+
+void normal_solid_angle_index_symmetric_fetch(PRIVATE float nsa[4], GLOBAL const float* idx, uint32_t face_sz, uint8_t face, uint32_t x, uint32_t y)
+{
+    float su, sv;
+    const uint32_t a = nsa_fold(x, face_sz, &su);
+    const uint32_t b = nsa_fold(y, face_sz, &sv);
+    const uint32_t lo = a < b ? a : b;
+    const uint32_t hi = a < b ? b : a;
+    float basis[3][3];
+    envmap_cube_face_basis(basis, face);
+    nsa_symmetric_expand(nsa, idx + (hi * (hi + 1) / 2 + lo) * 4, a > b, su, sv, basis);
+}
+
+/*======================================================================
+ * Texel fetch
+ *======================================================================*/
+void normal_solid_angle_index_fetch(PRIVATE float nsa[4], GLOBAL const float* idx, enum nsa_layout layout, uint32_t plane_stride, uint32_t face_sz, uint8_t face, uint32_t x, uint32_t y)
+{
+    const uint32_t i = (face * face_sz * face_sz) + y * face_sz + x;
+    if (layout == NSA_LAYOUT_SOA) {
+        nsa[0] = idx[i + 0 * plane_stride];
+        nsa[1] = idx[i + 1 * plane_stride];
+        nsa[2] = idx[i + 2 * plane_stride];
+        nsa[3] = idx[i + 3 * plane_stride];
+    } else if (layout == NSA_LAYOUT_NONE) {
+        const float texel_size = 1.0f / (float)face_sz;
+        const float v = 2.0f * ((y + 0.5f) * texel_size) - 1.0f;
+        const float u = 2.0f * ((x + 0.5f) * texel_size) - 1.0f;
+        envmap_texel_coord_to_vec_warp(nsa, EM_TYPE_HCROSS, u, v, face, envmap_warp_fixup_factor(face_sz));
+        nsa[3] = texel_solid_angle(u, v, texel_size);
+    } else if (layout == NSA_LAYOUT_SYMMETRIC) {
+        normal_solid_angle_index_symmetric_fetch(nsa, idx, face_sz, face, x, y);
+    } else {
+        nsa[0] = idx[i * 4 + 0];
+        nsa[1] = idx[i * 4 + 1];
+        nsa[2] = idx[i * 4 + 2];
+        nsa[3] = idx[i * 4 + 3];
+    }
+}
+
+#ifndef OPENCL_MODE
+static void nsa_symmetric_build(float* dst_ptr, size_t face_sz)
+{
+    const float warp = envmap_warp_fixup_factor(face_sz);
+    const float texel_size = 1.0f / (float)face_sz;
+    const uint32_t half = nsa_fold_count(face_sz);
+    const size_t first = face_sz - half;
+    for (uint32_t b = 0; b < half; ++b) {
+        /* Map value to [-1, 1], offset by 0.5 to point to texel center */
+        const float v = 2.0f * (((first + b) + 0.5f) * texel_size) - 1.0f;
+        for (uint32_t a = 0; a <= b; ++a) {
+            const float u = 2.0f * (((first + a) + 0.5f) * texel_size) - 1.0f;
+            /* The +Z face maps (u, v) to (+x, -y, +z) */
+            float dir[3];
+            envmap_texel_coord_to_vec_warp(dir, EM_TYPE_HCROSS, u, v, CM_FACE_POS_Z, warp);
+            dst_ptr[0] = dir[0];
+            dst_ptr[1] = -dir[1];
+            dst_ptr[2] = dir[2];
+            dst_ptr[3] = texel_solid_angle(u, v, texel_size);
+            dst_ptr += 4;
+        }
+    }
+}
+
+/*======================================================================
+ * Indexless rows
+ *======================================================================*/
+/* http://www.rorydriscoll.com/2012/01/15/cubemap-texel-solid-angle/ */
+static float nsa_area_element(float x, float y)
+{
+    return atan2f(x * y, sqrtf(x * x + y * y + 1.0f));
+}
+
+void normal_solid_angle_row_generate(float* planes, size_t face_sz, int face, size_t row)
 {
     const float warp = envmap_warp_fixup_factor(face_sz);
     const float texel_size = 1.0f / (float)face_sz;
+    float basis[3][3];
+    envmap_cube_face_basis(basis, face);
+    float* xs = planes + 0 * face_sz;
+    float* ys = planes + 1 * face_sz;
+    float* zs = planes + 2 * face_sz;
+    float* sa = planes + 3 * face_sz;
+
+    /* Per row terms */
+    const float v = 2.0f * ((row + 0.5f) * texel_size) - 1.0f;
+    const float wv = (warp * v*v*v) + v;
+    const float rx = basis[1][0] * wv + basis[2][0];
+    const float ry = basis[1][1] * wv + basis[2][1];
+    const float rz = basis[1][2] * wv + basis[2][2];
+    const float y0 = v - texel_size;
+    const float y1 = v + texel_size;
+
+    /* Texel solid angles are differences of the area terms at shared column boundaries */
+    float prev = nsa_area_element(-1.0f, y1) - nsa_area_element(-1.0f, y0);
+    for (size_t i = 0; i < face_sz; ++i) {
+        /* Map value to [-1, 1], offset by 0.5 to point to texel center */
+        const float u = 2.0f * ((i + 0.5f) * texel_size) - 1.0f;
+        const float wu = (warp * u*u*u) + u;
+        const float x = basis[0][0] * wu + rx;
+        const float y = basis[0][1] * wu + ry;
+        const float z = basis[0][2] * wu + rz;
+        const float inv_len = 1.0f / sqrtf(x * x + y * y + z * z);
+        xs[i] = x * inv_len;
+        ys[i] = y * inv_len;
+        zs[i] = z * inv_len;
+        const float x1 = u + texel_size;
+        const float next = nsa_area_element(x1, y1) - nsa_area_element(x1, y0);
+        sa[i] = next - prev;
+        prev = next;
+    }
+}
+
+void normal_solid_angle_latlong_row_generate(float* planes, size_t width, size_t height, size_t row)
+{
+    float* xs = planes + 0 * width;
+    float* ys = planes + 1 * width;
+    float* zs = planes + 2 * width;
+    float* sa = planes + 3 * width;
+
+    /* Per row terms, the solid angle of a texel is its theta step times the cos(phi) difference of the row band */
+    const float phi0 = pi * (float)row / (float)height;
+    const float phi1 = pi * (float)(row + 1) / (float)height;
+    const float phi = pi * (row + 0.5f) / (float)height;
+    const float sin_phi = sinf(phi);
+    const float cos_phi = cosf(phi);
+    const float texel_sa = (two_pi / (float)width) * (cosf(phi0) - cosf(phi1));
+    for (size_t i = 0; i < width; ++i) {
+        const float theta = pi * (2.0f * ((i + 0.5f) / (float)width) - 1.0f);
+        xs[i] = sinf(theta) * sin_phi;
+        ys[i] = cos_phi;
+        zs[i] = cosf(theta) * sin_phi;
+        sa[i] = texel_sa;
+    }
+}
+
+/*======================================================================
+ * Full index
+ *======================================================================*/
+void normal_solid_angle_index_build(void* mem, size_t face_sz, enum envmap_type em_type, enum nsa_layout layout)
+{
+    if (layout == NSA_LAYOUT_NONE)
+        return;
+    if (layout == NSA_LAYOUT_SYMMETRIC) {
+        nsa_symmetric_build(mem, face_sz);
+        return;
+    }
+    const float warp = envmap_warp_fixup_factor(face_sz);
+    const float texel_size = 1.0f / (float)face_sz;
+    const size_t plane_stride = normal_solid_angle_index_plane_stride(face_sz);
     float* dst_ptr = mem;
     for (int face = 0; face < 6; ++face) {
         for (size_t ydst = 0; ydst < face_sz; ++ydst) {
@@ -12,22 +199,268 @@ void normal_solid_angle_index_build(void* mem, size_t face_sz, enum envmap_type
                 /* Map value to [-1, 1], offset by 0.5 to point to texel center */
                 const float v = 2.0f * ((ydst + 0.5f) * texel_size) - 1.0f;
                 const float u = 2.0f * ((xdst + 0.5f) * texel_size) - 1.0f;
-                /* Get sampling vector for the above u, v set */
-                envmap_texel_coord_to_vec_warp(dst_ptr, em_type, u, v, face, warp);
-                /* Get solid angle for u, v set */
-                dst_ptr[3] = texel_solid_angle(u, v, texel_size);
-                /* Advance */
-                dst_ptr += 4;
+                /* Get sampling vector and solid angle for the above u, v set */
+                float nsa[4];
+                envmap_texel_coord_to_vec_warp(nsa, em_type, u, v, face, warp);
+                nsa[3] = texel_solid_angle(u, v, texel_size);
+                /* Store and advance */
+                if (layout == NSA_LAYOUT_SOA) {
+                    dst_ptr[0 * plane_stride] = nsa[0];
+                    dst_ptr[1 * plane_stride] = nsa[1];
+                    dst_ptr[2 * plane_stride] = nsa[2];
+                    dst_ptr[3 * plane_stride] = nsa[3];
+                    dst_ptr += 1;
+                } else {
+                    dst_ptr[0] = nsa[0];
+                    dst_ptr[1] = nsa[1];
+                    dst_ptr[2] = nsa[2];
+                    dst_ptr[3] = nsa[3];
+                    dst_ptr += 4;
+                }
             }
         }
     }
 }
 
-float normal_solid_angle_index_sz(size_t face_sz)
+size_t normal_solid_angle_index_plane_stride(size_t face_sz)
 {
+    const size_t align = NSA_PLANE_ALIGN / sizeof(float);
+    const size_t texels = face_sz * face_sz * 6;
+    return (texels + align - 1) / align * align;
+}
+
+size_t normal_solid_angle_index_sz(size_t face_sz, enum nsa_layout layout)
+{
+    if (layout == NSA_LAYOUT_NONE)
+        return 0;
+    if (layout == NSA_LAYOUT_SYMMETRIC) {
+        const size_t half = nsa_fold_count(face_sz);
+        return half * (half + 1) / 2 * 4 * sizeof(float);
+    }
+    if (layout == NSA_LAYOUT_SOA)
+        return normal_solid_angle_index_plane_stride(face_sz) * 4 * sizeof(float);
     return face_sz /* width    */
          * face_sz /* height   */
          * 6       /* faces    */
          * 4       /* channels */
          * 4;      /* bytes per channel */
 }
+
+void* normal_solid_angle_index_alloc(size_t face_sz, enum nsa_layout layout)
+{
+    /* Over-allocate and stash the original pointer right before the aligned block */
+    const size_t sz = normal_solid_angle_index_sz(face_sz, layout);
+    uint8_t* raw = malloc(sz + NSA_PLANE_ALIGN + sizeof(void*));
+    if (!raw)
+        return 0;
+    uintptr_t aligned = ((uintptr_t)(raw + sizeof(void*)) + NSA_PLANE_ALIGN - 1) & ~(uintptr_t)(NSA_PLANE_ALIGN - 1);
+    ((void**)aligned)[-1] = raw;
+    return (void*)aligned;
+}
+
+void normal_solid_angle_index_free(void* mem)
+{
+    if (mem)
+        free(((void**)mem)[-1]);
+}
+
+void normal_solid_angle_index_row(const float* planes[4], const void* idx, size_t face_sz, enum nsa_layout layout, int face, size_t row, float* scratch)
+{
+    const size_t first = (face * face_sz + row) * face_sz;
+    if (layout == NSA_LAYOUT_SOA) {
+        const size_t plane_stride = normal_solid_angle_index_plane_stride(face_sz);
+        const float* base = (const float*)idx + first;
+        planes[0] = base;
+        planes[1] = base + 1 * plane_stride;
+        planes[2] = base + 2 * plane_stride;
+        planes[3] = base + 3 * plane_stride;
+        return;
+    }
+    if (layout == NSA_LAYOUT_NONE) {
+        normal_solid_angle_row_generate(scratch, face_sz, face, row);
+    } else if (layout == NSA_LAYOUT_SYMMETRIC) {
+        /* Expand octant entries */
+        float basis[3][3];
+        envmap_cube_face_basis(basis, face);
+        float sv;
+        const uint32_t b = nsa_fold(row, face_sz, &sv);
+        for (size_t i = 0; i < face_sz; ++i) {
+            float su, nsa[4];
+            const uint32_t a = nsa_fold(i, face_sz, &su);
+            const uint32_t lo = a < b ? a : b;
+            const uint32_t hi = a < b ? b : a;
+            nsa_symmetric_expand(nsa, (const float*)idx + (hi * (hi + 1) / 2 + lo) * 4, a > b, su, sv, basis);
+            scratch[0 * face_sz + i] = nsa[0];
+            scratch[1 * face_sz + i] = nsa[1];
+            scratch[2 * face_sz + i] = nsa[2];
+            scratch[3 * face_sz + i] = nsa[3];
+        }
+    } else {
+        /* Deinterleave */
+        const float* src = (const float*)idx + first * 4;
+        for (size_t i = 0; i < face_sz; ++i) {
+            scratch[0 * face_sz + i] = src[i * 4 + 0];
+            scratch[1 * face_sz + i] = src[i * 4 + 1];
+            scratch[2 * face_sz + i] = src[i * 4 + 2];
+            scratch[3 * face_sz + i] = src[i * 4 + 3];
+        }
+    }
+    planes[0] = scratch + 0 * face_sz;
+    planes[1] = scratch + 1 * face_sz;
+    planes[2] = scratch + 2 * face_sz;
+    planes[3] = scratch + 3 * face_sz;
+}
+
+/*======================================================================
+ * Index cache
+ *======================================================================*/
+/* Default cache memory budget, 512MB */
+#define NSA_CACHE_DEFAULT_BUDGET (512u * 1024u * 1024u)
+
+struct nsa_cache_entry {
+    /* Key */
+    size_t face_sz;
+    enum envmap_type em_type;
+    enum nsa_layout layout;
+    /* Index memory */
+    float* data;
+    size_t bytes;
+    /* Active references, entries are only evicted when zero */
+    size_t refs;
+    /* Tick of the last acquire, for LRU ordering */
+    unsigned long long last_use;
+    struct nsa_cache_entry* next;
+};
+
+static struct {
+    struct nsa_cache_entry* head;
+    size_t total_bytes;
+    size_t budget;
+    unsigned long long tick;
+} nsa_cache = { 0, 0, NSA_CACHE_DEFAULT_BUDGET, 0 };
+static tp_mutex nsa_cache_lock = TP_MUTEX_INIT;
+
+/* All cube layouts share the same texel directions */
+static enum envmap_type nsa_cache_key_type(enum envmap_type em_type)
+{
+    switch (em_type) {
+        case EM_TYPE_HCROSS:
+        case EM_TYPE_VCROSS:
+        case EM_TYPE_VSTRIP:
+            return EM_TYPE_HCROSS;
+        default:
+            return em_type;
+    }
+}
+
+/* Drops least recently used unreferenced entries until the budget is met, must be called with the cache lock held */
+static void nsa_cache_trim(size_t budget)
+{
+    while (nsa_cache.total_bytes > budget) {
+        struct nsa_cache_entry** victim = 0;
+        for (struct nsa_cache_entry** it = &nsa_cache.head; *it; it = &(*it)->next)
+            if ((*it)->refs == 0 && (!victim || (*it)->last_use < (*victim)->last_use))
+                victim = it;
+        if (!victim)
+            break;
+        struct nsa_cache_entry* e = *victim;
+        *victim = e->next;
+        nsa_cache.total_bytes -= e->bytes;
+        normal_solid_angle_index_free(e->data);
+        free(e);
+    }
+}
+
+/* Looks up and references an entry, must be called with the cache lock held */
+static struct nsa_cache_entry* nsa_cache_find(size_t face_sz, enum envmap_type em_type, enum nsa_layout layout)
+{
+    for (struct nsa_cache_entry* e = nsa_cache.head; e; e = e->next) {
+        if (e->face_sz == face_sz && e->em_type == em_type && e->layout == layout) {
+            ++e->refs;
+            e->last_use = ++nsa_cache.tick;
+            return e;
+        }
+    }
+    return 0;
+}
+
+const float* normal_solid_angle_index_acquire(size_t face_sz, enum envmap_type em_type, enum nsa_layout layout)
+{
+    /* Nothing is stored for this layout */
+    if (layout == NSA_LAYOUT_NONE)
+        return 0;
+    em_type = nsa_cache_key_type(em_type);
+    tp_mutex_lock(&nsa_cache_lock);
+    struct nsa_cache_entry* e = nsa_cache_find(face_sz, em_type, layout);
+    tp_mutex_unlock(&nsa_cache_lock);
+    if (e)
+        return e->data;
+
+    /* Build outside of the lock, so lookups of other sizes are not held up */
+    float* data = normal_solid_angle_index_alloc(face_sz, layout);
+    if (!data)
+        return 0;
+    normal_solid_angle_index_build(data, face_sz, em_type, layout);
+
+    tp_mutex_lock(&nsa_cache_lock);
+    /* Another thread may have inserted the same index meanwhile */
+    e = nsa_cache_find(face_sz, em_type, layout);
+    if (!e) {
+        e = malloc(sizeof(*e));
+        if (!e) {
+            /* Hand out the build uncached, the release frees it */
+            tp_mutex_unlock(&nsa_cache_lock);
+            return data;
+        }
+        e->face_sz = face_sz;
+        e->em_type = em_type;
+        e->layout = layout;
+        e->data = data;
+        e->bytes = normal_solid_angle_index_sz(face_sz, layout);
+        e->refs = 1;
+        e->last_use = ++nsa_cache.tick;
+        e->next = nsa_cache.head;
+        nsa_cache.head = e;
+        nsa_cache.total_bytes += e->bytes;
+        data = 0;
+        nsa_cache_trim(nsa_cache.budget);
+    }
+    tp_mutex_unlock(&nsa_cache_lock);
+    normal_solid_angle_index_free(data);
+    return e->data;
+}
+
+void normal_solid_angle_index_release(const float* idx)
+{
+    if (!idx)
+        return;
+    tp_mutex_lock(&nsa_cache_lock);
+    struct nsa_cache_entry* e = nsa_cache.head;
+    for (; e; e = e->next) {
+        if (e->data == idx) {
+            --e->refs;
+            break;
+        }
+    }
+    nsa_cache_trim(nsa_cache.budget);
+    tp_mutex_unlock(&nsa_cache_lock);
+    /* Referenced entries are never evicted, so an index missing from the cache was handed out uncached */
+    if (!e)
+        normal_solid_angle_index_free((void*)idx);
+}
+
+void normal_solid_angle_index_cache_budget(size_t bytes)
+{
+    tp_mutex_lock(&nsa_cache_lock);
+    nsa_cache.budget = bytes;
+    nsa_cache_trim(nsa_cache.budget);
+    tp_mutex_unlock(&nsa_cache_lock);
+}
+
+void normal_solid_angle_index_cache_clear(void)
+{
+    tp_mutex_lock(&nsa_cache_lock);
+    nsa_cache_trim(0);
+    tp_mutex_unlock(&nsa_cache_lock);
+}
+#endif
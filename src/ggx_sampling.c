@@ -0,0 +1,25 @@
+#include "ggx_sampling.h"
+#include <emproc/envmap.h>
+#include <math.h>
+
+float hammersley_radical_inverse(uint32_t bits)
+{
+    bits = (bits << 16) | (bits >> 16);
+    bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+    bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+    bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+    bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+    return (float)bits * 2.3283064365386963e-10f;
+}
+
+void ggx_sample_half_vector(float h[3], uint32_t i, uint32_t n, float a2)
+{
+    const float xi0 = (float)i / n;
+    const float xi1 = hammersley_radical_inverse(i);
+    const float phi = two_pi * xi0;
+    const float cos_theta = sqrtf((1.0f - xi1) / (1.0f + (a2 - 1.0f) * xi1));
+    const float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+    h[0] = sin_theta * cosf(phi);
+    h[1] = sin_theta * sinf(phi);
+    h[2] = cos_theta;
+}
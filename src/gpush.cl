@@ -1,5 +1,6 @@
 #include "envmap.c"
 #include "sh.c"
+#include "filter_util.c"
 
 #pragma OPENCL EXTENSION cl_khr_fp64: enable
 #pragma OPENCL EXTENSION cl_khr_int64_base_atomics: enable
@@ -24,36 +25,40 @@ __kernel void booo(__global double* sh_coeffs,
                    __global double* weight_accum,
                    __global unsigned char* img_in,
                    __global float* nsa_idx,
+                   const unsigned int nsa_layout,
+                   const unsigned int nsa_plane_stride,
                    const unsigned int face_sz,
+                   const unsigned int em_type,
+                   const unsigned int em_format,
                    const unsigned int face)
 {
     /* Current processing pixel */
     unsigned int xdst = get_global_id(1);
     unsigned int ydst = get_global_id(0);
-    const int channels = 3;
 
     /* Fill in input envmap struct */
     struct envmap em;
-    em.channels = channels;
+    em.format = em_format;
     em.data = img_in;
-    em.width = face_sz * 4;
-    em.height = face_sz * 3;
-    em.type = EM_TYPE_HCROSS;
+    em.type = em_type;
+    envmap_cube_dims(&em.width, &em.height, em.type, face_sz);
 
-    /* Ptr to the normal/solid angle index */
-    __global float* nsa_ptr = nsa_idx + ((face * face_sz * face_sz) + ydst * face_sz + xdst) * 4;
+    /* Fetch normal/solid angle index entry */
+    float nsa[4];
+    normal_solid_angle_index_fetch(nsa, nsa_idx, nsa_layout, nsa_plane_stride, face_sz, face, xdst, ydst);
 
     /* Current pixel values */
-    __global uint8_t* src_ptr = envmap_pixel_ptr(&em, xdst, ydst, face);
-    const double rr = (double)src_ptr[0] / 255.0;
-    const double gg = (double)src_ptr[1] / 255.0;
-    const double bb = (double)src_ptr[2] / 255.0;
+    float col[3];
+    envmap_texel_load(col, envmap_pixel_ptr(&em, xdst, ydst, face), em.format);
+    const double rr = (double)col[0];
+    const double gg = (double)col[1];
+    const double bb = (double)col[2];
 
     /* Calculate SH Basis */
-    double sh_basis[SH_COEFF_NUM];
-    sh_eval_basis5(sh_basis, nsa_ptr);
-    const double weight = (double)nsa_ptr[3];
-    for (uint8_t ii = 0; ii < SH_COEFF_NUM; ++ii) {
+    double sh_basis[SH_KERNEL_COEFF_NUM];
+    sh_eval_basis(sh_basis, SH_KERNEL_ORDER, nsa);
+    const double weight = (double)nsa[3];
+    for (uint8_t ii = 0; ii < SH_KERNEL_COEFF_NUM; ++ii) {
         atomic_add_dbl(sh_coeffs + ii * 3 + 0, rr * sh_basis[ii] * weight);
         atomic_add_dbl(sh_coeffs + ii * 3 + 1, gg * sh_basis[ii] * weight);
         atomic_add_dbl(sh_coeffs + ii * 3 + 2, bb * sh_basis[ii] * weight);
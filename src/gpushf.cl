@@ -0,0 +1,69 @@
+#define SH_NO_DOUBLE
+#include "envmap.c"
+#include "sh.c"
+#include "filter_util.c"
+
+/* Number of floats every row writes, the rgb coefficients followed by the weight */
+#define SH_ROW_PARTIAL_SZ (SH_KERNEL_COEFF_NUM * 3 + 1)
+
+/*
+ * Single precision projection for devices without (fast) double support.
+ * Every work item sums one face row with Kahan compensated accumulators
+ * and stores its partial sums, which the host reduces in double.
+ */
+__kernel void booo_f(__global float* row_partials,
+                     __global unsigned char* img_in,
+                     __global float* nsa_idx,
+                     const unsigned int nsa_layout,
+                     const unsigned int nsa_plane_stride,
+                     const unsigned int face_sz,
+                     const unsigned int em_type,
+                     const unsigned int em_format,
+                     const unsigned int face)
+{
+    /* Current processing row */
+    unsigned int ydst = get_global_id(0);
+
+    /* Fill in input envmap struct */
+    struct envmap em;
+    em.format = em_format;
+    em.data = img_in;
+    em.type = em_type;
+    envmap_cube_dims(&em.width, &em.height, em.type, face_sz);
+
+    float sum[SH_ROW_PARTIAL_SZ];
+    float comp[SH_ROW_PARTIAL_SZ];
+    for (uint8_t ii = 0; ii < SH_ROW_PARTIAL_SZ; ++ii) {
+        sum[ii] = 0.0f;
+        comp[ii] = 0.0f;
+    }
+
+    for (unsigned int xdst = 0; xdst < face_sz; ++xdst) {
+        /* Fetch normal/solid angle index entry */
+        float nsa[4];
+        normal_solid_angle_index_fetch(nsa, nsa_idx, nsa_layout, nsa_plane_stride, face_sz, face, xdst, ydst);
+
+        /* Current pixel values */
+        float col[3];
+        envmap_texel_load(col, envmap_pixel_ptr(&em, xdst, ydst, face), em.format);
+        const float rr = col[0];
+        const float gg = col[1];
+        const float bb = col[2];
+
+        /* Calculate SH Basis */
+        float sh_basis[SH_KERNEL_COEFF_NUM];
+        sh_eval_basisf(sh_basis, SH_KERNEL_ORDER, nsa);
+        const float weight = nsa[3];
+        for (uint8_t ii = 0; ii < SH_KERNEL_COEFF_NUM; ++ii) {
+            SH_KAHAN_ADD(sum[ii * 3 + 0], comp[ii * 3 + 0], rr * sh_basis[ii] * weight);
+            SH_KAHAN_ADD(sum[ii * 3 + 1], comp[ii * 3 + 1], gg * sh_basis[ii] * weight);
+            SH_KAHAN_ADD(sum[ii * 3 + 2], comp[ii * 3 + 2], bb * sh_basis[ii] * weight);
+        }
+        SH_KAHAN_ADD(sum[SH_KERNEL_COEFF_NUM * 3], comp[SH_KERNEL_COEFF_NUM * 3], weight);
+    }
+
+    /* Store compensated row sums */
+    __global float* dst = row_partials + (face * face_sz + ydst) * SH_ROW_PARTIAL_SZ;
+    for (uint8_t ii = 0; ii < SH_ROW_PARTIAL_SZ; ++ii)
+        dst[ii] = sum[ii] - comp[ii];
+}
@@ -0,0 +1,84 @@
+#include "irradiance_kernel.h"
+#ifndef OPENCL_MODE
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#endif
+
+void irradiance_kernel_frame(PRIVATE float frame[3][3], PRIVATE const float dir[3])
+{
+    /* Theta tangent is horizontal, falls back to +X at the poles */
+    const float len = sqrtf(dir[0] * dir[0] + dir[2] * dir[2]);
+    if (len > 0.0f) {
+        frame[0][0] = dir[2] / len;
+        frame[0][1] = 0.0f;
+        frame[0][2] = -dir[0] / len;
+    } else {
+        frame[0][0] = 1.0f;
+        frame[0][1] = 0.0f;
+        frame[0][2] = 0.0f;
+    }
+    /* Phi tangent, theta x normal */
+    frame[1][0] = frame[0][1] * dir[2] - frame[0][2] * dir[1];
+    frame[1][1] = frame[0][2] * dir[0] - frame[0][0] * dir[2];
+    frame[1][2] = frame[0][0] * dir[1] - frame[0][1] * dir[0];
+    /* Normal */
+    frame[2][0] = dir[0];
+    frame[2][1] = dir[1];
+    frame[2][2] = dir[2];
+}
+
+#ifndef OPENCL_MODE
+void irradiance_kernel_build(struct irradiance_kernel* kern)
+{
+    const float step = pi_half / 16.0f;
+    float total_weight = 0.0f;
+    for (int i = 0; i < IRRADIANCE_KERNEL_STEPS; ++i) {
+        const float k = -pi_half + i * step;
+        for (int j = 0; j < IRRADIANCE_KERNEL_STEPS; ++j) {
+            const float l = -pi_half + j * step;
+            /* sc_to_vec(k, pi/2 + l) with the -y of the equator frame flipped onto the phi tangent */
+            float* d = kern->dir[i * IRRADIANCE_KERNEL_STEPS + j];
+            d[0] = sinf(k) * cosf(l);
+            d[1] = sinf(l);
+            d[2] = cosf(k) * cosf(l);
+            /* Dot product between normal and current direction */
+            const float c = fabsf(d[2]);
+            kern->weight[i * IRRADIANCE_KERNEL_STEPS + j] = c;
+            total_weight += c;
+        }
+    }
+    kern->inv_total_weight = 1.0f / total_weight;
+}
+
+void irradiance_source_init(struct irradiance_source* src, struct envmap* em_in, uint32_t out_face_sz)
+{
+    src->em = em_in;
+    src->em_float = *em_in;
+    const uint32_t min_face_sz = out_face_sz > IRRADIANCE_SOURCE_FACE_SZ ? out_face_sz : IRRADIANCE_SOURCE_FACE_SZ;
+    src->reduced = envmap_face_size(em_in) >= 2 * min_face_sz;
+    if (!src->reduced)
+        return;
+
+    /* Reduced in float like the radiance source, the levels keep the full precision of the average */
+    if (em_in->format != EM_FORMAT_RGB32F) {
+        src->em_float.format = EM_FORMAT_RGB32F;
+        src->em_float.data = malloc((size_t)src->em_float.width * src->em_float.height * envmap_format_size(src->em_float.format));
+        envmap_convert(&src->em_float, em_in);
+    }
+    envmap_build_mips(&src->mips, &src->em_float);
+    uint32_t level = 0;
+    while (level + 1 < src->mips.num_levels && envmap_face_size(&src->mips.levels[level + 1]) >= min_face_sz)
+        ++level;
+    src->em = &src->mips.levels[level];
+}
+
+void irradiance_source_free(struct irradiance_source* src, struct envmap* em_in)
+{
+    if (!src->reduced)
+        return;
+    envmap_mips_free(&src->mips);
+    if (src->em_float.data != em_in->data)
+        free(src->em_float.data);
+}
+#endif
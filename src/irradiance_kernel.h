@@ -0,0 +1,74 @@
+/*********************************************************************************************************************/
+/*                                                  /===-_---~~~~~~~~~------____                                     */
+/*                                                 |===-~___                _,-'                                     */
+/*                  -==\\                         `//~\\   ~~~~`---.___.-~~                                          */
+/*              ______-==|                         | |  \\           _-~`                                            */
+/*        __--~~~  ,-/-==\\                        | |   `\        ,'                                                */
+/*     _-~       /'    |  \\                      / /      \      /                                                  */
+/*   .'        /       |   \\                   /' /        \   /'                                                   */
+/*  /  ____  /         |    \`\.__/-~~ ~ \ _ _/'  /          \/'                                                     */
+/* /-'~    ~~~~~---__  |     ~-/~         ( )   /'        _--~`                                                      */
+/*                   \_|      /        _)   ;  ),   __--~~                                                           */
+/*                     '~~--_/      _-~/-  / \   '-~ \                                                               */
+/*                    {\__--_/}    / \\_>- )<__\      \                                                              */
+/*                    /'   (_/  _-~  | |__>--<__|      |                                                             */
+/*                   |0  0 _/) )-~     | |__>--<__|     |                                                            */
+/*                   / /~ ,_/       / /__>---<__/      |                                                             */
+/*                  o o _//        /-~_>---<__-~      /                                                              */
+/*                  (^(~          /~_>---<__-      _-~                                                               */
+/*                 ,/|           /__>--<__/     _-~                                                                  */
+/*              ,//('(          |__>--<__|     /                  .----_                                             */
+/*             ( ( '))          |__>--<__|    |                 /' _---_~\                                           */
+/*          `-)) )) (           |__>--<__|    |               /'  /     ~\`\                                         */
+/*         ,/,'//( (             \__>--<__\    \            /'  //        ||                                         */
+/*       ,( ( ((, ))              ~-__>--<_~-_  ~--____---~' _/'/        /'                                          */
+/*     `~/  )` ) ,/|                 ~-_~>--<_/-__       __-~ _/                                                     */
+/*   ._-~//( )/ )) `                    ~~-'_/_/ /~~~~~~~__--~                                                       */
+/*    ;'( ')/ ,)(                              ~~~~~~~~~~                                                            */
+/*   ' ') '( (/                                                                                                      */
+/*     '   '  `                                                                                                      */
+/*********************************************************************************************************************/
+#ifndef _IRRADIANCE_KERNEL_H_
+#define _IRRADIANCE_KERNEL_H_
+
+#include <emproc/envmap.h>
+
+/* Angular steps per axis of the convolution kernel, pi/32 apart over [-pi/2, pi/2] */
+#define IRRADIANCE_KERNEL_STEPS 33
+#define IRRADIANCE_KERNEL_SZ (IRRADIANCE_KERNEL_STEPS * IRRADIANCE_KERNEL_STEPS)
+/* Kernel steps span about two texels of faces this size, smaller outputs read finer sources from their mip chain so the taps do not alias */
+#define IRRADIANCE_SOURCE_FACE_SZ 32
+
+/* Builds the theta and phi tangents of the spherical coordinates around dir, followed by dir itself */
+void irradiance_kernel_frame(PRIVATE float frame[3][3], PRIVATE const float dir[3]);
+
+#ifndef OPENCL_MODE
+/*
+ * Sample directions and cosine weights of the convolution, in a local frame whose z axis is the normal.
+ * Offsets are taken in spherical coordinates around a normal on the equator, x follows theta and y phi.
+ */
+struct irradiance_kernel {
+    float dir[IRRADIANCE_KERNEL_SZ][3];
+    float weight[IRRADIANCE_KERNEL_SZ];
+    float inv_total_weight;
+};
+
+void irradiance_kernel_build(struct irradiance_kernel* kern);
+
+/* Map the convolution of a given output reads, either the input itself or a level of its float mip chain */
+struct irradiance_source {
+    struct envmap* em;
+    struct envmap em_float;
+    struct envmap_mips mips;
+    int reduced;
+};
+
+/*
+ * Smaller outputs read the coarsest source level that is still as fine as their own faces and
+ * IRRADIANCE_SOURCE_FACE_SZ, outputs with the source face size keep reading the source itself
+ */
+void irradiance_source_init(struct irradiance_source* src, struct envmap* em_in, uint32_t out_face_sz);
+void irradiance_source_free(struct irradiance_source* src, struct envmap* em_in);
+#endif
+
+#endif /* ! _IRRADIANCE_KERNEL_H_ */
@@ -4,207 +4,404 @@
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include "thread_pool.h"
 #endif
+#include "sh_basis.h"
 
-#define PI      3.1415926535897932384626433832795028841971693993751058
-#define PI4     12.566370614359172953850573533118011536788677597500423
-#define PI16    50.265482457436691815402294132472046147154710390001693
-#define PI64    201.06192982974676726160917652988818458861884156000677
-#define SQRT_PI 1.7724538509055160272981674833411451827975494561223871
-
-/* 1.0 / (2.0 * SQRT_PI) */
-#define K0      0.28209479177
-/* sqrt(3.0 / PI4) */
-#define K1      0.4886025119
-/* sqrt(15.0 / PI4) */
-#define K2      1.09254843059
-/* -sqrt(15.0 / PI4) */
-#define K3     -1.09254843059
-/* sqrt(5.0 / PI16) */
-#define K4      0.31539156525
-/* sqrt(15.0 / PI16) */
-#define K5      0.54627421529
-/* -sqrt(70.0 / PI64) */
-#define K6     -0.59004358992
-/* sqrt(105.0 / PI4) */
-#define K7      2.89061144264
-/* -sqrt(21.0 / PI16) */
-#define K8     -0.64636036822
-/* sqrt(7.0 / PI16) */
-#define K9      0.37317633259
-/* -sqrt(42.0 / PI64) */
-#define K10    -0.45704579946
-/* sqrt(105.0 / PI16) */
-#define K11     1.44530572132
-/* -sqrt(70.0 / PI64) */
-#define K12    -0.59004358992
-/* 3.0 * sqrt(35.0 / PI16) */
-#define K13     2.5033429418
-/* -3.0 * sqrt(70.0 / PI64) */
-#define K14    -1.77013076978
-/* 3.0 * sqrt(5.0 / PI16) */
-#define K15     0.94617469575
-/* -3.0 * sqrt(10.0 / PI64) */
-#define K16    -1.33809308711
-/* 3.0 * sqrt(5.0 / PI64) */
-#define K17     0.47308734787
-/* 3.0 * sqrt(35.0 / (4.0 * PI64)) */
-#define K18     0.62583573544
-
-void sh_eval_basis5(double* sh_basis, GLOBAL const float* dir)
-{
-    const double x = (double)dir[0];
-    const double y = (double)dir[1];
-    const double z = (double)dir[2];
-
-    const double x2 = x*x;
-    const double y2 = y*y;
-    const double z2 = z*z;
-
-    const double z3 = z*z*z;
-
-    const double x4 = x*x*x*x;
-    const double y4 = y*y*y*y;
-    const double z4 = z*z*z*z;
-
-    /* Equations based on data from: http://ppsloan.org/publications/stupid_sH36.pdf */
-    sh_basis[0]  = K0;
-
-    sh_basis[1]  = -K1 * y;
-    sh_basis[2]  = K1 * z;
-    sh_basis[3]  = -K1 * x;
-
-    sh_basis[4]  = K2 * y * x;
-    sh_basis[5]  = K3 * y * z;
-    sh_basis[6]  = K4 * (3.0 * z2 - 1.0);
-    sh_basis[7]  = K3 * x * z;
-    sh_basis[8]  = K5 * (x2 - y2);
-
-    sh_basis[9]  = K6 * y * (3 * x2 - y2);
-    sh_basis[10] = K7 * y * x * z;
-    sh_basis[11] = K8 * y * (-1.0 + 5.0 * z2);
-    sh_basis[12] = K9 * (5.0 * z3 - 3.0 * z);
-    sh_basis[13] = K10 * x * (-1.0 + 5.0 * z2);
-    sh_basis[14] = K11 * (x2 - y2) * z;
-    sh_basis[15] = K12 * x * (x2 - 3.0 * y2);
-
-    sh_basis[16] = K13 * x * y * (x2 - y2);
-    sh_basis[17] = K14 * y * z * (3.0 * x2 - y2);
-    sh_basis[18] = K15 * y * x * (-1.0 + 7.0 * z2);
-    sh_basis[19] = K16 * y * z * (-3.0 + 7.0 * z2);
-    sh_basis[20] =  (105.0 * z4 -90.0 * z2 + 9.0) / (16.0 * SQRT_PI);
-    sh_basis[21] = K16 * x * z * (-3.0 + 7.0 * z2);
-    sh_basis[22] = K17 * (x2 - y2) * (-1.0 + 7.0 * z2);
-    sh_basis[23] = K14 * x * z * (x2 - 3.0 * y2);
-    sh_basis[24] = K18 * (x4 - 6.0 * y2 * x2 + y4);
+/* Unrolled evaluators of one order each, the constant band count folds the higher bands away */
+#define SH_DEFINE_EVAL_BASIS(name, T, C, bands)             \
+static void name(T* sh_basis, const float* dir)             \
+{                                                           \
+    const T x = (T)dir[0];                                  \
+    const T y = (T)dir[1];                                  \
+    const T z = (T)dir[2];                                  \
+    SH_EVAL_BASIS(T, C, x, y, z, SH_BASIS_STORE, bands);    \
 }
 
-#ifndef OPENCL_MODE
-void sh_coeffs(double sh_coeffs[SH_COEFF_NUM][3], struct envmap* em, float* nsa_idx)
+#define SH_BASIS_STORE(i, val) sh_basis[i] = (val)
+/* Kernels for devices without double support define SH_NO_DOUBLE */
+#ifndef SH_NO_DOUBLE
+SH_DEFINE_EVAL_BASIS(sh_eval_basis_l1, double, SH_CONST_DOUBLE, 2)
+SH_DEFINE_EVAL_BASIS(sh_eval_basis_l2, double, SH_CONST_DOUBLE, 3)
+SH_DEFINE_EVAL_BASIS(sh_eval_basis_l3, double, SH_CONST_DOUBLE, 4)
+SH_DEFINE_EVAL_BASIS(sh_eval_basis_l4, double, SH_CONST_DOUBLE, 5)
+
+void sh_eval_basis(double* sh_basis, enum sh_order order, const float* dir)
 {
-    const size_t face_sz = envmap_face_size(em);
-    memset(sh_coeffs, 0, SH_COEFF_NUM * 3 * sizeof(double));
+    switch (order) {
+        case SH_ORDER_L1: sh_eval_basis_l1(sh_basis, dir); break;
+        case SH_ORDER_L2: sh_eval_basis_l2(sh_basis, dir); break;
+        case SH_ORDER_L3: sh_eval_basis_l3(sh_basis, dir); break;
+        default:          sh_eval_basis_l4(sh_basis, dir); break;
+    }
+}
 
-#ifndef WITH_OPENMP
-    float* nsa_ptr = nsa_idx;
-#endif
-    double weight_accum = 0.0;
-    for (int face = 0; face < 6; ++face) {
-#ifdef WITH_OPENMP
-        #pragma omp parallel for
-#endif
-        for (size_t ydst = 0; ydst < face_sz; ++ydst) {
-            for (size_t xdst = 0; xdst < face_sz; ++xdst) {
-#ifdef WITH_OPENMP
-                float* nsa_ptr = nsa_idx + ((face * face_sz * face_sz) + ydst * face_sz + xdst) * 4;
-#endif
-                /* Current pixel values */
-                uint8_t* src_ptr = envmap_pixel_ptr(em, xdst, ydst, face);
-                const double rr = (double)src_ptr[0] / 255.0;
-                const double gg = (double)src_ptr[1] / 255.0;
-                const double bb = (double)src_ptr[2] / 255.0;
-                /* Calculate SH Basis */
-                double sh_basis[SH_COEFF_NUM];
-                sh_eval_basis5(sh_basis, nsa_ptr);
-                const double weight = (double)nsa_ptr[3];
-                for (uint8_t ii = 0; ii < SH_COEFF_NUM; ++ii) {
-#ifdef WITH_OPENMP
-                    #pragma omp atomic update
-#endif
-                    sh_coeffs[ii][0] += rr * sh_basis[ii] * weight;
-#ifdef WITH_OPENMP
-                    #pragma omp atomic update
-#endif
-                    sh_coeffs[ii][1] += gg * sh_basis[ii] * weight;
-#ifdef WITH_OPENMP
-                    #pragma omp atomic update
+void sh_eval_basis5(double* sh_basis, const float* dir)
+{
+    sh_eval_basis_l4(sh_basis, dir);
+}
 #endif
-                    sh_coeffs[ii][2] += bb * sh_basis[ii] * weight;
+
+SH_DEFINE_EVAL_BASIS(sh_eval_basisf_l1, float, SH_CONST_FLOAT, 2)
+SH_DEFINE_EVAL_BASIS(sh_eval_basisf_l2, float, SH_CONST_FLOAT, 3)
+SH_DEFINE_EVAL_BASIS(sh_eval_basisf_l3, float, SH_CONST_FLOAT, 4)
+SH_DEFINE_EVAL_BASIS(sh_eval_basisf_l4, float, SH_CONST_FLOAT, 5)
+
+void sh_eval_basisf(float* sh_basis, enum sh_order order, const float* dir)
+{
+    switch (order) {
+        case SH_ORDER_L1: sh_eval_basisf_l1(sh_basis, dir); break;
+        case SH_ORDER_L2: sh_eval_basisf_l2(sh_basis, dir); break;
+        case SH_ORDER_L3: sh_eval_basisf_l3(sh_basis, dir); break;
+        default:          sh_eval_basisf_l4(sh_basis, dir); break;
+    }
+}
+
+void sh_eval_basis5f(float* sh_basis, const float* dir)
+{
+    sh_eval_basisf_l4(sh_basis, dir);
+}
+#undef SH_BASIS_STORE
+
+#ifndef OPENCL_MODE
+/* Partial projection sum of a chunk of face rows */
+struct sh_accum {
+    double coeffs[SH_COEFF_NUM][3];
+    double weight;
+};
+
+struct sh_project_job {
+    struct envmap_view em;
+    enum sh_order order;
+    size_t num_coeffs;
+    const float* nsa_idx;
+    enum nsa_layout nsa_layout;
+    size_t face_sz;
+    size_t face_w;
+    size_t grain;
+    struct sh_accum* partials;
+};
+
+/* Fetches the direction and solid angle planes of a face row, latlong rows are generated and cube rows come from the index */
+static void sh_project_row_planes(const float* planes[4], struct sh_project_job* job, int face, size_t row, float* scratch)
+{
+    if (job->em.type == EM_TYPE_LATLONG) {
+        normal_solid_angle_latlong_row_generate(scratch, job->face_w, job->face_sz, row);
+        for (int i = 0; i < 4; ++i)
+            planes[i] = scratch + i * job->face_w;
+        return;
+    }
+    normal_solid_angle_index_row(planes, job->nsa_idx, job->face_sz, job->nsa_layout, face, row, scratch);
+}
+
+/* Row scratch of sh_project_row_planes, none is needed for rows returned in place */
+static float* sh_project_row_scratch(struct sh_project_job* job)
+{
+    if (job->em.type != EM_TYPE_LATLONG && job->nsa_layout == NSA_LAYOUT_SOA)
+        return 0;
+    return malloc(4 * job->face_w * sizeof(float));
+}
+
+/* Projects the face rows [first, last) into the partial sum owned by their chunk */
+static void sh_project_rows(size_t first, size_t last, void* userdata)
+{
+    struct sh_project_job* job = userdata;
+    const size_t face_sz = job->face_sz;
+    const size_t face_w = job->face_w;
+    struct sh_accum* acc = &job->partials[first / job->grain];
+    memset(acc, 0, sizeof(*acc));
+
+    float* scratch = sh_project_row_scratch(job);
+    for (size_t row = first; row < last; ++row) {
+        const int face = row / face_sz;
+        const size_t ydst = row % face_sz;
+        const float* nsa[4];
+        sh_project_row_planes(nsa, job, face, ydst, scratch);
+        for (size_t xbeg = 0; xbeg < face_w; xbeg += SH_BATCH_SZ) {
+            const size_t n = face_w - xbeg < SH_BATCH_SZ ? face_w - xbeg : SH_BATCH_SZ;
+            /* Gather weights and pixel values of the batch */
+            double w[SH_BATCH_SZ], col[3][SH_BATCH_SZ];
+            double* col_planes[3] = { col[0], col[1], col[2] };
+            envmap_view_load_row_d(col_planes, &job->em, xbeg, ydst, face, n);
+            for (size_t k = 0; k < n; ++k)
+                w[k] = (double)nsa[3][xbeg + k];
+            /* Calculate SH Basis */
+            double sh_basis[SH_COEFF_NUM * SH_BATCH_SZ];
+            sh_eval_basis_batch(sh_basis, job->order, nsa[0] + xbeg, nsa[1] + xbeg, nsa[2] + xbeg, n);
+            for (uint8_t ii = 0; ii < job->num_coeffs; ++ii) {
+                const double* basis = sh_basis + ii * n;
+                double* c = acc->coeffs[ii];
+                for (size_t k = 0; k < n; ++k) {
+                    c[0] += col[0][k] * basis[k] * w[k];
+                    c[1] += col[1][k] * basis[k] * w[k];
+                    c[2] += col[2][k] * basis[k] * w[k];
                 }
-                weight_accum += weight;
-#ifndef WITH_OPENMP
-                /* Forward index ptr */
-                nsa_ptr += 4;
-#endif
             }
+            for (size_t k = 0; k < n; ++k)
+                acc->weight += w[k];
+        }
+    }
+    free(scratch);
+}
+
+/* Sums a zero padded batch pairwise in place, rounding error grows with log(n) instead of n */
+static float sh_pairwise_sumf(float v[SH_BATCH_SZ])
+{
+    for (size_t half = SH_BATCH_SZ / 2; half > 0; half /= 2)
+        for (size_t k = 0; k < half; ++k)
+            v[k] += v[k + half];
+    return v[0];
+}
+
+/* Single precision variant of sh_project_rows */
+static void sh_project_rows_f(size_t first, size_t last, void* userdata)
+{
+    struct sh_project_job* job = userdata;
+    const size_t face_sz = job->face_sz;
+    const size_t face_w = job->face_w;
+    struct sh_accum* acc = &job->partials[first / job->grain];
+
+    /* Kahan compensated running sums */
+    float sum[SH_COEFF_NUM][3], comp[SH_COEFF_NUM][3];
+    float wsum = 0.0f, wcomp = 0.0f;
+    memset(sum, 0, sizeof(sum));
+    memset(comp, 0, sizeof(comp));
+
+    float* scratch = sh_project_row_scratch(job);
+    for (size_t row = first; row < last; ++row) {
+        const int face = row / face_sz;
+        const size_t ydst = row % face_sz;
+        const float* nsa[4];
+        sh_project_row_planes(nsa, job, face, ydst, scratch);
+        for (size_t xbeg = 0; xbeg < face_w; xbeg += SH_BATCH_SZ) {
+            const size_t n = face_w - xbeg < SH_BATCH_SZ ? face_w - xbeg : SH_BATCH_SZ;
+            /* Gather weights and pixel values of the batch */
+            float w[SH_BATCH_SZ], col[3][SH_BATCH_SZ];
+            float* col_planes[3] = { col[0], col[1], col[2] };
+            envmap_view_load_row(col_planes, &job->em, xbeg, ydst, face, n);
+            for (size_t k = 0; k < n; ++k)
+                w[k] = nsa[3][xbeg + k];
+            /* Calculate SH Basis */
+            float sh_basis[SH_COEFF_NUM * SH_BATCH_SZ];
+            sh_eval_basisf_batch(sh_basis, job->order, nsa[0] + xbeg, nsa[1] + xbeg, nsa[2] + xbeg, n);
+            for (uint8_t ii = 0; ii < job->num_coeffs; ++ii) {
+                const float* basis = sh_basis + ii * n;
+                float terms[3][SH_BATCH_SZ];
+                memset(terms, 0, sizeof(terms));
+                for (size_t k = 0; k < n; ++k) {
+                    terms[0][k] = col[0][k] * basis[k] * w[k];
+                    terms[1][k] = col[1][k] * basis[k] * w[k];
+                    terms[2][k] = col[2][k] * basis[k] * w[k];
+                }
+                SH_KAHAN_ADD(sum[ii][0], comp[ii][0], sh_pairwise_sumf(terms[0]));
+                SH_KAHAN_ADD(sum[ii][1], comp[ii][1], sh_pairwise_sumf(terms[1]));
+                SH_KAHAN_ADD(sum[ii][2], comp[ii][2], sh_pairwise_sumf(terms[2]));
+            }
+            for (size_t k = n; k < SH_BATCH_SZ; ++k)
+                w[k] = 0.0f;
+            SH_KAHAN_ADD(wsum, wcomp, sh_pairwise_sumf(w));
         }
     }
+    free(scratch);
+
+    /* Hand the compensated sums to the double reduction */
+    for (uint8_t ii = 0; ii < job->num_coeffs; ++ii) {
+        acc->coeffs[ii][0] = (double)sum[ii][0] - (double)comp[ii][0];
+        acc->coeffs[ii][1] = (double)sum[ii][1] - (double)comp[ii][1];
+        acc->coeffs[ii][2] = (double)sum[ii][2] - (double)comp[ii][2];
+    }
+    acc->weight = (double)wsum - (double)wcomp;
+}
+
+/* Sums partials pairwise in a fixed tree order, so the total does not depend on thread count or scheduling */
+static void sh_accum_reduce(struct sh_accum* partials, size_t n, size_t num_coeffs)
+{
+    for (size_t stride = 1; stride < n; stride *= 2) {
+        for (size_t i = 0; i + stride < n; i += 2 * stride) {
+            struct sh_accum* dst = &partials[i];
+            const struct sh_accum* src = &partials[i + stride];
+            for (uint8_t ii = 0; ii < num_coeffs; ++ii) {
+                dst->coeffs[ii][0] += src->coeffs[ii][0];
+                dst->coeffs[ii][1] += src->coeffs[ii][1];
+                dst->coeffs[ii][2] += src->coeffs[ii][2];
+            }
+            dst->weight += src->weight;
+        }
+    }
+}
+
+void sh_coeffs(double sh_coeffs[][3], enum sh_order order, struct envmap* em, const float* nsa_idx, enum nsa_layout nsa_layout, enum sh_precision precision)
+{
+    const size_t face_sz = envmap_face_size(em);
+    const size_t face_w = envmap_face_width(em);
+    const size_t num_rows = envmap_face_count(em) * face_sz;
+
+    /* Chunks only depend on the face size, each one owns a private accumulator */
+    struct sh_project_job job;
+    envmap_view_init(&job.em, em);
+    job.order = order;
+    job.num_coeffs = SH_COEFF_COUNT(order);
+    job.nsa_idx = nsa_idx;
+    job.nsa_layout = nsa_layout;
+    job.face_sz = face_sz;
+    job.face_w = face_w;
+    job.grain = 16384 / face_w > 0 ? 16384 / face_w : 1;
+    const size_t num_chunks = (num_rows + job.grain - 1) / job.grain;
+    job.partials = malloc(num_chunks * sizeof(struct sh_accum));
+    parallel_for(num_rows, job.grain, precision == SH_PRECISION_FLOAT ? sh_project_rows_f : sh_project_rows, &job);
+    sh_accum_reduce(job.partials, num_chunks, job.num_coeffs);
 
     /*
      * Normalization.
      * This is not really necesarry because usually PI*4 - weightAccum ~= 0.000003
      * so it doesn't change almost anything, but it doesn't cost much be more correct.
      */
-    const double norm = PI4 / weight_accum;
-    for (uint8_t ii = 0; ii < SH_COEFF_NUM; ++ii) {
-        sh_coeffs[ii][0] *= norm;
-        sh_coeffs[ii][1] *= norm;
-        sh_coeffs[ii][2] *= norm;
+    const double norm = PI4 / job.partials[0].weight;
+    for (uint8_t ii = 0; ii < job.num_coeffs; ++ii) {
+        sh_coeffs[ii][0] = job.partials[0].coeffs[ii][0] * norm;
+        sh_coeffs[ii][1] = job.partials[0].coeffs[ii][1] * norm;
+        sh_coeffs[ii][2] = job.partials[0].coeffs[ii][2] * norm;
     }
+    free(job.partials);
 }
 
-void sh_irradiance(float irr[3], double sh_rgb[SH_COEFF_NUM][3], float dir[3])
+/* Irradiance transfer factors of every coefficient, band 3 is zero and skipped */
+static const float sh_irradiance_band_factor[SH_COEFF_NUM] = {
+    1.0f,
+    2.0f/3.0f, 2.0f/3.0f, 2.0f/3.0f,
+    1.0f/4.0f, 1.0f/4.0f, 1.0f/4.0f, 1.0f/4.0f, 1.0f/4.0f,
+    0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+    -1.0f/24.0f, -1.0f/24.0f, -1.0f/24.0f, -1.0f/24.0f, -1.0f/24.0f, -1.0f/24.0f, -1.0f/24.0f, -1.0f/24.0f, -1.0f/24.0f
+};
+
+/* Order whose basis the reconstruction needs, an L3 expansion only contributes through its first three bands */
+static enum sh_order sh_irradiance_order(enum sh_order order)
+{
+    return order == SH_ORDER_L3 ? SH_ORDER_L2 : order;
+}
+
+void sh_irradiance(float irr[3], double sh_rgb[][3], enum sh_order order, float dir[3])
 {
     /* Eval basis for current direction */
+    const enum sh_order eval_order = sh_irradiance_order(order);
     double sh_basis[SH_COEFF_NUM];
-    sh_eval_basis5(sh_basis, dir);
+    sh_eval_basis(sh_basis, eval_order, dir);
 
     /* Calculate pixel value using sh */
     double rgb[3] = {0.0f, 0.0f, 0.0f};
+    const uint8_t num_coeffs = SH_COEFF_COUNT(eval_order);
+    for (uint8_t ii = 0; ii < num_coeffs; ++ii) {
+        if (ii == 9)
+            ii = 16;
+        const float f = sh_irradiance_band_factor[ii];
+        rgb[0] += sh_rgb[ii][0] * sh_basis[ii] * f;
+        rgb[1] += sh_rgb[ii][1] * sh_basis[ii] * f;
+        rgb[2] += sh_rgb[ii][2] * sh_basis[ii] * f;
+    }
+
+    /* Store output */
+    irr[0] = (float)rgb[0];
+    irr[1] = (float)rgb[1];
+    irr[2] = (float)rgb[2];
+}
+
+void sh_irradiance_batch(float* irr, double sh_rgb[][3], enum sh_order order, const float* x, const float* y, const float* z, size_t n)
+{
+    const enum sh_order eval_order = sh_irradiance_order(order);
+    const uint8_t num_coeffs = SH_COEFF_COUNT(eval_order);
+    for (size_t beg = 0; beg < n; beg += SH_BATCH_SZ) {
+        const size_t bn = n - beg < SH_BATCH_SZ ? n - beg : SH_BATCH_SZ;
+        /* Eval basis for current directions */
+        double sh_basis[SH_COEFF_NUM * SH_BATCH_SZ];
+        sh_eval_basis_batch(sh_basis, eval_order, x + beg, y + beg, z + beg, bn);
 
-    /* Band 0 (factor 1.0) */
-    rgb[0] += sh_rgb[0][0] * sh_basis[0] * 1.0f;
-    rgb[1] += sh_rgb[0][1] * sh_basis[0] * 1.0f;
-    rgb[2] += sh_rgb[0][2] * sh_basis[0] * 1.0f;
-
-    /* Band 1 (factor 2/3). */
-    uint8_t ii = 1;
-    for (; ii < 4; ++ii) {
-        rgb[0] += sh_rgb[ii][0] * sh_basis[ii] * (2.0f/3.0f);
-        rgb[1] += sh_rgb[ii][1] * sh_basis[ii] * (2.0f/3.0f);
-        rgb[2] += sh_rgb[ii][2] * sh_basis[ii] * (2.0f/3.0f);
+        /* Calculate pixel values using sh, accumulated in the same order as sh_irradiance */
+        double rgb[3][SH_BATCH_SZ];
+        memset(rgb, 0, sizeof(rgb));
+        for (uint8_t ii = 0; ii < num_coeffs; ++ii) {
+            if (ii == 9)
+                ii = 16;
+            const double* basis = sh_basis + ii * bn;
+            const float f = sh_irradiance_band_factor[ii];
+            for (size_t k = 0; k < bn; ++k) {
+                rgb[0][k] += sh_rgb[ii][0] * basis[k] * f;
+                rgb[1][k] += sh_rgb[ii][1] * basis[k] * f;
+                rgb[2][k] += sh_rgb[ii][2] * basis[k] * f;
+            }
+        }
+
+        /* Store output */
+        float* dst = irr + beg * 3;
+        for (size_t k = 0; k < bn; ++k) {
+            dst[k * 3 + 0] = (float)rgb[0][k];
+            dst[k * 3 + 1] = (float)rgb[1][k];
+            dst[k * 3 + 2] = (float)rgb[2][k];
+        }
     }
+}
 
-    /* Band 2 (factor 1/4). */
-    for (; ii < 9; ++ii) {
-        rgb[0] += sh_rgb[ii][0] * sh_basis[ii] * (1.0f/4.0f);
-        rgb[1] += sh_rgb[ii][1] * sh_basis[ii] * (1.0f/4.0f);
-        rgb[2] += sh_rgb[ii][2] * sh_basis[ii] * (1.0f/4.0f);
+void sh_irradiancef_batch(float* irr, float sh_rgb[][3], enum sh_order order, const float* x, const float* y, const float* z, size_t n)
+{
+    const enum sh_order eval_order = sh_irradiance_order(order);
+    const uint8_t num_coeffs = SH_COEFF_COUNT(eval_order);
+    /* Band factors folded into the coefficients */
+    float sh_scaled[SH_COEFF_NUM][3];
+    for (uint8_t ii = 0; ii < num_coeffs; ++ii) {
+        sh_scaled[ii][0] = sh_rgb[ii][0] * sh_irradiance_band_factor[ii];
+        sh_scaled[ii][1] = sh_rgb[ii][1] * sh_irradiance_band_factor[ii];
+        sh_scaled[ii][2] = sh_rgb[ii][2] * sh_irradiance_band_factor[ii];
     }
+    for (size_t beg = 0; beg < n; beg += SH_BATCH_SZ) {
+        const size_t bn = n - beg < SH_BATCH_SZ ? n - beg : SH_BATCH_SZ;
+        /* Eval basis for current directions */
+        float sh_basis[SH_COEFF_NUM * SH_BATCH_SZ];
+        sh_eval_basisf_batch(sh_basis, eval_order, x + beg, y + beg, z + beg, bn);
 
-    /* Band 3 (factor 0). */
-    ii = 16;
+        /* Calculate pixel values using sh, at most 16 terms per channel so no compensation is needed */
+        float rgb[3][SH_BATCH_SZ];
+        memset(rgb, 0, sizeof(rgb));
+        for (uint8_t ii = 0; ii < num_coeffs; ++ii) {
+            if (ii == 9)
+                ii = 16;
+            const float* basis = sh_basis + ii * bn;
+            for (size_t k = 0; k < bn; ++k) {
+                rgb[0][k] += sh_scaled[ii][0] * basis[k];
+                rgb[1][k] += sh_scaled[ii][1] * basis[k];
+                rgb[2][k] += sh_scaled[ii][2] * basis[k];
+            }
+        }
 
-    /* Band 4 (factor -1/24). */
-    for (; ii < 25; ++ii) {
-        rgb[0] += sh_rgb[ii][0] * sh_basis[ii] * (-1.0f/24.0f);
-        rgb[1] += sh_rgb[ii][1] * sh_basis[ii] * (-1.0f/24.0f);
-        rgb[2] += sh_rgb[ii][2] * sh_basis[ii] * (-1.0f/24.0f);
+        /* Store output */
+        float* dst = irr + beg * 3;
+        for (size_t k = 0; k < bn; ++k) {
+            dst[k * 3 + 0] = rgb[0][k];
+            dst[k * 3 + 1] = rgb[1][k];
+            dst[k * 3 + 2] = rgb[2][k];
+        }
     }
+}
 
-    /* Store output */
-    irr[0] = (float)rgb[0];
-    irr[1] = (float)rgb[1];
-    irr[2] = (float)rgb[2];
+void sh_irradiance_matrices(float m[3][4][4], double sh_rgb[][3])
+{
+    /* Band factors of the irradiance transfer */
+    const double f0 = 1.0, f1 = 2.0 / 3.0, f2 = 1.0 / 4.0;
+    for (int c = 0; c < 3; ++c) {
+        double q[4][4];
+        /* Squared terms */
+        q[0][0] = f2 * K5 * sh_rgb[8][c];
+        q[1][1] = -f2 * K5 * sh_rgb[8][c];
+        q[2][2] = 3.0 * f2 * K4 * sh_rgb[6][c];
+        q[3][3] = f0 * K0 * sh_rgb[0][c] - f2 * K4 * sh_rgb[6][c];
+        /* Cross terms, split evenly between the symmetric entries */
+        q[0][1] = q[1][0] = 0.5 * f2 * K2 * sh_rgb[4][c];
+        q[1][2] = q[2][1] = 0.5 * f2 * K3 * sh_rgb[5][c];
+        q[0][2] = q[2][0] = 0.5 * f2 * K3 * sh_rgb[7][c];
+        q[0][3] = q[3][0] = -0.5 * f1 * K1 * sh_rgb[3][c];
+        q[1][3] = q[3][1] = -0.5 * f1 * K1 * sh_rgb[1][c];
+        q[2][3] = q[3][2] = 0.5 * f1 * K1 * sh_rgb[2][c];
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                m[c][i][j] = (float)q[i][j];
+    }
 }
 #endif
@@ -0,0 +1,149 @@
+/*********************************************************************************************************************/
+/*                                                  /===-_---~~~~~~~~~------____                                     */
+/*                                                 |===-~___                _,-'                                     */
+/*                  -==\\                         `//~\\   ~~~~`---.___.-~~                                          */
+/*              ______-==|                         | |  \\           _-~`                                            */
+/*        __--~~~  ,-/-==\\                        | |   `\        ,'                                                */
+/*     _-~       /'    |  \\                      / /      \      /                                                  */
+/*   .'        /       |   \\                   /' /        \   /'                                                   */
+/*  /  ____  /         |    \`\.__/-~~ ~ \ _ _/'  /          \/'                                                     */
+/* /-'~    ~~~~~---__  |     ~-/~         ( )   /'        _--~`                                                      */
+/*                   \_|      /        _)   ;  ),   __--~~                                                           */
+/*                     '~~--_/      _-~/-  / \   '-~ \                                                               */
+/*                    {\__--_/}    / \\_>- )<__\      \                                                              */
+/*                    /'   (_/  _-~  | |__>--<__|      |                                                             */
+/*                   |0  0 _/) )-~     | |__>--<__|     |                                                            */
+/*                   / /~ ,_/       / /__>---<__/      |                                                             */
+/*                  o o _//        /-~_>---<__-~      /                                                              */
+/*                  (^(~          /~_>---<__-      _-~                                                               */
+/*                 ,/|           /__>--<__/     _-~                                                                  */
+/*              ,//('(          |__>--<__|     /                  .----_                                             */
+/*             ( ( '))          |__>--<__|    |                 /' _---_~\                                           */
+/*          `-)) )) (           |__>--<__|    |               /'  /     ~\`\                                         */
+/*         ,/,'//( (             \__>--<__\    \            /'  //        ||                                         */
+/*       ,( ( ((, ))              ~-__>--<_~-_  ~--____---~' _/'/        /'                                          */
+/*     `~/  )` ) ,/|                 ~-_~>--<_/-__       __-~ _/                                                     */
+/*   ._-~//( )/ )) `                    ~~-'_/_/ /~~~~~~~__--~                                                       */
+/*    ;'( ')/ ,)(                              ~~~~~~~~~~                                                            */
+/*   ' ') '( (/                                                                                                      */
+/*     '   '  `                                                                                                      */
+/*********************************************************************************************************************/
+#ifndef _SH_BASIS_H_
+#define _SH_BASIS_H_
+
+#define PI      3.1415926535897932384626433832795028841971693993751058
+#define PI4     12.566370614359172953850573533118011536788677597500423
+#define PI16    50.265482457436691815402294132472046147154710390001693
+#define PI64    201.06192982974676726160917652988818458861884156000677
+#define SQRT_PI 1.7724538509055160272981674833411451827975494561223871
+
+/* 1.0 / (2.0 * SQRT_PI) */
+#define K0      0.28209479177
+/* sqrt(3.0 / PI4) */
+#define K1      0.4886025119
+/* sqrt(15.0 / PI4) */
+#define K2      1.09254843059
+/* -sqrt(15.0 / PI4) */
+#define K3     -1.09254843059
+/* sqrt(5.0 / PI16) */
+#define K4      0.31539156525
+/* sqrt(15.0 / PI16) */
+#define K5      0.54627421529
+/* -sqrt(70.0 / PI64) */
+#define K6     -0.59004358992
+/* sqrt(105.0 / PI4) */
+#define K7      2.89061144264
+/* -sqrt(21.0 / PI16) */
+#define K8     -0.64636036822
+/* sqrt(7.0 / PI16) */
+#define K9      0.37317633259
+/* -sqrt(42.0 / PI64) */
+#define K10    -0.45704579946
+/* sqrt(105.0 / PI16) */
+#define K11     1.44530572132
+/* -sqrt(70.0 / PI64) */
+#define K12    -0.59004358992
+/* 3.0 * sqrt(35.0 / PI16) */
+#define K13     2.5033429418
+/* -3.0 * sqrt(70.0 / PI64) */
+#define K14    -1.77013076978
+/* 3.0 * sqrt(5.0 / PI16) */
+#define K15     0.94617469575
+/* -3.0 * sqrt(10.0 / PI64) */
+#define K16    -1.33809308711
+/* 3.0 * sqrt(5.0 / PI64) */
+#define K17     0.47308734787
+/* 3.0 * sqrt(35.0 / (4.0 * PI64)) */
+#define K18     0.62583573544
+
+/*
+ * Basis evaluation shared by the scalar and the vector kernels, for the first BANDS bands (2 to 5).
+ * T is the working type (a floating point scalar or vector), C(k) converts a floating point
+ * constant to the scalar precision of T, x, y and z are the direction components and
+ * STORE(i, val) writes the i-th basis function value. BANDS is expected to be a constant,
+ * so every instance is fully unrolled and the bands past it fold away.
+ * Equations based on data from: http://ppsloan.org/publications/stupid_sH36.pdf
+ */
+#define SH_EVAL_BASIS(T, C, x, y, z, STORE, BANDS) do {                        \
+    const T zero = {0};                                                         \
+                                                                                \
+    STORE(0,  zero + C(K0));                                                    \
+                                                                                \
+    STORE(1,  C(-K1) * y);                                                      \
+    STORE(2,  C(K1) * z);                                                       \
+    STORE(3,  C(-K1) * x);                                                      \
+    if ((BANDS) <= 2)                                                           \
+        break;                                                                  \
+                                                                                \
+    const T x2 = x*x;                                                           \
+    const T y2 = y*y;                                                           \
+    const T z2 = z*z;                                                           \
+                                                                                \
+    STORE(4,  C(K2) * y * x);                                                   \
+    STORE(5,  C(K3) * y * z);                                                   \
+    STORE(6,  C(K4) * (C(3.0) * z2 - C(1.0)));                                  \
+    STORE(7,  C(K3) * x * z);                                                   \
+    STORE(8,  C(K5) * (x2 - y2));                                               \
+    if ((BANDS) <= 3)                                                           \
+        break;                                                                  \
+                                                                                \
+    const T z3 = z*z*z;                                                         \
+                                                                                \
+    STORE(9,  C(K6) * y * (3 * x2 - y2));                                       \
+    STORE(10, C(K7) * y * x * z);                                               \
+    STORE(11, C(K8) * y * (C(-1.0) + C(5.0) * z2));                             \
+    STORE(12, C(K9) * (C(5.0) * z3 - C(3.0) * z));                              \
+    STORE(13, C(K10) * x * (C(-1.0) + C(5.0) * z2));                            \
+    STORE(14, C(K11) * (x2 - y2) * z);                                          \
+    STORE(15, C(K12) * x * (x2 - C(3.0) * y2));                                 \
+    if ((BANDS) <= 4)                                                           \
+        break;                                                                  \
+                                                                                \
+    const T x4 = x*x*x*x;                                                       \
+    const T y4 = y*y*y*y;                                                       \
+    const T z4 = z*z*z*z;                                                       \
+                                                                                \
+    STORE(16, C(K13) * x * y * (x2 - y2));                                      \
+    STORE(17, C(K14) * y * z * (C(3.0) * x2 - y2));                             \
+    STORE(18, C(K15) * y * x * (C(-1.0) + C(7.0) * z2));                        \
+    STORE(19, C(K16) * y * z * (C(-3.0) + C(7.0) * z2));                        \
+    STORE(20, (C(105.0) * z4 - C(90.0) * z2 + C(9.0)) / C(16.0 * SQRT_PI));     \
+    STORE(21, C(K16) * x * z * (C(-3.0) + C(7.0) * z2));                        \
+    STORE(22, C(K17) * (x2 - y2) * (C(-1.0) + C(7.0) * z2));                    \
+    STORE(23, C(K14) * x * z * (x2 - C(3.0) * y2));                             \
+    STORE(24, C(K18) * (x4 - C(6.0) * y2 * x2 + y4));                           \
+} while (0)
+
+/* Constant conversions for SH_EVAL_BASIS */
+#define SH_CONST_DOUBLE(k) (k)
+#define SH_CONST_FLOAT(k)  ((float)(k))
+
+/* Kahan compensated single precision accumulation, the running sum is sum - comp */
+#define SH_KAHAN_ADD(sum, comp, val) do { \
+    const float y_ = (val) - (comp);      \
+    const float t_ = (sum) + y_;          \
+    (comp) = (t_ - (sum)) - y_;           \
+    (sum) = t_;                           \
+} while (0)
+
+#endif /* ! _SH_BASIS_H_ */
@@ -3,17 +3,38 @@
 #include <stdio.h>
 #include "cl_helper.h"
 #include "gpush.h"
+#include "gpushf.h"
 
 #define PI4     12.566370614359172953850573533118011536788677597500423
 
-void sh_coeffs_gpu(double sh_coeffs[SH_COEFF_NUM][3], struct envmap* em, float* nsa_idx)
+/* Host projection, reachable from sh_coeffs_gpu whose output parameter shadows sh_coeffs */
+static void sh_coeffs_host(double coeffs[][3], enum sh_order order, struct envmap* em, const float* nsa_idx, enum nsa_layout nsa_layout, enum sh_precision precision)
 {
+    sh_coeffs(coeffs, order, em, nsa_idx, nsa_layout, precision);
+}
+
+void sh_coeffs_gpu(double sh_coeffs[][3], enum sh_order order, struct envmap* em, const float* nsa_idx, enum nsa_layout nsa_layout, enum sh_precision precision)
+{
+    /* The kernels only address cube faces, latlong maps are projected on the host */
+    if (em->type == EM_TYPE_LATLONG) {
+        sh_coeffs_host(sh_coeffs, order, em, nsa_idx, nsa_layout, precision);
+        return;
+    }
+
     /* Sizes */
-    const uint8_t bytes_per_channel = sizeof(unsigned char);
-    const size_t face_size = em->width / 4;
-    const size_t data_sz = bytes_per_channel * em->channels * em->width * em->height;
-    const size_t nsa_idx_sz = face_size * face_size * 6 * 4 * sizeof(float);
-    const size_t sh_coeffs_sz = SH_COEFF_NUM * 3 * sizeof(double);
+    const unsigned int face_size = envmap_face_size(em);
+    const unsigned int em_type = em->type;
+    const unsigned int em_format = em->format;
+    const size_t data_sz = (size_t)envmap_format_size(em->format) * em->width * em->height;
+    const size_t nsa_idx_sz = normal_solid_angle_index_sz(face_size, nsa_layout);
+    const unsigned int nsa_plane_stride = normal_solid_angle_index_plane_stride(face_size);
+    const unsigned int nsa_layout_arg = nsa_layout;
+    const size_t num_coeffs = SH_COEFF_COUNT(order);
+    const size_t sh_coeffs_sz = num_coeffs * 3 * sizeof(double);
+    /* Floats per face row written by the single precision kernel, the rgb coefficients and the weight */
+    const size_t row_partial_sz = num_coeffs * 3 + 1;
+    const size_t row_partials_sz = 6 * face_size * row_partial_sz * sizeof(float);
+    const int single = precision == SH_PRECISION_FLOAT;
 
     /* Platform and device ids used to create the context */
     cl_int err;
@@ -37,11 +58,14 @@ void sh_coeffs_gpu(double sh_coeffs[SH_COEFF_NUM][3], struct envmap* em, float*
     }
 
     /* Create program */
-    const char* cl_src = (const char*) gpush_pp;
-    const size_t cl_src_len = gpush_pp_len;
+    const char* cl_src = single ? (const char*) gpushf_pp : (const char*) gpush_pp;
+    const size_t cl_src_len = single ? gpushf_pp_len : gpush_pp_len;
     cl_program prog = clCreateProgramWithSource(ctx, 1, &cl_src, &cl_src_len, &err);
     cl_check_error(err, "Creating program");
-    err = clBuildProgram(prog, 0, 0, 0, 0, 0);
+    /* Kernels are specialized for the requested order */
+    char build_opts[32];
+    snprintf(build_opts, sizeof(build_opts), "-DSH_KERNEL_ORDER=%u", (unsigned int)order);
+    err = clBuildProgram(prog, 0, 0, build_opts, 0, 0);
     /* Check for build errors */
     if (err != CL_SUCCESS) {
         cl_print_prog_build_info_log(prog, ctx_did);
@@ -49,7 +73,7 @@ void sh_coeffs_gpu(double sh_coeffs[SH_COEFF_NUM][3], struct envmap* em, float*
     }
 
     /* Create kernel from source */
-    cl_kernel kernel = clCreateKernel(prog, "booo", &err);
+    cl_kernel kernel = clCreateKernel(prog, single ? "booo_f" : "booo", &err);
     cl_check_error(err, "Creating Kernel");
 
     /* Create command queue */
@@ -59,39 +83,68 @@ void sh_coeffs_gpu(double sh_coeffs[SH_COEFF_NUM][3], struct envmap* em, float*
 
     /* Create input and output array in device memory */
     double weight_accum = 0.0f;
-    cl_mem sh_out_dev_mem  = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sh_coeffs_sz, sh_coeffs, &err);
+    cl_mem sh_out_dev_mem  = single
+        ? clCreateBuffer(ctx, CL_MEM_WRITE_ONLY, row_partials_sz, 0, &err)
+        : clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sh_coeffs_sz, sh_coeffs, &err);
     cl_mem wacum_dev_mem   = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(weight_accum), &weight_accum, &err);
     cl_mem img_in_dev_mem  = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, data_sz, em->data, &err);
-    cl_mem nsa_idx_dev_mem = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nsa_idx_sz, nsa_idx, &err);
+    /* Indexless projection still needs a valid buffer object to bind */
+    cl_mem nsa_idx_dev_mem = nsa_idx_sz > 0
+        ? clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, nsa_idx_sz, (void*) nsa_idx, &err)
+        : clCreateBuffer(ctx, CL_MEM_READ_ONLY, sizeof(float), 0, &err);
     cl_check_error(err, "Creating buffers");
 
-    /* Enqueue kernel */
+    /* Enqueue kernel, the single precision one has no weight accumulator argument */
+    const cl_uint arg0 = single ? 1 : 2;
     err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &sh_out_dev_mem);
-    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &wacum_dev_mem);
-    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &img_in_dev_mem);
-    err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &nsa_idx_dev_mem);
-    err |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &face_size);
+    if (!single)
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &wacum_dev_mem);
+    err |= clSetKernelArg(kernel, arg0 + 0, sizeof(cl_mem), &img_in_dev_mem);
+    err |= clSetKernelArg(kernel, arg0 + 1, sizeof(cl_mem), &nsa_idx_dev_mem);
+    err |= clSetKernelArg(kernel, arg0 + 2, sizeof(unsigned int), &nsa_layout_arg);
+    err |= clSetKernelArg(kernel, arg0 + 3, sizeof(unsigned int), &nsa_plane_stride);
+    err |= clSetKernelArg(kernel, arg0 + 4, sizeof(unsigned int), &face_size);
+    err |= clSetKernelArg(kernel, arg0 + 5, sizeof(unsigned int), &em_type);
+    err |= clSetKernelArg(kernel, arg0 + 6, sizeof(unsigned int), &em_format);
     cl_check_error(err, "Setting kernel arguments");
 
     for (unsigned int i = 0; i < 6; ++i) {
         /* Set face id argument */
-        err |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &i);
-        /* Execute the kernel over the entire range of our 2D input data set
-           letting the OpenCL runtime choose the work-group size */
+        err |= clSetKernelArg(kernel, arg0 + 7, sizeof(unsigned int), &i);
+        /* Execute the kernel over the entire range of our 2D input data set (one work item
+           per row for the single precision kernel) letting the OpenCL runtime choose the work-group size */
         size_t work_size[2] = {face_size, face_size};
-        err = clEnqueueNDRangeKernel(cmd_queue, kernel, 2, 0, work_size, 0, 0, 0, 0);
+        err = clEnqueueNDRangeKernel(cmd_queue, kernel, single ? 1 : 2, 0, work_size, 0, 0, 0, 0);
         cl_check_error(err, "Enqueueing kernel");
         /* Wait finish */
         clFinish(cmd_queue);
     }
     /* Read back the result from the compute device */
-    err = clEnqueueReadBuffer(cmd_queue, sh_out_dev_mem, CL_TRUE, 0, sh_coeffs_sz, sh_coeffs, 0, 0, 0);
-    err = clEnqueueReadBuffer(cmd_queue, wacum_dev_mem, CL_TRUE, 0, sizeof(weight_accum), &weight_accum, 0, 0, 0);
+    if (single) {
+        /* Rows are summed in order in double */
+        float* row_partials = malloc(row_partials_sz);
+        for (uint8_t ii = 0; ii < num_coeffs; ++ii)
+            sh_coeffs[ii][0] = sh_coeffs[ii][1] = sh_coeffs[ii][2] = 0.0;
+        err = clEnqueueReadBuffer(cmd_queue, sh_out_dev_mem, CL_TRUE, 0, row_partials_sz, row_partials, 0, 0, 0);
+        for (size_t r = 0; r < 6 * face_size; ++r) {
+            const float* p = row_partials + r * row_partial_sz;
+            for (uint8_t ii = 0; ii < num_coeffs; ++ii) {
+                sh_coeffs[ii][0] += (double)p[ii * 3 + 0];
+                sh_coeffs[ii][1] += (double)p[ii * 3 + 1];
+                sh_coeffs[ii][2] += (double)p[ii * 3 + 2];
+            }
+            weight_accum += (double)p[num_coeffs * 3];
+        }
+        free(row_partials);
+    } else {
+        err = clEnqueueReadBuffer(cmd_queue, sh_out_dev_mem, CL_TRUE, 0, sh_coeffs_sz, sh_coeffs, 0, 0, 0);
+        err = clEnqueueReadBuffer(cmd_queue, wacum_dev_mem, CL_TRUE, 0, sizeof(weight_accum), &weight_accum, 0, 0, 0);
+    }
     cl_check_error(err, "Reading back result");
 
     /* Normalize */
     const double norm = PI4 / weight_accum;
-    for (uint8_t ii = 0; ii < SH_COEFF_NUM; ++ii) {
+    for (uint8_t ii = 0; ii < num_coeffs; ++ii) {
         sh_coeffs[ii][0] *= norm;
         sh_coeffs[ii][1] *= norm;
         sh_coeffs[ii][2] *= norm;
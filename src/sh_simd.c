@@ -0,0 +1,237 @@
+#include <emproc/sh.h>
+#include <string.h>
+#include "sh_basis.h"
+#include "thread_pool.h"
+
+/* GCC only, clang ignores the optimize attribute that keeps the vector kernels free of contractions */
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define SH_SIMD_X86
+#endif
+
+typedef void(*sh_eval_basis_batch_fn)(double* sh_basis, const float* x, const float* y, const float* z, size_t n, size_t first);
+typedef void(*sh_eval_basisf_batch_fn)(float* sh_basis, const float* x, const float* y, const float* z, size_t n, size_t first);
+
+/* Distinct terms of an irradiance quadratic form, evaluated as x(t0 x + t1 y + t2 z + t3) + y(t4 y + t5 z + t6) + z(t7 z + t8) + t9 */
+#define SH_QUADRATIC_TERMS 10
+typedef void(*sh_irradiance_quadratic_fn)(float* irr, const float q[3][SH_QUADRATIC_TERMS], const float* x, const float* y, const float* z, size_t n, size_t first);
+
+/* Kernels of one instruction set, the basis ones indexed by order - SH_ORDER_L1 */
+struct sh_batch_kernels {
+    sh_eval_basis_batch_fn basis[4];
+    sh_eval_basisf_batch_fn basisf[4];
+    sh_irradiance_quadratic_fn quadratic;
+};
+
+#define SH_QUADRATIC_FORM(t, x, y, z) \
+    ((x) * ((t)[0] * (x) + (t)[1] * (y) + (t)[2] * (z) + (t)[3]) + (y) * ((t)[4] * (y) + (t)[5] * (z) + (t)[6]) + (z) * ((t)[7] * (z) + (t)[8]) + (t)[9])
+
+/*======================================================================
+ * Scalar kernels
+ *======================================================================*/
+/* Evaluates directions [first, n), also used to finish the tails of the vector kernels */
+#define SH_DEFINE_BATCH_SCALAR(name, bands)                                                   \
+static void name(double* sh_basis, const float* xs, const float* ys, const float* zs, size_t n, size_t first) \
+{                                                                                             \
+    for (size_t k = first; k < n; ++k) {                                                      \
+        const double x = (double)xs[k];                                                       \
+        const double y = (double)ys[k];                                                       \
+        const double z = (double)zs[k];                                                       \
+        SH_EVAL_BASIS(double, SH_CONST_DOUBLE, x, y, z, SH_BASIS_STORE, bands);               \
+    }                                                                                         \
+}
+
+#define SH_DEFINE_BATCH_SCALARF(name, bands)                                                  \
+static void name(float* sh_basis, const float* xs, const float* ys, const float* zs, size_t n, size_t first) \
+{                                                                                             \
+    for (size_t k = first; k < n; ++k) {                                                      \
+        const float x = xs[k];                                                                \
+        const float y = ys[k];                                                                \
+        const float z = zs[k];                                                                \
+        SH_EVAL_BASIS(float, SH_CONST_FLOAT, x, y, z, SH_BASIS_STORE, bands);                 \
+    }                                                                                         \
+}
+
+#define SH_BASIS_STORE(i, val) sh_basis[(i) * n + k] = (val)
+SH_DEFINE_BATCH_SCALAR(sh_eval_basis_l1_batch_scalar, 2)
+SH_DEFINE_BATCH_SCALAR(sh_eval_basis_l2_batch_scalar, 3)
+SH_DEFINE_BATCH_SCALAR(sh_eval_basis_l3_batch_scalar, 4)
+SH_DEFINE_BATCH_SCALAR(sh_eval_basis_l4_batch_scalar, 5)
+SH_DEFINE_BATCH_SCALARF(sh_eval_basisf_l1_batch_scalar, 2)
+SH_DEFINE_BATCH_SCALARF(sh_eval_basisf_l2_batch_scalar, 3)
+SH_DEFINE_BATCH_SCALARF(sh_eval_basisf_l3_batch_scalar, 4)
+SH_DEFINE_BATCH_SCALARF(sh_eval_basisf_l4_batch_scalar, 5)
+#undef SH_BASIS_STORE
+
+static void sh_irradiance_quadratic_scalar(float* irr, const float q[3][SH_QUADRATIC_TERMS], const float* xs, const float* ys, const float* zs, size_t n, size_t first)
+{
+    for (size_t k = first; k < n; ++k) {
+        const float x = xs[k];
+        const float y = ys[k];
+        const float z = zs[k];
+        irr[k * 3 + 0] = SH_QUADRATIC_FORM(q[0], x, y, z);
+        irr[k * 3 + 1] = SH_QUADRATIC_FORM(q[1], x, y, z);
+        irr[k * 3 + 2] = SH_QUADRATIC_FORM(q[2], x, y, z);
+    }
+}
+
+static const struct sh_batch_kernels sh_batch_kernels_scalar = {
+    { sh_eval_basis_l1_batch_scalar, sh_eval_basis_l2_batch_scalar, sh_eval_basis_l3_batch_scalar, sh_eval_basis_l4_batch_scalar },
+    { sh_eval_basisf_l1_batch_scalar, sh_eval_basisf_l2_batch_scalar, sh_eval_basisf_l3_batch_scalar, sh_eval_basisf_l4_batch_scalar },
+    sh_irradiance_quadratic_scalar
+};
+
+/*======================================================================
+ * Vector kernels
+ *======================================================================*/
+#ifdef SH_SIMD_X86
+/*
+ * The kernels reuse the scalar equations on GCC vector types, so every lane
+ * performs the exact same operations as the matching scalar kernel does.
+ * Contraction into FMAs is disabled to keep them bit-identical to the scalar path.
+ */
+#define SH_DEFINE_BATCH_KERNEL(name, isa, lanes, bands, tail)                                 \
+typedef double name##_vd __attribute__((vector_size(lanes * sizeof(double))));               \
+typedef float  name##_vf __attribute__((vector_size(lanes * sizeof(float))));                \
+__attribute__((target(isa), optimize("fp-contract=off")))                                     \
+static void name(double* sh_basis, const float* xs, const float* ys, const float* zs, size_t n, size_t first) \
+{                                                                                             \
+    size_t k = first;                                                                         \
+    for (; k + lanes <= n; k += lanes) {                                                      \
+        name##_vf xf, yf, zf;                                                                 \
+        memcpy(&xf, xs + k, sizeof(xf));                                                      \
+        memcpy(&yf, ys + k, sizeof(yf));                                                      \
+        memcpy(&zf, zs + k, sizeof(zf));                                                      \
+        const name##_vd x = __builtin_convertvector(xf, name##_vd);                           \
+        const name##_vd y = __builtin_convertvector(yf, name##_vd);                           \
+        const name##_vd z = __builtin_convertvector(zf, name##_vd);                           \
+        SH_EVAL_BASIS(name##_vd, SH_CONST_DOUBLE, x, y, z, SH_BASIS_VSTORE, bands);           \
+    }                                                                                         \
+    tail(sh_basis, xs, ys, zs, n, k);                                                         \
+}
+
+/* Single precision variant, twice the lanes per register */
+#define SH_DEFINE_BATCH_KERNELF(name, isa, lanes, bands, tail)                                \
+typedef float name##_vf __attribute__((vector_size(lanes * sizeof(float))));                 \
+__attribute__((target(isa), optimize("fp-contract=off")))                                     \
+static void name(float* sh_basis, const float* xs, const float* ys, const float* zs, size_t n, size_t first) \
+{                                                                                             \
+    size_t k = first;                                                                         \
+    for (; k + lanes <= n; k += lanes) {                                                      \
+        name##_vf x, y, z;                                                                    \
+        memcpy(&x, xs + k, sizeof(x));                                                        \
+        memcpy(&y, ys + k, sizeof(y));                                                        \
+        memcpy(&z, zs + k, sizeof(z));                                                        \
+        SH_EVAL_BASIS(name##_vf, SH_CONST_FLOAT, x, y, z, SH_BASIS_VSTORE, bands);            \
+    }                                                                                         \
+    tail(sh_basis, xs, ys, zs, n, k);                                                         \
+}
+
+/* Quadratic form evaluation, lanes are computed planar and interleaved on store */
+#define SH_DEFINE_QUADRATIC_KERNEL(name, isa, lanes)                                          \
+typedef float name##_vf __attribute__((vector_size(lanes * sizeof(float))));                 \
+__attribute__((target(isa), optimize("fp-contract=off")))                                     \
+static void name(float* irr, const float q[3][SH_QUADRATIC_TERMS], const float* xs, const float* ys, const float* zs, size_t n, size_t first) \
+{                                                                                             \
+    size_t k = first;                                                                         \
+    for (; k + lanes <= n; k += lanes) {                                                      \
+        name##_vf x, y, z;                                                                    \
+        memcpy(&x, xs + k, sizeof(x));                                                        \
+        memcpy(&y, ys + k, sizeof(y));                                                        \
+        memcpy(&z, zs + k, sizeof(z));                                                        \
+        float rgb[3][lanes];                                                                  \
+        for (int c = 0; c < 3; ++c) {                                                         \
+            const name##_vf v = SH_QUADRATIC_FORM(q[c], x, y, z);                             \
+            memcpy(rgb[c], &v, sizeof(v));                                                    \
+        }                                                                                     \
+        for (size_t l = 0; l < lanes; ++l) {                                                  \
+            irr[(k + l) * 3 + 0] = rgb[0][l];                                                 \
+            irr[(k + l) * 3 + 1] = rgb[1][l];                                                 \
+            irr[(k + l) * 3 + 2] = rgb[2][l];                                                 \
+        }                                                                                     \
+    }                                                                                         \
+    sh_irradiance_quadratic_scalar(irr, q, xs, ys, zs, n, k);                                 \
+}
+
+/* Kernels of every order for one instruction set and their table */
+#define SH_DEFINE_BATCH_KERNELS(sfx, isa, lanes)                                                                   \
+SH_DEFINE_BATCH_KERNEL(sh_eval_basis_l1_batch_##sfx, isa, lanes, 2, sh_eval_basis_l1_batch_scalar)                \
+SH_DEFINE_BATCH_KERNEL(sh_eval_basis_l2_batch_##sfx, isa, lanes, 3, sh_eval_basis_l2_batch_scalar)                \
+SH_DEFINE_BATCH_KERNEL(sh_eval_basis_l3_batch_##sfx, isa, lanes, 4, sh_eval_basis_l3_batch_scalar)                \
+SH_DEFINE_BATCH_KERNEL(sh_eval_basis_l4_batch_##sfx, isa, lanes, 5, sh_eval_basis_l4_batch_scalar)                \
+SH_DEFINE_BATCH_KERNELF(sh_eval_basisf_l1_batch_##sfx, isa, 2 * lanes, 2, sh_eval_basisf_l1_batch_scalar)         \
+SH_DEFINE_BATCH_KERNELF(sh_eval_basisf_l2_batch_##sfx, isa, 2 * lanes, 3, sh_eval_basisf_l2_batch_scalar)         \
+SH_DEFINE_BATCH_KERNELF(sh_eval_basisf_l3_batch_##sfx, isa, 2 * lanes, 4, sh_eval_basisf_l3_batch_scalar)         \
+SH_DEFINE_BATCH_KERNELF(sh_eval_basisf_l4_batch_##sfx, isa, 2 * lanes, 5, sh_eval_basisf_l4_batch_scalar)         \
+SH_DEFINE_QUADRATIC_KERNEL(sh_irradiance_quadratic_##sfx, isa, 2 * lanes)                                           \
+static const struct sh_batch_kernels sh_batch_kernels_##sfx = {                                                     \
+    { sh_eval_basis_l1_batch_##sfx, sh_eval_basis_l2_batch_##sfx, sh_eval_basis_l3_batch_##sfx, sh_eval_basis_l4_batch_##sfx },         \
+    { sh_eval_basisf_l1_batch_##sfx, sh_eval_basisf_l2_batch_##sfx, sh_eval_basisf_l3_batch_##sfx, sh_eval_basisf_l4_batch_##sfx },     \
+    sh_irradiance_quadratic_##sfx                                                                                   \
+};
+
+#define SH_BASIS_VSTORE(i, val) do { const __typeof__(x) v_ = (val); memcpy(sh_basis + (i) * n + k, &v_, sizeof(v_)); } while (0)
+SH_DEFINE_BATCH_KERNELS(sse2,   "sse2",    2)
+SH_DEFINE_BATCH_KERNELS(avx2,   "avx2",    4)
+SH_DEFINE_BATCH_KERNELS(avx512, "avx512f", 8)
+#undef SH_BASIS_VSTORE
+#endif
+
+/*======================================================================
+ * Dispatch
+ *======================================================================*/
+static const struct sh_batch_kernels* sh_batch_kernels_select(void)
+{
+#ifdef SH_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return &sh_batch_kernels_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return &sh_batch_kernels_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return &sh_batch_kernels_sse2;
+#endif
+    return &sh_batch_kernels_scalar;
+}
+
+static const struct sh_batch_kernels* sh_batch_kernels_resolved = 0;
+static tp_once_flag sh_batch_kernels_once = TP_ONCE_INIT;
+
+static void sh_batch_kernels_resolve(void)
+{
+    sh_batch_kernels_resolved = sh_batch_kernels_select();
+}
+
+static const struct sh_batch_kernels* sh_batch_kernels_get(void)
+{
+    tp_once(&sh_batch_kernels_once, sh_batch_kernels_resolve);
+    return sh_batch_kernels_resolved;
+}
+
+void sh_eval_basis_batch(double* sh_basis, enum sh_order order, const float* x, const float* y, const float* z, size_t n)
+{
+    sh_batch_kernels_get()->basis[order - SH_ORDER_L1](sh_basis, x, y, z, n, 0);
+}
+
+void sh_eval_basisf_batch(float* sh_basis, enum sh_order order, const float* x, const float* y, const float* z, size_t n)
+{
+    sh_batch_kernels_get()->basisf[order - SH_ORDER_L1](sh_basis, x, y, z, n, 0);
+}
+
+void sh_irradiance_quadratic_batch(float* irr, float m[3][4][4], const float* x, const float* y, const float* z, size_t n)
+{
+    /* Symmetric entries are summed once */
+    float q[3][SH_QUADRATIC_TERMS];
+    for (int c = 0; c < 3; ++c) {
+        q[c][0] = m[c][0][0];
+        q[c][1] = m[c][0][1] + m[c][1][0];
+        q[c][2] = m[c][0][2] + m[c][2][0];
+        q[c][3] = m[c][0][3] + m[c][3][0];
+        q[c][4] = m[c][1][1];
+        q[c][5] = m[c][1][2] + m[c][2][1];
+        q[c][6] = m[c][1][3] + m[c][3][1];
+        q[c][7] = m[c][2][2];
+        q[c][8] = m[c][2][3] + m[c][3][2];
+        q[c][9] = m[c][3][3];
+    }
+    sh_batch_kernels_get()->quadratic(irr, (const float (*)[SH_QUADRATIC_TERMS])q, x, y, z, n, 0);
+}
@@ -0,0 +1,222 @@
+#include "thread_pool.h"
+#include <stdlib.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/* Upper bound of worker threads the pool will ever spawn */
+#define THREAD_POOL_MAX_WORKERS 256
+
+/*======================================================================
+ * Platform wrappers
+ *======================================================================*/
+#ifdef _WIN32
+typedef CONDITION_VARIABLE tp_cond;
+typedef HANDLE tp_thread;
+#define TP_THREAD_LOCAL __declspec(thread)
+
+void tp_mutex_lock(tp_mutex* m) { AcquireSRWLockExclusive(m); }
+void tp_mutex_unlock(tp_mutex* m) { ReleaseSRWLockExclusive(m); }
+
+static BOOL CALLBACK tp_once_call(PINIT_ONCE once, PVOID fn, PVOID* ctx)
+{
+    (void) once;
+    (void) ctx;
+    ((void(*)(void))fn)();
+    return TRUE;
+}
+
+void tp_once(tp_once_flag* flag, void(*fn)(void)) { InitOnceExecuteOnce(flag, tp_once_call, (PVOID)fn, 0); }
+static void tp_cond_init(tp_cond* c) { InitializeConditionVariable(c); }
+static void tp_cond_wait(tp_cond* c, tp_mutex* m) { SleepConditionVariableSRW(c, m, INFINITE, 0); }
+static void tp_cond_broadcast(tp_cond* c) { WakeAllConditionVariable(c); }
+
+static int tp_thread_create(tp_thread* t, DWORD(WINAPI *fn)(LPVOID), void* arg)
+{
+    *t = CreateThread(0, 0, fn, arg, 0, 0);
+    return *t != 0;
+}
+
+static size_t tp_processor_count(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+}
+#else
+typedef pthread_cond_t tp_cond;
+typedef pthread_t tp_thread;
+#define TP_THREAD_LOCAL __thread
+
+void tp_mutex_lock(tp_mutex* m) { pthread_mutex_lock(m); }
+void tp_mutex_unlock(tp_mutex* m) { pthread_mutex_unlock(m); }
+void tp_once(tp_once_flag* flag, void(*fn)(void)) { pthread_once(flag, fn); }
+static void tp_cond_init(tp_cond* c) { pthread_cond_init(c, 0); }
+static void tp_cond_wait(tp_cond* c, tp_mutex* m) { pthread_cond_wait(c, m); }
+static void tp_cond_broadcast(tp_cond* c) { pthread_cond_broadcast(c); }
+
+static int tp_thread_create(tp_thread* t, void*(*fn)(void*), void* arg)
+{
+    if (pthread_create(t, 0, fn, arg) != 0)
+        return 0;
+    pthread_detach(*t);
+    return 1;
+}
+
+static size_t tp_processor_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+}
+#endif
+
+/*======================================================================
+ * Pool state
+ *======================================================================*/
+struct thread_pool {
+    /* Signaled when a new job is posted */
+    tp_cond work_cv;
+    /* Signaled when the last chunk of a job completes */
+    tp_cond done_cv;
+    /* Spawned worker threads, the calling thread is not counted */
+    size_t num_workers;
+    /* Bumped on every posted job so sleeping workers can tell it apart from the previous one */
+    unsigned long generation;
+    /* Current job */
+    parallel_for_fn fn;
+    void* userdata;
+    size_t count;
+    size_t grain;
+    size_t num_chunks;
+    size_t next_chunk;
+    size_t done_chunks;
+};
+
+static struct thread_pool pool;
+/* Protects every field of the pool state */
+static tp_mutex pool_lock = TP_MUTEX_INIT;
+/* Serializes jobs posted from different application threads */
+static tp_mutex submit_lock = TP_MUTEX_INIT;
+/* Set while the current thread is executing pool work */
+static TP_THREAD_LOCAL int in_pool_work = 0;
+
+/* Grabs and executes chunks of the current job until none are left, must be called with the pool lock held */
+static void thread_pool_drain(void)
+{
+    while (pool.next_chunk < pool.num_chunks) {
+        const size_t chunk = pool.next_chunk++;
+        const parallel_for_fn fn = pool.fn;
+        void* userdata = pool.userdata;
+        const size_t first = chunk * pool.grain;
+        const size_t last = first + pool.grain < pool.count ? first + pool.grain : pool.count;
+        tp_mutex_unlock(&pool_lock);
+        fn(first, last, userdata);
+        tp_mutex_lock(&pool_lock);
+        if (++pool.done_chunks == pool.num_chunks)
+            tp_cond_broadcast(&pool.done_cv);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI thread_pool_worker(LPVOID arg)
+#else
+static void* thread_pool_worker(void* arg)
+#endif
+{
+    (void) arg;
+    in_pool_work = 1;
+    tp_mutex_lock(&pool_lock);
+    /* Workers are spawned before the first job is posted */
+    unsigned long seen = 0;
+    for (;;) {
+        while (seen == pool.generation)
+            tp_cond_wait(&pool.work_cv, &pool_lock);
+        seen = pool.generation;
+        thread_pool_drain();
+    }
+    /* Never reached, workers live as long as the process */
+    tp_mutex_unlock(&pool_lock);
+    return 0;
+}
+
+static size_t thread_pool_desired_workers(void)
+{
+    size_t n = tp_processor_count();
+    const char* env = getenv("EMPROC_NUM_THREADS");
+    if (env && atoi(env) > 0)
+        n = (size_t)atoi(env);
+    if (n > THREAD_POOL_MAX_WORKERS + 1)
+        n = THREAD_POOL_MAX_WORKERS + 1;
+    return n - 1;
+}
+
+/* Spawns the workers on first use, must be called with the submit lock held */
+static void thread_pool_init(void)
+{
+    static int initialized = 0;
+    if (initialized)
+        return;
+    initialized = 1;
+    tp_cond_init(&pool.work_cv);
+    tp_cond_init(&pool.done_cv);
+    const size_t wanted = thread_pool_desired_workers();
+    for (size_t i = 0; i < wanted; ++i) {
+        tp_thread t;
+        if (!tp_thread_create(&t, thread_pool_worker, 0))
+            break;
+        ++pool.num_workers;
+    }
+}
+
+/*======================================================================
+ * Public interface
+ *======================================================================*/
+size_t thread_pool_concurrency(void)
+{
+    tp_mutex_lock(&submit_lock);
+    thread_pool_init();
+    const size_t n = pool.num_workers + 1;
+    tp_mutex_unlock(&submit_lock);
+    return n;
+}
+
+void parallel_for(size_t count, size_t grain, parallel_for_fn fn, void* userdata)
+{
+    if (count == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+    const size_t num_chunks = (count + grain - 1) / grain;
+
+    /* Run inline when nested or when there is nothing to split */
+    if (in_pool_work || num_chunks == 1) {
+        for (size_t first = 0; first < count; first += grain)
+            fn(first, first + grain < count ? first + grain : count, userdata);
+        return;
+    }
+
+    tp_mutex_lock(&submit_lock);
+    thread_pool_init();
+    in_pool_work = 1;
+
+    /* Post job */
+    tp_mutex_lock(&pool_lock);
+    pool.fn = fn;
+    pool.userdata = userdata;
+    pool.count = count;
+    pool.grain = grain;
+    pool.num_chunks = num_chunks;
+    pool.next_chunk = 0;
+    pool.done_chunks = 0;
+    ++pool.generation;
+    tp_cond_broadcast(&pool.work_cv);
+
+    /* Participate and wait for stragglers */
+    thread_pool_drain();
+    while (pool.done_chunks != pool.num_chunks)
+        tp_cond_wait(&pool.done_cv, &pool_lock);
+    tp_mutex_unlock(&pool_lock);
+
+    in_pool_work = 0;
+    tp_mutex_unlock(&submit_lock);
+}
@@ -0,0 +1,75 @@
+/*********************************************************************************************************************/
+/*                                                  /===-_---~~~~~~~~~------____                                     */
+/*                                                 |===-~___                _,-'                                     */
+/*                  -==\\                         `//~\\   ~~~~`---.___.-~~                                          */
+/*              ______-==|                         | |  \\           _-~`                                            */
+/*        __--~~~  ,-/-==\\                        | |   `\        ,'                                                */
+/*     _-~       /'    |  \\                      / /      \      /                                                  */
+/*   .'        /       |   \\                   /' /        \   /'                                                   */
+/*  /  ____  /         |    \`\.__/-~~ ~ \ _ _/'  /          \/'                                                     */
+/* /-'~    ~~~~~---__  |     ~-/~         ( )   /'        _--~`                                                      */
+/*                   \_|      /        _)   ;  ),   __--~~                                                           */
+/*                     '~~--_/      _-~/-  / \   '-~ \                                                               */
+/*                    {\__--_/}    / \\_>- )<__\      \                                                              */
+/*                    /'   (_/  _-~  | |__>--<__|      |                                                             */
+/*                   |0  0 _/) )-~     | |__>--<__|     |                                                            */
+/*                   / /~ ,_/       / /__>---<__/      |                                                             */
+/*                  o o _//        /-~_>---<__-~      /                                                              */
+/*                  (^(~          /~_>---<__-      _-~                                                               */
+/*                 ,/|           /__>--<__/     _-~                                                                  */
+/*              ,//('(          |__>--<__|     /                  .----_                                             */
+/*             ( ( '))          |__>--<__|    |                 /' _---_~\                                           */
+/*          `-)) )) (           |__>--<__|    |               /'  /     ~\`\                                         */
+/*         ,/,'//( (             \__>--<__\    \            /'  //        ||                                         */
+/*       ,( ( ((, ))              ~-__>--<_~-_  ~--____---~' _/'/        /'                                          */
+/*     `~/  )` ) ,/|                 ~-_~>--<_/-__       __-~ _/                                                     */
+/*   ._-~//( )/ )) `                    ~~-'_/_/ /~~~~~~~__--~                                                       */
+/*    ;'( ')/ ,)(                              ~~~~~~~~~~                                                            */
+/*   ' ') '( (/                                                                                                      */
+/*     '   '  `                                                                                                      */
+/*********************************************************************************************************************/
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <stddef.h>
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    typedef SRWLOCK tp_mutex;
+    #define TP_MUTEX_INIT SRWLOCK_INIT
+    typedef INIT_ONCE tp_once_flag;
+    #define TP_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+    #include <pthread.h>
+    typedef pthread_mutex_t tp_mutex;
+    #define TP_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+    typedef pthread_once_t tp_once_flag;
+    #define TP_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+/* Work function called for every [first, last) chunk of a parallel range */
+typedef void(*parallel_for_fn)(size_t first, size_t last, void* userdata);
+
+/*
+ * Splits [0, count) into chunks of grain items and runs them on the library worker pool.
+ * The calling thread takes part in the work and the call blocks until every chunk has completed.
+ * Chunk boundaries depend only on count and grain, never on the number of threads.
+ * Nested calls from inside a work function run serially on the current thread.
+ */
+void parallel_for(size_t count, size_t grain, parallel_for_fn fn, void* userdata);
+/* Number of threads (workers plus the calling thread) that take part in a parallel_for.
+ * Defaults to the number of online processors, overridable with the EMPROC_NUM_THREADS environment variable */
+size_t thread_pool_concurrency(void);
+
+/* Mutex helpers, statically initialized with TP_MUTEX_INIT */
+void tp_mutex_lock(tp_mutex* m);
+void tp_mutex_unlock(tp_mutex* m);
+/*
+ * Runs fn exactly once per flag, statically initialized with TP_ONCE_INIT. Every caller returns after fn has
+ * completed and sees what it stored, which makes it the way to resolve lazily selected kernels from pool workers.
+ */
+void tp_once(tp_once_flag* flag, void(*fn)(void));
+
+#endif /* ! _THREAD_POOL_H_ */
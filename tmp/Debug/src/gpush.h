@@ -0,0 +1,5191 @@
+unsigned char gpush_pp[] = {
+  0x74, 0x79, 0x70, 0x65, 0x64, 0x65, 0x66, 0x20, 0x75, 0x6e, 0x73, 0x69,
+  0x67, 0x6e, 0x65, 0x64, 0x20, 0x63, 0x68, 0x61, 0x72, 0x20, 0x75, 0x69,
+  0x6e, 0x74, 0x38, 0x5f, 0x74, 0x3b, 0x0a, 0x74, 0x79, 0x70, 0x65, 0x64,
+  0x65, 0x66, 0x20, 0x75, 0x6e, 0x73, 0x69, 0x67, 0x6e, 0x65, 0x64, 0x20,
+  0x69, 0x6e, 0x74, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74,
+  0x3b, 0x0a, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x48, 0x43, 0x52,
+  0x4f, 0x53, 0x53, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x45, 0x4d, 0x5f,
+  0x54, 0x59, 0x50, 0x45, 0x5f, 0x56, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45,
+  0x5f, 0x4c, 0x41, 0x54, 0x4c, 0x4f, 0x4e, 0x47, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x56, 0x53,
+  0x54, 0x52, 0x49, 0x50, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x45, 0x4d,
+  0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x55, 0x4e, 0x4b, 0x4e, 0x4f, 0x57,
+  0x4e, 0x0a, 0x7d, 0x3b, 0x0a, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20,
+  0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52,
+  0x4d, 0x41, 0x54, 0x5f, 0x52, 0x38, 0x47, 0x38, 0x42, 0x38, 0x20, 0x3d,
+  0x20, 0x30, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x45, 0x4d, 0x5f, 0x46,
+  0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x38, 0x47, 0x38, 0x42, 0x38,
+  0x41, 0x38, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x45, 0x4d, 0x5f, 0x46,
+  0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x31, 0x36, 0x46,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52,
+  0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x41, 0x31, 0x36, 0x46, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d,
+  0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x33, 0x32, 0x46, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54,
+  0x5f, 0x52, 0x47, 0x42, 0x41, 0x33, 0x32, 0x46, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f,
+  0x53, 0x52, 0x47, 0x42, 0x38, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x45,
+  0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x53, 0x52, 0x47,
+  0x42, 0x38, 0x5f, 0x41, 0x38, 0x0a, 0x7d, 0x3b, 0x0a, 0x73, 0x74, 0x72,
+  0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x20, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x20, 0x74, 0x79,
+  0x70, 0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20,
+  0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6f, 0x72, 0x6d, 0x61,
+  0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f,
+  0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a,
+  0x20, 0x64, 0x61, 0x74, 0x61, 0x3b, 0x0a, 0x7d, 0x3b, 0x0a, 0x65, 0x6e,
+  0x75, 0x6d, 0x20, 0x63, 0x75, 0x62, 0x65, 0x6d, 0x61, 0x70, 0x5f, 0x66,
+  0x61, 0x63, 0x65, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x43, 0x4d,
+  0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x58, 0x20,
+  0x3d, 0x20, 0x30, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x43, 0x4d, 0x5f,
+  0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x58, 0x20, 0x3d,
+  0x20, 0x31, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x43, 0x4d, 0x5f, 0x46,
+  0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x59, 0x20, 0x3d, 0x20,
+  0x32, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41,
+  0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x59, 0x20, 0x3d, 0x20, 0x33,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43,
+  0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x5a, 0x20, 0x3d, 0x20, 0x34, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45,
+  0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x5a, 0x20, 0x3d, 0x20, 0x35, 0x2c, 0x0a,
+  0x7d, 0x3b, 0x0a, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x63, 0x75, 0x62, 0x65,
+  0x6d, 0x61, 0x70, 0x5f, 0x65, 0x64, 0x67, 0x65, 0x0a, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x4c,
+  0x45, 0x46, 0x54, 0x20, 0x3d, 0x20, 0x30, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x52, 0x49, 0x47,
+  0x48, 0x54, 0x20, 0x3d, 0x20, 0x31, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x54, 0x4f, 0x50, 0x20,
+  0x3d, 0x20, 0x32, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x43, 0x4d, 0x5f,
+  0x45, 0x44, 0x47, 0x45, 0x5f, 0x42, 0x4f, 0x54, 0x54, 0x4f, 0x4d, 0x20,
+  0x3d, 0x20, 0x33, 0x2c, 0x0a, 0x7d, 0x3b, 0x0a, 0x65, 0x6e, 0x75, 0x6d,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79, 0x70, 0x65,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x64, 0x65, 0x74, 0x65,
+  0x63, 0x74, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x28, 0x69, 0x6e, 0x74, 0x20,
+  0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x68,
+  0x65, 0x69, 0x67, 0x68, 0x74, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x76, 0x65, 0x63, 0x5f,
+  0x74, 0x6f, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f,
+  0x72, 0x64, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x75, 0x2c, 0x20, 0x5f,
+  0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x2a, 0x20, 0x76, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69,
+  0x76, 0x61, 0x74, 0x65, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74,
+  0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x78, 0x2c, 0x20,
+  0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x74, 0x79, 0x70, 0x65, 0x20, 0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65,
+  0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a,
+  0x20, 0x76, 0x65, 0x63, 0x29, 0x3b, 0x0a, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x77, 0x61, 0x72, 0x70,
+  0x5f, 0x66, 0x69, 0x78, 0x75, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x74, 0x6f,
+  0x72, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78, 0x65,
+  0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x5f, 0x74, 0x6f, 0x5f, 0x76,
+  0x65, 0x63, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x6f, 0x75, 0x74, 0x33,
+  0x66, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d,
+  0x61, 0x70, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x20, 0x65, 0x6d, 0x5f, 0x74,
+  0x79, 0x70, 0x65, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x75,
+  0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x2c, 0x20, 0x75,
+  0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x69, 0x64, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63,
+  0x6f, 0x6f, 0x72, 0x64, 0x5f, 0x74, 0x6f, 0x5f, 0x76, 0x65, 0x63, 0x5f,
+  0x77, 0x61, 0x72, 0x70, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x6f, 0x75,
+  0x74, 0x33, 0x66, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x20, 0x65, 0x6d,
+  0x5f, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x75, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x2c,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x69, 0x64, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x77, 0x61, 0x72, 0x70, 0x5f, 0x66, 0x69, 0x78, 0x75, 0x70, 0x29, 0x3b,
+  0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x63, 0x75, 0x62, 0x65, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x33, 0x5d, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x75, 0x69,
+  0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69,
+  0x64, 0x29, 0x3b, 0x0a, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x73, 0x74, 0x72, 0x75, 0x63, 0x74,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20, 0x65, 0x6d, 0x29,
+  0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x63, 0x75, 0x62, 0x65, 0x5f, 0x64, 0x69, 0x6d, 0x73, 0x28,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x75, 0x69,
+  0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x2a, 0x20, 0x77, 0x69, 0x64, 0x74,
+  0x68, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x2a, 0x20, 0x68,
+  0x65, 0x69, 0x67, 0x68, 0x74, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20,
+  0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x20,
+  0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x29, 0x3b, 0x0a, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32,
+  0x5f, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x77, 0x69, 0x64, 0x74, 0x68, 0x28, 0x73, 0x74, 0x72,
+  0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20,
+  0x65, 0x6d, 0x29, 0x3b, 0x0a, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f,
+  0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x63, 0x6f, 0x75, 0x6e, 0x74, 0x28, 0x73, 0x74, 0x72, 0x75,
+  0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20, 0x65,
+  0x6d, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e, 0x76,
+  0x6d, 0x61, 0x70, 0x5f, 0x73, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x28, 0x5f,
+  0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x5f,
+  0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x73, 0x74, 0x72,
+  0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20,
+  0x65, 0x6d, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74,
+  0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x65, 0x63, 0x5b,
+  0x33, 0x5d, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x73, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x5f,
+  0x62, 0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x28, 0x5f, 0x5f, 0x70,
+  0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x5f, 0x5f, 0x70,
+  0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x73, 0x74, 0x72, 0x75, 0x63,
+  0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20, 0x65, 0x6d,
+  0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x76, 0x65, 0x63, 0x5b, 0x33, 0x5d, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69,
+  0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x73, 0x65, 0x74,
+  0x70, 0x69, 0x78, 0x65, 0x6c, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76,
+  0x61, 0x74, 0x65, 0x20, 0x73, 0x74, 0x72, 0x75, 0x63, 0x74, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20, 0x65, 0x6d, 0x2c, 0x20, 0x75,
+  0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x78, 0x2c, 0x20, 0x75,
+  0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x79, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x63, 0x75, 0x62, 0x65, 0x6d, 0x61, 0x70, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x5f,
+  0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x76, 0x61, 0x6c, 0x5b, 0x33, 0x5d, 0x29, 0x3b, 0x0a,
+  0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28, 0x5f,
+  0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x73, 0x74, 0x72,
+  0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20,
+  0x65, 0x6d, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74,
+  0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74,
+  0x20, 0x79, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x63, 0x75, 0x62,
+  0x65, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x29, 0x3b, 0x0a, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f,
+  0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72,
+  0x6d, 0x61, 0x74, 0x5f, 0x63, 0x68, 0x61, 0x6e, 0x6e, 0x65, 0x6c, 0x73,
+  0x28, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74, 0x29,
+  0x3b, 0x0a, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74,
+  0x20, 0x66, 0x6d, 0x74, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20,
+  0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c,
+  0x5f, 0x6c, 0x6f, 0x61, 0x64, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76,
+  0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x63, 0x6f,
+  0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62,
+  0x61, 0x6c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x73, 0x72, 0x63, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66,
+  0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74, 0x29, 0x3b, 0x0a,
+  0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x28,
+  0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x64, 0x73, 0x74, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66,
+  0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20, 0x5f,
+  0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x61, 0x6c,
+  0x5b, 0x33, 0x5d, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73,
+  0x63, 0x5f, 0x74, 0x6f, 0x5f, 0x76, 0x65, 0x63, 0x28, 0x5f, 0x5f, 0x70,
+  0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x76, 0x65, 0x63, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x74, 0x68, 0x65, 0x74, 0x61, 0x2c, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x70, 0x68, 0x69, 0x29, 0x3b, 0x0a, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x76, 0x65, 0x63, 0x5f, 0x74, 0x6f, 0x5f, 0x73, 0x63,
+  0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x74, 0x68, 0x65, 0x74, 0x61, 0x2c,
+  0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x70, 0x68, 0x69, 0x2c, 0x20, 0x5f,
+  0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x65, 0x63,
+  0x5b, 0x33, 0x5d, 0x29, 0x3b, 0x0a, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f,
+  0x61, 0x6e, 0x67, 0x6c, 0x65, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x75, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x2c, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x69, 0x6e, 0x76, 0x5f, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x3b, 0x0a, 0x73, 0x74,
+  0x61, 0x74, 0x69, 0x63, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x65, 0x71,
+  0x75, 0x61, 0x6c, 0x73, 0x65, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x61, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x62, 0x2c, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x65, 0x70, 0x73, 0x69, 0x6c, 0x6f,
+  0x6e, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74,
+  0x75, 0x72, 0x6e, 0x20, 0x66, 0x61, 0x62, 0x73, 0x28, 0x61, 0x20, 0x2d,
+  0x20, 0x62, 0x29, 0x20, 0x3c, 0x20, 0x65, 0x70, 0x73, 0x69, 0x6c, 0x6f,
+  0x6e, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20,
+  0x69, 0x6e, 0x74, 0x20, 0x69, 0x6d, 0x61, 0x67, 0x65, 0x5f, 0x69, 0x73,
+  0x5f, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x28, 0x69, 0x6e, 0x74, 0x20,
+  0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x68,
+  0x65, 0x69, 0x67, 0x68, 0x74, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x61, 0x73, 0x70, 0x65, 0x63,
+  0x74, 0x20, 0x3d, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x77,
+  0x69, 0x64, 0x74, 0x68, 0x20, 0x2f, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x66, 0x65, 0x71,
+  0x75, 0x61, 0x6c, 0x73, 0x65, 0x28, 0x61, 0x73, 0x70, 0x65, 0x63, 0x74,
+  0x2c, 0x20, 0x34, 0x2e, 0x30, 0x66, 0x20, 0x2f, 0x20, 0x33, 0x2e, 0x30,
+  0x66, 0x2c, 0x20, 0x31, 0x30, 0x65, 0x2d, 0x33, 0x29, 0x3b, 0x0a, 0x7d,
+  0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x69, 0x6e, 0x74, 0x20,
+  0x69, 0x6d, 0x61, 0x67, 0x65, 0x5f, 0x69, 0x73, 0x5f, 0x76, 0x63, 0x72,
+  0x6f, 0x73, 0x73, 0x28, 0x69, 0x6e, 0x74, 0x20, 0x77, 0x69, 0x64, 0x74,
+  0x68, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x68, 0x65, 0x69, 0x67, 0x68,
+  0x74, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x61, 0x73, 0x70, 0x65, 0x63, 0x74, 0x20, 0x3d, 0x20,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x77, 0x69, 0x64, 0x74, 0x68,
+  0x20, 0x2f, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x68, 0x65,
+  0x69, 0x67, 0x68, 0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65,
+  0x74, 0x75, 0x72, 0x6e, 0x20, 0x66, 0x65, 0x71, 0x75, 0x61, 0x6c, 0x73,
+  0x65, 0x28, 0x61, 0x73, 0x70, 0x65, 0x63, 0x74, 0x2c, 0x20, 0x33, 0x2e,
+  0x30, 0x66, 0x20, 0x2f, 0x20, 0x34, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x31,
+  0x30, 0x65, 0x2d, 0x33, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61,
+  0x74, 0x69, 0x63, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x69, 0x6d, 0x61, 0x67,
+  0x65, 0x5f, 0x69, 0x73, 0x5f, 0x6c, 0x61, 0x74, 0x6c, 0x6f, 0x6e, 0x67,
+  0x28, 0x69, 0x6e, 0x74, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20,
+  0x69, 0x6e, 0x74, 0x20, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x29, 0x0a,
+  0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x61, 0x73, 0x70, 0x65, 0x63, 0x74, 0x20, 0x3d, 0x20, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x2f, 0x20,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x68, 0x65, 0x69, 0x67, 0x68,
+  0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72,
+  0x6e, 0x20, 0x66, 0x65, 0x71, 0x75, 0x61, 0x6c, 0x73, 0x65, 0x28, 0x61,
+  0x73, 0x70, 0x65, 0x63, 0x74, 0x2c, 0x20, 0x32, 0x2e, 0x30, 0x66, 0x2c,
+  0x20, 0x31, 0x30, 0x65, 0x2d, 0x34, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x73,
+  0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x69, 0x6d,
+  0x61, 0x67, 0x65, 0x5f, 0x69, 0x73, 0x5f, 0x76, 0x73, 0x74, 0x72, 0x69,
+  0x70, 0x28, 0x69, 0x6e, 0x74, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c,
+  0x20, 0x69, 0x6e, 0x74, 0x20, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x29,
+  0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x61, 0x73, 0x70, 0x65, 0x63, 0x74, 0x20, 0x3d, 0x20, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x2f,
+  0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x68, 0x65, 0x69, 0x67,
+  0x68, 0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75,
+  0x72, 0x6e, 0x20, 0x66, 0x65, 0x71, 0x75, 0x61, 0x6c, 0x73, 0x65, 0x28,
+  0x61, 0x73, 0x70, 0x65, 0x63, 0x74, 0x2c, 0x20, 0x31, 0x2e, 0x30, 0x66,
+  0x20, 0x2f, 0x20, 0x36, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x31, 0x30, 0x65,
+  0x2d, 0x34, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x65, 0x6e, 0x75, 0x6d, 0x20,
+  0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x20,
+  0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x64, 0x65, 0x74, 0x65, 0x63,
+  0x74, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x28, 0x69, 0x6e, 0x74, 0x20, 0x77,
+  0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x68, 0x65,
+  0x69, 0x67, 0x68, 0x74, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x69, 0x66, 0x20, 0x28, 0x69, 0x6d, 0x61, 0x67, 0x65, 0x5f, 0x69, 0x73,
+  0x5f, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x28, 0x77, 0x69, 0x64, 0x74,
+  0x68, 0x2c, 0x20, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x29, 0x29, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75,
+  0x72, 0x6e, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x48,
+  0x43, 0x52, 0x4f, 0x53, 0x53, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x65,
+  0x6c, 0x73, 0x65, 0x20, 0x69, 0x66, 0x20, 0x28, 0x69, 0x6d, 0x61, 0x67,
+  0x65, 0x5f, 0x69, 0x73, 0x5f, 0x76, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x28,
+  0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x68, 0x65, 0x69, 0x67, 0x68,
+  0x74, 0x29, 0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59,
+  0x50, 0x45, 0x5f, 0x56, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x65, 0x6c, 0x73, 0x65, 0x20, 0x69, 0x66, 0x20, 0x28,
+  0x69, 0x6d, 0x61, 0x67, 0x65, 0x5f, 0x69, 0x73, 0x5f, 0x6c, 0x61, 0x74,
+  0x6c, 0x6f, 0x6e, 0x67, 0x28, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20,
+  0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x29, 0x29, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20,
+  0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x4c, 0x41, 0x54, 0x4c,
+  0x4f, 0x4e, 0x47, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6c, 0x73,
+  0x65, 0x20, 0x69, 0x66, 0x20, 0x28, 0x69, 0x6d, 0x61, 0x67, 0x65, 0x5f,
+  0x69, 0x73, 0x5f, 0x76, 0x73, 0x74, 0x72, 0x69, 0x70, 0x28, 0x77, 0x69,
+  0x64, 0x74, 0x68, 0x2c, 0x20, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x29,
+  0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65,
+  0x74, 0x75, 0x72, 0x6e, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45,
+  0x5f, 0x56, 0x53, 0x54, 0x52, 0x49, 0x50, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x45, 0x4d, 0x5f, 0x54,
+  0x59, 0x50, 0x45, 0x5f, 0x55, 0x4e, 0x4b, 0x4e, 0x4f, 0x57, 0x4e, 0x3b,
+  0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x5f, 0x5f,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x61, 0x6e, 0x74, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x64, 0x65,
+  0x63, 0x6f, 0x64, 0x65, 0x5f, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x5b,
+  0x32, 0x35, 0x36, 0x5d, 0x20, 0x3d, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x33,
+  0x39, 0x32, 0x31, 0x35, 0x36, 0x38, 0x38, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x30, 0x37, 0x38, 0x34, 0x33, 0x31, 0x33, 0x37, 0x37, 0x32,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x31, 0x37, 0x36, 0x34, 0x37,
+  0x30, 0x36, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x35, 0x36,
+  0x38, 0x36, 0x32, 0x37, 0x35, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x31, 0x39, 0x36, 0x30, 0x37, 0x38, 0x34, 0x33, 0x38, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x32, 0x33, 0x35, 0x32, 0x39, 0x34, 0x31, 0x32, 0x32,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x37, 0x34, 0x35, 0x30, 0x39,
+  0x38, 0x30, 0x36, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e,
+  0x30, 0x33, 0x31, 0x33, 0x37, 0x32, 0x35, 0x35, 0x30, 0x39, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x33, 0x35, 0x32, 0x39, 0x34, 0x31, 0x31, 0x39,
+  0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x39, 0x32, 0x31, 0x35,
+  0x36, 0x38, 0x37, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x34, 0x33,
+  0x31, 0x33, 0x37, 0x32, 0x35, 0x36, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x34, 0x37, 0x30, 0x35, 0x38, 0x38, 0x32, 0x34, 0x34, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x35, 0x30, 0x39, 0x38, 0x30, 0x33, 0x39, 0x32,
+  0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x35, 0x34, 0x39, 0x30, 0x31,
+  0x39, 0x36, 0x31, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x35, 0x38,
+  0x38, 0x32, 0x33, 0x35, 0x32, 0x39, 0x36, 0x66, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x30, 0x2e, 0x30, 0x36, 0x32, 0x37, 0x34, 0x35, 0x31, 0x30,
+  0x31, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x36, 0x36, 0x36, 0x36,
+  0x36, 0x36, 0x37, 0x30, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37,
+  0x30, 0x35, 0x38, 0x38, 0x32, 0x33, 0x38, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x37, 0x34, 0x35, 0x30, 0x39, 0x38, 0x30, 0x36, 0x39, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37, 0x38, 0x34, 0x33, 0x31, 0x33, 0x37,
+  0x35, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x38, 0x32, 0x33, 0x35,
+  0x32, 0x39, 0x34, 0x33, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x38,
+  0x36, 0x32, 0x37, 0x34, 0x35, 0x31, 0x32, 0x31, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x39, 0x30, 0x31, 0x39, 0x36, 0x30, 0x38, 0x30, 0x35, 0x66,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x39, 0x34, 0x31,
+  0x31, 0x37, 0x36, 0x34, 0x38, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x39, 0x38, 0x30, 0x33, 0x39, 0x32, 0x31, 0x37, 0x33, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x31, 0x30, 0x31, 0x39, 0x36, 0x30, 0x37, 0x38, 0x36, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x31, 0x30, 0x35, 0x38, 0x38, 0x32, 0x33, 0x35,
+  0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x30, 0x39, 0x38, 0x30, 0x33,
+  0x39, 0x32, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x31, 0x33, 0x37,
+  0x32, 0x35, 0x34, 0x39, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x31,
+  0x37, 0x36, 0x34, 0x37, 0x30, 0x35, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x31, 0x32, 0x31, 0x35, 0x36, 0x38, 0x36, 0x32, 0x38, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x31, 0x32, 0x35, 0x34, 0x39, 0x30,
+  0x32, 0x30, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x32, 0x39, 0x34,
+  0x31, 0x31, 0x37, 0x37, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x33,
+  0x33, 0x33, 0x33, 0x33, 0x33, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31,
+  0x33, 0x37, 0x32, 0x35, 0x34, 0x39, 0x30, 0x39, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x31, 0x34, 0x31, 0x31, 0x37, 0x36, 0x34, 0x37, 0x37, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x31, 0x34, 0x35, 0x30, 0x39, 0x38, 0x30, 0x34, 0x35,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x34, 0x39, 0x30, 0x31, 0x39, 0x36,
+  0x31, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x35, 0x32, 0x39, 0x34,
+  0x31, 0x31, 0x38, 0x32, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30,
+  0x2e, 0x31, 0x35, 0x36, 0x38, 0x36, 0x32, 0x37, 0x35, 0x31, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x31, 0x36, 0x30, 0x37, 0x38, 0x34, 0x33, 0x31, 0x39,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x36, 0x34, 0x37, 0x30, 0x35, 0x38,
+  0x38, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x36, 0x38, 0x36, 0x32,
+  0x37, 0x34, 0x35, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x37, 0x32,
+  0x35, 0x34, 0x39, 0x30, 0x32, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31,
+  0x37, 0x36, 0x34, 0x37, 0x30, 0x35, 0x39, 0x33, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x31, 0x38, 0x30, 0x33, 0x39, 0x32, 0x31, 0x36, 0x31, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x31, 0x38, 0x34, 0x33, 0x31, 0x33, 0x37, 0x32, 0x39,
+  0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x31, 0x38, 0x38,
+  0x32, 0x33, 0x35, 0x32, 0x39, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31,
+  0x39, 0x32, 0x31, 0x35, 0x36, 0x38, 0x36, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x31, 0x39, 0x36, 0x30, 0x37, 0x38, 0x34, 0x33, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x32, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x33,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x30, 0x33, 0x39, 0x32, 0x31, 0x35,
+  0x37, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x30, 0x37, 0x38, 0x34,
+  0x33, 0x31, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x31, 0x31, 0x37,
+  0x36, 0x34, 0x37, 0x30, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x31,
+  0x35, 0x36, 0x38, 0x36, 0x32, 0x37, 0x37, 0x66, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x30, 0x2e, 0x32, 0x31, 0x39, 0x36, 0x30, 0x37, 0x38, 0x34,
+  0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x32, 0x33, 0x35, 0x32, 0x39,
+  0x34, 0x31, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x32, 0x37, 0x34,
+  0x35, 0x30, 0x39, 0x38, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x33,
+  0x31, 0x33, 0x37, 0x32, 0x35, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32,
+  0x33, 0x35, 0x32, 0x39, 0x34, 0x31, 0x31, 0x39, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x32, 0x33, 0x39, 0x32, 0x31, 0x35, 0x36, 0x38, 0x37, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x32, 0x34, 0x33, 0x31, 0x33, 0x37, 0x32, 0x35, 0x35,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x34, 0x37, 0x30, 0x35, 0x38, 0x38,
+  0x32, 0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x32,
+  0x35, 0x30, 0x39, 0x38, 0x30, 0x34, 0x30, 0x37, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x32, 0x35, 0x34, 0x39, 0x30, 0x31, 0x39, 0x37, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x32, 0x35, 0x38, 0x38, 0x32, 0x33, 0x35, 0x34, 0x34,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x36, 0x32, 0x37, 0x34, 0x35, 0x31,
+  0x31, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x36, 0x36, 0x36, 0x36,
+  0x36, 0x36, 0x38, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x37, 0x30,
+  0x35, 0x38, 0x38, 0x32, 0x34, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32,
+  0x37, 0x34, 0x35, 0x30, 0x39, 0x38, 0x31, 0x37, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x32, 0x37, 0x38, 0x34, 0x33, 0x31, 0x33, 0x38, 0x36, 0x66, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x32, 0x38, 0x32, 0x33, 0x35,
+  0x32, 0x39, 0x35, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x38, 0x36,
+  0x32, 0x37, 0x34, 0x35, 0x32, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32,
+  0x39, 0x30, 0x31, 0x39, 0x36, 0x30, 0x39, 0x31, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x32, 0x39, 0x34, 0x31, 0x31, 0x37, 0x36, 0x35, 0x39, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x32, 0x39, 0x38, 0x30, 0x33, 0x39, 0x32, 0x32, 0x38,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x30, 0x31, 0x39, 0x36, 0x30, 0x37,
+  0x39, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x30, 0x35, 0x38, 0x38,
+  0x32, 0x33, 0x36, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x30, 0x39,
+  0x38, 0x30, 0x33, 0x39, 0x33, 0x33, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x30, 0x2e, 0x33, 0x31, 0x33, 0x37, 0x32, 0x35, 0x35, 0x30, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x31, 0x37, 0x36, 0x34, 0x37, 0x30,
+  0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x32, 0x31, 0x35, 0x36, 0x38,
+  0x36, 0x33, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x32, 0x35, 0x34,
+  0x39, 0x30, 0x32, 0x30, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x32,
+  0x39, 0x34, 0x31, 0x31, 0x37, 0x37, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x34, 0x33, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x33, 0x33, 0x37, 0x32, 0x35, 0x34, 0x39, 0x31, 0x32, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x33, 0x34, 0x31, 0x31, 0x37, 0x36, 0x34, 0x38,
+  0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x33, 0x34, 0x35,
+  0x30, 0x39, 0x38, 0x30, 0x34, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33,
+  0x34, 0x39, 0x30, 0x31, 0x39, 0x36, 0x31, 0x37, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x33, 0x35, 0x32, 0x39, 0x34, 0x31, 0x31, 0x38, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x33, 0x35, 0x36, 0x38, 0x36, 0x32, 0x37, 0x35, 0x34,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x36, 0x30, 0x37, 0x38, 0x34, 0x33,
+  0x32, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x36, 0x34, 0x37, 0x30,
+  0x35, 0x38, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x36, 0x38, 0x36,
+  0x32, 0x37, 0x34, 0x35, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x37,
+  0x32, 0x35, 0x34, 0x39, 0x30, 0x32, 0x37, 0x66, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x30, 0x2e, 0x33, 0x37, 0x36, 0x34, 0x37, 0x30, 0x35, 0x39,
+  0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x38, 0x30, 0x33, 0x39, 0x32,
+  0x31, 0x36, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x38, 0x34, 0x33,
+  0x31, 0x33, 0x37, 0x33, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x38,
+  0x38, 0x32, 0x33, 0x35, 0x33, 0x30, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x33, 0x39, 0x32, 0x31, 0x35, 0x36, 0x38, 0x36, 0x39, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x33, 0x39, 0x36, 0x30, 0x37, 0x38, 0x34, 0x33, 0x38, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x34, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+  0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x30, 0x33, 0x39, 0x32, 0x31,
+  0x35, 0x37, 0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e,
+  0x34, 0x30, 0x37, 0x38, 0x34, 0x33, 0x31, 0x34, 0x33, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x34, 0x31, 0x31, 0x37, 0x36, 0x34, 0x37, 0x31, 0x31, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x34, 0x31, 0x35, 0x36, 0x38, 0x36, 0x32, 0x38,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x31, 0x39, 0x36, 0x30, 0x37, 0x38,
+  0x34, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x32, 0x33, 0x35, 0x32,
+  0x39, 0x34, 0x31, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x32, 0x37,
+  0x34, 0x35, 0x30, 0x39, 0x38, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34,
+  0x33, 0x31, 0x33, 0x37, 0x32, 0x35, 0x35, 0x33, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x34, 0x33, 0x35, 0x32, 0x39, 0x34, 0x31, 0x32, 0x32, 0x66, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x34, 0x33, 0x39, 0x32, 0x31,
+  0x35, 0x36, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x34, 0x33, 0x31,
+  0x33, 0x37, 0x32, 0x35, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x34,
+  0x37, 0x30, 0x35, 0x38, 0x38, 0x32, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x34, 0x35, 0x30, 0x39, 0x38, 0x30, 0x33, 0x39, 0x35, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x34, 0x35, 0x34, 0x39, 0x30, 0x31, 0x39, 0x36, 0x33, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x34, 0x35, 0x38, 0x38, 0x32, 0x33, 0x35, 0x33,
+  0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x36, 0x32, 0x37, 0x34, 0x35,
+  0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x36, 0x36, 0x36, 0x36, 0x36,
+  0x36, 0x36, 0x39, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e,
+  0x34, 0x37, 0x30, 0x35, 0x38, 0x38, 0x32, 0x33, 0x37, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x34, 0x37, 0x34, 0x35, 0x30, 0x39, 0x38, 0x30, 0x35, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x34, 0x37, 0x38, 0x34, 0x33, 0x31, 0x33, 0x37,
+  0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x38, 0x32, 0x33, 0x35, 0x32,
+  0x39, 0x34, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x38, 0x36, 0x32,
+  0x37, 0x34, 0x35, 0x31, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x39,
+  0x30, 0x31, 0x39, 0x36, 0x30, 0x37, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x34, 0x39, 0x34, 0x31, 0x31, 0x37, 0x36, 0x34, 0x37, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x34, 0x39, 0x38, 0x30, 0x33, 0x39, 0x32, 0x31, 0x36, 0x66,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x35, 0x30, 0x31, 0x39,
+  0x36, 0x30, 0x38, 0x31, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x30,
+  0x35, 0x38, 0x38, 0x32, 0x33, 0x38, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x35, 0x30, 0x39, 0x38, 0x30, 0x33, 0x39, 0x35, 0x31, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x35, 0x31, 0x33, 0x37, 0x32, 0x35, 0x35, 0x31, 0x39, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x35, 0x31, 0x37, 0x36, 0x34, 0x37, 0x30, 0x38,
+  0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x32, 0x31, 0x35, 0x36, 0x38,
+  0x36, 0x35, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x32, 0x35, 0x34,
+  0x39, 0x30, 0x32, 0x32, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x32,
+  0x39, 0x34, 0x31, 0x31, 0x37, 0x39, 0x33, 0x66, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x30, 0x2e, 0x35, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x36,
+  0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x33, 0x37, 0x32, 0x35, 0x34,
+  0x39, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x34, 0x31, 0x31, 0x37,
+  0x36, 0x34, 0x39, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x34, 0x35,
+  0x30, 0x39, 0x38, 0x30, 0x36, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35,
+  0x34, 0x39, 0x30, 0x31, 0x39, 0x36, 0x33, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x35, 0x35, 0x32, 0x39, 0x34, 0x31, 0x32, 0x30, 0x33, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x35, 0x35, 0x36, 0x38, 0x36, 0x32, 0x37, 0x37, 0x32,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x36, 0x30, 0x37, 0x38, 0x34, 0x33,
+  0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x35, 0x36,
+  0x34, 0x37, 0x30, 0x35, 0x39, 0x30, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x35, 0x36, 0x38, 0x36, 0x32, 0x37, 0x34, 0x37, 0x37, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x35, 0x37, 0x32, 0x35, 0x34, 0x39, 0x30, 0x34, 0x35, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x35, 0x37, 0x36, 0x34, 0x37, 0x30, 0x36, 0x31,
+  0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x38, 0x30, 0x33, 0x39, 0x32,
+  0x31, 0x38, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x38, 0x34, 0x33,
+  0x31, 0x33, 0x37, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x38, 0x38,
+  0x32, 0x33, 0x35, 0x33, 0x31, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35,
+  0x39, 0x32, 0x31, 0x35, 0x36, 0x38, 0x38, 0x37, 0x66, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x30, 0x2e, 0x35, 0x39, 0x36, 0x30, 0x37, 0x38, 0x34,
+  0x35, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x30, 0x30, 0x30, 0x30,
+  0x30, 0x30, 0x32, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x30, 0x33,
+  0x39, 0x32, 0x31, 0x35, 0x39, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36,
+  0x30, 0x37, 0x38, 0x34, 0x33, 0x31, 0x36, 0x31, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x36, 0x31, 0x31, 0x37, 0x36, 0x34, 0x37, 0x32, 0x39, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x36, 0x31, 0x35, 0x36, 0x38, 0x36, 0x32, 0x39, 0x37,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x31, 0x39, 0x36, 0x30, 0x37, 0x38,
+  0x36, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x32, 0x33, 0x35, 0x32,
+  0x39, 0x34, 0x33, 0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30,
+  0x2e, 0x36, 0x32, 0x37, 0x34, 0x35, 0x31, 0x30, 0x30, 0x33, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x36, 0x33, 0x31, 0x33, 0x37, 0x32, 0x35, 0x37, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x33, 0x35, 0x32, 0x39, 0x34, 0x31,
+  0x33, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x33, 0x39, 0x32, 0x31,
+  0x35, 0x37, 0x30, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x34, 0x33,
+  0x31, 0x33, 0x37, 0x32, 0x37, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36,
+  0x34, 0x37, 0x30, 0x35, 0x38, 0x38, 0x34, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x36, 0x35, 0x30, 0x39, 0x38, 0x30, 0x34, 0x31, 0x33, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x36, 0x35, 0x34, 0x39, 0x30, 0x31, 0x39, 0x38, 0x31,
+  0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x36, 0x35, 0x38,
+  0x38, 0x32, 0x33, 0x35, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x36,
+  0x32, 0x37, 0x34, 0x35, 0x31, 0x31, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x36, 0x36, 0x36, 0x36, 0x36, 0x36, 0x36, 0x38, 0x37, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x36, 0x37, 0x30, 0x35, 0x38, 0x38, 0x32, 0x35, 0x35, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x36, 0x37, 0x34, 0x35, 0x30, 0x39, 0x38, 0x32,
+  0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x37, 0x38, 0x34, 0x33, 0x31,
+  0x33, 0x39, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x38, 0x32, 0x33,
+  0x35, 0x32, 0x39, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x38, 0x36,
+  0x32, 0x37, 0x34, 0x35, 0x32, 0x39, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x30, 0x2e, 0x36, 0x39, 0x30, 0x31, 0x39, 0x36, 0x30, 0x39, 0x37,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x39, 0x34, 0x31, 0x31, 0x37, 0x36,
+  0x36, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x39, 0x38, 0x30, 0x33,
+  0x39, 0x32, 0x33, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x30, 0x31,
+  0x39, 0x36, 0x30, 0x38, 0x30, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37,
+  0x30, 0x35, 0x38, 0x38, 0x32, 0x33, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x37, 0x30, 0x39, 0x38, 0x30, 0x33, 0x39, 0x33, 0x39, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x37, 0x31, 0x33, 0x37, 0x32, 0x35, 0x35, 0x30, 0x37, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x37, 0x31, 0x37, 0x36, 0x34, 0x37, 0x30, 0x37,
+  0x36, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x37, 0x32,
+  0x31, 0x35, 0x36, 0x38, 0x36, 0x34, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x37, 0x32, 0x35, 0x34, 0x39, 0x30, 0x32, 0x31, 0x32, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x37, 0x32, 0x39, 0x34, 0x31, 0x31, 0x37, 0x38, 0x31, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x37, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x34,
+  0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x33, 0x37, 0x32, 0x35, 0x34,
+  0x39, 0x31, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x34, 0x31, 0x31,
+  0x37, 0x36, 0x34, 0x38, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x34,
+  0x35, 0x30, 0x39, 0x38, 0x30, 0x35, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x37, 0x34, 0x39, 0x30, 0x31, 0x39, 0x36, 0x32, 0x33, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x37, 0x35, 0x32, 0x39, 0x34, 0x31,
+  0x31, 0x39, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x35, 0x36, 0x38,
+  0x36, 0x32, 0x37, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x36, 0x30,
+  0x37, 0x38, 0x34, 0x33, 0x32, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37,
+  0x36, 0x34, 0x37, 0x30, 0x35, 0x38, 0x39, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x37, 0x36, 0x38, 0x36, 0x32, 0x37, 0x34, 0x36, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x37, 0x37, 0x32, 0x35, 0x34, 0x39, 0x30, 0x33, 0x33,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x37, 0x36, 0x34, 0x37, 0x30, 0x36,
+  0x30, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x38, 0x30, 0x33, 0x39,
+  0x32, 0x31, 0x37, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e,
+  0x37, 0x38, 0x34, 0x33, 0x31, 0x33, 0x37, 0x33, 0x38, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x37, 0x38, 0x38, 0x32, 0x33, 0x35, 0x33, 0x30, 0x37, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x37, 0x39, 0x32, 0x31, 0x35, 0x36, 0x38, 0x37,
+  0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x39, 0x36, 0x30, 0x37, 0x38,
+  0x34, 0x34, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x30, 0x30, 0x30,
+  0x30, 0x30, 0x30, 0x31, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x30,
+  0x33, 0x39, 0x32, 0x31, 0x35, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38,
+  0x30, 0x37, 0x38, 0x34, 0x33, 0x31, 0x34, 0x39, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x38, 0x31, 0x31, 0x37, 0x36, 0x34, 0x37, 0x31, 0x37, 0x66, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x38, 0x31, 0x35, 0x36, 0x38,
+  0x36, 0x32, 0x38, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x31, 0x39,
+  0x36, 0x30, 0x37, 0x38, 0x35, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38,
+  0x32, 0x33, 0x35, 0x32, 0x39, 0x34, 0x32, 0x32, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x38, 0x32, 0x37, 0x34, 0x35, 0x30, 0x39, 0x39, 0x31, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x38, 0x33, 0x31, 0x33, 0x37, 0x32, 0x35, 0x35, 0x39,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x33, 0x35, 0x32, 0x39, 0x34, 0x31,
+  0x32, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x33, 0x39, 0x32, 0x31,
+  0x35, 0x36, 0x39, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x34, 0x33,
+  0x31, 0x33, 0x37, 0x32, 0x36, 0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x30, 0x2e, 0x38, 0x34, 0x37, 0x30, 0x35, 0x38, 0x38, 0x33, 0x33,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x35, 0x30, 0x39, 0x38, 0x30, 0x34,
+  0x30, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x35, 0x34, 0x39, 0x30,
+  0x31, 0x39, 0x36, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x35, 0x38,
+  0x38, 0x32, 0x33, 0x35, 0x33, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38,
+  0x36, 0x32, 0x37, 0x34, 0x35, 0x31, 0x30, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x38, 0x36, 0x36, 0x36, 0x36, 0x36, 0x36, 0x37, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x38, 0x37, 0x30, 0x35, 0x38, 0x38, 0x32, 0x34, 0x33,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x37, 0x34, 0x35, 0x30, 0x39, 0x38,
+  0x31, 0x31, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x38,
+  0x37, 0x38, 0x34, 0x33, 0x31, 0x33, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x38, 0x38, 0x32, 0x33, 0x35, 0x32, 0x39, 0x34, 0x38, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x38, 0x38, 0x36, 0x32, 0x37, 0x34, 0x35, 0x31, 0x37, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x38, 0x39, 0x30, 0x31, 0x39, 0x36, 0x30, 0x38,
+  0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x39, 0x34, 0x31, 0x31, 0x37,
+  0x36, 0x35, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x39, 0x38, 0x30,
+  0x33, 0x39, 0x32, 0x32, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x30,
+  0x31, 0x39, 0x36, 0x30, 0x37, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39,
+  0x30, 0x35, 0x38, 0x38, 0x32, 0x33, 0x35, 0x39, 0x66, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x30, 0x2e, 0x39, 0x30, 0x39, 0x38, 0x30, 0x33, 0x39,
+  0x32, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x31, 0x33, 0x37, 0x32,
+  0x35, 0x34, 0x39, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x31, 0x37,
+  0x36, 0x34, 0x37, 0x30, 0x36, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39,
+  0x32, 0x31, 0x35, 0x36, 0x38, 0x36, 0x33, 0x32, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x39, 0x32, 0x35, 0x34, 0x39, 0x30, 0x32, 0x30, 0x31, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x39, 0x32, 0x39, 0x34, 0x31, 0x31, 0x37, 0x36, 0x39,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+  0x33, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x33, 0x37, 0x32, 0x35,
+  0x34, 0x39, 0x30, 0x36, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30,
+  0x2e, 0x39, 0x34, 0x31, 0x31, 0x37, 0x36, 0x34, 0x37, 0x34, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x39, 0x34, 0x35, 0x30, 0x39, 0x38, 0x30, 0x34, 0x32,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x34, 0x39, 0x30, 0x31, 0x39, 0x36,
+  0x31, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x35, 0x32, 0x39, 0x34,
+  0x31, 0x31, 0x37, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x35, 0x36,
+  0x38, 0x36, 0x32, 0x37, 0x34, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39,
+  0x36, 0x30, 0x37, 0x38, 0x34, 0x33, 0x31, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x39, 0x36, 0x34, 0x37, 0x30, 0x35, 0x38, 0x38, 0x34, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x39, 0x36, 0x38, 0x36, 0x32, 0x37, 0x34, 0x35, 0x33,
+  0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x39, 0x37, 0x32,
+  0x35, 0x34, 0x39, 0x30, 0x32, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39,
+  0x37, 0x36, 0x34, 0x37, 0x30, 0x35, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x39, 0x38, 0x30, 0x33, 0x39, 0x32, 0x31, 0x35, 0x38, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x39, 0x38, 0x34, 0x33, 0x31, 0x33, 0x37, 0x32, 0x36, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x39, 0x38, 0x38, 0x32, 0x33, 0x35, 0x32, 0x39,
+  0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x39, 0x32, 0x31, 0x35, 0x36,
+  0x38, 0x36, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x39, 0x36, 0x30,
+  0x37, 0x38, 0x34, 0x33, 0x32, 0x66, 0x2c, 0x20, 0x31, 0x2e, 0x30, 0x66,
+  0x0a, 0x7d, 0x3b, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x5f,
+  0x5f, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x61, 0x6e, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x64,
+  0x65, 0x63, 0x6f, 0x64, 0x65, 0x5f, 0x73, 0x72, 0x67, 0x62, 0x5b, 0x32,
+  0x35, 0x36, 0x5d, 0x20, 0x3d, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x30, 0x33,
+  0x30, 0x33, 0x35, 0x32, 0x36, 0x39, 0x39, 0x31, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x30, 0x30, 0x36, 0x30, 0x37, 0x30, 0x35, 0x33, 0x39, 0x38,
+  0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x30, 0x39, 0x31, 0x30,
+  0x35, 0x38, 0x30, 0x39, 0x37, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x30, 0x31, 0x32, 0x31, 0x34, 0x31, 0x30, 0x37, 0x39, 0x36, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x30, 0x31, 0x35, 0x31, 0x37, 0x36, 0x33, 0x34,
+  0x39, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x31, 0x38, 0x32,
+  0x31, 0x31, 0x36, 0x31, 0x39, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x30, 0x32, 0x31, 0x32, 0x34, 0x36, 0x38, 0x38, 0x38, 0x32, 0x66, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x32, 0x34, 0x32,
+  0x38, 0x32, 0x31, 0x35, 0x39, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x30, 0x32, 0x37, 0x33, 0x31, 0x37, 0x34, 0x32, 0x38, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x33, 0x30, 0x33, 0x35, 0x32, 0x36, 0x39, 0x39,
+  0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x33, 0x33, 0x34, 0x36,
+  0x35, 0x33, 0x35, 0x38, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x33, 0x36, 0x37, 0x36, 0x35, 0x30, 0x37, 0x33, 0x39, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x34, 0x30, 0x32, 0x34, 0x37, 0x31, 0x37, 0x30,
+  0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x34, 0x33, 0x39, 0x31,
+  0x34, 0x34, 0x32, 0x30, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x34, 0x37, 0x37, 0x36, 0x39, 0x35, 0x33, 0x32, 0x35, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x35, 0x31, 0x38, 0x31,
+  0x35, 0x31, 0x36, 0x35, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x35, 0x36, 0x30, 0x35, 0x33, 0x39, 0x31, 0x36, 0x39, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x36, 0x30, 0x34, 0x38, 0x38, 0x33, 0x33, 0x30,
+  0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x36, 0x35, 0x31, 0x32,
+  0x30, 0x39, 0x30, 0x35, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x36, 0x39, 0x39, 0x35, 0x34, 0x31, 0x30, 0x31, 0x39, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x37, 0x34, 0x39, 0x39, 0x30, 0x33, 0x32, 0x31,
+  0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x38, 0x30, 0x32, 0x33,
+  0x31, 0x39, 0x33, 0x31, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x38, 0x35, 0x36, 0x38, 0x31, 0x32, 0x35, 0x37, 0x38, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x39, 0x31, 0x33, 0x34,
+  0x30, 0x35, 0x38, 0x38, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x39, 0x37, 0x32, 0x31, 0x32, 0x31, 0x37, 0x36, 0x38, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x31, 0x30, 0x33, 0x32, 0x39, 0x38, 0x32, 0x33, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x30, 0x39, 0x36, 0x30, 0x30, 0x39,
+  0x33, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x31, 0x36, 0x31,
+  0x32, 0x32, 0x34, 0x34, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31,
+  0x32, 0x32, 0x38, 0x36, 0x34, 0x38, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x31, 0x32, 0x39, 0x38, 0x33, 0x30, 0x33, 0x32, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x31, 0x33, 0x37, 0x30, 0x32, 0x30, 0x38, 0x33,
+  0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x31,
+  0x34, 0x34, 0x34, 0x33, 0x38, 0x34, 0x33, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x31, 0x35, 0x32, 0x30, 0x38, 0x35, 0x31, 0x34, 0x34, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x35, 0x39, 0x39, 0x36, 0x32, 0x39,
+  0x34, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x36, 0x38, 0x30,
+  0x37, 0x33, 0x37, 0x35, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31,
+  0x37, 0x36, 0x34, 0x31, 0x39, 0x35, 0x34, 0x31, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x31, 0x38, 0x35, 0x30, 0x30, 0x32, 0x32, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x31, 0x39, 0x33, 0x38, 0x32, 0x33, 0x36, 0x31, 0x33,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x30, 0x32, 0x38, 0x38, 0x35,
+  0x36, 0x32, 0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e,
+  0x30, 0x32, 0x31, 0x32, 0x31, 0x39, 0x30, 0x30, 0x39, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x32, 0x32, 0x31, 0x37, 0x33, 0x38, 0x38, 0x35,
+  0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x33, 0x31, 0x35, 0x33,
+  0x33, 0x36, 0x36, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x34,
+  0x31, 0x35, 0x37, 0x36, 0x33, 0x32, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x32, 0x35, 0x31, 0x38, 0x36, 0x38, 0x35, 0x39, 0x31, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x32, 0x36, 0x32, 0x34, 0x31, 0x32, 0x32, 0x32,
+  0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x37, 0x33, 0x32, 0x30,
+  0x38, 0x39, 0x31, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x38,
+  0x34, 0x32, 0x36, 0x30, 0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x30, 0x2e, 0x30, 0x32, 0x39, 0x35, 0x35, 0x36, 0x38, 0x33, 0x35, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x30, 0x37, 0x31, 0x33, 0x34,
+  0x34, 0x34, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x31, 0x38,
+  0x39, 0x36, 0x30, 0x33, 0x32, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x33, 0x33, 0x31, 0x30, 0x34, 0x37, 0x36, 0x36, 0x32, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x33, 0x34, 0x33, 0x33, 0x39, 0x38, 0x30, 0x37, 0x39,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x35, 0x36, 0x30, 0x31, 0x33,
+  0x31, 0x34, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x36, 0x38,
+  0x38, 0x39, 0x34, 0x34, 0x38, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x33, 0x38, 0x32, 0x30, 0x34, 0x33, 0x37, 0x31, 0x39, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x39, 0x35, 0x34, 0x36,
+  0x32, 0x33, 0x36, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x34, 0x30,
+  0x39, 0x31, 0x35, 0x31, 0x39, 0x38, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x34, 0x32, 0x33, 0x31, 0x31, 0x34, 0x31, 0x31, 0x34, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x34, 0x33, 0x37, 0x33, 0x35, 0x30, 0x33, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x34, 0x35, 0x31, 0x38, 0x36, 0x32,
+  0x30, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x34, 0x36, 0x36, 0x36,
+  0x35, 0x30, 0x38, 0x37, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x34,
+  0x38, 0x31, 0x37, 0x31, 0x38, 0x32, 0x35, 0x37, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x34, 0x39, 0x37, 0x30, 0x36, 0x35, 0x36, 0x37, 0x31, 0x66,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x35, 0x31, 0x32,
+  0x36, 0x39, 0x34, 0x35, 0x36, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x35, 0x32, 0x38, 0x36, 0x30, 0x36, 0x34, 0x37, 0x34, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x35, 0x34, 0x34, 0x38, 0x30, 0x32, 0x37, 0x37, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x35, 0x36, 0x31, 0x32, 0x38, 0x34, 0x39,
+  0x30, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x35, 0x37, 0x38, 0x30,
+  0x35, 0x34, 0x33, 0x30, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x35,
+  0x39, 0x35, 0x31, 0x31, 0x32, 0x33, 0x36, 0x38, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x36, 0x31, 0x32, 0x34, 0x36, 0x30, 0x35, 0x32, 0x34, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x36, 0x33, 0x30, 0x31, 0x30, 0x30, 0x31,
+  0x34, 0x36, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30,
+  0x36, 0x34, 0x38, 0x30, 0x33, 0x32, 0x36, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x36, 0x36, 0x36, 0x32, 0x35, 0x39, 0x33, 0x37, 0x38, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x36, 0x38, 0x34, 0x37, 0x38, 0x31, 0x36,
+  0x37, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37, 0x30, 0x33, 0x36,
+  0x30, 0x30, 0x39, 0x34, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37,
+  0x32, 0x32, 0x37, 0x31, 0x38, 0x35, 0x33, 0x37, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x37, 0x34, 0x32, 0x31, 0x33, 0x35, 0x37, 0x31, 0x38, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37, 0x36, 0x31, 0x38, 0x35, 0x33, 0x38,
+  0x32, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37, 0x38, 0x31, 0x38,
+  0x37, 0x34, 0x32, 0x31, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30,
+  0x2e, 0x30, 0x38, 0x30, 0x32, 0x31, 0x39, 0x38, 0x32, 0x30, 0x31, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x38, 0x32, 0x32, 0x38, 0x32, 0x37, 0x30,
+  0x37, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x38, 0x34, 0x33, 0x37,
+  0x36, 0x32, 0x30, 0x38, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x38,
+  0x36, 0x35, 0x30, 0x30, 0x34, 0x35, 0x38, 0x34, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x38, 0x38, 0x36, 0x35, 0x35, 0x35, 0x38, 0x33, 0x36, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x39, 0x30, 0x38, 0x34, 0x31, 0x37, 0x31,
+  0x30, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x39, 0x33, 0x30, 0x35,
+  0x38, 0x39, 0x36, 0x36, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x39,
+  0x35, 0x33, 0x30, 0x37, 0x34, 0x36, 0x39, 0x34, 0x66, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x39, 0x37, 0x35, 0x38, 0x37, 0x33,
+  0x34, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x39, 0x39, 0x38, 0x39,
+  0x38, 0x37, 0x32, 0x35, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x30,
+  0x32, 0x32, 0x34, 0x31, 0x37, 0x33, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x31, 0x30, 0x34, 0x36, 0x31, 0x36, 0x34, 0x38, 0x36, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x31, 0x30, 0x37, 0x30, 0x32, 0x33, 0x31, 0x30, 0x35, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x31, 0x30, 0x39, 0x34, 0x36, 0x31, 0x37, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x31, 0x31, 0x39, 0x33, 0x32, 0x34,
+  0x32, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x31, 0x34, 0x34, 0x33,
+  0x35, 0x33, 0x37, 0x35, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30,
+  0x2e, 0x31, 0x31, 0x36, 0x39, 0x37, 0x30, 0x36, 0x36, 0x36, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x31, 0x31, 0x39, 0x35, 0x33, 0x38, 0x34, 0x32, 0x36,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x32, 0x32, 0x31, 0x33, 0x38, 0x37,
+  0x37, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x32, 0x34, 0x37, 0x37,
+  0x31, 0x38, 0x31, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x32, 0x37,
+  0x34, 0x33, 0x37, 0x36, 0x38, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31,
+  0x33, 0x30, 0x31, 0x33, 0x36, 0x34, 0x37, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x31, 0x33, 0x32, 0x38, 0x36, 0x38, 0x33, 0x32, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x31, 0x33, 0x35, 0x36, 0x33, 0x33, 0x33, 0x33, 0x35, 0x66,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x31, 0x33, 0x38, 0x34,
+  0x33, 0x31, 0x36, 0x30, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x34,
+  0x31, 0x32, 0x36, 0x33, 0x32, 0x39, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x31, 0x34, 0x34, 0x31, 0x32, 0x38, 0x34, 0x37, 0x32, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x31, 0x34, 0x37, 0x30, 0x32, 0x37, 0x32, 0x36, 0x39, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x31, 0x34, 0x39, 0x39, 0x35, 0x39, 0x37, 0x38,
+  0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x35, 0x32, 0x39, 0x32, 0x36,
+  0x31, 0x34, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x35, 0x35, 0x39,
+  0x32, 0x36, 0x34, 0x36, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x35,
+  0x38, 0x39, 0x36, 0x30, 0x38, 0x33, 0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x30, 0x2e, 0x31, 0x36, 0x32, 0x30, 0x32, 0x39, 0x33, 0x37,
+  0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x36, 0x35, 0x31, 0x33, 0x32,
+  0x31, 0x39, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x36, 0x38, 0x32,
+  0x36, 0x39, 0x33, 0x39, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x37,
+  0x31, 0x34, 0x34, 0x31, 0x31, 0x30, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x31, 0x37, 0x34, 0x36, 0x34, 0x37, 0x34, 0x30, 0x36, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x31, 0x37, 0x37, 0x38, 0x38, 0x38, 0x34, 0x32, 0x33, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x31, 0x38, 0x31, 0x31, 0x36, 0x34, 0x32, 0x35,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x38, 0x34, 0x34, 0x37, 0x34, 0x39,
+  0x39, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x31, 0x38,
+  0x37, 0x38, 0x32, 0x30, 0x37, 0x37, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x31, 0x39, 0x31, 0x32, 0x30, 0x31, 0x36, 0x38, 0x37, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x31, 0x39, 0x34, 0x36, 0x31, 0x37, 0x38, 0x33, 0x38, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x31, 0x39, 0x38, 0x30, 0x36, 0x39, 0x33, 0x31,
+  0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x30, 0x31, 0x35, 0x35, 0x36,
+  0x32, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x30, 0x35, 0x30, 0x37,
+  0x38, 0x37, 0x33, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x30, 0x38,
+  0x36, 0x33, 0x36, 0x38, 0x36, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32,
+  0x31, 0x32, 0x32, 0x33, 0x30, 0x37, 0x35, 0x37, 0x66, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x30, 0x2e, 0x32, 0x31, 0x35, 0x38, 0x36, 0x30, 0x35,
+  0x30, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x31, 0x39, 0x35, 0x32,
+  0x36, 0x32, 0x30, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x32, 0x33,
+  0x32, 0x32, 0x37, 0x39, 0x36, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32,
+  0x32, 0x36, 0x39, 0x36, 0x35, 0x38, 0x37, 0x34, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x32, 0x33, 0x30, 0x37, 0x34, 0x30, 0x30, 0x35, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x32, 0x33, 0x34, 0x35, 0x35, 0x30, 0x35, 0x38, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x32, 0x33, 0x38, 0x33, 0x39, 0x37, 0x35, 0x36,
+  0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x34, 0x32, 0x32, 0x38, 0x31,
+  0x31, 0x32, 0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e,
+  0x32, 0x34, 0x36, 0x32, 0x30, 0x31, 0x33, 0x32, 0x31, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x32, 0x35, 0x30, 0x31, 0x35, 0x38, 0x32, 0x38, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x32, 0x35, 0x34, 0x31, 0x35, 0x32, 0x30, 0x38, 0x39,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x35, 0x38, 0x31, 0x38, 0x32, 0x38,
+  0x35, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x36, 0x32, 0x32, 0x35,
+  0x30, 0x36, 0x36, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x36, 0x36,
+  0x33, 0x35, 0x35, 0x36, 0x30, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32,
+  0x37, 0x30, 0x34, 0x39, 0x37, 0x37, 0x39, 0x39, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x32, 0x37, 0x34, 0x36, 0x37, 0x37, 0x33, 0x30, 0x36, 0x66, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x32, 0x37, 0x38, 0x38, 0x39,
+  0x34, 0x32, 0x37, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x38, 0x33,
+  0x31, 0x34, 0x38, 0x37, 0x33, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32,
+  0x38, 0x37, 0x34, 0x34, 0x30, 0x38, 0x33, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x32, 0x39, 0x31, 0x37, 0x37, 0x30, 0x36, 0x33, 0x37, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x32, 0x39, 0x36, 0x31, 0x33, 0x38, 0x32, 0x35, 0x37,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x30, 0x30, 0x35, 0x34, 0x33, 0x37,
+  0x38, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x30, 0x34, 0x39, 0x38,
+  0x37, 0x33, 0x31, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x30, 0x39,
+  0x34, 0x36, 0x38, 0x39, 0x32, 0x35, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x30, 0x2e, 0x33, 0x31, 0x33, 0x39, 0x38, 0x38, 0x37, 0x31, 0x35,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x31, 0x38, 0x35, 0x34, 0x36, 0x37,
+  0x37, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x32, 0x33, 0x31, 0x34,
+  0x33, 0x32, 0x31, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x32, 0x37,
+  0x37, 0x37, 0x38, 0x31, 0x30, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33,
+  0x33, 0x32, 0x34, 0x35, 0x31, 0x35, 0x32, 0x32, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x33, 0x33, 0x37, 0x31, 0x36, 0x33, 0x36, 0x32, 0x37, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x33, 0x34, 0x31, 0x39, 0x31, 0x34, 0x34, 0x31, 0x35,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x34, 0x36, 0x37, 0x30, 0x34, 0x30,
+  0x36, 0x36, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x33,
+  0x35, 0x31, 0x35, 0x33, 0x32, 0x36, 0x30, 0x38, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x33, 0x35, 0x36, 0x34, 0x30, 0x30, 0x31, 0x33, 0x32, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x33, 0x36, 0x31, 0x33, 0x30, 0x36, 0x37, 0x38, 0x37,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x36, 0x36, 0x32, 0x35, 0x32, 0x36,
+  0x30, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x37, 0x31, 0x32, 0x33,
+  0x37, 0x36, 0x39, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x37, 0x36,
+  0x32, 0x36, 0x32, 0x31, 0x32, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33,
+  0x38, 0x31, 0x33, 0x32, 0x36, 0x30, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x33, 0x38, 0x36, 0x34, 0x32, 0x39, 0x34, 0x32, 0x39, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x33, 0x39, 0x31, 0x35, 0x37, 0x32,
+  0x34, 0x37, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x39, 0x36, 0x37,
+  0x35, 0x35, 0x32, 0x31, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x30,
+  0x31, 0x39, 0x37, 0x37, 0x37, 0x37, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x34, 0x30, 0x37, 0x32, 0x34, 0x30, 0x32, 0x31, 0x32, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x34, 0x31, 0x32, 0x35, 0x34, 0x32, 0x36, 0x31, 0x31, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x34, 0x31, 0x37, 0x38, 0x38, 0x35, 0x30, 0x36,
+  0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x32, 0x33, 0x32, 0x36, 0x37,
+  0x36, 0x36, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x32, 0x38, 0x36,
+  0x39, 0x30, 0x34, 0x39, 0x33, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x30, 0x2e, 0x34, 0x33, 0x34, 0x31, 0x35, 0x33, 0x36, 0x34, 0x36, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x34, 0x33, 0x39, 0x36, 0x35, 0x37, 0x31, 0x38,
+  0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x34, 0x35, 0x32, 0x30, 0x31,
+  0x31, 0x38, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x35, 0x30, 0x37,
+  0x38, 0x35, 0x37, 0x38, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x35,
+  0x36, 0x34, 0x31, 0x31, 0x30, 0x33, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x34, 0x36, 0x32, 0x30, 0x37, 0x36, 0x39, 0x39, 0x32, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x34, 0x36, 0x37, 0x37, 0x38, 0x33, 0x38, 0x30, 0x39, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x34, 0x37, 0x33, 0x35, 0x33, 0x31, 0x34, 0x38,
+  0x35, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x34, 0x37,
+  0x39, 0x33, 0x32, 0x30, 0x31, 0x36, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x34, 0x38, 0x35, 0x31, 0x34, 0x39, 0x39, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x34, 0x39, 0x31, 0x30, 0x32, 0x30, 0x38, 0x35, 0x38, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x34, 0x39, 0x36, 0x39, 0x33, 0x32, 0x39, 0x38, 0x33,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x30, 0x32, 0x38, 0x38, 0x36, 0x34,
+  0x37, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x30, 0x38, 0x38, 0x38,
+  0x31, 0x33, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x31, 0x34, 0x39,
+  0x31, 0x37, 0x36, 0x37, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x32,
+  0x30, 0x39, 0x39, 0x35, 0x35, 0x35, 0x37, 0x66, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x30, 0x2e, 0x35, 0x32, 0x37, 0x31, 0x31, 0x35, 0x31, 0x30,
+  0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x33, 0x33, 0x32, 0x37, 0x36,
+  0x33, 0x37, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x33, 0x39, 0x34,
+  0x37, 0x39, 0x34, 0x39, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x34,
+  0x35, 0x37, 0x32, 0x34, 0x34, 0x35, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x35, 0x35, 0x32, 0x30, 0x31, 0x31, 0x34, 0x33, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x35, 0x35, 0x38, 0x33, 0x34, 0x30, 0x33, 0x37, 0x31, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x35, 0x36, 0x34, 0x37, 0x31, 0x31, 0x35, 0x31, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x37, 0x31, 0x31, 0x32, 0x34, 0x38,
+  0x35, 0x32, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x35,
+  0x37, 0x37, 0x35, 0x38, 0x30, 0x34, 0x35, 0x32, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x35, 0x38, 0x34, 0x30, 0x37, 0x38, 0x34, 0x33, 0x31, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x35, 0x39, 0x30, 0x36, 0x31, 0x38, 0x38, 0x34, 0x39,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x39, 0x37, 0x32, 0x30, 0x31, 0x37,
+  0x36, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x30, 0x33, 0x38, 0x32,
+  0x37, 0x33, 0x35, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x31, 0x30,
+  0x34, 0x39, 0x35, 0x35, 0x36, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36,
+  0x31, 0x37, 0x32, 0x30, 0x36, 0x35, 0x37, 0x33, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x36, 0x32, 0x33, 0x39, 0x36, 0x30, 0x33, 0x37, 0x36, 0x66, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x36, 0x33, 0x30, 0x37, 0x35,
+  0x37, 0x31, 0x35, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x33, 0x37,
+  0x35, 0x39, 0x36, 0x38, 0x34, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36,
+  0x34, 0x34, 0x34, 0x37, 0x39, 0x36, 0x39, 0x32, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x36, 0x35, 0x31, 0x34, 0x30, 0x35, 0x36, 0x33, 0x32, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x36, 0x35, 0x38, 0x33, 0x37, 0x34, 0x38, 0x34, 0x36,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x36, 0x35, 0x33, 0x38, 0x37, 0x32,
+  0x37, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x37, 0x32, 0x34, 0x34,
+  0x33, 0x31, 0x35, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x37, 0x39,
+  0x35, 0x34, 0x32, 0x34, 0x38, 0x32, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x30, 0x2e, 0x36, 0x38, 0x36, 0x36, 0x38, 0x35, 0x33, 0x32, 0x34,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x39, 0x33, 0x38, 0x37, 0x31, 0x37,
+  0x33, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x30, 0x31, 0x31, 0x30,
+  0x31, 0x38, 0x39, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x30, 0x38,
+  0x33, 0x37, 0x35, 0x37, 0x35, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37,
+  0x31, 0x35, 0x36, 0x39, 0x33, 0x34, 0x37, 0x34, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x37, 0x32, 0x33, 0x30, 0x35, 0x35, 0x31, 0x32, 0x34, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x37, 0x33, 0x30, 0x34, 0x36, 0x30, 0x37, 0x36, 0x33,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x33, 0x37, 0x39, 0x31, 0x30, 0x33,
+  0x39, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x37, 0x34,
+  0x35, 0x34, 0x30, 0x34, 0x31, 0x38, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x37, 0x35, 0x32, 0x39, 0x34, 0x32, 0x32, 0x30, 0x34, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x37, 0x36, 0x30, 0x35, 0x32, 0x34, 0x35, 0x31, 0x31, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x37, 0x36, 0x38, 0x31, 0x35, 0x31, 0x31, 0x36,
+  0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x37, 0x35, 0x38, 0x32, 0x32,
+  0x32, 0x32, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x38, 0x33, 0x35,
+  0x33, 0x37, 0x38, 0x30, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x39,
+  0x31, 0x32, 0x39, 0x37, 0x39, 0x31, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x37, 0x39, 0x39, 0x31, 0x30, 0x32, 0x37, 0x32, 0x34, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x38, 0x30, 0x36, 0x39, 0x35, 0x32,
+  0x32, 0x33, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x31, 0x34, 0x38,
+  0x34, 0x36, 0x35, 0x37, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x32,
+  0x32, 0x37, 0x38, 0x35, 0x37, 0x33, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x38, 0x33, 0x30, 0x37, 0x36, 0x39, 0x38, 0x39, 0x37, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x38, 0x33, 0x38, 0x37, 0x39, 0x39, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x38, 0x34, 0x36, 0x38, 0x37, 0x33, 0x32, 0x32, 0x34, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x38, 0x35, 0x34, 0x39, 0x39, 0x32, 0x36, 0x32, 0x38,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x36, 0x33, 0x31, 0x35, 0x37, 0x32,
+  0x31, 0x33, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x38,
+  0x37, 0x31, 0x33, 0x36, 0x37, 0x30, 0x39, 0x37, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x38, 0x37, 0x39, 0x36, 0x32, 0x32, 0x34, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x38, 0x38, 0x37, 0x39, 0x32, 0x33, 0x31, 0x32, 0x31, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x38, 0x39, 0x36, 0x32, 0x36, 0x39, 0x33, 0x38, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x30, 0x34, 0x36, 0x36, 0x31, 0x31,
+  0x37, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x31, 0x33, 0x30, 0x39,
+  0x38, 0x36, 0x33, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x32, 0x31,
+  0x35, 0x38, 0x31, 0x38, 0x36, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39,
+  0x33, 0x30, 0x31, 0x31, 0x30, 0x38, 0x37, 0x32, 0x66, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x30, 0x2e, 0x39, 0x33, 0x38, 0x36, 0x38, 0x35, 0x37,
+  0x31, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x34, 0x37, 0x33, 0x30,
+  0x36, 0x35, 0x31, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x35, 0x35,
+  0x39, 0x37, 0x33, 0x33, 0x32, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39,
+  0x36, 0x34, 0x36, 0x38, 0x36, 0x32, 0x37, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x39, 0x37, 0x33, 0x34, 0x34, 0x35, 0x32, 0x39, 0x36, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x39, 0x38, 0x32, 0x32, 0x35, 0x30, 0x35, 0x37, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x39, 0x31, 0x31, 0x30, 0x32, 0x30,
+  0x39, 0x39, 0x66, 0x2c, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x0a, 0x7d, 0x3b,
+  0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x5f, 0x5f, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x61, 0x6e, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x73, 0x72, 0x67, 0x62, 0x38, 0x5f, 0x65, 0x6e, 0x63, 0x6f, 0x64,
+  0x65, 0x5f, 0x74, 0x68, 0x72, 0x65, 0x73, 0x68, 0x6f, 0x6c, 0x64, 0x73,
+  0x5b, 0x32, 0x35, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x30, 0x31, 0x35, 0x31, 0x37, 0x36,
+  0x33, 0x34, 0x39, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x30,
+  0x34, 0x35, 0x35, 0x32, 0x39, 0x30, 0x34, 0x38, 0x37, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x30, 0x37, 0x35, 0x38, 0x38, 0x31, 0x37, 0x34,
+  0x37, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x31, 0x30, 0x36,
+  0x32, 0x33, 0x34, 0x34, 0x34, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x30, 0x31, 0x33, 0x36, 0x35, 0x38, 0x37, 0x31, 0x34, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x31, 0x36, 0x36, 0x39, 0x33, 0x39, 0x38, 0x33,
+  0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x31, 0x39, 0x37, 0x32,
+  0x39, 0x32, 0x35, 0x33, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x32, 0x32, 0x37, 0x36, 0x34, 0x35, 0x32, 0x34, 0x39, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x32, 0x35, 0x37, 0x39,
+  0x39, 0x37, 0x39, 0x33, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x32, 0x38, 0x38, 0x33, 0x35, 0x30, 0x36, 0x32, 0x34, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x33, 0x31, 0x38, 0x38, 0x33, 0x30, 0x30, 0x38,
+  0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x33, 0x35, 0x30, 0x39,
+  0x32, 0x35, 0x39, 0x33, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x33, 0x38, 0x34, 0x38, 0x33, 0x31, 0x34, 0x39, 0x38, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x34, 0x32, 0x30, 0x35, 0x37, 0x34, 0x37, 0x39,
+  0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x34, 0x35, 0x38, 0x31,
+  0x38, 0x33, 0x32, 0x37, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x34, 0x39, 0x37, 0x36, 0x38, 0x33, 0x37, 0x34, 0x33, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x35, 0x33, 0x39, 0x31,
+  0x30, 0x32, 0x34, 0x30, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x35, 0x38, 0x32, 0x34, 0x36, 0x35, 0x30, 0x36, 0x34, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x36, 0x32, 0x37, 0x37, 0x39, 0x36, 0x39, 0x35,
+  0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x36, 0x37, 0x35, 0x31,
+  0x32, 0x32, 0x37, 0x36, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x37, 0x32, 0x34, 0x34, 0x36, 0x36, 0x38, 0x34, 0x34, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x30, 0x37, 0x37, 0x35, 0x38, 0x35, 0x33, 0x30, 0x33,
+  0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x38, 0x32, 0x39, 0x33,
+  0x30, 0x34, 0x38, 0x34, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x30,
+  0x38, 0x38, 0x34, 0x38, 0x34, 0x35, 0x32, 0x39, 0x34, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x30, 0x39, 0x34, 0x32, 0x34,
+  0x39, 0x37, 0x30, 0x34, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31,
+  0x30, 0x30, 0x32, 0x32, 0x38, 0x32, 0x35, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x31, 0x30, 0x36, 0x34, 0x32, 0x32, 0x33, 0x37, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x31, 0x31, 0x32, 0x38, 0x33, 0x34, 0x32, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x31, 0x39, 0x34, 0x36, 0x35,
+  0x39, 0x32, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x32, 0x36,
+  0x33, 0x31, 0x39, 0x36, 0x30, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x31, 0x33, 0x33, 0x33, 0x39, 0x37, 0x33, 0x31, 0x38, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x31, 0x34, 0x30, 0x37, 0x30, 0x31, 0x31, 0x32, 0x33,
+  0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x34,
+  0x38, 0x32, 0x33, 0x33, 0x30, 0x32, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x31, 0x35, 0x35, 0x39, 0x39, 0x35, 0x30, 0x33, 0x32, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x31, 0x36, 0x33, 0x39, 0x38, 0x39, 0x31, 0x30,
+  0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x37, 0x32, 0x32, 0x31,
+  0x37, 0x31, 0x35, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x31, 0x38,
+  0x30, 0x36, 0x38, 0x31, 0x31, 0x34, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x31, 0x38, 0x39, 0x33, 0x38, 0x32, 0x39, 0x33, 0x37, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x31, 0x39, 0x38, 0x33, 0x32, 0x34, 0x34, 0x33,
+  0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x30, 0x37, 0x35, 0x30,
+  0x37, 0x34, 0x34, 0x33, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30,
+  0x2e, 0x30, 0x32, 0x31, 0x36, 0x39, 0x33, 0x33, 0x38, 0x32, 0x34, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x32, 0x36, 0x36, 0x30, 0x35, 0x33,
+  0x38, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x33, 0x36, 0x35,
+  0x32, 0x33, 0x38, 0x39, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32,
+  0x34, 0x36, 0x36, 0x39, 0x31, 0x31, 0x34, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x32, 0x35, 0x37, 0x31, 0x30, 0x38, 0x38, 0x38, 0x32, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x36, 0x37, 0x37, 0x37, 0x38, 0x38,
+  0x32, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32, 0x37, 0x38, 0x37,
+  0x30, 0x32, 0x36, 0x39, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x32,
+  0x38, 0x39, 0x38, 0x38, 0x32, 0x31, 0x39, 0x38, 0x66, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x30, 0x31, 0x33, 0x31, 0x39,
+  0x30, 0x32, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x31, 0x33,
+  0x30, 0x31, 0x34, 0x37, 0x39, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x33, 0x32, 0x34, 0x39, 0x37, 0x31, 0x32, 0x32, 0x39, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x33, 0x33, 0x37, 0x31, 0x38, 0x39, 0x38, 0x38, 0x33,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x34, 0x39, 0x36, 0x37, 0x32,
+  0x34, 0x33, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x33, 0x36, 0x32,
+  0x34, 0x32, 0x30, 0x34, 0x35, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x33, 0x37, 0x35, 0x34, 0x33, 0x35, 0x35, 0x33, 0x39, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x33, 0x38, 0x38, 0x37, 0x31, 0x39, 0x32, 0x35, 0x33,
+  0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x34, 0x30,
+  0x32, 0x32, 0x37, 0x33, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x34,
+  0x31, 0x36, 0x30, 0x39, 0x38, 0x38, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x34, 0x33, 0x30, 0x31, 0x39, 0x37, 0x38, 0x36, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x34, 0x34, 0x34, 0x35, 0x37, 0x31, 0x36, 0x33,
+  0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x34, 0x35, 0x39, 0x32, 0x32,
+  0x31, 0x37, 0x31, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x34, 0x37,
+  0x34, 0x31, 0x34, 0x39, 0x36, 0x32, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x34, 0x38, 0x39, 0x33, 0x35, 0x36, 0x38, 0x35, 0x33, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x35, 0x30, 0x34, 0x38, 0x34, 0x34, 0x38, 0x35,
+  0x39, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x35,
+  0x32, 0x30, 0x36, 0x31, 0x35, 0x30, 0x35, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x35, 0x33, 0x36, 0x36, 0x36, 0x38, 0x39, 0x37, 0x31, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x35, 0x35, 0x33, 0x30, 0x30, 0x38, 0x30,
+  0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x35, 0x36, 0x39, 0x36, 0x33,
+  0x33, 0x36, 0x31, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x35, 0x38,
+  0x36, 0x35, 0x34, 0x37, 0x31, 0x38, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x36, 0x30, 0x33, 0x37, 0x35, 0x30, 0x31, 0x32, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x36, 0x32, 0x31, 0x32, 0x34, 0x33, 0x38, 0x32,
+  0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x36, 0x33, 0x39, 0x30, 0x32,
+  0x39, 0x37, 0x34, 0x31, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30,
+  0x2e, 0x30, 0x36, 0x35, 0x37, 0x31, 0x30, 0x39, 0x31, 0x37, 0x31, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x36, 0x37, 0x35, 0x34, 0x38, 0x33, 0x34,
+  0x39, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x36, 0x39, 0x34, 0x31,
+  0x35, 0x34, 0x31, 0x32, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37,
+  0x31, 0x33, 0x31, 0x32, 0x32, 0x33, 0x33, 0x38, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x37, 0x33, 0x32, 0x33, 0x38, 0x39, 0x35, 0x33, 0x39, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37, 0x35, 0x31, 0x39, 0x35, 0x37, 0x30,
+  0x37, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37, 0x37, 0x31, 0x38,
+  0x32, 0x36, 0x31, 0x33, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x37,
+  0x39, 0x31, 0x39, 0x39, 0x38, 0x32, 0x30, 0x38, 0x66, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x38, 0x31, 0x32, 0x34, 0x37, 0x34,
+  0x34, 0x31, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x38, 0x33, 0x33,
+  0x32, 0x35, 0x36, 0x32, 0x34, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x38, 0x35, 0x34, 0x33, 0x34, 0x34, 0x38, 0x39, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x38, 0x37, 0x35, 0x37, 0x34, 0x31, 0x35, 0x34, 0x31, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x38, 0x39, 0x37, 0x34, 0x34, 0x37, 0x36,
+  0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x39, 0x31, 0x39, 0x34, 0x36,
+  0x34, 0x33, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x39, 0x34, 0x31,
+  0x37, 0x39, 0x33, 0x30, 0x32, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x39, 0x36, 0x34, 0x34, 0x33, 0x34, 0x37, 0x34, 0x33, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x30, 0x39, 0x38, 0x37, 0x33, 0x39,
+  0x30, 0x39, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x30, 0x31, 0x30,
+  0x36, 0x36, 0x32, 0x36, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x30,
+  0x33, 0x34, 0x32, 0x35, 0x31, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31,
+  0x30, 0x35, 0x38, 0x31, 0x35, 0x38, 0x30, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x31, 0x30, 0x38, 0x32, 0x33, 0x38, 0x33, 0x39, 0x39, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x31, 0x31, 0x30, 0x36, 0x39, 0x33, 0x30, 0x34, 0x35,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x31, 0x33, 0x31, 0x37, 0x39, 0x38,
+  0x36, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x31, 0x35, 0x36, 0x39,
+  0x38, 0x39, 0x37, 0x31, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30,
+  0x2e, 0x31, 0x31, 0x38, 0x32, 0x35, 0x30, 0x34, 0x38, 0x32, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x31, 0x32, 0x30, 0x38, 0x33, 0x34, 0x35, 0x32, 0x32,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x32, 0x33, 0x34, 0x35, 0x31, 0x32,
+  0x30, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x32, 0x36, 0x31, 0x30,
+  0x30, 0x36, 0x34, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x32, 0x38,
+  0x37, 0x38, 0x32, 0x39, 0x35, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31,
+  0x33, 0x31, 0x34, 0x39, 0x38, 0x32, 0x36, 0x32, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x31, 0x33, 0x34, 0x32, 0x34, 0x36, 0x36, 0x37, 0x37, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x31, 0x33, 0x37, 0x30, 0x32, 0x38, 0x33, 0x30, 0x37,
+  0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x31, 0x33, 0x39,
+  0x38, 0x34, 0x33, 0x32, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x34,
+  0x32, 0x36, 0x39, 0x31, 0x36, 0x38, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x31, 0x34, 0x35, 0x35, 0x37, 0x33, 0x36, 0x36, 0x31, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x31, 0x34, 0x38, 0x34, 0x38, 0x39, 0x33, 0x31, 0x31, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x31, 0x35, 0x31, 0x34, 0x33, 0x38, 0x37, 0x32,
+  0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x35, 0x34, 0x34, 0x32, 0x32,
+  0x30, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x35, 0x37, 0x34, 0x33,
+  0x39, 0x33, 0x38, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x36, 0x30,
+  0x34, 0x39, 0x30, 0x38, 0x32, 0x36, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x30, 0x2e, 0x31, 0x36, 0x33, 0x35, 0x37, 0x36, 0x34, 0x39, 0x39,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x36, 0x36, 0x36, 0x39, 0x36, 0x34,
+  0x38, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x36, 0x39, 0x38, 0x35,
+  0x30, 0x39, 0x33, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x37, 0x33,
+  0x30, 0x33, 0x39, 0x39, 0x31, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31,
+  0x37, 0x36, 0x32, 0x36, 0x33, 0x35, 0x37, 0x31, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x31, 0x37, 0x39, 0x35, 0x32, 0x31, 0x39, 0x37, 0x38, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x31, 0x38, 0x32, 0x38, 0x31, 0x35, 0x32, 0x35, 0x34,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x38, 0x36, 0x31, 0x34, 0x33, 0x35,
+  0x30, 0x33, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x31,
+  0x38, 0x39, 0x35, 0x30, 0x36, 0x38, 0x32, 0x39, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x31, 0x39, 0x32, 0x39, 0x30, 0x35, 0x33, 0x35, 0x32, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x31, 0x39, 0x36, 0x33, 0x33, 0x39, 0x31, 0x34, 0x35,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x31, 0x39, 0x39, 0x38, 0x30, 0x38, 0x33,
+  0x34, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x30, 0x33, 0x33, 0x31,
+  0x33, 0x30, 0x33, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x30, 0x36,
+  0x38, 0x35, 0x33, 0x33, 0x34, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32,
+  0x31, 0x30, 0x34, 0x32, 0x39, 0x33, 0x34, 0x31, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x32, 0x31, 0x34, 0x30, 0x34, 0x31, 0x31, 0x34, 0x34, 0x66, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x32, 0x31, 0x37, 0x36, 0x38,
+  0x38, 0x38, 0x34, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x32, 0x31,
+  0x33, 0x37, 0x32, 0x35, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x32,
+  0x35, 0x30, 0x39, 0x32, 0x33, 0x39, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x32, 0x32, 0x38, 0x38, 0x34, 0x38, 0x34, 0x32, 0x38, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x32, 0x33, 0x32, 0x36, 0x34, 0x30, 0x37, 0x35, 0x38, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x32, 0x33, 0x36, 0x34, 0x36, 0x39, 0x35, 0x30,
+  0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x34, 0x30, 0x33, 0x33, 0x34,
+  0x37, 0x37, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x34, 0x34, 0x32,
+  0x33, 0x36, 0x36, 0x33, 0x33, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x30, 0x2e, 0x32, 0x34, 0x38, 0x31, 0x37, 0x35, 0x32, 0x30, 0x34, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x32, 0x35, 0x32, 0x31, 0x35, 0x30, 0x35, 0x36,
+  0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x35, 0x36, 0x31, 0x36, 0x32,
+  0x38, 0x35, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x36, 0x30, 0x32,
+  0x31, 0x32, 0x31, 0x32, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x36,
+  0x34, 0x32, 0x39, 0x38, 0x34, 0x36, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x32, 0x36, 0x38, 0x34, 0x32, 0x32, 0x30, 0x33, 0x37, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x32, 0x37, 0x32, 0x35, 0x38, 0x32, 0x38, 0x38, 0x39, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x32, 0x37, 0x36, 0x37, 0x38, 0x31, 0x31, 0x31,
+  0x32, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x32, 0x38,
+  0x31, 0x30, 0x31, 0x36, 0x37, 0x39, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x32, 0x38, 0x35, 0x32, 0x39, 0x30, 0x30, 0x39, 0x32, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x32, 0x38, 0x39, 0x36, 0x30, 0x31, 0x30, 0x32, 0x38, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x32, 0x39, 0x33, 0x39, 0x34, 0x39, 0x37, 0x32,
+  0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x32, 0x39, 0x38, 0x33, 0x33, 0x36,
+  0x32, 0x39, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x30, 0x32, 0x37,
+  0x36, 0x30, 0x38, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x30, 0x37,
+  0x32, 0x32, 0x33, 0x33, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x31,
+  0x31, 0x37, 0x32, 0x34, 0x30, 0x33, 0x37, 0x66, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x30, 0x2e, 0x33, 0x31, 0x36, 0x32, 0x36, 0x32, 0x39, 0x36,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x32, 0x30, 0x38, 0x34, 0x30, 0x31,
+  0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x32, 0x35, 0x34, 0x35, 0x35,
+  0x38, 0x34, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x33, 0x30, 0x31,
+  0x30, 0x39, 0x39, 0x38, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x33,
+  0x34, 0x38, 0x30, 0x32, 0x37, 0x34, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x33, 0x33, 0x39, 0x35, 0x33, 0x34, 0x31, 0x36, 0x33, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x33, 0x34, 0x34, 0x33, 0x30, 0x34, 0x33, 0x38, 0x33, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x33, 0x34, 0x39, 0x31, 0x31, 0x33, 0x34, 0x36,
+  0x34, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x33, 0x35,
+  0x33, 0x39, 0x36, 0x31, 0x34, 0x39, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x33, 0x35, 0x38, 0x38, 0x34, 0x38, 0x35, 0x37, 0x32, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x33, 0x36, 0x33, 0x37, 0x37, 0x34, 0x37, 0x37, 0x36, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x33, 0x36, 0x38, 0x37, 0x34, 0x30, 0x32, 0x33,
+  0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x37, 0x33, 0x37, 0x34, 0x34,
+  0x39, 0x36, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x37, 0x38, 0x37,
+  0x38, 0x39, 0x31, 0x32, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x38,
+  0x33, 0x38, 0x37, 0x32, 0x37, 0x37, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x33, 0x38, 0x38, 0x39, 0x39, 0x36, 0x30, 0x30, 0x35, 0x66, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x33, 0x39, 0x34, 0x31, 0x35, 0x38,
+  0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x33, 0x39, 0x39, 0x33, 0x36, 0x31,
+  0x35, 0x32, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x30, 0x34, 0x36,
+  0x30, 0x34, 0x30, 0x31, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x30,
+  0x39, 0x38, 0x38, 0x36, 0x34, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34,
+  0x31, 0x35, 0x32, 0x30, 0x38, 0x38, 0x31, 0x37, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x34, 0x32, 0x30, 0x35, 0x37, 0x31, 0x33, 0x35, 0x37, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x34, 0x32, 0x35, 0x39, 0x37, 0x34, 0x30, 0x34, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x33, 0x31, 0x34, 0x31, 0x37, 0x30,
+  0x31, 0x38, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x34,
+  0x33, 0x36, 0x39, 0x30, 0x30, 0x33, 0x34, 0x37, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x34, 0x34, 0x32, 0x34, 0x32, 0x34, 0x31, 0x31, 0x39, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x34, 0x34, 0x37, 0x39, 0x38, 0x38, 0x34, 0x32, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x35, 0x33, 0x35, 0x39, 0x33, 0x33,
+  0x31, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x35, 0x39, 0x32, 0x33,
+  0x38, 0x39, 0x31, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x36, 0x34,
+  0x39, 0x32, 0x35, 0x32, 0x38, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34,
+  0x37, 0x30, 0x36, 0x35, 0x32, 0x35, 0x32, 0x31, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x34, 0x37, 0x36, 0x34, 0x32, 0x30, 0x37, 0x30, 0x31, 0x66, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x34, 0x38, 0x32, 0x32, 0x32,
+  0x39, 0x39, 0x31, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34, 0x38, 0x38,
+  0x30, 0x38, 0x30, 0x32, 0x33, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x34,
+  0x39, 0x33, 0x39, 0x37, 0x31, 0x37, 0x36, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x34, 0x39, 0x39, 0x39, 0x30, 0x34, 0x35, 0x34, 0x33, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x35, 0x30, 0x35, 0x38, 0x37, 0x38, 0x36, 0x38, 0x37,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x31, 0x31, 0x38, 0x39, 0x34, 0x32,
+  0x38, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x31, 0x37, 0x39, 0x35,
+  0x31, 0x34, 0x32, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x32, 0x34,
+  0x30, 0x35, 0x30, 0x31, 0x31, 0x37, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x30, 0x2e, 0x35, 0x33, 0x30, 0x31, 0x39, 0x30, 0x35, 0x32, 0x37,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x33, 0x36, 0x33, 0x37, 0x32, 0x37,
+  0x32, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x34, 0x32, 0x35, 0x39,
+  0x36, 0x37, 0x35, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x34, 0x38,
+  0x38, 0x36, 0x32, 0x36, 0x39, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35,
+  0x35, 0x35, 0x31, 0x37, 0x30, 0x36, 0x35, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x35, 0x36, 0x31, 0x35, 0x32, 0x30, 0x36, 0x39, 0x36, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x35, 0x36, 0x37, 0x39, 0x31, 0x32, 0x38, 0x37, 0x37,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x35, 0x37, 0x34, 0x33, 0x34, 0x37, 0x33,
+  0x31, 0x37, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x35,
+  0x38, 0x30, 0x38, 0x32, 0x34, 0x31, 0x33, 0x37, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x35, 0x38, 0x37, 0x33, 0x34, 0x33, 0x33, 0x33, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x35, 0x39, 0x33, 0x39, 0x30, 0x34, 0x39, 0x37, 0x32,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x30, 0x30, 0x35, 0x30, 0x39, 0x32,
+  0x32, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x30, 0x37, 0x31, 0x35,
+  0x36, 0x30, 0x39, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x31, 0x33,
+  0x38, 0x34, 0x35, 0x37, 0x30, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36,
+  0x32, 0x30, 0x35, 0x37, 0x38, 0x31, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x36, 0x32, 0x37, 0x33, 0x35, 0x33, 0x33, 0x37, 0x66, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x30, 0x2e, 0x36, 0x33, 0x34, 0x31, 0x37, 0x31, 0x36,
+  0x30, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x34, 0x31, 0x30, 0x33,
+  0x32, 0x38, 0x37, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x34, 0x37,
+  0x39, 0x33, 0x37, 0x32, 0x33, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36,
+  0x35, 0x34, 0x38, 0x38, 0x34, 0x38, 0x31, 0x35, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x36, 0x36, 0x31, 0x38, 0x37, 0x35, 0x36, 0x36, 0x35, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x36, 0x36, 0x38, 0x39, 0x30, 0x39, 0x37, 0x38, 0x38,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x37, 0x35, 0x39, 0x38, 0x37, 0x33,
+  0x36, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x36, 0x38, 0x33, 0x31, 0x30,
+  0x38, 0x34, 0x34, 0x39, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30,
+  0x2e, 0x36, 0x39, 0x30, 0x32, 0x37, 0x33, 0x31, 0x30, 0x36, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x36, 0x39, 0x37, 0x34, 0x38, 0x31, 0x33, 0x33, 0x34,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x30, 0x34, 0x37, 0x33, 0x33, 0x33,
+  0x37, 0x32, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x31, 0x32, 0x30, 0x32,
+  0x39, 0x31, 0x35, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x31, 0x39,
+  0x33, 0x36, 0x38, 0x38, 0x31, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37,
+  0x32, 0x36, 0x37, 0x35, 0x32, 0x34, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x37, 0x33, 0x34, 0x31, 0x38, 0x30, 0x30, 0x33, 0x33, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x37, 0x34, 0x31, 0x36, 0x35, 0x31, 0x37, 0x37, 0x33, 0x66,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x37, 0x34, 0x39, 0x31,
+  0x36, 0x37, 0x36, 0x38, 0x31, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x35,
+  0x36, 0x37, 0x32, 0x37, 0x38, 0x31, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x37, 0x36, 0x34, 0x33, 0x33, 0x32, 0x32, 0x39, 0x34, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x37, 0x37, 0x31, 0x39, 0x38, 0x31, 0x31, 0x32, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x37, 0x37, 0x39, 0x36, 0x37, 0x34, 0x34, 0x31, 0x31,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x38, 0x37, 0x34, 0x31, 0x32, 0x32,
+  0x38, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x37, 0x39, 0x35, 0x31, 0x39,
+  0x34, 0x37, 0x34, 0x35, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x30, 0x33,
+  0x30, 0x32, 0x31, 0x39, 0x30, 0x38, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x30, 0x2e, 0x38, 0x31, 0x30, 0x38, 0x39, 0x33, 0x38, 0x33, 0x34,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x31, 0x38, 0x38, 0x31, 0x30, 0x35,
+  0x32, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x32, 0x36, 0x37, 0x37,
+  0x32, 0x32, 0x31, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x33, 0x34,
+  0x37, 0x37, 0x38, 0x37, 0x38, 0x36, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38,
+  0x34, 0x32, 0x38, 0x33, 0x30, 0x34, 0x37, 0x39, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x38, 0x35, 0x30, 0x39, 0x32, 0x37, 0x32, 0x39, 0x33, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x38, 0x35, 0x39, 0x30, 0x36, 0x39, 0x32, 0x32, 0x38,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x38, 0x36, 0x37, 0x32, 0x35, 0x36, 0x35,
+  0x32, 0x32, 0x66, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x38,
+  0x37, 0x35, 0x34, 0x38, 0x39, 0x30, 0x35, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x38, 0x38, 0x33, 0x37, 0x36, 0x37, 0x30, 0x36, 0x38, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x38, 0x39, 0x32, 0x30, 0x39, 0x30, 0x35, 0x35, 0x39,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x30, 0x30, 0x34, 0x35, 0x39, 0x35,
+  0x38, 0x38, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x30, 0x38, 0x38, 0x37,
+  0x34, 0x32, 0x31, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x31, 0x37,
+  0x33, 0x33, 0x34, 0x35, 0x35, 0x37, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39,
+  0x32, 0x35, 0x38, 0x34, 0x30, 0x36, 0x31, 0x36, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x39, 0x33, 0x34, 0x33, 0x39, 0x32, 0x35, 0x37, 0x31, 0x66, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x30, 0x2e, 0x39, 0x34, 0x32, 0x39, 0x39,
+  0x30, 0x33, 0x36, 0x33, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x35, 0x31,
+  0x36, 0x33, 0x34, 0x31, 0x36, 0x39, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39,
+  0x36, 0x30, 0x33, 0x32, 0x34, 0x30, 0x34, 0x39, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x39, 0x36, 0x39, 0x30, 0x36, 0x30, 0x30, 0x30, 0x34, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x39, 0x37, 0x37, 0x38, 0x34, 0x32, 0x31, 0x35, 0x32,
+  0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x38, 0x36, 0x36, 0x37, 0x30, 0x35,
+  0x35, 0x34, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x39, 0x39, 0x35, 0x35, 0x34,
+  0x35, 0x32, 0x36, 0x38, 0x66, 0x0a, 0x7d, 0x3b, 0x0a, 0x75, 0x69, 0x6e,
+  0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x63, 0x68, 0x61, 0x6e,
+  0x6e, 0x65, 0x6c, 0x73, 0x28, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20,
+  0x66, 0x6d, 0x74, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73,
+  0x77, 0x69, 0x74, 0x63, 0x68, 0x20, 0x28, 0x66, 0x6d, 0x74, 0x29, 0x20,
+  0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61,
+  0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54,
+  0x5f, 0x52, 0x38, 0x47, 0x38, 0x42, 0x38, 0x41, 0x38, 0x3a, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20,
+  0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x53, 0x52,
+  0x47, 0x42, 0x38, 0x5f, 0x41, 0x38, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f,
+  0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x41, 0x31,
+  0x36, 0x46, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d,
+  0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x41, 0x33, 0x32, 0x46, 0x3a, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x34, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x65, 0x66, 0x61, 0x75, 0x6c,
+  0x74, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x33, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x75, 0x69, 0x6e,
+  0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73, 0x69, 0x7a, 0x65,
+  0x28, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74, 0x29,
+  0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69, 0x74, 0x63,
+  0x68, 0x20, 0x28, 0x66, 0x6d, 0x74, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45,
+  0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x38, 0x47,
+  0x38, 0x42, 0x38, 0x3a, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20,
+  0x33, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41,
+  0x54, 0x5f, 0x52, 0x38, 0x47, 0x38, 0x42, 0x38, 0x41, 0x38, 0x3a, 0x20,
+  0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x34, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45,
+  0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x53, 0x52, 0x47,
+  0x42, 0x38, 0x3a, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x33,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61,
+  0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54,
+  0x5f, 0x53, 0x52, 0x47, 0x42, 0x38, 0x5f, 0x41, 0x38, 0x3a, 0x20, 0x72,
+  0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x34, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d,
+  0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x31,
+  0x36, 0x46, 0x3a, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x36,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61,
+  0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54,
+  0x5f, 0x52, 0x47, 0x42, 0x41, 0x31, 0x36, 0x46, 0x3a, 0x20, 0x72, 0x65,
+  0x74, 0x75, 0x72, 0x6e, 0x20, 0x38, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f,
+  0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x33, 0x32,
+  0x46, 0x3a, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x31, 0x32,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61,
+  0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54,
+  0x5f, 0x52, 0x47, 0x42, 0x41, 0x33, 0x32, 0x46, 0x3a, 0x20, 0x72, 0x65,
+  0x74, 0x75, 0x72, 0x6e, 0x20, 0x31, 0x36, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x65, 0x66, 0x61, 0x75, 0x6c, 0x74,
+  0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x30,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65,
+  0x78, 0x65, 0x6c, 0x5f, 0x6c, 0x6f, 0x61, 0x64, 0x28, 0x5f, 0x5f, 0x70,
+  0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x5f, 0x5f, 0x67,
+  0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x73, 0x72, 0x63,
+  0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74,
+  0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69, 0x74,
+  0x63, 0x68, 0x20, 0x28, 0x66, 0x6d, 0x74, 0x29, 0x20, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20,
+  0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47,
+  0x42, 0x31, 0x36, 0x46, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f,
+  0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x41, 0x31, 0x36, 0x46,
+  0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x76,
+  0x6c, 0x6f, 0x61, 0x64, 0x5f, 0x68, 0x61, 0x6c, 0x66, 0x28, 0x30, 0x2c,
+  0x20, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x68, 0x61, 0x6c, 0x66, 0x2a, 0x29, 0x28,
+  0x73, 0x72, 0x63, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x31,
+  0x5d, 0x20, 0x3d, 0x20, 0x76, 0x6c, 0x6f, 0x61, 0x64, 0x5f, 0x68, 0x61,
+  0x6c, 0x66, 0x28, 0x31, 0x2c, 0x20, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f,
+  0x62, 0x61, 0x6c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x68, 0x61,
+  0x6c, 0x66, 0x2a, 0x29, 0x28, 0x73, 0x72, 0x63, 0x29, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x6f, 0x6c, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x76, 0x6c, 0x6f,
+  0x61, 0x64, 0x5f, 0x68, 0x61, 0x6c, 0x66, 0x28, 0x32, 0x2c, 0x20, 0x28,
+  0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x68, 0x61, 0x6c, 0x66, 0x2a, 0x29, 0x28, 0x73, 0x72,
+  0x63, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65,
+  0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52,
+  0x47, 0x42, 0x33, 0x32, 0x46, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46,
+  0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x41, 0x33, 0x32,
+  0x46, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a,
+  0x29, 0x28, 0x73, 0x72, 0x63, 0x29, 0x29, 0x5b, 0x30, 0x5d, 0x29, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x29, 0x28,
+  0x73, 0x72, 0x63, 0x29, 0x29, 0x5b, 0x31, 0x5d, 0x29, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x6f, 0x6c, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x5f,
+  0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x29, 0x28, 0x73, 0x72,
+  0x63, 0x29, 0x29, 0x5b, 0x32, 0x5d, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65,
+  0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d,
+  0x41, 0x54, 0x5f, 0x52, 0x38, 0x47, 0x38, 0x42, 0x38, 0x41, 0x38, 0x3a,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73,
+  0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f,
+  0x53, 0x52, 0x47, 0x42, 0x38, 0x5f, 0x41, 0x38, 0x3a, 0x20, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x75, 0x63, 0x68, 0x61, 0x72, 0x34,
+  0x20, 0x74, 0x20, 0x3d, 0x20, 0x76, 0x6c, 0x6f, 0x61, 0x64, 0x34, 0x28,
+  0x30, 0x2c, 0x20, 0x73, 0x72, 0x63, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x61, 0x6e, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x2a, 0x20, 0x6c, 0x75, 0x74, 0x20, 0x3d, 0x20, 0x66, 0x6d, 0x74,
+  0x20, 0x3d, 0x3d, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41,
+  0x54, 0x5f, 0x53, 0x52, 0x47, 0x42, 0x38, 0x5f, 0x41, 0x38, 0x20, 0x3f,
+  0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x64, 0x65, 0x63, 0x6f,
+  0x64, 0x65, 0x5f, 0x73, 0x72, 0x67, 0x62, 0x20, 0x3a, 0x20, 0x75, 0x6e,
+  0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x64, 0x65, 0x63, 0x6f, 0x64, 0x65, 0x5f,
+  0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b,
+  0x30, 0x5d, 0x20, 0x3d, 0x20, 0x6c, 0x75, 0x74, 0x5b, 0x74, 0x2e, 0x78,
+  0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20,
+  0x6c, 0x75, 0x74, 0x5b, 0x74, 0x2e, 0x79, 0x5d, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f,
+  0x6c, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x6c, 0x75, 0x74, 0x5b, 0x74,
+  0x2e, 0x7a, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45,
+  0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x53, 0x52, 0x47,
+  0x42, 0x38, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x30, 0x5d, 0x20, 0x3d,
+  0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x64, 0x65, 0x63, 0x6f,
+  0x64, 0x65, 0x5f, 0x73, 0x72, 0x67, 0x62, 0x5b, 0x73, 0x72, 0x63, 0x5b,
+  0x30, 0x5d, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x31, 0x5d, 0x20,
+  0x3d, 0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x64, 0x65, 0x63,
+  0x6f, 0x64, 0x65, 0x5f, 0x73, 0x72, 0x67, 0x62, 0x5b, 0x73, 0x72, 0x63,
+  0x5b, 0x31, 0x5d, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x32, 0x5d,
+  0x20, 0x3d, 0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x64, 0x65,
+  0x63, 0x6f, 0x64, 0x65, 0x5f, 0x73, 0x72, 0x67, 0x62, 0x5b, 0x73, 0x72,
+  0x63, 0x5b, 0x32, 0x5d, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x65,
+  0x66, 0x61, 0x75, 0x6c, 0x74, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x30,
+  0x5d, 0x20, 0x3d, 0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x64,
+  0x65, 0x63, 0x6f, 0x64, 0x65, 0x5f, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72,
+  0x5b, 0x73, 0x72, 0x63, 0x5b, 0x30, 0x5d, 0x5d, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f,
+  0x6c, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d,
+  0x38, 0x5f, 0x64, 0x65, 0x63, 0x6f, 0x64, 0x65, 0x5f, 0x6c, 0x69, 0x6e,
+  0x65, 0x61, 0x72, 0x5b, 0x73, 0x72, 0x63, 0x5b, 0x31, 0x5d, 0x5d, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x75, 0x6e,
+  0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x64, 0x65, 0x63, 0x6f, 0x64, 0x65, 0x5f,
+  0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x5b, 0x73, 0x72, 0x63, 0x5b, 0x32,
+  0x5d, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69,
+  0x63, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x75, 0x6e,
+  0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x76, 0x20, 0x3c,
+  0x3d, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x20, 0x3f, 0x20, 0x30, 0x20, 0x3a,
+  0x20, 0x76, 0x20, 0x3e, 0x3d, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x3f,
+  0x20, 0x32, 0x35, 0x35, 0x20, 0x3a, 0x20, 0x28, 0x75, 0x69, 0x6e, 0x74,
+  0x38, 0x5f, 0x74, 0x29, 0x28, 0x76, 0x20, 0x2a, 0x20, 0x32, 0x35, 0x35,
+  0x2e, 0x30, 0x66, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74,
+  0x69, 0x63, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x73,
+  0x72, 0x67, 0x62, 0x38, 0x5f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x63,
+  0x6f, 0x64, 0x65, 0x20, 0x3d, 0x20, 0x30, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x66, 0x6f, 0x72, 0x20, 0x28, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32,
+  0x5f, 0x74, 0x20, 0x73, 0x74, 0x65, 0x70, 0x20, 0x3d, 0x20, 0x31, 0x32,
+  0x38, 0x3b, 0x20, 0x73, 0x74, 0x65, 0x70, 0x20, 0x3e, 0x20, 0x30, 0x3b,
+  0x20, 0x73, 0x74, 0x65, 0x70, 0x20, 0x3e, 0x3e, 0x3d, 0x20, 0x31, 0x29,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x69, 0x66, 0x20,
+  0x28, 0x76, 0x20, 0x3e, 0x3d, 0x20, 0x73, 0x72, 0x67, 0x62, 0x38, 0x5f,
+  0x65, 0x6e, 0x63, 0x6f, 0x64, 0x65, 0x5f, 0x74, 0x68, 0x72, 0x65, 0x73,
+  0x68, 0x6f, 0x6c, 0x64, 0x73, 0x5b, 0x63, 0x6f, 0x64, 0x65, 0x20, 0x2b,
+  0x20, 0x73, 0x74, 0x65, 0x70, 0x20, 0x2d, 0x20, 0x31, 0x5d, 0x29, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x6f, 0x64, 0x65, 0x20, 0x2b, 0x3d, 0x20, 0x73, 0x74, 0x65, 0x70,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e,
+  0x20, 0x28, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x29, 0x63, 0x6f,
+  0x64, 0x65, 0x3b, 0x0a, 0x7d, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f,
+  0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62,
+  0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20,
+  0x64, 0x73, 0x74, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20,
+  0x66, 0x6d, 0x74, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x76, 0x61, 0x6c, 0x5b, 0x33, 0x5d, 0x29, 0x0a, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69, 0x74, 0x63, 0x68, 0x20,
+  0x28, 0x66, 0x6d, 0x74, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f,
+  0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x31, 0x36,
+  0x46, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41,
+  0x54, 0x5f, 0x52, 0x47, 0x42, 0x41, 0x31, 0x36, 0x46, 0x3a, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x76,
+  0x73, 0x74, 0x6f, 0x72, 0x65, 0x5f, 0x68, 0x61, 0x6c, 0x66, 0x5f, 0x72,
+  0x74, 0x65, 0x28, 0x76, 0x61, 0x6c, 0x5b, 0x30, 0x5d, 0x2c, 0x20, 0x30,
+  0x2c, 0x20, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20,
+  0x68, 0x61, 0x6c, 0x66, 0x2a, 0x29, 0x28, 0x64, 0x73, 0x74, 0x29, 0x29,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x76, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x5f, 0x68, 0x61, 0x6c,
+  0x66, 0x5f, 0x72, 0x74, 0x65, 0x28, 0x76, 0x61, 0x6c, 0x5b, 0x31, 0x5d,
+  0x2c, 0x20, 0x31, 0x2c, 0x20, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62,
+  0x61, 0x6c, 0x20, 0x68, 0x61, 0x6c, 0x66, 0x2a, 0x29, 0x28, 0x64, 0x73,
+  0x74, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x76, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x5f,
+  0x68, 0x61, 0x6c, 0x66, 0x5f, 0x72, 0x74, 0x65, 0x28, 0x76, 0x61, 0x6c,
+  0x5b, 0x32, 0x5d, 0x2c, 0x20, 0x32, 0x2c, 0x20, 0x28, 0x5f, 0x5f, 0x67,
+  0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x68, 0x61, 0x6c, 0x66, 0x2a, 0x29,
+  0x28, 0x64, 0x73, 0x74, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x69, 0x66, 0x20, 0x28,
+  0x66, 0x6d, 0x74, 0x20, 0x3d, 0x3d, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f,
+  0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x41, 0x31, 0x36, 0x46,
+  0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x76, 0x73, 0x74, 0x6f, 0x72, 0x65,
+  0x5f, 0x68, 0x61, 0x6c, 0x66, 0x5f, 0x72, 0x74, 0x65, 0x28, 0x31, 0x2e,
+  0x30, 0x66, 0x2c, 0x20, 0x33, 0x2c, 0x20, 0x28, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x68, 0x61, 0x6c, 0x66, 0x2a, 0x29, 0x28,
+  0x64, 0x73, 0x74, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61,
+  0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54,
+  0x5f, 0x52, 0x47, 0x42, 0x33, 0x32, 0x46, 0x3a, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d,
+  0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x41,
+  0x33, 0x32, 0x46, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x28, 0x28, 0x28, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x29,
+  0x28, 0x64, 0x73, 0x74, 0x29, 0x29, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x76, 0x61, 0x6c, 0x5b, 0x30, 0x5d, 0x29, 0x29, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x28,
+  0x28, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x29, 0x28, 0x64, 0x73, 0x74, 0x29, 0x29,
+  0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x76, 0x61, 0x6c, 0x5b, 0x31,
+  0x5d, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x28, 0x28, 0x28, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x29,
+  0x28, 0x64, 0x73, 0x74, 0x29, 0x29, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x76, 0x61, 0x6c, 0x5b, 0x32, 0x5d, 0x29, 0x29, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x69,
+  0x66, 0x20, 0x28, 0x66, 0x6d, 0x74, 0x20, 0x3d, 0x3d, 0x20, 0x45, 0x4d,
+  0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x52, 0x47, 0x42, 0x41,
+  0x33, 0x32, 0x46, 0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x28, 0x28, 0x28,
+  0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x2a, 0x29, 0x28, 0x64, 0x73, 0x74, 0x29, 0x29, 0x5b, 0x33,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x31, 0x2e, 0x30, 0x66, 0x29, 0x29, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f,
+  0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f, 0x53, 0x52, 0x47, 0x42, 0x38,
+  0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61,
+  0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54,
+  0x5f, 0x53, 0x52, 0x47, 0x42, 0x38, 0x5f, 0x41, 0x38, 0x3a, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64,
+  0x73, 0x74, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x73, 0x72, 0x67, 0x62,
+  0x38, 0x5f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x76, 0x61, 0x6c, 0x5b,
+  0x30, 0x5d, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x73, 0x74, 0x5b, 0x31, 0x5d, 0x20,
+  0x3d, 0x20, 0x73, 0x72, 0x67, 0x62, 0x38, 0x5f, 0x73, 0x74, 0x6f, 0x72,
+  0x65, 0x28, 0x76, 0x61, 0x6c, 0x5b, 0x31, 0x5d, 0x29, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64,
+  0x73, 0x74, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x73, 0x72, 0x67, 0x62,
+  0x38, 0x5f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x76, 0x61, 0x6c, 0x5b,
+  0x32, 0x5d, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x66, 0x6d, 0x74,
+  0x20, 0x3d, 0x3d, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41,
+  0x54, 0x5f, 0x53, 0x52, 0x47, 0x42, 0x38, 0x5f, 0x41, 0x38, 0x29, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x64, 0x73, 0x74, 0x5b, 0x33, 0x5d, 0x20, 0x3d,
+  0x20, 0x32, 0x35, 0x35, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x65, 0x66,
+  0x61, 0x75, 0x6c, 0x74, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x73, 0x74, 0x5b, 0x30, 0x5d,
+  0x20, 0x3d, 0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x73, 0x74,
+  0x6f, 0x72, 0x65, 0x28, 0x76, 0x61, 0x6c, 0x5b, 0x30, 0x5d, 0x29, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x64, 0x73, 0x74, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x75, 0x6e,
+  0x6f, 0x72, 0x6d, 0x38, 0x5f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x76,
+  0x61, 0x6c, 0x5b, 0x31, 0x5d, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x73, 0x74, 0x5b,
+  0x32, 0x5d, 0x20, 0x3d, 0x20, 0x75, 0x6e, 0x6f, 0x72, 0x6d, 0x38, 0x5f,
+  0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x76, 0x61, 0x6c, 0x5b, 0x32, 0x5d,
+  0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x66, 0x6d, 0x74, 0x20, 0x3d,
+  0x3d, 0x20, 0x45, 0x4d, 0x5f, 0x46, 0x4f, 0x52, 0x4d, 0x41, 0x54, 0x5f,
+  0x52, 0x38, 0x47, 0x38, 0x42, 0x38, 0x41, 0x38, 0x29, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x64, 0x73, 0x74, 0x5b, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x32,
+  0x35, 0x35, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x5f, 0x5f, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x61, 0x6e, 0x74, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f,
+  0x74, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6e, 0x65,
+  0x69, 0x67, 0x68, 0x62, 0x6f, 0x75, 0x72, 0x73, 0x5b, 0x36, 0x5d, 0x5b,
+  0x34, 0x5d, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f,
+  0x53, 0x5f, 0x5a, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45,
+  0x5f, 0x52, 0x49, 0x47, 0x48, 0x54, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46,
+  0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x5a, 0x2c, 0x20, 0x43,
+  0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x4c, 0x45, 0x46, 0x54, 0x20,
+  0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53,
+  0x5f, 0x59, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f,
+  0x52, 0x49, 0x47, 0x48, 0x54, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41,
+  0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x59, 0x2c, 0x20, 0x43, 0x4d,
+  0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x52, 0x49, 0x47, 0x48, 0x54, 0x20,
+  0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45,
+  0x47, 0x5f, 0x5a, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45,
+  0x5f, 0x52, 0x49, 0x47, 0x48, 0x54, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46,
+  0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x5a, 0x2c, 0x20, 0x43,
+  0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x4c, 0x45, 0x46, 0x54, 0x20,
+  0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53,
+  0x5f, 0x59, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f,
+  0x4c, 0x45, 0x46, 0x54, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43,
+  0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x59, 0x2c, 0x20, 0x43, 0x4d, 0x5f,
+  0x45, 0x44, 0x47, 0x45, 0x5f, 0x4c, 0x45, 0x46, 0x54, 0x20, 0x7d, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20,
+  0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f,
+  0x58, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x54,
+  0x4f, 0x50, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f,
+  0x50, 0x4f, 0x53, 0x5f, 0x58, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44,
+  0x47, 0x45, 0x5f, 0x54, 0x4f, 0x50, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46,
+  0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x5a, 0x2c, 0x20, 0x43,
+  0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x54, 0x4f, 0x50, 0x20, 0x7d,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20,
+  0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f,
+  0x5a, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x54,
+  0x4f, 0x50, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45,
+  0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x58, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45,
+  0x44, 0x47, 0x45, 0x5f, 0x42, 0x4f, 0x54, 0x54, 0x4f, 0x4d, 0x20, 0x7d,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20,
+  0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f,
+  0x58, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x42,
+  0x4f, 0x54, 0x54, 0x4f, 0x4d, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41,
+  0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x5a, 0x2c, 0x20, 0x43, 0x4d,
+  0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x42, 0x4f, 0x54, 0x54, 0x4f, 0x4d,
+  0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45,
+  0x47, 0x5f, 0x5a, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45,
+  0x5f, 0x42, 0x4f, 0x54, 0x54, 0x4f, 0x4d, 0x20, 0x7d, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d,
+  0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x58, 0x2c,
+  0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x52, 0x49, 0x47,
+  0x48, 0x54, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f,
+  0x50, 0x4f, 0x53, 0x5f, 0x58, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44,
+  0x47, 0x45, 0x5f, 0x4c, 0x45, 0x46, 0x54, 0x20, 0x7d, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f,
+  0x46, 0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x59, 0x2c, 0x20,
+  0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x42, 0x4f, 0x54, 0x54,
+  0x4f, 0x4d, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f,
+  0x4e, 0x45, 0x47, 0x5f, 0x59, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44,
+  0x47, 0x45, 0x5f, 0x54, 0x4f, 0x50, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f,
+  0x46, 0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x58, 0x2c, 0x20,
+  0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x52, 0x49, 0x47, 0x48,
+  0x54, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e,
+  0x45, 0x47, 0x5f, 0x58, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47,
+  0x45, 0x5f, 0x4c, 0x45, 0x46, 0x54, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x43, 0x4d, 0x5f, 0x46,
+  0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x59, 0x2c, 0x20, 0x43,
+  0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x54, 0x4f, 0x50, 0x20, 0x7d,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20,
+  0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f,
+  0x59, 0x2c, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x42,
+  0x4f, 0x54, 0x54, 0x4f, 0x4d, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x7d, 0x0a, 0x7d, 0x3b, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63,
+  0x20, 0x5f, 0x5f, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x61, 0x6e, 0x74, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x73,
+  0x5b, 0x36, 0x5d, 0x5b, 0x33, 0x5d, 0x5b, 0x33, 0x5d, 0x20, 0x3d, 0x0a,
+  0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x2d, 0x31, 0x2e, 0x30, 0x66, 0x20,
+  0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x2d, 0x31, 0x2e, 0x30, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x31, 0x2e, 0x30, 0x66,
+  0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66,
+  0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x7b, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x66, 0x2c, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x30, 0x2e, 0x30,
+  0x66, 0x2c, 0x20, 0x2d, 0x31, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x7b, 0x20, 0x2d, 0x31, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20,
+  0x31, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x7d,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20,
+  0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x2c, 0x20,
+  0x30, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x20,
+  0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c,
+  0x20, 0x2d, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x30, 0x2e, 0x30, 0x66,
+  0x2c, 0x20, 0x2d, 0x31, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30,
+  0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x7b, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e,
+  0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x30, 0x2e,
+  0x30, 0x66, 0x2c, 0x20, 0x2d, 0x31, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x7b, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30,
+  0x2e, 0x30, 0x66, 0x2c, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20,
+  0x2d, 0x31, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c,
+  0x20, 0x30, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x7b, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c,
+  0x20, 0x2d, 0x31, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66,
+  0x20, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x7b, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x2c, 0x20, 0x30, 0x2e, 0x30, 0x66,
+  0x2c, 0x20, 0x2d, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x7d, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x3b, 0x0a, 0x73, 0x74, 0x61, 0x74,
+  0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x63, 0x6d, 0x5f, 0x76,
+  0x65, 0x63, 0x5f, 0x74, 0x6f, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f,
+  0x63, 0x6f, 0x6f, 0x72, 0x64, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76,
+  0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x75,
+  0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x76, 0x2c, 0x20, 0x5f, 0x5f,
+  0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x38, 0x5f, 0x74, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64,
+  0x78, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x2a, 0x20, 0x76, 0x65, 0x63, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x61, 0x62, 0x73, 0x5f, 0x76, 0x65, 0x63, 0x5b, 0x33, 0x5d, 0x20,
+  0x3d, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x66, 0x61, 0x62, 0x73, 0x28, 0x76, 0x65, 0x63, 0x5b, 0x30, 0x5d, 0x29,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x66, 0x61,
+  0x62, 0x73, 0x28, 0x76, 0x65, 0x63, 0x5b, 0x31, 0x5d, 0x29, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x66, 0x61, 0x62, 0x73,
+  0x28, 0x76, 0x65, 0x63, 0x5b, 0x32, 0x5d, 0x29, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x7d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x6d, 0x61, 0x78,
+  0x20, 0x3d, 0x20, 0x66, 0x6d, 0x61, 0x78, 0x28, 0x66, 0x6d, 0x61, 0x78,
+  0x28, 0x61, 0x62, 0x73, 0x5f, 0x76, 0x65, 0x63, 0x5b, 0x30, 0x5d, 0x2c,
+  0x20, 0x61, 0x62, 0x73, 0x5f, 0x76, 0x65, 0x63, 0x5b, 0x31, 0x5d, 0x29,
+  0x2c, 0x20, 0x61, 0x62, 0x73, 0x5f, 0x76, 0x65, 0x63, 0x5b, 0x32, 0x5d,
+  0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x6d,
+  0x61, 0x78, 0x20, 0x3d, 0x3d, 0x20, 0x61, 0x62, 0x73, 0x5f, 0x76, 0x65,
+  0x63, 0x5b, 0x30, 0x5d, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x2a, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64,
+  0x78, 0x20, 0x3d, 0x20, 0x28, 0x76, 0x65, 0x63, 0x5b, 0x30, 0x5d, 0x20,
+  0x3e, 0x3d, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x29, 0x20, 0x3f, 0x20, 0x28,
+  0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x29, 0x43, 0x4d, 0x5f, 0x46,
+  0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x58, 0x20, 0x3a, 0x20,
+  0x28, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x29, 0x43, 0x4d, 0x5f,
+  0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x58, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x7d, 0x20, 0x65, 0x6c, 0x73, 0x65, 0x20, 0x69,
+  0x66, 0x20, 0x28, 0x6d, 0x61, 0x78, 0x20, 0x3d, 0x3d, 0x20, 0x61, 0x62,
+  0x73, 0x5f, 0x76, 0x65, 0x63, 0x5b, 0x31, 0x5d, 0x29, 0x20, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x2a, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x69, 0x64, 0x78, 0x20, 0x3d, 0x20, 0x28, 0x76, 0x65, 0x63,
+  0x5b, 0x31, 0x5d, 0x20, 0x3e, 0x3d, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x29,
+  0x20, 0x3f, 0x20, 0x28, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x29,
+  0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x50, 0x4f, 0x53, 0x5f,
+  0x59, 0x20, 0x3a, 0x20, 0x28, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74,
+  0x29, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45, 0x47,
+  0x5f, 0x59, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x20, 0x65, 0x6c,
+  0x73, 0x65, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x2a, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x78, 0x20, 0x3d,
+  0x20, 0x28, 0x76, 0x65, 0x63, 0x5b, 0x32, 0x5d, 0x20, 0x3e, 0x3d, 0x20,
+  0x30, 0x2e, 0x30, 0x66, 0x29, 0x20, 0x3f, 0x20, 0x28, 0x75, 0x69, 0x6e,
+  0x74, 0x38, 0x5f, 0x74, 0x29, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45,
+  0x5f, 0x50, 0x4f, 0x53, 0x5f, 0x5a, 0x20, 0x3a, 0x20, 0x28, 0x75, 0x69,
+  0x6e, 0x74, 0x38, 0x5f, 0x74, 0x29, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43,
+  0x45, 0x5f, 0x4e, 0x45, 0x47, 0x5f, 0x5a, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x7d, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x76, 0x65, 0x63, 0x5b, 0x33, 0x5d,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x76,
+  0x65, 0x63, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x76, 0x65, 0x63, 0x5b,
+  0x30, 0x5d, 0x20, 0x2a, 0x20, 0x28, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x2f,
+  0x20, 0x6d, 0x61, 0x78, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x76, 0x65, 0x63, 0x5b, 0x31, 0x5d, 0x20, 0x3d,
+  0x20, 0x76, 0x65, 0x63, 0x5b, 0x31, 0x5d, 0x20, 0x2a, 0x20, 0x28, 0x31,
+  0x2e, 0x30, 0x66, 0x20, 0x2f, 0x20, 0x6d, 0x61, 0x78, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x76, 0x65, 0x63,
+  0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x76, 0x65, 0x63, 0x5b, 0x32, 0x5d,
+  0x20, 0x2a, 0x20, 0x28, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x2f, 0x20, 0x6d,
+  0x61, 0x78, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x2a, 0x75, 0x20,
+  0x3d, 0x20, 0x28, 0x64, 0x6f, 0x74, 0x28, 0x76, 0x6c, 0x6f, 0x61, 0x64,
+  0x33, 0x28, 0x30, 0x2c, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b,
+  0x2a, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x78, 0x5d, 0x5b, 0x30,
+  0x5d, 0x29, 0x2c, 0x20, 0x76, 0x6c, 0x6f, 0x61, 0x64, 0x33, 0x28, 0x30,
+  0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x76, 0x65, 0x63, 0x29, 0x29,
+  0x20, 0x2b, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x29, 0x20, 0x2a, 0x20, 0x30,
+  0x2e, 0x35, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x2a, 0x76, 0x20,
+  0x3d, 0x20, 0x28, 0x64, 0x6f, 0x74, 0x28, 0x76, 0x6c, 0x6f, 0x61, 0x64,
+  0x33, 0x28, 0x30, 0x2c, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b,
+  0x2a, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x78, 0x5d, 0x5b, 0x31,
+  0x5d, 0x29, 0x2c, 0x20, 0x76, 0x6c, 0x6f, 0x61, 0x64, 0x33, 0x28, 0x30,
+  0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x76, 0x65, 0x63, 0x29, 0x29,
+  0x20, 0x2b, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x29, 0x20, 0x2a, 0x20, 0x30,
+  0x2e, 0x35, 0x66, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69,
+  0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x63, 0x6d, 0x5f, 0x74, 0x65,
+  0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x5f, 0x74, 0x6f,
+  0x5f, 0x76, 0x65, 0x63, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x6f, 0x75,
+  0x74, 0x33, 0x66, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x75,
+  0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x2c, 0x20, 0x75,
+  0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x69, 0x64, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x6f, 0x75,
+  0x74, 0x33, 0x66, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x63, 0x6d, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74,
+  0x6f, 0x72, 0x73, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x5d,
+  0x5b, 0x30, 0x5d, 0x5b, 0x30, 0x5d, 0x20, 0x2a, 0x20, 0x75, 0x20, 0x2b,
+  0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f,
+  0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x69, 0x64, 0x5d, 0x5b, 0x31, 0x5d, 0x5b, 0x30, 0x5d, 0x20, 0x2a,
+  0x20, 0x76, 0x20, 0x2b, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x5d, 0x5b, 0x32, 0x5d, 0x5b,
+  0x30, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x6f, 0x75, 0x74, 0x33,
+  0x66, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72,
+  0x73, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x5d, 0x5b, 0x30,
+  0x5d, 0x5b, 0x31, 0x5d, 0x20, 0x2a, 0x20, 0x75, 0x20, 0x2b, 0x20, 0x63,
+  0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65,
+  0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69,
+  0x64, 0x5d, 0x5b, 0x31, 0x5d, 0x5b, 0x31, 0x5d, 0x20, 0x2a, 0x20, 0x76,
+  0x20, 0x2b, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x75,
+  0x76, 0x5f, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x69, 0x64, 0x5d, 0x5b, 0x32, 0x5d, 0x5b, 0x31, 0x5d,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x5b,
+  0x32, 0x5d, 0x20, 0x3d, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x5d, 0x5b, 0x30, 0x5d, 0x5b,
+  0x32, 0x5d, 0x20, 0x2a, 0x20, 0x75, 0x20, 0x2b, 0x20, 0x63, 0x6d, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74,
+  0x6f, 0x72, 0x73, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x5d,
+  0x5b, 0x31, 0x5d, 0x5b, 0x32, 0x5d, 0x20, 0x2a, 0x20, 0x76, 0x20, 0x2b,
+  0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f,
+  0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x69, 0x64, 0x5d, 0x5b, 0x32, 0x5d, 0x5b, 0x32, 0x5d, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x69, 0x6e, 0x76, 0x5f, 0x6c, 0x65, 0x6e, 0x20,
+  0x3d, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x2f, 0x20, 0x73, 0x71, 0x72,
+  0x74, 0x28, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x5b, 0x30, 0x5d, 0x20, 0x2a,
+  0x20, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x5b, 0x30, 0x5d, 0x20, 0x2b, 0x20,
+  0x6f, 0x75, 0x74, 0x33, 0x66, 0x5b, 0x31, 0x5d, 0x20, 0x2a, 0x20, 0x6f,
+  0x75, 0x74, 0x33, 0x66, 0x5b, 0x31, 0x5d, 0x20, 0x2b, 0x20, 0x6f, 0x75,
+  0x74, 0x33, 0x66, 0x5b, 0x32, 0x5d, 0x20, 0x2a, 0x20, 0x6f, 0x75, 0x74,
+  0x33, 0x66, 0x5b, 0x32, 0x5d, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x6f, 0x75, 0x74, 0x33, 0x66, 0x5b, 0x30, 0x5d, 0x20, 0x2a, 0x3d, 0x20,
+  0x69, 0x6e, 0x76, 0x5f, 0x6c, 0x65, 0x6e, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x5b, 0x31, 0x5d, 0x20, 0x2a, 0x3d,
+  0x20, 0x69, 0x6e, 0x76, 0x5f, 0x6c, 0x65, 0x6e, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x5b, 0x32, 0x5d, 0x20, 0x2a,
+  0x3d, 0x20, 0x69, 0x6e, 0x76, 0x5f, 0x6c, 0x65, 0x6e, 0x3b, 0x0a, 0x7d,
+  0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64,
+  0x20, 0x63, 0x6d, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x77, 0x72,
+  0x61, 0x70, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65,
+  0x20, 0x69, 0x6e, 0x74, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x69, 0x6e,
+  0x74, 0x2a, 0x20, 0x78, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76,
+  0x61, 0x74, 0x65, 0x20, 0x69, 0x6e, 0x74, 0x2a, 0x20, 0x79, 0x2c, 0x20,
+  0x69, 0x6e, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x69, 0x6e, 0x74,
+  0x20, 0x65, 0x64, 0x67, 0x65, 0x2c, 0x20, 0x64, 0x65, 0x70, 0x74, 0x68,
+  0x2c, 0x20, 0x61, 0x6c, 0x6f, 0x6e, 0x67, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x69, 0x66, 0x20, 0x28, 0x2a, 0x78, 0x20, 0x3c, 0x20, 0x30, 0x29,
+  0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x65,
+  0x64, 0x67, 0x65, 0x20, 0x3d, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47,
+  0x45, 0x5f, 0x4c, 0x45, 0x46, 0x54, 0x3b, 0x20, 0x64, 0x65, 0x70, 0x74,
+  0x68, 0x20, 0x3d, 0x20, 0x2d, 0x31, 0x20, 0x2d, 0x20, 0x2a, 0x78, 0x3b,
+  0x20, 0x61, 0x6c, 0x6f, 0x6e, 0x67, 0x20, 0x3d, 0x20, 0x2a, 0x79, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x20, 0x65, 0x6c, 0x73, 0x65, 0x20,
+  0x69, 0x66, 0x20, 0x28, 0x2a, 0x78, 0x20, 0x3e, 0x3d, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x20, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x65, 0x64, 0x67, 0x65, 0x20,
+  0x3d, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x52, 0x49,
+  0x47, 0x48, 0x54, 0x3b, 0x20, 0x64, 0x65, 0x70, 0x74, 0x68, 0x20, 0x3d,
+  0x20, 0x2a, 0x78, 0x20, 0x2d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x3b, 0x20, 0x61, 0x6c, 0x6f, 0x6e, 0x67, 0x20, 0x3d,
+  0x20, 0x2a, 0x79, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x20, 0x65,
+  0x6c, 0x73, 0x65, 0x20, 0x69, 0x66, 0x20, 0x28, 0x2a, 0x79, 0x20, 0x3c,
+  0x20, 0x30, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x65, 0x64, 0x67, 0x65, 0x20, 0x3d, 0x20, 0x43, 0x4d, 0x5f,
+  0x45, 0x44, 0x47, 0x45, 0x5f, 0x54, 0x4f, 0x50, 0x3b, 0x20, 0x64, 0x65,
+  0x70, 0x74, 0x68, 0x20, 0x3d, 0x20, 0x2d, 0x31, 0x20, 0x2d, 0x20, 0x2a,
+  0x79, 0x3b, 0x20, 0x61, 0x6c, 0x6f, 0x6e, 0x67, 0x20, 0x3d, 0x20, 0x2a,
+  0x78, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x20, 0x65, 0x6c, 0x73,
+  0x65, 0x20, 0x69, 0x66, 0x20, 0x28, 0x2a, 0x79, 0x20, 0x3e, 0x3d, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x20, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x65, 0x64, 0x67,
+  0x65, 0x20, 0x3d, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f,
+  0x42, 0x4f, 0x54, 0x54, 0x4f, 0x4d, 0x3b, 0x20, 0x64, 0x65, 0x70, 0x74,
+  0x68, 0x20, 0x3d, 0x20, 0x2a, 0x79, 0x20, 0x2d, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b, 0x20, 0x61, 0x6c, 0x6f, 0x6e,
+  0x67, 0x20, 0x3d, 0x20, 0x2a, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x7d, 0x20, 0x65, 0x6c, 0x73, 0x65, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x6e, 0x66, 0x61,
+  0x63, 0x65, 0x20, 0x3d, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x6e, 0x65, 0x69, 0x67, 0x68, 0x62, 0x6f, 0x75, 0x72, 0x73, 0x5b,
+  0x2a, 0x66, 0x61, 0x63, 0x65, 0x5d, 0x5b, 0x65, 0x64, 0x67, 0x65, 0x5d,
+  0x5b, 0x30, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x6e, 0x65, 0x64, 0x67, 0x65,
+  0x20, 0x3d, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6e,
+  0x65, 0x69, 0x67, 0x68, 0x62, 0x6f, 0x75, 0x72, 0x73, 0x5b, 0x2a, 0x66,
+  0x61, 0x63, 0x65, 0x5d, 0x5b, 0x65, 0x64, 0x67, 0x65, 0x5d, 0x5b, 0x31,
+  0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x69, 0x6e, 0x74, 0x20, 0x61, 0x78, 0x69, 0x73, 0x20, 0x3d, 0x20,
+  0x65, 0x64, 0x67, 0x65, 0x20, 0x3c, 0x3d, 0x20, 0x43, 0x4d, 0x5f, 0x45,
+  0x44, 0x47, 0x45, 0x5f, 0x52, 0x49, 0x47, 0x48, 0x54, 0x20, 0x3f, 0x20,
+  0x31, 0x20, 0x3a, 0x20, 0x30, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x6e, 0x61, 0x78,
+  0x69, 0x73, 0x20, 0x3d, 0x20, 0x6e, 0x65, 0x64, 0x67, 0x65, 0x20, 0x3c,
+  0x3d, 0x20, 0x43, 0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x52, 0x49,
+  0x47, 0x48, 0x54, 0x20, 0x3f, 0x20, 0x31, 0x20, 0x3a, 0x20, 0x30, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x64, 0x6f, 0x74,
+  0x28, 0x76, 0x6c, 0x6f, 0x61, 0x64, 0x33, 0x28, 0x30, 0x2c, 0x20, 0x63,
+  0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65,
+  0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b, 0x2a, 0x66, 0x61, 0x63, 0x65, 0x5d,
+  0x5b, 0x61, 0x78, 0x69, 0x73, 0x5d, 0x29, 0x2c, 0x20, 0x76, 0x6c, 0x6f,
+  0x61, 0x64, 0x33, 0x28, 0x30, 0x2c, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72,
+  0x73, 0x5b, 0x6e, 0x66, 0x61, 0x63, 0x65, 0x5d, 0x5b, 0x6e, 0x61, 0x78,
+  0x69, 0x73, 0x5d, 0x29, 0x29, 0x20, 0x3c, 0x20, 0x30, 0x2e, 0x30, 0x66,
+  0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x61, 0x6c,
+  0x6f, 0x6e, 0x67, 0x20, 0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x20, 0x2d, 0x20, 0x31, 0x20, 0x2d, 0x20, 0x61, 0x6c,
+  0x6f, 0x6e, 0x67, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x2a, 0x66, 0x61,
+  0x63, 0x65, 0x20, 0x3d, 0x20, 0x6e, 0x66, 0x61, 0x63, 0x65, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69, 0x74, 0x63, 0x68, 0x20, 0x28,
+  0x6e, 0x65, 0x64, 0x67, 0x65, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x43, 0x4d,
+  0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x4c, 0x45, 0x46, 0x54, 0x3a, 0x20,
+  0x2a, 0x78, 0x20, 0x3d, 0x20, 0x64, 0x65, 0x70, 0x74, 0x68, 0x3b, 0x20,
+  0x2a, 0x79, 0x20, 0x3d, 0x20, 0x61, 0x6c, 0x6f, 0x6e, 0x67, 0x3b, 0x20,
+  0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x43, 0x4d, 0x5f, 0x45,
+  0x44, 0x47, 0x45, 0x5f, 0x52, 0x49, 0x47, 0x48, 0x54, 0x3a, 0x20, 0x2a,
+  0x78, 0x20, 0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x20, 0x2d, 0x20, 0x31, 0x20, 0x2d, 0x20, 0x64, 0x65, 0x70, 0x74,
+  0x68, 0x3b, 0x20, 0x2a, 0x79, 0x20, 0x3d, 0x20, 0x61, 0x6c, 0x6f, 0x6e,
+  0x67, 0x3b, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x43,
+  0x4d, 0x5f, 0x45, 0x44, 0x47, 0x45, 0x5f, 0x54, 0x4f, 0x50, 0x3a, 0x20,
+  0x2a, 0x78, 0x20, 0x3d, 0x20, 0x61, 0x6c, 0x6f, 0x6e, 0x67, 0x3b, 0x20,
+  0x2a, 0x79, 0x20, 0x3d, 0x20, 0x64, 0x65, 0x70, 0x74, 0x68, 0x3b, 0x20,
+  0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x43, 0x4d, 0x5f, 0x45,
+  0x44, 0x47, 0x45, 0x5f, 0x42, 0x4f, 0x54, 0x54, 0x4f, 0x4d, 0x3a, 0x20,
+  0x2a, 0x78, 0x20, 0x3d, 0x20, 0x61, 0x6c, 0x6f, 0x6e, 0x67, 0x3b, 0x20,
+  0x2a, 0x79, 0x20, 0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69,
+  0x7a, 0x65, 0x20, 0x2d, 0x20, 0x31, 0x20, 0x2d, 0x20, 0x64, 0x65, 0x70,
+  0x74, 0x68, 0x3b, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69,
+  0x63, 0x20, 0x5f, 0x5f, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x61, 0x6e, 0x74,
+  0x20, 0x69, 0x6e, 0x74, 0x20, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x6d, 0x61, 0x70, 0x5b, 0x36, 0x5d, 0x5b,
+  0x32, 0x5d, 0x20, 0x3d, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x32, 0x2c, 0x20, 0x31, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x30, 0x2c, 0x20, 0x31, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x31, 0x2c, 0x20, 0x30, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x31, 0x2c, 0x20, 0x32, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x31, 0x2c, 0x20, 0x31, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x33, 0x2c, 0x20, 0x31, 0x7d, 0x0a, 0x7d, 0x3b, 0x0a, 0x73, 0x74, 0x61,
+  0x74, 0x69, 0x63, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x68,
+  0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6f,
+  0x66, 0x66, 0x73, 0x65, 0x74, 0x28, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x2c, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x0a, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x73,
+  0x74, 0x72, 0x69, 0x64, 0x65, 0x20, 0x3d, 0x20, 0x34, 0x20, 0x2a, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x68, 0x63,
+  0x72, 0x6f, 0x73, 0x73, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6d, 0x61,
+  0x70, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5d, 0x5b, 0x31, 0x5d, 0x20, 0x2a,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x2a,
+  0x20, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x20, 0x2b, 0x20, 0x68, 0x63,
+  0x72, 0x6f, 0x73, 0x73, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6d, 0x61,
+  0x70, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5d, 0x5b, 0x30, 0x5d, 0x20, 0x2a,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b, 0x0a,
+  0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x5f, 0x5f, 0x67,
+  0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f,
+  0x74, 0x2a, 0x20, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x70, 0x69,
+  0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74,
+  0x2a, 0x20, 0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x79, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x63, 0x75, 0x62, 0x65, 0x6d, 0x61, 0x70, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x69,
+  0x6e, 0x74, 0x20, 0x62, 0x70, 0x70, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x73, 0x74, 0x72,
+  0x69, 0x64, 0x65, 0x20, 0x3d, 0x20, 0x34, 0x20, 0x2a, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x6f, 0x66, 0x66, 0x73,
+  0x65, 0x74, 0x20, 0x3d, 0x20, 0x28, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73,
+  0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74,
+  0x28, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x73, 0x69, 0x7a, 0x65, 0x29, 0x20, 0x2b, 0x20, 0x79, 0x20, 0x2a, 0x20,
+  0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x20, 0x2b, 0x20, 0x78, 0x29, 0x20,
+  0x2a, 0x20, 0x62, 0x70, 0x70, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x5f,
+  0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x38, 0x5f, 0x74, 0x2a, 0x20, 0x64, 0x61, 0x74, 0x61, 0x20, 0x3d, 0x20,
+  0x62, 0x61, 0x73, 0x65, 0x20, 0x2b, 0x20, 0x6f, 0x66, 0x66, 0x73, 0x65,
+  0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72,
+  0x6e, 0x20, 0x64, 0x61, 0x74, 0x61, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74,
+  0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x61,
+  0x6d, 0x70, 0x6c, 0x65, 0x5f, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f,
+  0x6d, 0x61, 0x70, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x63, 0x6f,
+  0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62,
+  0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20,
+  0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x75,
+  0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72,
+  0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20, 0x5f, 0x5f, 0x70,
+  0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x65, 0x63, 0x5b, 0x33,
+  0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x75, 0x2c, 0x20, 0x76, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x69, 0x64, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x6d, 0x5f, 0x76, 0x65, 0x63, 0x5f, 0x74, 0x6f, 0x5f, 0x74, 0x65, 0x78,
+  0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x28, 0x26, 0x75, 0x2c,
+  0x20, 0x26, 0x76, 0x2c, 0x20, 0x26, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69,
+  0x64, 0x78, 0x2c, 0x20, 0x76, 0x65, 0x63, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x78, 0x20, 0x3d, 0x20, 0x75, 0x20,
+  0x2a, 0x20, 0x28, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65,
+  0x20, 0x2d, 0x20, 0x31, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x69,
+  0x6e, 0x74, 0x20, 0x79, 0x20, 0x3d, 0x20, 0x76, 0x20, 0x2a, 0x20, 0x28,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x2d, 0x20,
+  0x31, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x69, 0x7a, 0x65,
+  0x5f, 0x74, 0x20, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x20, 0x3d, 0x20,
+  0x34, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f,
+  0x74, 0x20, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x20, 0x3d, 0x20, 0x28,
+  0x68, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x28, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x69, 0x64, 0x78, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69,
+  0x7a, 0x65, 0x29, 0x20, 0x2b, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x73, 0x74,
+  0x72, 0x69, 0x64, 0x65, 0x20, 0x2b, 0x20, 0x78, 0x29, 0x20, 0x2a, 0x20,
+  0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61,
+  0x74, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x66, 0x6d, 0x74, 0x29, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61,
+  0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x64,
+  0x61, 0x74, 0x61, 0x20, 0x3d, 0x20, 0x62, 0x61, 0x73, 0x65, 0x20, 0x2b,
+  0x20, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78, 0x65,
+  0x6c, 0x5f, 0x6c, 0x6f, 0x61, 0x64, 0x28, 0x63, 0x6f, 0x6c, 0x2c, 0x20,
+  0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x66, 0x6d, 0x74, 0x29, 0x3b, 0x0a,
+  0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69,
+  0x64, 0x20, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x73, 0x65, 0x74,
+  0x70, 0x69, 0x78, 0x65, 0x6c, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62,
+  0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20,
+  0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32,
+  0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65,
+  0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74,
+  0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x78,
+  0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x79,
+  0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x63, 0x75, 0x62, 0x65, 0x6d,
+  0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x20, 0x66, 0x61, 0x63, 0x65,
+  0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x61, 0x6c, 0x5b,
+  0x33, 0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x69,
+  0x7a, 0x65, 0x5f, 0x74, 0x20, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x20,
+  0x3d, 0x20, 0x34, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67,
+  0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f,
+  0x74, 0x2a, 0x20, 0x64, 0x73, 0x74, 0x20, 0x3d, 0x20, 0x62, 0x61, 0x73,
+  0x65, 0x20, 0x2b, 0x20, 0x28, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x28,
+  0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x29, 0x20, 0x2b, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x73,
+  0x74, 0x72, 0x69, 0x64, 0x65, 0x20, 0x2b, 0x20, 0x78, 0x29, 0x20, 0x2a,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d,
+  0x61, 0x74, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x66, 0x6d, 0x74, 0x29,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x73, 0x74, 0x6f, 0x72, 0x65,
+  0x28, 0x64, 0x73, 0x74, 0x2c, 0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20, 0x76,
+  0x61, 0x6c, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69,
+  0x63, 0x20, 0x5f, 0x5f, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x61, 0x6e, 0x74,
+  0x20, 0x69, 0x6e, 0x74, 0x20, 0x76, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x6d, 0x61, 0x70, 0x5b, 0x36, 0x5d, 0x5b,
+  0x32, 0x5d, 0x20, 0x3d, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x32, 0x2c, 0x20, 0x31, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x30, 0x2c, 0x20, 0x31, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x31, 0x2c, 0x20, 0x30, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x31, 0x2c, 0x20, 0x32, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x31, 0x2c, 0x20, 0x31, 0x7d, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7b,
+  0x31, 0x2c, 0x20, 0x33, 0x7d, 0x0a, 0x7d, 0x3b, 0x0a, 0x73, 0x74, 0x61,
+  0x74, 0x69, 0x63, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x76,
+  0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6f,
+  0x66, 0x66, 0x73, 0x65, 0x74, 0x28, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x2c, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x0a, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x73,
+  0x74, 0x72, 0x69, 0x64, 0x65, 0x20, 0x3d, 0x20, 0x33, 0x20, 0x2a, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x76, 0x63,
+  0x72, 0x6f, 0x73, 0x73, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6d, 0x61,
+  0x70, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5d, 0x5b, 0x31, 0x5d, 0x20, 0x2a,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x2a,
+  0x20, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x20, 0x2b, 0x20, 0x76, 0x63,
+  0x72, 0x6f, 0x73, 0x73, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6d, 0x61,
+  0x70, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5d, 0x5b, 0x30, 0x5d, 0x20, 0x2a,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b, 0x0a,
+  0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x5f, 0x5f, 0x67,
+  0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f,
+  0x74, 0x2a, 0x20, 0x76, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x70, 0x69,
+  0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74,
+  0x2a, 0x20, 0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x79, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x63, 0x75, 0x62, 0x65, 0x6d, 0x61, 0x70, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x69,
+  0x6e, 0x74, 0x20, 0x62, 0x70, 0x70, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x66, 0x61, 0x63, 0x65, 0x20, 0x3d,
+  0x3d, 0x20, 0x43, 0x4d, 0x5f, 0x46, 0x41, 0x43, 0x45, 0x5f, 0x4e, 0x45,
+  0x47, 0x5f, 0x5a, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x78, 0x20, 0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x73, 0x69, 0x7a, 0x65, 0x20, 0x2d, 0x20, 0x31, 0x20, 0x2d, 0x20, 0x78,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x79, 0x20,
+  0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20,
+  0x2d, 0x20, 0x31, 0x20, 0x2d, 0x20, 0x79, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x7d, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f,
+  0x74, 0x20, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x20, 0x3d, 0x20, 0x33,
+  0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74,
+  0x20, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x20, 0x3d, 0x20, 0x28, 0x76,
+  0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6f,
+  0x66, 0x66, 0x73, 0x65, 0x74, 0x28, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x20, 0x2b,
+  0x20, 0x79, 0x20, 0x2a, 0x20, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x20,
+  0x2b, 0x20, 0x78, 0x29, 0x20, 0x2a, 0x20, 0x62, 0x70, 0x70, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x64, 0x61,
+  0x74, 0x61, 0x20, 0x3d, 0x20, 0x62, 0x61, 0x73, 0x65, 0x20, 0x2b, 0x20,
+  0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x64, 0x61, 0x74, 0x61, 0x3b,
+  0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x73, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x5f, 0x76, 0x63,
+  0x72, 0x6f, 0x73, 0x73, 0x5f, 0x6d, 0x61, 0x70, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x5f,
+  0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x38, 0x5f, 0x74, 0x2a, 0x20, 0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x69,
+  0x6e, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65,
+  0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74,
+  0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x76, 0x65, 0x63, 0x5b, 0x33, 0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x75, 0x2c, 0x20, 0x76,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f,
+  0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x78, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x6d, 0x5f, 0x76, 0x65, 0x63, 0x5f, 0x74,
+  0x6f, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72,
+  0x64, 0x28, 0x26, 0x75, 0x2c, 0x20, 0x26, 0x76, 0x2c, 0x20, 0x26, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x78, 0x2c, 0x20, 0x76, 0x65, 0x63,
+  0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x78,
+  0x20, 0x3d, 0x20, 0x75, 0x20, 0x2a, 0x20, 0x28, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x2d, 0x20, 0x31, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x79, 0x20, 0x3d, 0x20,
+  0x76, 0x20, 0x2a, 0x20, 0x28, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69,
+  0x7a, 0x65, 0x20, 0x2d, 0x20, 0x31, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69,
+  0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x64, 0x61, 0x74, 0x61, 0x20,
+  0x3d, 0x20, 0x76, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x70, 0x69, 0x78,
+  0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28, 0x62, 0x61, 0x73, 0x65, 0x2c,
+  0x20, 0x78, 0x2c, 0x20, 0x79, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69,
+  0x64, 0x78, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66,
+  0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x66,
+  0x6d, 0x74, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x6c,
+  0x6f, 0x61, 0x64, 0x28, 0x63, 0x6f, 0x6c, 0x2c, 0x20, 0x64, 0x61, 0x74,
+  0x61, 0x2c, 0x20, 0x66, 0x6d, 0x74, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x73,
+  0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x76,
+  0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x73, 0x65, 0x74, 0x70, 0x69, 0x78,
+  0x65, 0x6c, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20,
+  0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x62, 0x61, 0x73,
+  0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66,
+  0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20, 0x75,
+  0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x78, 0x2c, 0x20, 0x75,
+  0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x79, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x63, 0x75, 0x62, 0x65, 0x6d, 0x61, 0x70, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x61, 0x6c, 0x5b, 0x33, 0x5d, 0x29,
+  0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f,
+  0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a,
+  0x20, 0x64, 0x73, 0x74, 0x20, 0x3d, 0x20, 0x76, 0x63, 0x72, 0x6f, 0x73,
+  0x73, 0x5f, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28,
+  0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x78, 0x2c, 0x20, 0x79, 0x2c, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28,
+  0x66, 0x6d, 0x74, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f,
+  0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x64, 0x73, 0x74, 0x2c, 0x20, 0x66,
+  0x6d, 0x74, 0x2c, 0x20, 0x76, 0x61, 0x6c, 0x29, 0x3b, 0x0a, 0x7d, 0x0a,
+  0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f,
+  0x74, 0x20, 0x76, 0x73, 0x74, 0x72, 0x69, 0x70, 0x5f, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x28, 0x69, 0x6e, 0x74,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f,
+  0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29,
+  0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72,
+  0x6e, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20,
+  0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20,
+  0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74,
+  0x61, 0x74, 0x69, 0x63, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61,
+  0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x76,
+  0x73, 0x74, 0x72, 0x69, 0x70, 0x5f, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x5f,
+  0x70, 0x74, 0x72, 0x28, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x62, 0x61,
+  0x73, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74,
+  0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74,
+  0x20, 0x79, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20,
+  0x63, 0x75, 0x62, 0x65, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x62,
+  0x70, 0x70, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x69,
+  0x7a, 0x65, 0x5f, 0x74, 0x20, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x20,
+  0x3d, 0x20, 0x28, 0x76, 0x73, 0x74, 0x72, 0x69, 0x70, 0x5f, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x28, 0x66, 0x61,
+  0x63, 0x65, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x29, 0x20, 0x2b, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x2b, 0x20, 0x78, 0x29, 0x20,
+  0x2a, 0x20, 0x62, 0x70, 0x70, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x5f,
+  0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x38, 0x5f, 0x74, 0x2a, 0x20, 0x64, 0x61, 0x74, 0x61, 0x20, 0x3d, 0x20,
+  0x62, 0x61, 0x73, 0x65, 0x20, 0x2b, 0x20, 0x6f, 0x66, 0x66, 0x73, 0x65,
+  0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72,
+  0x6e, 0x20, 0x64, 0x61, 0x74, 0x61, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74,
+  0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x61,
+  0x6d, 0x70, 0x6c, 0x65, 0x5f, 0x76, 0x73, 0x74, 0x72, 0x69, 0x70, 0x5f,
+  0x6d, 0x61, 0x70, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x63, 0x6f,
+  0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62,
+  0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20,
+  0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x75,
+  0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72,
+  0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20, 0x5f, 0x5f, 0x70,
+  0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x65, 0x63, 0x5b, 0x33,
+  0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x75, 0x2c, 0x20, 0x76, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x69, 0x64, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x6d, 0x5f, 0x76, 0x65, 0x63, 0x5f, 0x74, 0x6f, 0x5f, 0x74, 0x65, 0x78,
+  0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x28, 0x26, 0x75, 0x2c,
+  0x20, 0x26, 0x76, 0x2c, 0x20, 0x26, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69,
+  0x64, 0x78, 0x2c, 0x20, 0x76, 0x65, 0x63, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x78, 0x20, 0x3d, 0x20, 0x75, 0x20,
+  0x2a, 0x20, 0x28, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65,
+  0x20, 0x2d, 0x20, 0x31, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x69,
+  0x6e, 0x74, 0x20, 0x79, 0x20, 0x3d, 0x20, 0x76, 0x20, 0x2a, 0x20, 0x28,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x2d, 0x20,
+  0x31, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x69, 0x7a, 0x65,
+  0x5f, 0x74, 0x20, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x20, 0x3d, 0x20,
+  0x28, 0x76, 0x73, 0x74, 0x72, 0x69, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x28, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x69, 0x64, 0x78, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x29, 0x20, 0x2b, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x2b, 0x20, 0x78,
+  0x29, 0x20, 0x2a, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66,
+  0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x66,
+  0x6d, 0x74, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67,
+  0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f,
+  0x74, 0x2a, 0x20, 0x64, 0x61, 0x74, 0x61, 0x20, 0x3d, 0x20, 0x62, 0x61,
+  0x73, 0x65, 0x20, 0x2b, 0x20, 0x6f, 0x66, 0x66, 0x73, 0x65, 0x74, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x6c, 0x6f, 0x61, 0x64, 0x28, 0x63,
+  0x6f, 0x6c, 0x2c, 0x20, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x66, 0x6d,
+  0x74, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63,
+  0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x76, 0x73, 0x74, 0x72, 0x69, 0x70,
+  0x5f, 0x73, 0x65, 0x74, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x28, 0x5f, 0x5f,
+  0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38,
+  0x5f, 0x74, 0x2a, 0x20, 0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x75, 0x69,
+  0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74,
+  0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32,
+  0x5f, 0x74, 0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32,
+  0x5f, 0x74, 0x20, 0x79, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x63,
+  0x75, 0x62, 0x65, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x76, 0x61, 0x6c, 0x5b, 0x33, 0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75,
+  0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x64, 0x73, 0x74, 0x20,
+  0x3d, 0x20, 0x62, 0x61, 0x73, 0x65, 0x20, 0x2b, 0x20, 0x28, 0x76, 0x73,
+  0x74, 0x72, 0x69, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x6f, 0x66,
+  0x66, 0x73, 0x65, 0x74, 0x28, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x20, 0x2b, 0x20,
+  0x79, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x20, 0x2b, 0x20, 0x78, 0x29, 0x20, 0x2a, 0x20, 0x65, 0x6e, 0x76,
+  0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x28, 0x66, 0x6d, 0x74, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78,
+  0x65, 0x6c, 0x5f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x64, 0x73, 0x74,
+  0x2c, 0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20, 0x76, 0x61, 0x6c, 0x29, 0x3b,
+  0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x6c, 0x61, 0x74, 0x6c, 0x6f, 0x6e, 0x67, 0x5f, 0x76,
+  0x65, 0x63, 0x5f, 0x74, 0x6f, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f,
+  0x63, 0x6f, 0x6f, 0x72, 0x64, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76,
+  0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x75,
+  0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x76, 0x2c, 0x20, 0x5f, 0x5f,
+  0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x76, 0x65, 0x63,
+  0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x20, 0x74, 0x68, 0x65, 0x74, 0x61, 0x2c, 0x20, 0x70, 0x68, 0x69,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x76, 0x65, 0x63, 0x5f, 0x74, 0x6f,
+  0x5f, 0x73, 0x63, 0x28, 0x26, 0x74, 0x68, 0x65, 0x74, 0x61, 0x2c, 0x20,
+  0x26, 0x70, 0x68, 0x69, 0x2c, 0x20, 0x76, 0x65, 0x63, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x2a, 0x75, 0x20, 0x3d, 0x20, 0x74, 0x68, 0x65,
+  0x74, 0x61, 0x20, 0x2a, 0x20, 0x30, 0x2e, 0x31, 0x35, 0x39, 0x31, 0x35,
+  0x34, 0x39, 0x34, 0x33, 0x30, 0x39, 0x31, 0x38, 0x39, 0x35, 0x33, 0x33,
+  0x35, 0x37, 0x36, 0x66, 0x20, 0x2b, 0x20, 0x30, 0x2e, 0x35, 0x66, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x2a, 0x76, 0x20, 0x3d, 0x20, 0x70, 0x68,
+  0x69, 0x20, 0x2a, 0x20, 0x30, 0x2e, 0x33, 0x31, 0x38, 0x33, 0x30, 0x39,
+  0x38, 0x38, 0x36, 0x31, 0x38, 0x33, 0x37, 0x39, 0x30, 0x36, 0x37, 0x31,
+  0x35, 0x33, 0x66, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69,
+  0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x6c, 0x61, 0x74, 0x6c, 0x6f,
+  0x6e, 0x67, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f,
+  0x72, 0x64, 0x5f, 0x74, 0x6f, 0x5f, 0x76, 0x65, 0x63, 0x28, 0x5f, 0x5f,
+  0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x2a, 0x20, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x2c, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x75, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x76, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x63,
+  0x5f, 0x74, 0x6f, 0x5f, 0x76, 0x65, 0x63, 0x28, 0x6f, 0x75, 0x74, 0x33,
+  0x66, 0x2c, 0x20, 0x75, 0x20, 0x2a, 0x20, 0x33, 0x2e, 0x31, 0x34, 0x31,
+  0x35, 0x39, 0x32, 0x36, 0x35, 0x33, 0x35, 0x38, 0x39, 0x37, 0x39, 0x33,
+  0x32, 0x33, 0x38, 0x34, 0x36, 0x66, 0x2c, 0x20, 0x28, 0x76, 0x20, 0x2b,
+  0x20, 0x31, 0x2e, 0x30, 0x66, 0x29, 0x20, 0x2a, 0x20, 0x31, 0x2e, 0x35,
+  0x37, 0x30, 0x37, 0x39, 0x36, 0x33, 0x32, 0x36, 0x37, 0x39, 0x34, 0x38,
+  0x39, 0x36, 0x36, 0x31, 0x39, 0x32, 0x33, 0x66, 0x29, 0x3b, 0x0a, 0x7d,
+  0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74,
+  0x2a, 0x20, 0x6c, 0x61, 0x74, 0x6c, 0x6f, 0x6e, 0x67, 0x5f, 0x70, 0x69,
+  0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74,
+  0x2a, 0x20, 0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x79, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20,
+  0x69, 0x6e, 0x74, 0x20, 0x62, 0x70, 0x70, 0x29, 0x0a, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x62, 0x61,
+  0x73, 0x65, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x73, 0x69, 0x7a, 0x65, 0x5f,
+  0x74, 0x29, 0x79, 0x20, 0x2a, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20,
+  0x2b, 0x20, 0x78, 0x29, 0x20, 0x2a, 0x20, 0x62, 0x70, 0x70, 0x3b, 0x0a,
+  0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69,
+  0x64, 0x20, 0x73, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x5f, 0x6c, 0x61, 0x74,
+  0x6c, 0x6f, 0x6e, 0x67, 0x5f, 0x6d, 0x61, 0x70, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x5f,
+  0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x38, 0x5f, 0x74, 0x2a, 0x20, 0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x75,
+  0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x77, 0x69, 0x64, 0x74,
+  0x68, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20,
+  0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d,
+  0x61, 0x74, 0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72,
+  0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x65, 0x63, 0x5b, 0x33, 0x5d,
+  0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x20, 0x75, 0x2c, 0x20, 0x76, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x6c, 0x61, 0x74, 0x6c, 0x6f, 0x6e, 0x67, 0x5f, 0x76, 0x65, 0x63, 0x5f,
+  0x74, 0x6f, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f,
+  0x72, 0x64, 0x28, 0x26, 0x75, 0x2c, 0x20, 0x26, 0x76, 0x2c, 0x20, 0x76,
+  0x65, 0x63, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x78, 0x20, 0x3d, 0x20, 0x75, 0x20,
+  0x2a, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x79, 0x20,
+  0x3d, 0x20, 0x76, 0x20, 0x2a, 0x20, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x78, 0x20, 0x3d, 0x20, 0x78, 0x20,
+  0x3c, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x3f, 0x20, 0x78, 0x20,
+  0x3a, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x2d, 0x20, 0x31, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x79, 0x20, 0x3d, 0x20, 0x79, 0x20, 0x3c,
+  0x20, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x20, 0x3f, 0x20, 0x79, 0x20,
+  0x3a, 0x20, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x20, 0x2d, 0x20, 0x31,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62,
+  0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20,
+  0x64, 0x61, 0x74, 0x61, 0x20, 0x3d, 0x20, 0x6c, 0x61, 0x74, 0x6c, 0x6f,
+  0x6e, 0x67, 0x5f, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72,
+  0x28, 0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x78, 0x2c, 0x20, 0x79, 0x2c,
+  0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d,
+  0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73, 0x69,
+  0x7a, 0x65, 0x28, 0x66, 0x6d, 0x74, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78,
+  0x65, 0x6c, 0x5f, 0x6c, 0x6f, 0x61, 0x64, 0x28, 0x63, 0x6f, 0x6c, 0x2c,
+  0x20, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x66, 0x6d, 0x74, 0x29, 0x3b,
+  0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x6c, 0x61, 0x74, 0x6c, 0x6f, 0x6e, 0x67, 0x5f, 0x73,
+  0x65, 0x74, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x28, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74,
+  0x2a, 0x20, 0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20,
+  0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20,
+  0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x78, 0x2c, 0x20,
+  0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x79, 0x2c, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x61, 0x6c, 0x5b, 0x33, 0x5d,
+  0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74,
+  0x2a, 0x20, 0x64, 0x73, 0x74, 0x20, 0x3d, 0x20, 0x6c, 0x61, 0x74, 0x6c,
+  0x6f, 0x6e, 0x67, 0x5f, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74,
+  0x72, 0x28, 0x62, 0x61, 0x73, 0x65, 0x2c, 0x20, 0x78, 0x2c, 0x20, 0x79,
+  0x2c, 0x20, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x65, 0x6e, 0x76,
+  0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x28, 0x66, 0x6d, 0x74, 0x29, 0x29, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65,
+  0x78, 0x65, 0x6c, 0x5f, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x28, 0x64, 0x73,
+  0x74, 0x2c, 0x20, 0x66, 0x6d, 0x74, 0x2c, 0x20, 0x76, 0x61, 0x6c, 0x29,
+  0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x72, 0x75, 0x63, 0x74, 0x20, 0x62,
+  0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x5f, 0x74, 0x61, 0x70, 0x73,
+  0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5b, 0x34, 0x5d, 0x2c, 0x20, 0x78, 0x5b, 0x34, 0x5d,
+  0x2c, 0x20, 0x79, 0x5b, 0x34, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x77, 0x5b, 0x34, 0x5d, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x63, 0x6f, 0x72, 0x6e,
+  0x65, 0x72, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x69, 0x6e, 0x74, 0x20,
+  0x69, 0x6e, 0x74, 0x65, 0x72, 0x69, 0x6f, 0x72, 0x3b, 0x0a, 0x7d, 0x3b,
+  0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64,
+  0x20, 0x62, 0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x5f, 0x74, 0x61,
+  0x70, 0x73, 0x5f, 0x61, 0x74, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76,
+  0x61, 0x74, 0x65, 0x20, 0x73, 0x74, 0x72, 0x75, 0x63, 0x74, 0x20, 0x62,
+  0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x5f, 0x74, 0x61, 0x70, 0x73,
+  0x2a, 0x20, 0x74, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x20, 0x74, 0x79,
+  0x70, 0x65, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x75, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x20, 0x76, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x69, 0x64, 0x78, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x73, 0x20, 0x3d, 0x20, 0x75, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x2d, 0x20, 0x30, 0x2e,
+  0x35, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x72, 0x20, 0x3d, 0x20,
+  0x76, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x20, 0x2d, 0x20, 0x30, 0x2e, 0x35, 0x66, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x20, 0x73, 0x66, 0x20, 0x3d, 0x20, 0x66, 0x6c, 0x6f, 0x6f, 0x72,
+  0x28, 0x73, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x72, 0x66, 0x20,
+  0x3d, 0x20, 0x66, 0x6c, 0x6f, 0x6f, 0x72, 0x28, 0x72, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x66, 0x78, 0x20, 0x3d, 0x20, 0x73, 0x20, 0x2d,
+  0x20, 0x73, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x66, 0x79, 0x20,
+  0x3d, 0x20, 0x72, 0x20, 0x2d, 0x20, 0x72, 0x66, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x69, 0x6e, 0x74, 0x20,
+  0x78, 0x30, 0x20, 0x3d, 0x20, 0x28, 0x69, 0x6e, 0x74, 0x29, 0x73, 0x66,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x69, 0x6e, 0x74, 0x20, 0x79, 0x30, 0x20, 0x3d, 0x20, 0x28, 0x69, 0x6e,
+  0x74, 0x29, 0x72, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x74, 0x2d,
+  0x3e, 0x69, 0x6e, 0x74, 0x65, 0x72, 0x69, 0x6f, 0x72, 0x20, 0x3d, 0x20,
+  0x78, 0x30, 0x20, 0x3e, 0x3d, 0x20, 0x30, 0x20, 0x26, 0x26, 0x20, 0x79,
+  0x30, 0x20, 0x3e, 0x3d, 0x20, 0x30, 0x20, 0x26, 0x26, 0x20, 0x78, 0x30,
+  0x20, 0x2b, 0x20, 0x31, 0x20, 0x3c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x26, 0x26, 0x20, 0x79, 0x30, 0x20,
+  0x2b, 0x20, 0x31, 0x20, 0x3c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x74, 0x2d, 0x3e,
+  0x63, 0x6f, 0x72, 0x6e, 0x65, 0x72, 0x20, 0x3d, 0x20, 0x2d, 0x31, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6f, 0x72, 0x20, 0x28, 0x69, 0x6e,
+  0x74, 0x20, 0x69, 0x20, 0x3d, 0x20, 0x30, 0x3b, 0x20, 0x69, 0x20, 0x3c,
+  0x20, 0x34, 0x3b, 0x20, 0x2b, 0x2b, 0x69, 0x29, 0x20, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x78,
+  0x20, 0x3d, 0x20, 0x78, 0x30, 0x20, 0x2b, 0x20, 0x28, 0x69, 0x20, 0x26,
+  0x20, 0x31, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x69, 0x6e, 0x74, 0x20, 0x79, 0x20, 0x3d, 0x20, 0x79, 0x30, 0x20,
+  0x2b, 0x20, 0x28, 0x69, 0x20, 0x3e, 0x3e, 0x20, 0x31, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x69, 0x6e, 0x74, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x20, 0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x69, 0x64, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x69, 0x66, 0x20, 0x28, 0x74, 0x2d, 0x3e, 0x69, 0x6e, 0x74, 0x65,
+  0x72, 0x69, 0x6f, 0x72, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x7d, 0x20, 0x65, 0x6c, 0x73, 0x65, 0x20, 0x69,
+  0x66, 0x20, 0x28, 0x74, 0x79, 0x70, 0x65, 0x20, 0x3d, 0x3d, 0x20, 0x45,
+  0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x4c, 0x41, 0x54, 0x4c, 0x4f,
+  0x4e, 0x47, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x79, 0x20,
+  0x3c, 0x20, 0x30, 0x20, 0x7c, 0x7c, 0x20, 0x79, 0x20, 0x3e, 0x3d, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x20, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x79, 0x20, 0x3d, 0x20, 0x79, 0x20, 0x3c,
+  0x20, 0x30, 0x20, 0x3f, 0x20, 0x30, 0x20, 0x3a, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x2d, 0x20, 0x31, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x78, 0x20, 0x2b, 0x3d, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x2f, 0x20, 0x32, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x7d, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x78, 0x20, 0x3d, 0x20, 0x28, 0x78, 0x20, 0x2b, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x77, 0x69, 0x64, 0x74, 0x68, 0x29, 0x20,
+  0x25, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x77, 0x69, 0x64, 0x74, 0x68,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x20,
+  0x65, 0x6c, 0x73, 0x65, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x69, 0x6e, 0x74, 0x20, 0x78, 0x6f, 0x75, 0x74, 0x20, 0x3d, 0x20,
+  0x78, 0x20, 0x3c, 0x20, 0x30, 0x20, 0x7c, 0x7c, 0x20, 0x78, 0x20, 0x3e,
+  0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x79,
+  0x6f, 0x75, 0x74, 0x20, 0x3d, 0x20, 0x79, 0x20, 0x3c, 0x20, 0x30, 0x20,
+  0x7c, 0x7c, 0x20, 0x79, 0x20, 0x3e, 0x3d, 0x20, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x78,
+  0x6f, 0x75, 0x74, 0x20, 0x26, 0x26, 0x20, 0x79, 0x6f, 0x75, 0x74, 0x29,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x74, 0x2d, 0x3e, 0x63, 0x6f, 0x72, 0x6e,
+  0x65, 0x72, 0x20, 0x3d, 0x20, 0x69, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6c, 0x73, 0x65,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6d, 0x5f, 0x74, 0x65, 0x78, 0x65,
+  0x6c, 0x5f, 0x77, 0x72, 0x61, 0x70, 0x28, 0x26, 0x66, 0x61, 0x63, 0x65,
+  0x2c, 0x20, 0x26, 0x78, 0x2c, 0x20, 0x26, 0x79, 0x2c, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x74, 0x2d, 0x3e, 0x66, 0x61, 0x63, 0x65, 0x5b,
+  0x69, 0x5d, 0x20, 0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x74, 0x2d, 0x3e, 0x78, 0x5b,
+  0x69, 0x5d, 0x20, 0x3d, 0x20, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x74, 0x2d, 0x3e, 0x79, 0x5b, 0x69, 0x5d, 0x20,
+  0x3d, 0x20, 0x79, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x74, 0x2d, 0x3e, 0x77, 0x5b, 0x69, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x69, 0x20, 0x26, 0x20, 0x31, 0x29, 0x20, 0x3f, 0x20, 0x66, 0x78,
+  0x20, 0x3a, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x2d, 0x20, 0x66, 0x78,
+  0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x69, 0x20, 0x3e, 0x3e, 0x20, 0x31,
+  0x29, 0x20, 0x3f, 0x20, 0x66, 0x79, 0x20, 0x3a, 0x20, 0x31, 0x2e, 0x30,
+  0x66, 0x20, 0x2d, 0x20, 0x66, 0x79, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20,
+  0x76, 0x6f, 0x69, 0x64, 0x20, 0x62, 0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61,
+  0x72, 0x5f, 0x74, 0x61, 0x70, 0x73, 0x5f, 0x66, 0x69, 0x6e, 0x64, 0x28,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x73, 0x74,
+  0x72, 0x75, 0x63, 0x74, 0x20, 0x62, 0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61,
+  0x72, 0x5f, 0x74, 0x61, 0x70, 0x73, 0x2a, 0x20, 0x74, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74,
+  0x79, 0x70, 0x65, 0x20, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x69, 0x6e,
+  0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c,
+  0x20, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x77, 0x69,
+  0x64, 0x74, 0x68, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x76, 0x65, 0x63, 0x5b, 0x33, 0x5d, 0x29, 0x0a, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x75,
+  0x2c, 0x20, 0x76, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64,
+  0x78, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x76, 0x65, 0x63, 0x5f, 0x74, 0x6f, 0x5f, 0x74, 0x65, 0x78,
+  0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x28, 0x26, 0x75, 0x2c,
+  0x20, 0x26, 0x76, 0x2c, 0x20, 0x26, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69,
+  0x64, 0x78, 0x2c, 0x20, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x76, 0x65,
+  0x63, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x62, 0x69, 0x6c, 0x69,
+  0x6e, 0x65, 0x61, 0x72, 0x5f, 0x74, 0x61, 0x70, 0x73, 0x5f, 0x61, 0x74,
+  0x28, 0x74, 0x2c, 0x20, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x2c, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x75, 0x2c, 0x20,
+  0x76, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x78, 0x29,
+  0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76,
+  0x6f, 0x69, 0x64, 0x20, 0x62, 0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72,
+  0x5f, 0x74, 0x61, 0x70, 0x73, 0x5f, 0x62, 0x6c, 0x65, 0x6e, 0x64, 0x28,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x73, 0x74, 0x72, 0x75, 0x63, 0x74, 0x20, 0x62,
+  0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x5f, 0x74, 0x61, 0x70, 0x73,
+  0x2a, 0x20, 0x74, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x74, 0x61, 0x70,
+  0x5b, 0x34, 0x5d, 0x5b, 0x33, 0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x74, 0x2d, 0x3e, 0x63, 0x6f, 0x72,
+  0x6e, 0x65, 0x72, 0x20, 0x3e, 0x3d, 0x20, 0x30, 0x29, 0x20, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6f, 0x72, 0x20,
+  0x28, 0x69, 0x6e, 0x74, 0x20, 0x63, 0x20, 0x3d, 0x20, 0x30, 0x3b, 0x20,
+  0x63, 0x20, 0x3c, 0x20, 0x33, 0x3b, 0x20, 0x2b, 0x2b, 0x63, 0x29, 0x20,
+  0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x73, 0x75, 0x6d, 0x20,
+  0x3d, 0x20, 0x30, 0x2e, 0x30, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6f, 0x72, 0x20,
+  0x28, 0x69, 0x6e, 0x74, 0x20, 0x69, 0x20, 0x3d, 0x20, 0x30, 0x3b, 0x20,
+  0x69, 0x20, 0x3c, 0x20, 0x34, 0x3b, 0x20, 0x2b, 0x2b, 0x69, 0x29, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x69, 0x20, 0x21, 0x3d,
+  0x20, 0x74, 0x2d, 0x3e, 0x63, 0x6f, 0x72, 0x6e, 0x65, 0x72, 0x29, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x73, 0x75, 0x6d, 0x20,
+  0x2b, 0x3d, 0x20, 0x74, 0x61, 0x70, 0x5b, 0x69, 0x5d, 0x5b, 0x63, 0x5d,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x74, 0x61, 0x70, 0x5b, 0x74, 0x2d, 0x3e, 0x63, 0x6f, 0x72,
+  0x6e, 0x65, 0x72, 0x5d, 0x5b, 0x63, 0x5d, 0x20, 0x3d, 0x20, 0x73, 0x75,
+  0x6d, 0x20, 0x2a, 0x20, 0x28, 0x31, 0x2e, 0x30, 0x66, 0x20, 0x2f, 0x20,
+  0x33, 0x2e, 0x30, 0x66, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x7d, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x66, 0x6f, 0x72, 0x20, 0x28, 0x69, 0x6e, 0x74, 0x20,
+  0x63, 0x20, 0x3d, 0x20, 0x30, 0x3b, 0x20, 0x63, 0x20, 0x3c, 0x20, 0x33,
+  0x3b, 0x20, 0x2b, 0x2b, 0x63, 0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x63, 0x5d, 0x20, 0x3d, 0x20,
+  0x74, 0x2d, 0x3e, 0x77, 0x5b, 0x30, 0x5d, 0x20, 0x2a, 0x20, 0x74, 0x61,
+  0x70, 0x5b, 0x30, 0x5d, 0x5b, 0x63, 0x5d, 0x20, 0x2b, 0x20, 0x74, 0x2d,
+  0x3e, 0x77, 0x5b, 0x31, 0x5d, 0x20, 0x2a, 0x20, 0x74, 0x61, 0x70, 0x5b,
+  0x31, 0x5d, 0x5b, 0x63, 0x5d, 0x20, 0x2b, 0x20, 0x74, 0x2d, 0x3e, 0x77,
+  0x5b, 0x32, 0x5d, 0x20, 0x2a, 0x20, 0x74, 0x61, 0x70, 0x5b, 0x32, 0x5d,
+  0x5b, 0x63, 0x5d, 0x20, 0x2b, 0x20, 0x74, 0x2d, 0x3e, 0x77, 0x5b, 0x33,
+  0x5d, 0x20, 0x2a, 0x20, 0x74, 0x61, 0x70, 0x5b, 0x33, 0x5d, 0x5b, 0x63,
+  0x5d, 0x3b, 0x0a, 0x7d, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x76, 0x65, 0x63, 0x5f, 0x74, 0x6f, 0x5f,
+  0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x28,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x2a, 0x20, 0x75, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72,
+  0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a,
+  0x20, 0x76, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74,
+  0x65, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x78, 0x2c, 0x20, 0x65, 0x6e, 0x75,
+  0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79, 0x70,
+  0x65, 0x20, 0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x5f,
+  0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x76, 0x65,
+  0x63, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69,
+  0x74, 0x63, 0x68, 0x28, 0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x29,
+  0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f,
+  0x48, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f,
+  0x54, 0x59, 0x50, 0x45, 0x5f, 0x56, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3a,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73,
+  0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x56, 0x53,
+  0x54, 0x52, 0x49, 0x50, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6d, 0x5f, 0x76, 0x65, 0x63,
+  0x5f, 0x74, 0x6f, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f,
+  0x6f, 0x72, 0x64, 0x28, 0x75, 0x2c, 0x20, 0x76, 0x2c, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x69, 0x64, 0x78, 0x2c, 0x20, 0x76, 0x65, 0x63, 0x29,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d,
+  0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x4c, 0x41, 0x54, 0x4c, 0x4f, 0x4e,
+  0x47, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x2a, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x78,
+  0x20, 0x3d, 0x20, 0x30, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x6c, 0x61, 0x74, 0x6c, 0x6f, 0x6e,
+  0x67, 0x5f, 0x76, 0x65, 0x63, 0x5f, 0x74, 0x6f, 0x5f, 0x74, 0x65, 0x78,
+  0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x28, 0x75, 0x2c, 0x20,
+  0x76, 0x2c, 0x20, 0x76, 0x65, 0x63, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65,
+  0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x64, 0x65, 0x66, 0x61, 0x75, 0x6c, 0x74, 0x3a, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62,
+  0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a,
+  0x7d, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72,
+  0x64, 0x5f, 0x74, 0x6f, 0x5f, 0x76, 0x65, 0x63, 0x28, 0x5f, 0x5f, 0x70,
+  0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x2a, 0x20, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x2c, 0x20, 0x65, 0x6e, 0x75,
+  0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79, 0x70,
+  0x65, 0x20, 0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x75, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x20, 0x76, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x29, 0x0a, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69, 0x74, 0x63, 0x68, 0x28, 0x65,
+  0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45,
+  0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x48, 0x43, 0x52, 0x4f, 0x53,
+  0x53, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f,
+  0x56, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f,
+  0x54, 0x59, 0x50, 0x45, 0x5f, 0x56, 0x53, 0x54, 0x52, 0x49, 0x50, 0x3a,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6d, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f,
+  0x6f, 0x72, 0x64, 0x5f, 0x74, 0x6f, 0x5f, 0x76, 0x65, 0x63, 0x28, 0x6f,
+  0x75, 0x74, 0x33, 0x66, 0x2c, 0x20, 0x75, 0x2c, 0x20, 0x76, 0x2c, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72,
+  0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50,
+  0x45, 0x5f, 0x4c, 0x41, 0x54, 0x4c, 0x4f, 0x4e, 0x47, 0x3a, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x6c,
+  0x61, 0x74, 0x6c, 0x6f, 0x6e, 0x67, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c,
+  0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x5f, 0x74, 0x6f, 0x5f, 0x76, 0x65,
+  0x63, 0x28, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x2c, 0x20, 0x75, 0x2c, 0x20,
+  0x76, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x65, 0x66, 0x61, 0x75,
+  0x6c, 0x74, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x77, 0x61,
+  0x72, 0x70, 0x5f, 0x66, 0x69, 0x78, 0x75, 0x70, 0x5f, 0x66, 0x61, 0x63,
+  0x74, 0x6f, 0x72, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x0a, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x69, 0x66, 0x20, 0x28, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x73, 0x69, 0x7a, 0x65, 0x20, 0x3d, 0x3d, 0x20, 0x31, 0x2e, 0x30, 0x66,
+  0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x66,
+  0x73, 0x20, 0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x66, 0x73, 0x6d, 0x6f, 0x20,
+  0x3d, 0x20, 0x66, 0x73, 0x20, 0x2d, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20,
+  0x28, 0x66, 0x73, 0x20, 0x2a, 0x20, 0x66, 0x73, 0x29, 0x20, 0x2f, 0x20,
+  0x28, 0x66, 0x73, 0x6d, 0x6f, 0x20, 0x2a, 0x20, 0x66, 0x73, 0x6d, 0x6f,
+  0x20, 0x2a, 0x20, 0x66, 0x73, 0x6d, 0x6f, 0x29, 0x3b, 0x0a, 0x7d, 0x0a,
+  0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x5f,
+  0x74, 0x6f, 0x5f, 0x76, 0x65, 0x63, 0x5f, 0x77, 0x61, 0x72, 0x70, 0x28,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x2a, 0x20, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x2c, 0x20,
+  0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x74, 0x79, 0x70, 0x65, 0x20, 0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65,
+  0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x75, 0x2c, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x2c,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x77, 0x61, 0x72, 0x70, 0x5f,
+  0x66, 0x69, 0x78, 0x75, 0x70, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x69, 0x66, 0x20, 0x28, 0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65,
+  0x20, 0x21, 0x3d, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f,
+  0x4c, 0x41, 0x54, 0x4c, 0x4f, 0x4e, 0x47, 0x29, 0x20, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x75, 0x20, 0x3d, 0x20, 0x28,
+  0x77, 0x61, 0x72, 0x70, 0x5f, 0x66, 0x69, 0x78, 0x75, 0x70, 0x20, 0x2a,
+  0x20, 0x75, 0x2a, 0x75, 0x2a, 0x75, 0x29, 0x20, 0x2b, 0x20, 0x75, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x76, 0x20, 0x3d,
+  0x20, 0x28, 0x77, 0x61, 0x72, 0x70, 0x5f, 0x66, 0x69, 0x78, 0x75, 0x70,
+  0x20, 0x2a, 0x20, 0x76, 0x2a, 0x76, 0x2a, 0x76, 0x29, 0x20, 0x2b, 0x20,
+  0x76, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78, 0x65,
+  0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x5f, 0x74, 0x6f, 0x5f, 0x76,
+  0x65, 0x63, 0x28, 0x6f, 0x75, 0x74, 0x33, 0x66, 0x2c, 0x20, 0x65, 0x6d,
+  0x5f, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x75, 0x2c, 0x20, 0x76, 0x2c,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x29, 0x3b, 0x0a, 0x7d,
+  0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x63, 0x75, 0x62, 0x65, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x33, 0x5d, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x75, 0x69,
+  0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69,
+  0x64, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6f, 0x72,
+  0x20, 0x28, 0x69, 0x6e, 0x74, 0x20, 0x69, 0x20, 0x3d, 0x20, 0x30, 0x3b,
+  0x20, 0x69, 0x20, 0x3c, 0x20, 0x33, 0x3b, 0x20, 0x2b, 0x2b, 0x69, 0x29,
+  0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x69, 0x5d, 0x5b, 0x30, 0x5d, 0x20, 0x3d,
+  0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f,
+  0x76, 0x65, 0x63, 0x74, 0x6f, 0x72, 0x73, 0x5b, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x69, 0x64, 0x5d, 0x5b, 0x69, 0x5d, 0x5b, 0x30, 0x5d, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x69, 0x5d, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x63, 0x6d,
+  0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63,
+  0x74, 0x6f, 0x72, 0x73, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64,
+  0x5d, 0x5b, 0x69, 0x5d, 0x5b, 0x31, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x69,
+  0x5d, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x63, 0x6d, 0x5f, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x75, 0x76, 0x5f, 0x76, 0x65, 0x63, 0x74, 0x6f, 0x72,
+  0x73, 0x5b, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x69, 0x64, 0x5d, 0x5b, 0x69,
+  0x5d, 0x5b, 0x32, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a,
+  0x7d, 0x0a, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x28, 0x73, 0x74, 0x72, 0x75, 0x63, 0x74, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20, 0x65, 0x6d, 0x29, 0x0a, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69, 0x74, 0x63, 0x68, 0x28,
+  0x65, 0x6d, 0x2d, 0x3e, 0x74, 0x79, 0x70, 0x65, 0x29, 0x20, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65,
+  0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x48, 0x43, 0x52,
+  0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20,
+  0x65, 0x6d, 0x2d, 0x3e, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x2f, 0x20,
+  0x34, 0x2e, 0x30, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59,
+  0x50, 0x45, 0x5f, 0x56, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x72,
+  0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x65, 0x6d, 0x2d, 0x3e, 0x77, 0x69,
+  0x64, 0x74, 0x68, 0x20, 0x2f, 0x20, 0x33, 0x2e, 0x30, 0x66, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65,
+  0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x56, 0x53, 0x54,
+  0x52, 0x49, 0x50, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20,
+  0x65, 0x6d, 0x2d, 0x3e, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x20, 0x2f,
+  0x20, 0x36, 0x2e, 0x30, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54,
+  0x59, 0x50, 0x45, 0x5f, 0x4c, 0x41, 0x54, 0x4c, 0x4f, 0x4e, 0x47, 0x3a,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x65, 0x6d, 0x2d, 0x3e,
+  0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x64, 0x65, 0x66, 0x61, 0x75, 0x6c, 0x74, 0x3a,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x63, 0x75, 0x62, 0x65, 0x5f, 0x64,
+  0x69, 0x6d, 0x73, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74,
+  0x65, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x2a, 0x20,
+  0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69,
+  0x76, 0x61, 0x74, 0x65, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f,
+  0x74, 0x2a, 0x20, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74,
+  0x79, 0x70, 0x65, 0x20, 0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x2c,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x0a, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x73, 0x77, 0x69, 0x74, 0x63, 0x68, 0x28, 0x65, 0x6d,
+  0x5f, 0x74, 0x79, 0x70, 0x65, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d,
+  0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x48, 0x43, 0x52, 0x4f, 0x53, 0x53,
+  0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x2a, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x3d, 0x20, 0x34,
+  0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x2a, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x20, 0x3d, 0x20,
+  0x33, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45,
+  0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x56, 0x43, 0x52, 0x4f, 0x53,
+  0x53, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x2a, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x3d, 0x20,
+  0x33, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x2a, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x20, 0x3d,
+  0x20, 0x34, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69,
+  0x7a, 0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20,
+  0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x56, 0x53, 0x54, 0x52,
+  0x49, 0x50, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x2a, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x3d,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x2a, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x20, 0x3d, 0x20, 0x36, 0x20,
+  0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x64, 0x65, 0x66, 0x61, 0x75, 0x6c, 0x74, 0x3a,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32,
+  0x5f, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x77, 0x69, 0x64, 0x74, 0x68, 0x28, 0x73, 0x74, 0x72,
+  0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20,
+  0x65, 0x6d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65,
+  0x74, 0x75, 0x72, 0x6e, 0x20, 0x65, 0x6d, 0x2d, 0x3e, 0x74, 0x79, 0x70,
+  0x65, 0x20, 0x3d, 0x3d, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45,
+  0x5f, 0x4c, 0x41, 0x54, 0x4c, 0x4f, 0x4e, 0x47, 0x20, 0x3f, 0x20, 0x65,
+  0x6d, 0x2d, 0x3e, 0x77, 0x69, 0x64, 0x74, 0x68, 0x20, 0x3a, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x28, 0x65, 0x6d, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x75,
+  0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d,
+  0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x63, 0x6f, 0x75, 0x6e,
+  0x74, 0x28, 0x73, 0x74, 0x72, 0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76,
+  0x6d, 0x61, 0x70, 0x2a, 0x20, 0x65, 0x6d, 0x29, 0x0a, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x65, 0x6d,
+  0x2d, 0x3e, 0x74, 0x79, 0x70, 0x65, 0x20, 0x3d, 0x3d, 0x20, 0x45, 0x4d,
+  0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x4c, 0x41, 0x54, 0x4c, 0x4f, 0x4e,
+  0x47, 0x20, 0x3f, 0x20, 0x31, 0x20, 0x3a, 0x20, 0x36, 0x3b, 0x0a, 0x7d,
+  0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x73, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x28, 0x5f, 0x5f, 0x70, 0x72,
+  0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x63, 0x6f, 0x6c, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x73, 0x74, 0x72, 0x75,
+  0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20, 0x65,
+  0x6d, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x65, 0x63, 0x5b, 0x33,
+  0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69,
+  0x74, 0x63, 0x68, 0x28, 0x65, 0x6d, 0x2d, 0x3e, 0x74, 0x79, 0x70, 0x65,
+  0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45,
+  0x5f, 0x48, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x73, 0x61, 0x6d,
+  0x70, 0x6c, 0x65, 0x5f, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x6d,
+  0x61, 0x70, 0x28, 0x63, 0x6f, 0x6c, 0x2c, 0x20, 0x65, 0x6d, 0x2d, 0x3e,
+  0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x65,
+  0x6d, 0x29, 0x2c, 0x20, 0x65, 0x6d, 0x2d, 0x3e, 0x66, 0x6f, 0x72, 0x6d,
+  0x61, 0x74, 0x2c, 0x20, 0x76, 0x65, 0x63, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72,
+  0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50,
+  0x45, 0x5f, 0x56, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x73, 0x61,
+  0x6d, 0x70, 0x6c, 0x65, 0x5f, 0x76, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f,
+  0x6d, 0x61, 0x70, 0x28, 0x63, 0x6f, 0x6c, 0x2c, 0x20, 0x65, 0x6d, 0x2d,
+  0x3e, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28,
+  0x65, 0x6d, 0x29, 0x2c, 0x20, 0x65, 0x6d, 0x2d, 0x3e, 0x66, 0x6f, 0x72,
+  0x6d, 0x61, 0x74, 0x2c, 0x20, 0x76, 0x65, 0x63, 0x29, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62,
+  0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59,
+  0x50, 0x45, 0x5f, 0x56, 0x53, 0x54, 0x52, 0x49, 0x50, 0x3a, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x73,
+  0x61, 0x6d, 0x70, 0x6c, 0x65, 0x5f, 0x76, 0x73, 0x74, 0x72, 0x69, 0x70,
+  0x5f, 0x6d, 0x61, 0x70, 0x28, 0x63, 0x6f, 0x6c, 0x2c, 0x20, 0x65, 0x6d,
+  0x2d, 0x3e, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d,
+  0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65,
+  0x28, 0x65, 0x6d, 0x29, 0x2c, 0x20, 0x65, 0x6d, 0x2d, 0x3e, 0x66, 0x6f,
+  0x72, 0x6d, 0x61, 0x74, 0x2c, 0x20, 0x76, 0x65, 0x63, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54,
+  0x59, 0x50, 0x45, 0x5f, 0x4c, 0x41, 0x54, 0x4c, 0x4f, 0x4e, 0x47, 0x3a,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x73, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x5f, 0x6c, 0x61, 0x74, 0x6c,
+  0x6f, 0x6e, 0x67, 0x5f, 0x6d, 0x61, 0x70, 0x28, 0x63, 0x6f, 0x6c, 0x2c,
+  0x20, 0x65, 0x6d, 0x2d, 0x3e, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x65,
+  0x6d, 0x2d, 0x3e, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x65, 0x6d,
+  0x2d, 0x3e, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74, 0x2c, 0x20, 0x65, 0x6d,
+  0x2d, 0x3e, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x2c, 0x20, 0x76, 0x65,
+  0x63, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x65, 0x66, 0x61, 0x75,
+  0x6c, 0x74, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x76, 0x6f, 0x69,
+  0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x73, 0x61, 0x6d,
+  0x70, 0x6c, 0x65, 0x5f, 0x62, 0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72,
+  0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x63, 0x6f, 0x6c, 0x5b, 0x33, 0x5d, 0x2c,
+  0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x73,
+  0x74, 0x72, 0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x2a, 0x20, 0x65, 0x6d, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76,
+  0x61, 0x74, 0x65, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x76, 0x65, 0x63, 0x5b, 0x33, 0x5d, 0x29, 0x0a,
+  0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x74, 0x72, 0x75, 0x63, 0x74,
+  0x20, 0x62, 0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x5f, 0x74, 0x61,
+  0x70, 0x73, 0x20, 0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x62, 0x69,
+  0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x5f, 0x74, 0x61, 0x70, 0x73, 0x5f,
+  0x66, 0x69, 0x6e, 0x64, 0x28, 0x26, 0x74, 0x2c, 0x20, 0x65, 0x6d, 0x2d,
+  0x3e, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28,
+  0x65, 0x6d, 0x29, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x77, 0x69, 0x64, 0x74, 0x68, 0x28, 0x65,
+  0x6d, 0x29, 0x2c, 0x20, 0x76, 0x65, 0x63, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x74, 0x61, 0x70, 0x5b,
+  0x34, 0x5d, 0x5b, 0x33, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66,
+  0x6f, 0x72, 0x20, 0x28, 0x69, 0x6e, 0x74, 0x20, 0x69, 0x20, 0x3d, 0x20,
+  0x30, 0x3b, 0x20, 0x69, 0x20, 0x3c, 0x20, 0x34, 0x3b, 0x20, 0x2b, 0x2b,
+  0x69, 0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x69,
+  0x66, 0x20, 0x28, 0x69, 0x20, 0x21, 0x3d, 0x20, 0x74, 0x2e, 0x63, 0x6f,
+  0x72, 0x6e, 0x65, 0x72, 0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x6c, 0x6f, 0x61, 0x64, 0x28,
+  0x74, 0x61, 0x70, 0x5b, 0x69, 0x5d, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d,
+  0x61, 0x70, 0x5f, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72,
+  0x28, 0x65, 0x6d, 0x2c, 0x20, 0x74, 0x2e, 0x78, 0x5b, 0x69, 0x5d, 0x2c,
+  0x20, 0x74, 0x2e, 0x79, 0x5b, 0x69, 0x5d, 0x2c, 0x20, 0x74, 0x2e, 0x66,
+  0x61, 0x63, 0x65, 0x5b, 0x69, 0x5d, 0x29, 0x2c, 0x20, 0x65, 0x6d, 0x2d,
+  0x3e, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x62, 0x69, 0x6c, 0x69, 0x6e, 0x65, 0x61, 0x72, 0x5f, 0x74,
+  0x61, 0x70, 0x73, 0x5f, 0x62, 0x6c, 0x65, 0x6e, 0x64, 0x28, 0x63, 0x6f,
+  0x6c, 0x2c, 0x20, 0x26, 0x74, 0x2c, 0x20, 0x74, 0x61, 0x70, 0x29, 0x3b,
+  0x0a, 0x7d, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x65, 0x6e, 0x76, 0x6d,
+  0x61, 0x70, 0x5f, 0x73, 0x65, 0x74, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x28,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x73, 0x74,
+  0x72, 0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a,
+  0x20, 0x65, 0x6d, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f,
+  0x74, 0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f,
+  0x74, 0x20, 0x79, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x63, 0x75,
+  0x62, 0x65, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x61, 0x6c,
+  0x5b, 0x33, 0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73,
+  0x77, 0x69, 0x74, 0x63, 0x68, 0x28, 0x65, 0x6d, 0x2d, 0x3e, 0x74, 0x79,
+  0x70, 0x65, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59,
+  0x50, 0x45, 0x5f, 0x48, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x68,
+  0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x73, 0x65, 0x74, 0x70, 0x69, 0x78,
+  0x65, 0x6c, 0x28, 0x65, 0x6d, 0x2d, 0x3e, 0x64, 0x61, 0x74, 0x61, 0x2c,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x65, 0x6d, 0x29, 0x2c, 0x20, 0x65,
+  0x6d, 0x2d, 0x3e, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x2c, 0x20, 0x78,
+  0x2c, 0x20, 0x79, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x76,
+  0x61, 0x6c, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65,
+  0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x56, 0x43, 0x52,
+  0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x76, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f,
+  0x73, 0x65, 0x74, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x28, 0x65, 0x6d, 0x2d,
+  0x3e, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28,
+  0x65, 0x6d, 0x29, 0x2c, 0x20, 0x65, 0x6d, 0x2d, 0x3e, 0x66, 0x6f, 0x72,
+  0x6d, 0x61, 0x74, 0x2c, 0x20, 0x78, 0x2c, 0x20, 0x79, 0x2c, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x2c, 0x20, 0x76, 0x61, 0x6c, 0x29, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62,
+  0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59,
+  0x50, 0x45, 0x5f, 0x56, 0x53, 0x54, 0x52, 0x49, 0x50, 0x3a, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x76,
+  0x73, 0x74, 0x72, 0x69, 0x70, 0x5f, 0x73, 0x65, 0x74, 0x70, 0x69, 0x78,
+  0x65, 0x6c, 0x28, 0x65, 0x6d, 0x2d, 0x3e, 0x64, 0x61, 0x74, 0x61, 0x2c,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x65, 0x6d, 0x29, 0x2c, 0x20, 0x65,
+  0x6d, 0x2d, 0x3e, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x2c, 0x20, 0x78,
+  0x2c, 0x20, 0x79, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x76,
+  0x61, 0x6c, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65,
+  0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x4c, 0x41, 0x54,
+  0x4c, 0x4f, 0x4e, 0x47, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x6c, 0x61, 0x74, 0x6c, 0x6f, 0x6e,
+  0x67, 0x5f, 0x73, 0x65, 0x74, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x28, 0x65,
+  0x6d, 0x2d, 0x3e, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x65, 0x6d, 0x2d,
+  0x3e, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x65, 0x6d, 0x2d, 0x3e,
+  0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x2c, 0x20, 0x78, 0x2c, 0x20, 0x79,
+  0x2c, 0x20, 0x76, 0x61, 0x6c, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72, 0x65, 0x61,
+  0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64,
+  0x65, 0x66, 0x61, 0x75, 0x6c, 0x74, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x62, 0x72,
+  0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d,
+  0x0a, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x69,
+  0x6e, 0x74, 0x38, 0x5f, 0x74, 0x2a, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x73, 0x74,
+  0x72, 0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a,
+  0x20, 0x65, 0x6d, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f,
+  0x74, 0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f,
+  0x74, 0x20, 0x79, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x63, 0x75,
+  0x62, 0x65, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73,
+  0x77, 0x69, 0x74, 0x63, 0x68, 0x28, 0x65, 0x6d, 0x2d, 0x3e, 0x74, 0x79,
+  0x70, 0x65, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59,
+  0x50, 0x45, 0x5f, 0x48, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x72,
+  0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x68, 0x63, 0x72, 0x6f, 0x73, 0x73,
+  0x5f, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28, 0x65,
+  0x6d, 0x2d, 0x3e, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x78, 0x2c, 0x20,
+  0x79, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x65, 0x6d, 0x29, 0x2c,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73, 0x69, 0x7a,
+  0x65, 0x28, 0x65, 0x6d, 0x2d, 0x3e, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74,
+  0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x61, 0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45,
+  0x5f, 0x56, 0x43, 0x52, 0x4f, 0x53, 0x53, 0x3a, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74,
+  0x75, 0x72, 0x6e, 0x20, 0x76, 0x63, 0x72, 0x6f, 0x73, 0x73, 0x5f, 0x70,
+  0x69, 0x78, 0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28, 0x65, 0x6d, 0x2d,
+  0x3e, 0x64, 0x61, 0x74, 0x61, 0x2c, 0x20, 0x78, 0x2c, 0x20, 0x79, 0x2c,
+  0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x65, 0x6d, 0x29, 0x2c, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f,
+  0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28,
+  0x65, 0x6d, 0x2d, 0x3e, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x29, 0x29,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61,
+  0x73, 0x65, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x56,
+  0x53, 0x54, 0x52, 0x49, 0x50, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72,
+  0x6e, 0x20, 0x76, 0x73, 0x74, 0x72, 0x69, 0x70, 0x5f, 0x70, 0x69, 0x78,
+  0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28, 0x65, 0x6d, 0x2d, 0x3e, 0x64,
+  0x61, 0x74, 0x61, 0x2c, 0x20, 0x78, 0x2c, 0x20, 0x79, 0x2c, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x28, 0x65, 0x6d, 0x29, 0x2c, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f,
+  0x72, 0x6d, 0x61, 0x74, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x28, 0x65, 0x6d,
+  0x2d, 0x3e, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x29, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65,
+  0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x4c, 0x41, 0x54,
+  0x4c, 0x4f, 0x4e, 0x47, 0x3a, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e,
+  0x20, 0x6c, 0x61, 0x74, 0x6c, 0x6f, 0x6e, 0x67, 0x5f, 0x70, 0x69, 0x78,
+  0x65, 0x6c, 0x5f, 0x70, 0x74, 0x72, 0x28, 0x65, 0x6d, 0x2d, 0x3e, 0x64,
+  0x61, 0x74, 0x61, 0x2c, 0x20, 0x78, 0x2c, 0x20, 0x79, 0x2c, 0x20, 0x65,
+  0x6d, 0x2d, 0x3e, 0x77, 0x69, 0x64, 0x74, 0x68, 0x2c, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x5f,
+  0x73, 0x69, 0x7a, 0x65, 0x28, 0x65, 0x6d, 0x2d, 0x3e, 0x66, 0x6f, 0x72,
+  0x6d, 0x61, 0x74, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x64, 0x65, 0x66, 0x61, 0x75, 0x6c, 0x74, 0x3a, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x63,
+  0x5f, 0x74, 0x6f, 0x5f, 0x76, 0x65, 0x63, 0x28, 0x5f, 0x5f, 0x70, 0x72,
+  0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x76, 0x65, 0x63, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x20, 0x74, 0x68, 0x65, 0x74, 0x61, 0x2c, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x70, 0x68, 0x69, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x76, 0x65, 0x63, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x73,
+  0x69, 0x6e, 0x28, 0x74, 0x68, 0x65, 0x74, 0x61, 0x29, 0x20, 0x2a, 0x20,
+  0x73, 0x69, 0x6e, 0x28, 0x70, 0x68, 0x69, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x76, 0x65, 0x63, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x63,
+  0x6f, 0x73, 0x28, 0x70, 0x68, 0x69, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x76, 0x65, 0x63, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x63, 0x6f,
+  0x73, 0x28, 0x74, 0x68, 0x65, 0x74, 0x61, 0x29, 0x20, 0x2a, 0x20, 0x73,
+  0x69, 0x6e, 0x28, 0x70, 0x68, 0x69, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x76,
+  0x6f, 0x69, 0x64, 0x20, 0x76, 0x65, 0x63, 0x5f, 0x74, 0x6f, 0x5f, 0x73,
+  0x63, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x74, 0x68, 0x65, 0x74, 0x61,
+  0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x70, 0x68, 0x69, 0x2c, 0x20,
+  0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x65,
+  0x63, 0x5b, 0x33, 0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x2a, 0x74, 0x68, 0x65, 0x74, 0x61, 0x20, 0x3d, 0x20, 0x61, 0x74, 0x61,
+  0x6e, 0x32, 0x28, 0x76, 0x65, 0x63, 0x5b, 0x30, 0x5d, 0x2c, 0x20, 0x76,
+  0x65, 0x63, 0x5b, 0x32, 0x5d, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x2a, 0x70, 0x68, 0x69, 0x20, 0x3d, 0x20, 0x61, 0x63, 0x6f, 0x73, 0x28,
+  0x76, 0x65, 0x63, 0x5b, 0x31, 0x5d, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x73,
+  0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x61, 0x72, 0x65, 0x61, 0x5f, 0x65, 0x6c, 0x65, 0x6d, 0x65, 0x6e, 0x74,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x2c, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x79, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20, 0x61, 0x74, 0x61, 0x6e,
+  0x32, 0x28, 0x78, 0x20, 0x2a, 0x20, 0x79, 0x2c, 0x20, 0x73, 0x71, 0x72,
+  0x74, 0x28, 0x78, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2b, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x79, 0x20, 0x2b, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x29, 0x29,
+  0x3b, 0x0a, 0x7d, 0x0a, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x74, 0x65,
+  0x78, 0x65, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e,
+  0x67, 0x6c, 0x65, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x75, 0x2c,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x76, 0x2c, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x69, 0x6e, 0x76, 0x5f, 0x66, 0x61, 0x63, 0x65,
+  0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x78, 0x30, 0x20, 0x3d, 0x20, 0x75, 0x20, 0x2d, 0x20, 0x69, 0x6e,
+  0x76, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x31, 0x20, 0x3d, 0x20, 0x75, 0x20,
+  0x2b, 0x20, 0x69, 0x6e, 0x76, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x79, 0x30, 0x20,
+  0x3d, 0x20, 0x76, 0x20, 0x2d, 0x20, 0x69, 0x6e, 0x76, 0x5f, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x79, 0x31, 0x20, 0x3d, 0x20, 0x76, 0x20, 0x2b, 0x20, 0x69, 0x6e,
+  0x76, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61,
+  0x6e, 0x67, 0x6c, 0x65, 0x20, 0x3d, 0x20, 0x61, 0x72, 0x65, 0x61, 0x5f,
+  0x65, 0x6c, 0x65, 0x6d, 0x65, 0x6e, 0x74, 0x28, 0x78, 0x31, 0x2c, 0x20,
+  0x79, 0x31, 0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x2d, 0x20, 0x61, 0x72,
+  0x65, 0x61, 0x5f, 0x65, 0x6c, 0x65, 0x6d, 0x65, 0x6e, 0x74, 0x28, 0x78,
+  0x30, 0x2c, 0x20, 0x79, 0x31, 0x29, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x2d,
+  0x20, 0x61, 0x72, 0x65, 0x61, 0x5f, 0x65, 0x6c, 0x65, 0x6d, 0x65, 0x6e,
+  0x74, 0x28, 0x78, 0x31, 0x2c, 0x20, 0x79, 0x30, 0x29, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x2b, 0x20, 0x61, 0x72, 0x65, 0x61, 0x5f, 0x65, 0x6c, 0x65,
+  0x6d, 0x65, 0x6e, 0x74, 0x28, 0x78, 0x30, 0x2c, 0x20, 0x79, 0x30, 0x29,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e,
+  0x20, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65,
+  0x3b, 0x0a, 0x7d, 0x0a, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x6e, 0x73, 0x61,
+  0x5f, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x20, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x4e, 0x53, 0x41, 0x5f, 0x4c, 0x41, 0x59, 0x4f, 0x55, 0x54,
+  0x5f, 0x41, 0x4f, 0x53, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x4e, 0x53,
+  0x41, 0x5f, 0x4c, 0x41, 0x59, 0x4f, 0x55, 0x54, 0x5f, 0x53, 0x4f, 0x41,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x4e, 0x53, 0x41, 0x5f, 0x4c, 0x41,
+  0x59, 0x4f, 0x55, 0x54, 0x5f, 0x53, 0x59, 0x4d, 0x4d, 0x45, 0x54, 0x52,
+  0x49, 0x43, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x4e, 0x53, 0x41, 0x5f,
+  0x4c, 0x41, 0x59, 0x4f, 0x55, 0x54, 0x5f, 0x4e, 0x4f, 0x4e, 0x45, 0x0a,
+  0x7d, 0x3b, 0x0a, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x6e, 0x6f,
+  0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61,
+  0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x5f, 0x73,
+  0x7a, 0x28, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x6e,
+  0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x20, 0x6c, 0x61,
+  0x79, 0x6f, 0x75, 0x74, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20,
+  0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64,
+  0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78,
+  0x5f, 0x62, 0x75, 0x69, 0x6c, 0x64, 0x28, 0x76, 0x6f, 0x69, 0x64, 0x2a,
+  0x20, 0x6d, 0x65, 0x6d, 0x2c, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20, 0x65, 0x6e,
+  0x75, 0x6d, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79,
+  0x70, 0x65, 0x20, 0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20,
+  0x65, 0x6e, 0x75, 0x6d, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79,
+  0x6f, 0x75, 0x74, 0x20, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x29, 0x3b,
+  0x0a, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x6e, 0x6f, 0x72, 0x6d,
+  0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e, 0x67,
+  0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x5f, 0x70, 0x6c, 0x61,
+  0x6e, 0x65, 0x5f, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x28, 0x73, 0x69,
+  0x7a, 0x65, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a,
+  0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x2a, 0x20, 0x6e, 0x6f, 0x72,
+  0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e,
+  0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x5f, 0x61, 0x6c,
+  0x6c, 0x6f, 0x63, 0x28, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d,
+  0x20, 0x6e, 0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x20,
+  0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69,
+  0x64, 0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c,
+  0x69, 0x64, 0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64,
+  0x65, 0x78, 0x5f, 0x66, 0x72, 0x65, 0x65, 0x28, 0x76, 0x6f, 0x69, 0x64,
+  0x2a, 0x20, 0x6d, 0x65, 0x6d, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64,
+  0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69,
+  0x64, 0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65,
+  0x78, 0x5f, 0x72, 0x6f, 0x77, 0x28, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x70, 0x6c, 0x61, 0x6e, 0x65,
+  0x73, 0x5b, 0x34, 0x5d, 0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x76, 0x6f, 0x69, 0x64, 0x2a, 0x20, 0x69, 0x64, 0x78, 0x2c, 0x20, 0x73,
+  0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x7a, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x6e, 0x73, 0x61, 0x5f,
+  0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x20, 0x6c, 0x61, 0x79, 0x6f, 0x75,
+  0x74, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c,
+  0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x72, 0x6f, 0x77, 0x2c,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x73, 0x63, 0x72, 0x61,
+  0x74, 0x63, 0x68, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x6e,
+  0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f,
+  0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x72, 0x6f, 0x77, 0x5f, 0x67, 0x65,
+  0x6e, 0x65, 0x72, 0x61, 0x74, 0x65, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x2a, 0x20, 0x70, 0x6c, 0x61, 0x6e, 0x65, 0x73, 0x2c, 0x20, 0x73, 0x69,
+  0x7a, 0x65, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a,
+  0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20,
+  0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x72, 0x6f, 0x77, 0x29, 0x3b,
+  0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c,
+  0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65,
+  0x5f, 0x6c, 0x61, 0x74, 0x6c, 0x6f, 0x6e, 0x67, 0x5f, 0x72, 0x6f, 0x77,
+  0x5f, 0x67, 0x65, 0x6e, 0x65, 0x72, 0x61, 0x74, 0x65, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x2a, 0x20, 0x70, 0x6c, 0x61, 0x6e, 0x65, 0x73, 0x2c,
+  0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x77, 0x69, 0x64, 0x74,
+  0x68, 0x2c, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x68, 0x65,
+  0x69, 0x67, 0x68, 0x74, 0x2c, 0x20, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74,
+  0x20, 0x72, 0x6f, 0x77, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20,
+  0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64,
+  0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78,
+  0x5f, 0x73, 0x79, 0x6d, 0x6d, 0x65, 0x74, 0x72, 0x69, 0x63, 0x5f, 0x66,
+  0x65, 0x74, 0x63, 0x68, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x6e, 0x73, 0x61,
+  0x5b, 0x34, 0x5d, 0x2c, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61,
+  0x6c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x2a, 0x20, 0x69, 0x64, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a,
+  0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74,
+  0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74,
+  0x20, 0x79, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x6e, 0x6f,
+  0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61,
+  0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x5f, 0x66,
+  0x65, 0x74, 0x63, 0x68, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61,
+  0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x6e, 0x73, 0x61,
+  0x5b, 0x34, 0x5d, 0x2c, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61,
+  0x6c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x2a, 0x20, 0x69, 0x64, 0x78, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d,
+  0x20, 0x6e, 0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x20,
+  0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x70, 0x6c, 0x61, 0x6e, 0x65, 0x5f, 0x73,
+  0x74, 0x72, 0x69, 0x64, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33,
+  0x32, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20,
+  0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20,
+  0x79, 0x29, 0x3b, 0x0a, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x2a, 0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f,
+  0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f,
+  0x69, 0x6e, 0x64, 0x65, 0x78, 0x5f, 0x61, 0x63, 0x71, 0x75, 0x69, 0x72,
+  0x65, 0x28, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x20, 0x65,
+  0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d,
+  0x20, 0x6e, 0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x20,
+  0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69,
+  0x64, 0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c,
+  0x69, 0x64, 0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64,
+  0x65, 0x78, 0x5f, 0x72, 0x65, 0x6c, 0x65, 0x61, 0x73, 0x65, 0x28, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20,
+  0x69, 0x64, 0x78, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x6e,
+  0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f,
+  0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x5f,
+  0x63, 0x61, 0x63, 0x68, 0x65, 0x5f, 0x62, 0x75, 0x64, 0x67, 0x65, 0x74,
+  0x28, 0x73, 0x69, 0x7a, 0x65, 0x5f, 0x74, 0x20, 0x62, 0x79, 0x74, 0x65,
+  0x73, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x6e, 0x6f, 0x72,
+  0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e,
+  0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x5f, 0x63, 0x61,
+  0x63, 0x68, 0x65, 0x5f, 0x63, 0x6c, 0x65, 0x61, 0x72, 0x28, 0x76, 0x6f,
+  0x69, 0x64, 0x29, 0x3b, 0x0a, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x73, 0x68,
+  0x5f, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x53, 0x48, 0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x5f, 0x4c, 0x31,
+  0x20, 0x3d, 0x20, 0x32, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x53, 0x48,
+  0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x5f, 0x4c, 0x32, 0x20, 0x3d, 0x20,
+  0x33, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x53, 0x48, 0x5f, 0x4f, 0x52,
+  0x44, 0x45, 0x52, 0x5f, 0x4c, 0x33, 0x20, 0x3d, 0x20, 0x34, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x53, 0x48, 0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52,
+  0x5f, 0x4c, 0x34, 0x20, 0x3d, 0x20, 0x35, 0x0a, 0x7d, 0x3b, 0x0a, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x73, 0x68, 0x5f, 0x70, 0x72, 0x65, 0x63, 0x69,
+  0x73, 0x69, 0x6f, 0x6e, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x53,
+  0x48, 0x5f, 0x50, 0x52, 0x45, 0x43, 0x49, 0x53, 0x49, 0x4f, 0x4e, 0x5f,
+  0x44, 0x4f, 0x55, 0x42, 0x4c, 0x45, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x53, 0x48, 0x5f, 0x50, 0x52, 0x45, 0x43, 0x49, 0x53, 0x49, 0x4f, 0x4e,
+  0x5f, 0x46, 0x4c, 0x4f, 0x41, 0x54, 0x0a, 0x7d, 0x3b, 0x0a, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x2a,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x65,
+  0x6e, 0x75, 0x6d, 0x20, 0x73, 0x68, 0x5f, 0x6f, 0x72, 0x64, 0x65, 0x72,
+  0x20, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x64, 0x69, 0x72,
+  0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x68, 0x5f, 0x65,
+  0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x66, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x73, 0x68, 0x5f,
+  0x6f, 0x72, 0x64, 0x65, 0x72, 0x20, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x2c,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x2a, 0x20, 0x64, 0x69, 0x72, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64,
+  0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x35, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x2a, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x64,
+  0x69, 0x72, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x68,
+  0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x35,
+  0x66, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x64, 0x69, 0x72, 0x29,
+  0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x68, 0x5f, 0x63, 0x6f,
+  0x65, 0x66, 0x66, 0x73, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20,
+  0x73, 0x68, 0x5f, 0x63, 0x6f, 0x65, 0x66, 0x66, 0x73, 0x5b, 0x5d, 0x5b,
+  0x33, 0x5d, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x73, 0x68, 0x5f,
+  0x6f, 0x72, 0x64, 0x65, 0x72, 0x20, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x2c,
+  0x20, 0x73, 0x74, 0x72, 0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d,
+  0x61, 0x70, 0x2a, 0x20, 0x65, 0x6d, 0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x6e, 0x73, 0x61,
+  0x5f, 0x69, 0x64, 0x78, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x6e,
+  0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x20, 0x6e, 0x73,
+  0x61, 0x5f, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x2c, 0x20, 0x65, 0x6e,
+  0x75, 0x6d, 0x20, 0x73, 0x68, 0x5f, 0x70, 0x72, 0x65, 0x63, 0x69, 0x73,
+  0x69, 0x6f, 0x6e, 0x20, 0x70, 0x72, 0x65, 0x63, 0x69, 0x73, 0x69, 0x6f,
+  0x6e, 0x29, 0x3b, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x68, 0x5f,
+  0x63, 0x6f, 0x65, 0x66, 0x66, 0x73, 0x5f, 0x67, 0x70, 0x75, 0x28, 0x64,
+  0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x73, 0x68, 0x5f, 0x63, 0x6f, 0x65,
+  0x66, 0x66, 0x73, 0x5b, 0x5d, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x65, 0x6e,
+  0x75, 0x6d, 0x20, 0x73, 0x68, 0x5f, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x20,
+  0x6f, 0x72, 0x64, 0x65, 0x72, 0x2c, 0x20, 0x73, 0x74, 0x72, 0x75, 0x63,
+  0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x2a, 0x20, 0x65, 0x6d,
+  0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x2a, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x69, 0x64, 0x78, 0x2c, 0x20,
+  0x65, 0x6e, 0x75, 0x6d, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79,
+  0x6f, 0x75, 0x74, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79, 0x6f,
+  0x75, 0x74, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x73, 0x68, 0x5f,
+  0x70, 0x72, 0x65, 0x63, 0x69, 0x73, 0x69, 0x6f, 0x6e, 0x20, 0x70, 0x72,
+  0x65, 0x63, 0x69, 0x73, 0x69, 0x6f, 0x6e, 0x29, 0x3b, 0x0a, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x73, 0x68, 0x5f, 0x69, 0x72, 0x72, 0x61, 0x64, 0x69,
+  0x61, 0x6e, 0x63, 0x65, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x69,
+  0x72, 0x72, 0x5b, 0x33, 0x5d, 0x2c, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c,
+  0x65, 0x20, 0x73, 0x68, 0x5f, 0x72, 0x67, 0x62, 0x5b, 0x5d, 0x5b, 0x33,
+  0x5d, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x73, 0x68, 0x5f, 0x6f,
+  0x72, 0x64, 0x65, 0x72, 0x20, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x2c, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x64, 0x69, 0x72, 0x5b, 0x33, 0x5d,
+  0x29, 0x3b, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5f, 0x6c, 0x31, 0x28, 0x64, 0x6f, 0x75, 0x62,
+  0x6c, 0x65, 0x2a, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x2a, 0x20, 0x64, 0x69, 0x72, 0x29, 0x20, 0x7b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x78,
+  0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x29, 0x64,
+  0x69, 0x72, 0x5b, 0x30, 0x5d, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x79, 0x20, 0x3d, 0x20,
+  0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x29, 0x64, 0x69, 0x72, 0x5b,
+  0x31, 0x5d, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f,
+  0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f,
+  0x75, 0x62, 0x6c, 0x65, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x32, 0x5d, 0x3b,
+  0x20, 0x64, 0x6f, 0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x65, 0x72, 0x6f, 0x20,
+  0x3d, 0x20, 0x7b, 0x30, 0x7d, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x7a, 0x65,
+  0x72, 0x6f, 0x20, 0x2b, 0x20, 0x28, 0x30, 0x2e, 0x32, 0x38, 0x32, 0x30,
+  0x39, 0x34, 0x37, 0x39, 0x31, 0x37, 0x37, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32,
+  0x35, 0x31, 0x31, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32,
+  0x35, 0x31, 0x31, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x33, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30,
+  0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b,
+  0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x32, 0x29, 0x20, 0x3c, 0x3d, 0x20,
+  0x32, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x78,
+  0x32, 0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x79, 0x32,
+  0x20, 0x3d, 0x20, 0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x32, 0x20,
+  0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x31,
+  0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39,
+  0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x35, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34,
+  0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x36, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e,
+  0x33, 0x31, 0x35, 0x33, 0x39, 0x31, 0x35, 0x36, 0x35, 0x32, 0x35, 0x29,
+  0x20, 0x2a, 0x20, 0x28, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20,
+  0x7a, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x37,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32,
+  0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x20, 0x2a, 0x20,
+  0x78, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x30, 0x2e, 0x35, 0x34, 0x36, 0x32, 0x37, 0x34, 0x32, 0x31, 0x35, 0x32,
+  0x39, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x32, 0x29,
+  0x20, 0x3c, 0x3d, 0x20, 0x33, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b,
+  0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62,
+  0x6c, 0x65, 0x20, 0x7a, 0x33, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a,
+  0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x39, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39,
+  0x30, 0x30, 0x34, 0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x33, 0x20, 0x2a, 0x20, 0x78, 0x32,
+  0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x30, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x32, 0x2e, 0x38, 0x39, 0x30, 0x36, 0x31, 0x31, 0x34, 0x34,
+  0x32, 0x36, 0x34, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78,
+  0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x31, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x2d, 0x30, 0x2e, 0x36, 0x34, 0x36, 0x33, 0x36, 0x30, 0x33, 0x36, 0x38,
+  0x32, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x28,
+  0x2d, 0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x35, 0x2e, 0x30,
+  0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x32, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x30, 0x2e, 0x33, 0x37, 0x33, 0x31, 0x37, 0x36, 0x33,
+  0x33, 0x32, 0x35, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x35, 0x2e,
+  0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x33, 0x20, 0x2d, 0x20, 0x28, 0x33,
+  0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x33, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x35, 0x37, 0x30, 0x34,
+  0x35, 0x37, 0x39, 0x39, 0x34, 0x36, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20,
+  0x2a, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20,
+  0x28, 0x35, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31,
+  0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x31, 0x2e, 0x34, 0x34, 0x35,
+  0x33, 0x30, 0x35, 0x37, 0x32, 0x31, 0x33, 0x32, 0x29, 0x20, 0x2a, 0x20,
+  0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20,
+  0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e,
+  0x35, 0x39, 0x30, 0x30, 0x34, 0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29,
+  0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d,
+  0x20, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29,
+  0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x32, 0x29, 0x20, 0x3c,
+  0x3d, 0x20, 0x34, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65,
+  0x20, 0x78, 0x34, 0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x2a, 0x78, 0x2a,
+  0x78, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75,
+  0x62, 0x6c, 0x65, 0x20, 0x79, 0x34, 0x20, 0x3d, 0x20, 0x79, 0x2a, 0x79,
+  0x2a, 0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x34, 0x20, 0x3d, 0x20,
+  0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x36, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x32, 0x2e, 0x35, 0x30, 0x33, 0x33, 0x34, 0x32, 0x39, 0x34,
+  0x31, 0x38, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31,
+  0x37, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37,
+  0x30, 0x31, 0x33, 0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x33,
+  0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x31, 0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e,
+  0x39, 0x34, 0x36, 0x31, 0x37, 0x34, 0x36, 0x39, 0x35, 0x37, 0x35, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28,
+  0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x37, 0x2e,
+  0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x39, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x33, 0x33, 0x38, 0x30, 0x39,
+  0x33, 0x30, 0x38, 0x37, 0x31, 0x31, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x33, 0x2e, 0x30,
+  0x29, 0x20, 0x2b, 0x20, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20,
+  0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x32, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28,
+  0x31, 0x30, 0x35, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x34, 0x20,
+  0x2d, 0x20, 0x28, 0x39, 0x30, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a,
+  0x32, 0x20, 0x2b, 0x20, 0x28, 0x39, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2f,
+  0x20, 0x28, 0x31, 0x36, 0x2e, 0x30, 0x20, 0x2a, 0x20, 0x31, 0x2e, 0x37,
+  0x37, 0x32, 0x34, 0x35, 0x33, 0x38, 0x35, 0x30, 0x39, 0x30, 0x35, 0x35,
+  0x31, 0x36, 0x30, 0x32, 0x37, 0x32, 0x39, 0x38, 0x31, 0x36, 0x37, 0x34,
+  0x38, 0x33, 0x33, 0x34, 0x31, 0x31, 0x34, 0x35, 0x31, 0x38, 0x32, 0x37,
+  0x39, 0x37, 0x35, 0x34, 0x39, 0x34, 0x35, 0x36, 0x31, 0x32, 0x32, 0x33,
+  0x38, 0x37, 0x31, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x32, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x2d, 0x31, 0x2e, 0x33, 0x33, 0x38, 0x30, 0x39, 0x33, 0x30, 0x38, 0x37,
+  0x31, 0x31, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20,
+  0x2a, 0x20, 0x28, 0x28, 0x2d, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20,
+  0x28, 0x37, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32,
+  0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x34, 0x37, 0x33,
+  0x30, 0x38, 0x37, 0x33, 0x34, 0x37, 0x38, 0x37, 0x29, 0x20, 0x2a, 0x20,
+  0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20,
+  0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x37,
+  0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x33, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30, 0x31,
+  0x33, 0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29, 0x20, 0x2a, 0x20, 0x78,
+  0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d,
+  0x20, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x32, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x36, 0x32,
+  0x35, 0x38, 0x33, 0x35, 0x37, 0x33, 0x35, 0x34, 0x34, 0x29, 0x20, 0x2a,
+  0x20, 0x28, 0x78, 0x34, 0x20, 0x2d, 0x20, 0x28, 0x36, 0x2e, 0x30, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x32, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2b,
+  0x20, 0x79, 0x34, 0x29, 0x29, 0x3b, 0x20, 0x7d, 0x20, 0x77, 0x68, 0x69,
+  0x6c, 0x65, 0x20, 0x28, 0x30, 0x29, 0x3b, 0x20, 0x7d, 0x0a, 0x73, 0x74,
+  0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x68,
+  0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5f,
+  0x6c, 0x32, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x2a, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x64, 0x69,
+  0x72, 0x29, 0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64,
+  0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x78, 0x20, 0x3d, 0x20, 0x28, 0x64,
+  0x6f, 0x75, 0x62, 0x6c, 0x65, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x30, 0x5d,
+  0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62,
+  0x6c, 0x65, 0x20, 0x79, 0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62,
+  0x6c, 0x65, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x31, 0x5d, 0x3b, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20,
+  0x7a, 0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x29,
+  0x64, 0x69, 0x72, 0x5b, 0x32, 0x5d, 0x3b, 0x20, 0x64, 0x6f, 0x20, 0x7b,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c,
+  0x65, 0x20, 0x7a, 0x65, 0x72, 0x6f, 0x20, 0x3d, 0x20, 0x7b, 0x30, 0x7d,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x30,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x7a, 0x65, 0x72, 0x6f, 0x20, 0x2b, 0x20,
+  0x28, 0x30, 0x2e, 0x32, 0x38, 0x32, 0x30, 0x39, 0x34, 0x37, 0x39, 0x31,
+  0x37, 0x37, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30,
+  0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30,
+  0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d,
+  0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39,
+  0x29, 0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28,
+  0x28, 0x33, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x32, 0x29, 0x20, 0x62, 0x72,
+  0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64,
+  0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x78, 0x32, 0x20, 0x3d, 0x20, 0x78,
+  0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f,
+  0x75, 0x62, 0x6c, 0x65, 0x20, 0x79, 0x32, 0x20, 0x3d, 0x20, 0x79, 0x2a,
+  0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75,
+  0x62, 0x6c, 0x65, 0x20, 0x7a, 0x32, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x34,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35,
+  0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x79,
+  0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d,
+  0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35,
+  0x39, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x36, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x33, 0x31, 0x35, 0x33, 0x39,
+  0x31, 0x35, 0x36, 0x35, 0x32, 0x35, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28,
+  0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x20, 0x2d, 0x20,
+  0x28, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x37, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33,
+  0x30, 0x35, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x35, 0x34, 0x36,
+  0x32, 0x37, 0x34, 0x32, 0x31, 0x35, 0x32, 0x39, 0x29, 0x20, 0x2a, 0x20,
+  0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20,
+  0x69, 0x66, 0x20, 0x28, 0x28, 0x33, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x33,
+  0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x33,
+  0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x39, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39, 0x30, 0x30, 0x34, 0x33, 0x35,
+  0x38, 0x39, 0x39, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20,
+  0x28, 0x33, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x32, 0x2e, 0x38,
+  0x39, 0x30, 0x36, 0x31, 0x31, 0x34, 0x34, 0x32, 0x36, 0x34, 0x29, 0x20,
+  0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31,
+  0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x36, 0x34,
+  0x36, 0x33, 0x36, 0x30, 0x33, 0x36, 0x38, 0x32, 0x32, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29,
+  0x20, 0x2b, 0x20, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x31, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e,
+  0x33, 0x37, 0x33, 0x31, 0x37, 0x36, 0x33, 0x33, 0x32, 0x35, 0x39, 0x29,
+  0x20, 0x2a, 0x20, 0x28, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20,
+  0x7a, 0x33, 0x20, 0x2d, 0x20, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a,
+  0x20, 0x7a, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d,
+  0x30, 0x2e, 0x34, 0x35, 0x37, 0x30, 0x34, 0x35, 0x37, 0x39, 0x39, 0x34,
+  0x36, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d,
+  0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x35, 0x2e, 0x30, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x34, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x31, 0x2e, 0x34, 0x34, 0x35, 0x33, 0x30, 0x35, 0x37, 0x32,
+  0x31, 0x33, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d,
+  0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x35, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39, 0x30, 0x30, 0x34,
+  0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x33, 0x2e, 0x30,
+  0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x69, 0x66,
+  0x20, 0x28, 0x28, 0x33, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x34, 0x29, 0x20,
+  0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x78, 0x34, 0x20, 0x3d,
+  0x20, 0x78, 0x2a, 0x78, 0x2a, 0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x79,
+  0x34, 0x20, 0x3d, 0x20, 0x79, 0x2a, 0x79, 0x2a, 0x79, 0x2a, 0x79, 0x3b,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c,
+  0x65, 0x20, 0x7a, 0x34, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a,
+  0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x36, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x32, 0x2e, 0x35,
+  0x30, 0x33, 0x33, 0x34, 0x32, 0x39, 0x34, 0x31, 0x38, 0x29, 0x20, 0x2a,
+  0x20, 0x78, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32,
+  0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x37, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30, 0x31, 0x33, 0x30, 0x37,
+  0x36, 0x39, 0x37, 0x38, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20,
+  0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a,
+  0x20, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x38, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x39, 0x34, 0x36, 0x31, 0x37,
+  0x34, 0x36, 0x39, 0x35, 0x37, 0x35, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30,
+  0x29, 0x20, 0x2b, 0x20, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20,
+  0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x39, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d,
+  0x31, 0x2e, 0x33, 0x33, 0x38, 0x30, 0x39, 0x33, 0x30, 0x38, 0x37, 0x31,
+  0x31, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a,
+  0x20, 0x28, 0x28, 0x2d, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28,
+  0x37, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x30,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x31, 0x30, 0x35, 0x2e, 0x30,
+  0x29, 0x20, 0x2a, 0x20, 0x7a, 0x34, 0x20, 0x2d, 0x20, 0x28, 0x39, 0x30,
+  0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x20, 0x2b, 0x20, 0x28,
+  0x39, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2f, 0x20, 0x28, 0x31, 0x36, 0x2e,
+  0x30, 0x20, 0x2a, 0x20, 0x31, 0x2e, 0x37, 0x37, 0x32, 0x34, 0x35, 0x33,
+  0x38, 0x35, 0x30, 0x39, 0x30, 0x35, 0x35, 0x31, 0x36, 0x30, 0x32, 0x37,
+  0x32, 0x39, 0x38, 0x31, 0x36, 0x37, 0x34, 0x38, 0x33, 0x33, 0x34, 0x31,
+  0x31, 0x34, 0x35, 0x31, 0x38, 0x32, 0x37, 0x39, 0x37, 0x35, 0x34, 0x39,
+  0x34, 0x35, 0x36, 0x31, 0x32, 0x32, 0x33, 0x38, 0x37, 0x31, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32,
+  0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x33, 0x33,
+  0x38, 0x30, 0x39, 0x33, 0x30, 0x38, 0x37, 0x31, 0x31, 0x29, 0x20, 0x2a,
+  0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d,
+  0x33, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x37, 0x2e, 0x30, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x32, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x30, 0x2e, 0x34, 0x37, 0x33, 0x30, 0x38, 0x37, 0x33, 0x34,
+  0x37, 0x38, 0x37, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d,
+  0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e,
+  0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x20, 0x2a,
+  0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x32, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30, 0x31, 0x33, 0x30, 0x37, 0x36, 0x39,
+  0x37, 0x38, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x33, 0x2e, 0x30,
+  0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x34, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x30, 0x2e, 0x36, 0x32, 0x35, 0x38, 0x33, 0x35, 0x37,
+  0x33, 0x35, 0x34, 0x34, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x34, 0x20,
+  0x2d, 0x20, 0x28, 0x36, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32,
+  0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2b, 0x20, 0x79, 0x34, 0x29, 0x29,
+  0x3b, 0x20, 0x7d, 0x20, 0x77, 0x68, 0x69, 0x6c, 0x65, 0x20, 0x28, 0x30,
+  0x29, 0x3b, 0x20, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20,
+  0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5f, 0x6c, 0x33, 0x28, 0x64, 0x6f,
+  0x75, 0x62, 0x6c, 0x65, 0x2a, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x2a, 0x20, 0x64, 0x69, 0x72, 0x29, 0x20, 0x7b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65,
+  0x20, 0x78, 0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65,
+  0x29, 0x64, 0x69, 0x72, 0x5b, 0x30, 0x5d, 0x3b, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x79, 0x20,
+  0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x29, 0x64, 0x69,
+  0x72, 0x5b, 0x31, 0x5d, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x20, 0x3d, 0x20, 0x28,
+  0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x32,
+  0x5d, 0x3b, 0x20, 0x64, 0x6f, 0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x65, 0x72,
+  0x6f, 0x20, 0x3d, 0x20, 0x7b, 0x30, 0x7d, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x7a, 0x65, 0x72, 0x6f, 0x20, 0x2b, 0x20, 0x28, 0x30, 0x2e, 0x32, 0x38,
+  0x32, 0x30, 0x39, 0x34, 0x37, 0x39, 0x31, 0x37, 0x37, 0x29, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36,
+  0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36,
+  0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x33,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38,
+  0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x78,
+  0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x34, 0x29, 0x20, 0x3c,
+  0x3d, 0x20, 0x32, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65,
+  0x20, 0x78, 0x32, 0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20,
+  0x79, 0x32, 0x20, 0x3d, 0x20, 0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a,
+  0x32, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30,
+  0x35, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x35,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32,
+  0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x20, 0x2a, 0x20,
+  0x79, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x36, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x30, 0x2e, 0x33, 0x31, 0x35, 0x33, 0x39, 0x31, 0x35, 0x36, 0x35, 0x32,
+  0x35, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x31, 0x2e, 0x30, 0x29,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x37, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30,
+  0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x20,
+  0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x38, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x30, 0x2e, 0x35, 0x34, 0x36, 0x32, 0x37, 0x34, 0x32, 0x31,
+  0x35, 0x32, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d,
+  0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28,
+  0x34, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x33, 0x29, 0x20, 0x62, 0x72, 0x65,
+  0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f,
+  0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x33, 0x20, 0x3d, 0x20, 0x7a, 0x2a,
+  0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x39, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e,
+  0x35, 0x39, 0x30, 0x30, 0x34, 0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x33, 0x20, 0x2a, 0x20,
+  0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x30, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x32, 0x2e, 0x38, 0x39, 0x30, 0x36, 0x31, 0x31,
+  0x34, 0x34, 0x32, 0x36, 0x34, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a,
+  0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x31, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x2d, 0x30, 0x2e, 0x36, 0x34, 0x36, 0x33, 0x36, 0x30, 0x33,
+  0x36, 0x38, 0x32, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20,
+  0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x35,
+  0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x32, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x33, 0x37, 0x33, 0x31, 0x37,
+  0x36, 0x33, 0x33, 0x32, 0x35, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28,
+  0x35, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x33, 0x20, 0x2d, 0x20,
+  0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x33,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x35, 0x37,
+  0x30, 0x34, 0x35, 0x37, 0x39, 0x39, 0x34, 0x36, 0x29, 0x20, 0x2a, 0x20,
+  0x78, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x20,
+  0x2b, 0x20, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x31, 0x2e, 0x34,
+  0x34, 0x35, 0x33, 0x30, 0x35, 0x37, 0x32, 0x31, 0x33, 0x32, 0x29, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d,
+  0x30, 0x2e, 0x35, 0x39, 0x30, 0x30, 0x34, 0x33, 0x35, 0x38, 0x39, 0x39,
+  0x32, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32,
+  0x20, 0x2d, 0x20, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x79,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x34, 0x29,
+  0x20, 0x3c, 0x3d, 0x20, 0x34, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b,
+  0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62,
+  0x6c, 0x65, 0x20, 0x78, 0x34, 0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x2a,
+  0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64,
+  0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x79, 0x34, 0x20, 0x3d, 0x20, 0x79,
+  0x2a, 0x79, 0x2a, 0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x34, 0x20,
+  0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x36, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x32, 0x2e, 0x35, 0x30, 0x33, 0x33, 0x34, 0x32,
+  0x39, 0x34, 0x31, 0x38, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20,
+  0x79, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x37, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e,
+  0x37, 0x37, 0x30, 0x31, 0x33, 0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28,
+  0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2d,
+  0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x31, 0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x30, 0x2e, 0x39, 0x34, 0x36, 0x31, 0x37, 0x34, 0x36, 0x39, 0x35, 0x37,
+  0x35, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a,
+  0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28,
+  0x37, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x39,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x33, 0x33, 0x38,
+  0x30, 0x39, 0x33, 0x30, 0x38, 0x37, 0x31, 0x31, 0x29, 0x20, 0x2a, 0x20,
+  0x79, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x33,
+  0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x31, 0x30, 0x35, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a,
+  0x34, 0x20, 0x2d, 0x20, 0x28, 0x39, 0x30, 0x2e, 0x30, 0x29, 0x20, 0x2a,
+  0x20, 0x7a, 0x32, 0x20, 0x2b, 0x20, 0x28, 0x39, 0x2e, 0x30, 0x29, 0x29,
+  0x20, 0x2f, 0x20, 0x28, 0x31, 0x36, 0x2e, 0x30, 0x20, 0x2a, 0x20, 0x31,
+  0x2e, 0x37, 0x37, 0x32, 0x34, 0x35, 0x33, 0x38, 0x35, 0x30, 0x39, 0x30,
+  0x35, 0x35, 0x31, 0x36, 0x30, 0x32, 0x37, 0x32, 0x39, 0x38, 0x31, 0x36,
+  0x37, 0x34, 0x38, 0x33, 0x33, 0x34, 0x31, 0x31, 0x34, 0x35, 0x31, 0x38,
+  0x32, 0x37, 0x39, 0x37, 0x35, 0x34, 0x39, 0x34, 0x35, 0x36, 0x31, 0x32,
+  0x32, 0x33, 0x38, 0x37, 0x31, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x31, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x2d, 0x31, 0x2e, 0x33, 0x33, 0x38, 0x30, 0x39, 0x33, 0x30,
+  0x38, 0x37, 0x31, 0x31, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20,
+  0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x33, 0x2e, 0x30, 0x29, 0x20,
+  0x2b, 0x20, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x32, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x34,
+  0x37, 0x33, 0x30, 0x38, 0x37, 0x33, 0x34, 0x37, 0x38, 0x37, 0x29, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20,
+  0x2a, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20,
+  0x28, 0x37, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32,
+  0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37,
+  0x30, 0x31, 0x33, 0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29, 0x20, 0x2a,
+  0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32,
+  0x20, 0x2d, 0x20, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x79,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x32, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e,
+  0x36, 0x32, 0x35, 0x38, 0x33, 0x35, 0x37, 0x33, 0x35, 0x34, 0x34, 0x29,
+  0x20, 0x2a, 0x20, 0x28, 0x78, 0x34, 0x20, 0x2d, 0x20, 0x28, 0x36, 0x2e,
+  0x30, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x20, 0x2a, 0x20, 0x78, 0x32,
+  0x20, 0x2b, 0x20, 0x79, 0x34, 0x29, 0x29, 0x3b, 0x20, 0x7d, 0x20, 0x77,
+  0x68, 0x69, 0x6c, 0x65, 0x20, 0x28, 0x30, 0x29, 0x3b, 0x20, 0x7d, 0x0a,
+  0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20,
+  0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5f, 0x6c, 0x34, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x2a,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20,
+  0x64, 0x69, 0x72, 0x29, 0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x78, 0x20, 0x3d, 0x20,
+  0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x29, 0x64, 0x69, 0x72, 0x5b,
+  0x30, 0x5d, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f,
+  0x75, 0x62, 0x6c, 0x65, 0x20, 0x79, 0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f,
+  0x75, 0x62, 0x6c, 0x65, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x31, 0x5d, 0x3b,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c,
+  0x65, 0x20, 0x7a, 0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c,
+  0x65, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x32, 0x5d, 0x3b, 0x20, 0x64, 0x6f,
+  0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75,
+  0x62, 0x6c, 0x65, 0x20, 0x7a, 0x65, 0x72, 0x6f, 0x20, 0x3d, 0x20, 0x7b,
+  0x30, 0x7d, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x7a, 0x65, 0x72, 0x6f, 0x20,
+  0x2b, 0x20, 0x28, 0x30, 0x2e, 0x32, 0x38, 0x32, 0x30, 0x39, 0x34, 0x37,
+  0x39, 0x31, 0x37, 0x37, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31,
+  0x39, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31,
+  0x39, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31,
+  0x31, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20, 0x69, 0x66,
+  0x20, 0x28, 0x28, 0x35, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x32, 0x29, 0x20,
+  0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x78, 0x32, 0x20, 0x3d,
+  0x20, 0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x79, 0x32, 0x20, 0x3d, 0x20,
+  0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64,
+  0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x7a, 0x32, 0x20, 0x3d, 0x20, 0x7a,
+  0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x31, 0x2e, 0x30, 0x39,
+  0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33,
+  0x30, 0x35, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x36, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x33, 0x31, 0x35,
+  0x33, 0x39, 0x31, 0x35, 0x36, 0x35, 0x32, 0x35, 0x29, 0x20, 0x2a, 0x20,
+  0x28, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x20,
+  0x2d, 0x20, 0x28, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x37, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38,
+  0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a,
+  0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x35,
+  0x34, 0x36, 0x32, 0x37, 0x34, 0x32, 0x31, 0x35, 0x32, 0x39, 0x29, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29,
+  0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x35, 0x29, 0x20, 0x3c, 0x3d,
+  0x20, 0x33, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20,
+  0x7a, 0x33, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x39, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39, 0x30, 0x30, 0x34,
+  0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x28, 0x33, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2d, 0x20,
+  0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x32,
+  0x2e, 0x38, 0x39, 0x30, 0x36, 0x31, 0x31, 0x34, 0x34, 0x32, 0x36, 0x34,
+  0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20,
+  0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e,
+  0x36, 0x34, 0x36, 0x33, 0x36, 0x30, 0x33, 0x36, 0x38, 0x32, 0x32, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e,
+  0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x20, 0x2a,
+  0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x31, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x30, 0x2e, 0x33, 0x37, 0x33, 0x31, 0x37, 0x36, 0x33, 0x33, 0x32, 0x35,
+  0x39, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x33, 0x20, 0x2d, 0x20, 0x28, 0x33, 0x2e, 0x30, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x2d, 0x30, 0x2e, 0x34, 0x35, 0x37, 0x30, 0x34, 0x35, 0x37, 0x39,
+  0x39, 0x34, 0x36, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28,
+  0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x35, 0x2e,
+  0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x34, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x31, 0x2e, 0x34, 0x34, 0x35, 0x33, 0x30, 0x35,
+  0x37, 0x32, 0x31, 0x33, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32,
+  0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x35,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39, 0x30,
+  0x30, 0x34, 0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29, 0x20, 0x2a, 0x20,
+  0x78, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x33,
+  0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20,
+  0x69, 0x66, 0x20, 0x28, 0x28, 0x35, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x34,
+  0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x78, 0x34,
+  0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x2a, 0x78, 0x2a, 0x78, 0x3b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65,
+  0x20, 0x79, 0x34, 0x20, 0x3d, 0x20, 0x79, 0x2a, 0x79, 0x2a, 0x79, 0x2a,
+  0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75,
+  0x62, 0x6c, 0x65, 0x20, 0x7a, 0x34, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a,
+  0x2a, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x36, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x32,
+  0x2e, 0x35, 0x30, 0x33, 0x33, 0x34, 0x32, 0x39, 0x34, 0x31, 0x38, 0x29,
+  0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28,
+  0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x37, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30, 0x31, 0x33,
+  0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x33, 0x2e, 0x30, 0x29,
+  0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31,
+  0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x39, 0x34, 0x36,
+  0x31, 0x37, 0x34, 0x36, 0x39, 0x35, 0x37, 0x35, 0x29, 0x20, 0x2a, 0x20,
+  0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x31,
+  0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x39, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x2d, 0x31, 0x2e, 0x33, 0x33, 0x38, 0x30, 0x39, 0x33, 0x30, 0x38,
+  0x37, 0x31, 0x31, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a,
+  0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2b,
+  0x20, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x32, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x31, 0x30, 0x35,
+  0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x34, 0x20, 0x2d, 0x20, 0x28,
+  0x39, 0x30, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x20, 0x2b,
+  0x20, 0x28, 0x39, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2f, 0x20, 0x28, 0x31,
+  0x36, 0x2e, 0x30, 0x20, 0x2a, 0x20, 0x31, 0x2e, 0x37, 0x37, 0x32, 0x34,
+  0x35, 0x33, 0x38, 0x35, 0x30, 0x39, 0x30, 0x35, 0x35, 0x31, 0x36, 0x30,
+  0x32, 0x37, 0x32, 0x39, 0x38, 0x31, 0x36, 0x37, 0x34, 0x38, 0x33, 0x33,
+  0x34, 0x31, 0x31, 0x34, 0x35, 0x31, 0x38, 0x32, 0x37, 0x39, 0x37, 0x35,
+  0x34, 0x39, 0x34, 0x35, 0x36, 0x31, 0x32, 0x32, 0x33, 0x38, 0x37, 0x31,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x32, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x2d, 0x31, 0x2e,
+  0x33, 0x33, 0x38, 0x30, 0x39, 0x33, 0x30, 0x38, 0x37, 0x31, 0x31, 0x29,
+  0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28,
+  0x28, 0x2d, 0x33, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x37, 0x2e,
+  0x30, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x32, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x34, 0x37, 0x33, 0x30, 0x38, 0x37,
+  0x33, 0x34, 0x37, 0x38, 0x37, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32,
+  0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x2d,
+  0x31, 0x2e, 0x30, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x37, 0x2e, 0x30, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x33, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30, 0x31, 0x33, 0x30, 0x37,
+  0x36, 0x39, 0x37, 0x38, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20,
+  0x7a, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x33,
+  0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x34, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x30, 0x2e, 0x36, 0x32, 0x35, 0x38, 0x33,
+  0x35, 0x37, 0x33, 0x35, 0x34, 0x34, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78,
+  0x34, 0x20, 0x2d, 0x20, 0x28, 0x36, 0x2e, 0x30, 0x29, 0x20, 0x2a, 0x20,
+  0x79, 0x32, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2b, 0x20, 0x79, 0x34,
+  0x29, 0x29, 0x3b, 0x20, 0x7d, 0x20, 0x77, 0x68, 0x69, 0x6c, 0x65, 0x20,
+  0x28, 0x30, 0x29, 0x3b, 0x20, 0x7d, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20,
+  0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x2a, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d,
+  0x20, 0x73, 0x68, 0x5f, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x20, 0x6f, 0x72,
+  0x64, 0x65, 0x72, 0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x64, 0x69, 0x72, 0x29, 0x0a, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69, 0x74, 0x63, 0x68, 0x20,
+  0x28, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x53,
+  0x48, 0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x5f, 0x4c, 0x31, 0x3a, 0x20,
+  0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5f, 0x6c, 0x31, 0x28, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x2c, 0x20, 0x64, 0x69, 0x72, 0x29, 0x3b, 0x20, 0x62, 0x72, 0x65,
+  0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x61, 0x73, 0x65, 0x20, 0x53, 0x48, 0x5f, 0x4f, 0x52, 0x44, 0x45,
+  0x52, 0x5f, 0x4c, 0x32, 0x3a, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61,
+  0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5f, 0x6c, 0x32, 0x28, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x64, 0x69, 0x72,
+  0x29, 0x3b, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x53,
+  0x48, 0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x5f, 0x4c, 0x33, 0x3a, 0x20,
+  0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5f, 0x6c, 0x33, 0x28, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x2c, 0x20, 0x64, 0x69, 0x72, 0x29, 0x3b, 0x20, 0x62, 0x72, 0x65,
+  0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x64, 0x65, 0x66, 0x61, 0x75, 0x6c, 0x74, 0x3a, 0x20, 0x73, 0x68, 0x5f,
+  0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5f, 0x6c,
+  0x34, 0x28, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20,
+  0x64, 0x69, 0x72, 0x29, 0x3b, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x76, 0x6f, 0x69,
+  0x64, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x35, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x2a,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20,
+  0x64, 0x69, 0x72, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x73,
+  0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5f, 0x6c, 0x34, 0x28, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x2c, 0x20, 0x64, 0x69, 0x72, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74,
+  0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x68,
+  0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x66,
+  0x5f, 0x6c, 0x31, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x64, 0x69,
+  0x72, 0x29, 0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x20, 0x3d, 0x20, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x30, 0x5d, 0x3b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x79, 0x20, 0x3d, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x64,
+  0x69, 0x72, 0x5b, 0x31, 0x5d, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x20, 0x3d, 0x20, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x32, 0x5d,
+  0x3b, 0x20, 0x64, 0x6f, 0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x65, 0x72, 0x6f, 0x20,
+  0x3d, 0x20, 0x7b, 0x30, 0x7d, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x7a, 0x65,
+  0x72, 0x6f, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x30, 0x2e, 0x32, 0x38, 0x32, 0x30, 0x39, 0x34, 0x37, 0x39,
+  0x31, 0x37, 0x37, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x34,
+  0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x79, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36,
+  0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32,
+  0x35, 0x31, 0x31, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b,
+  0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x32, 0x29, 0x20, 0x3c, 0x3d, 0x20,
+  0x32, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x32,
+  0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x79, 0x32, 0x20, 0x3d,
+  0x20, 0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x32, 0x20, 0x3d, 0x20, 0x7a,
+  0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38,
+  0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32,
+  0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x36, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x33,
+  0x31, 0x35, 0x33, 0x39, 0x31, 0x35, 0x36, 0x35, 0x32, 0x35, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x20,
+  0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x31,
+  0x2e, 0x30, 0x29, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x37, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30,
+  0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x38, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30,
+  0x2e, 0x35, 0x34, 0x36, 0x32, 0x37, 0x34, 0x32, 0x31, 0x35, 0x32, 0x39,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x32, 0x29,
+  0x20, 0x3c, 0x3d, 0x20, 0x33, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b,
+  0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x20, 0x7a, 0x33, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x39,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39, 0x30, 0x30, 0x34, 0x33, 0x35,
+  0x38, 0x39, 0x39, 0x32, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a,
+  0x20, 0x28, 0x33, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x31, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x32, 0x2e, 0x38, 0x39, 0x30, 0x36,
+  0x31, 0x31, 0x34, 0x34, 0x32, 0x36, 0x34, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x31, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x2d, 0x30, 0x2e, 0x36, 0x34, 0x36, 0x33, 0x36, 0x30, 0x33, 0x36,
+  0x38, 0x32, 0x32, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20,
+  0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31,
+  0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x33, 0x37, 0x33,
+  0x31, 0x37, 0x36, 0x33, 0x33, 0x32, 0x35, 0x39, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x35,
+  0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x33, 0x20, 0x2d, 0x20,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x33, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x30, 0x2e, 0x34, 0x35, 0x37, 0x30, 0x34, 0x35, 0x37, 0x39, 0x39, 0x34,
+  0x36, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30,
+  0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x2e, 0x34, 0x34, 0x35, 0x33, 0x30,
+  0x35, 0x37, 0x32, 0x31, 0x33, 0x32, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28,
+  0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x7a,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x31, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39, 0x30, 0x30, 0x34,
+  0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78,
+  0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28,
+  0x28, 0x32, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x34, 0x29, 0x20, 0x62, 0x72,
+  0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x34, 0x20, 0x3d, 0x20, 0x78, 0x2a,
+  0x78, 0x2a, 0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x79, 0x34, 0x20, 0x3d, 0x20,
+  0x79, 0x2a, 0x79, 0x2a, 0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x34, 0x20,
+  0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x36, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x32, 0x2e, 0x35, 0x30, 0x33, 0x33, 0x34, 0x32, 0x39, 0x34, 0x31, 0x38,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a,
+  0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x37,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30, 0x31, 0x33, 0x30, 0x37,
+  0x36, 0x39, 0x37, 0x38, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a,
+  0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78,
+  0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x38, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30,
+  0x2e, 0x39, 0x34, 0x36, 0x31, 0x37, 0x34, 0x36, 0x39, 0x35, 0x37, 0x35,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x31, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x31, 0x39, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x33,
+  0x33, 0x38, 0x30, 0x39, 0x33, 0x30, 0x38, 0x37, 0x31, 0x31, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x33, 0x2e,
+  0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x32, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x30, 0x35, 0x2e, 0x30,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x34, 0x20, 0x2d, 0x20, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x39, 0x30, 0x2e, 0x30, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x39, 0x2e, 0x30, 0x29, 0x29, 0x29,
+  0x20, 0x2f, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x31, 0x36, 0x2e, 0x30, 0x20, 0x2a, 0x20, 0x31, 0x2e, 0x37, 0x37, 0x32,
+  0x34, 0x35, 0x33, 0x38, 0x35, 0x30, 0x39, 0x30, 0x35, 0x35, 0x31, 0x36,
+  0x30, 0x32, 0x37, 0x32, 0x39, 0x38, 0x31, 0x36, 0x37, 0x34, 0x38, 0x33,
+  0x33, 0x34, 0x31, 0x31, 0x34, 0x35, 0x31, 0x38, 0x32, 0x37, 0x39, 0x37,
+  0x35, 0x34, 0x39, 0x34, 0x35, 0x36, 0x31, 0x32, 0x32, 0x33, 0x38, 0x37,
+  0x31, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x32, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x33, 0x33,
+  0x38, 0x30, 0x39, 0x33, 0x30, 0x38, 0x37, 0x31, 0x31, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x33, 0x2e, 0x30,
+  0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x32, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x34, 0x37, 0x33, 0x30, 0x38,
+  0x37, 0x33, 0x34, 0x37, 0x38, 0x37, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28,
+  0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e,
+  0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x32, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30,
+  0x31, 0x33, 0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32,
+  0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32,
+  0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x30, 0x2e, 0x36, 0x32, 0x35, 0x38, 0x33, 0x35, 0x37,
+  0x33, 0x35, 0x34, 0x34, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x34,
+  0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x36, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x20, 0x2a,
+  0x20, 0x78, 0x32, 0x20, 0x2b, 0x20, 0x79, 0x34, 0x29, 0x29, 0x3b, 0x20,
+  0x7d, 0x20, 0x77, 0x68, 0x69, 0x6c, 0x65, 0x20, 0x28, 0x30, 0x29, 0x3b,
+  0x20, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x66, 0x5f, 0x6c, 0x32, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x2a, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x2a, 0x20, 0x64, 0x69, 0x72, 0x29, 0x20, 0x7b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x20,
+  0x3d, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x64, 0x69, 0x72,
+  0x5b, 0x30, 0x5d, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x79, 0x20, 0x3d, 0x20, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x31, 0x5d, 0x3b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x7a, 0x20, 0x3d, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x64,
+  0x69, 0x72, 0x5b, 0x32, 0x5d, 0x3b, 0x20, 0x64, 0x6f, 0x20, 0x7b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x7a, 0x65, 0x72, 0x6f, 0x20, 0x3d, 0x20, 0x7b, 0x30, 0x7d, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x30, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x7a, 0x65, 0x72, 0x6f, 0x20, 0x2b, 0x20, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x32, 0x38, 0x32,
+  0x30, 0x39, 0x34, 0x37, 0x39, 0x31, 0x37, 0x37, 0x29, 0x29, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31,
+  0x31, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30,
+  0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x34,
+  0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x33,
+  0x29, 0x20, 0x3c, 0x3d, 0x20, 0x32, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61,
+  0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x78, 0x32, 0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x3b,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x79, 0x32, 0x20, 0x3d, 0x20, 0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a,
+  0x32, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x2e, 0x30,
+  0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x35, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35,
+  0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x36,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x30, 0x2e, 0x33, 0x31, 0x35, 0x33, 0x39, 0x31, 0x35, 0x36,
+  0x35, 0x32, 0x35, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x29, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x37, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33,
+  0x30, 0x35, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20,
+  0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x35, 0x34, 0x36, 0x32, 0x37, 0x34,
+  0x32, 0x31, 0x35, 0x32, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78,
+  0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x69, 0x66,
+  0x20, 0x28, 0x28, 0x33, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x33, 0x29, 0x20,
+  0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x33, 0x20, 0x3d, 0x20,
+  0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x39, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39,
+  0x30, 0x30, 0x34, 0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x33, 0x20, 0x2a, 0x20, 0x78,
+  0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x30, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x32,
+  0x2e, 0x38, 0x39, 0x30, 0x36, 0x31, 0x31, 0x34, 0x34, 0x32, 0x36, 0x34,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a,
+  0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x31, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x36, 0x34, 0x36,
+  0x33, 0x36, 0x30, 0x33, 0x36, 0x38, 0x32, 0x32, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x35, 0x2e, 0x30,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x32, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x30, 0x2e, 0x33, 0x37, 0x33, 0x31, 0x37, 0x36, 0x33, 0x33, 0x32, 0x35,
+  0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x7a, 0x33, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x31, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x35, 0x37, 0x30, 0x34,
+  0x35, 0x37, 0x39, 0x39, 0x34, 0x36, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78,
+  0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x34, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x2e,
+  0x34, 0x34, 0x35, 0x33, 0x30, 0x35, 0x37, 0x32, 0x31, 0x33, 0x32, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32,
+  0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e,
+  0x35, 0x39, 0x30, 0x30, 0x34, 0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20,
+  0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33,
+  0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b,
+  0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x33, 0x29, 0x20, 0x3c, 0x3d, 0x20,
+  0x34, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x34,
+  0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x2a, 0x78, 0x2a, 0x78, 0x3b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x79, 0x34, 0x20, 0x3d, 0x20, 0x79, 0x2a, 0x79, 0x2a, 0x79, 0x2a, 0x79,
+  0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x20, 0x7a, 0x34, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a,
+  0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x36, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x32, 0x2e, 0x35, 0x30, 0x33, 0x33, 0x34,
+  0x32, 0x39, 0x34, 0x31, 0x38, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20,
+  0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20,
+  0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x37, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37,
+  0x30, 0x31, 0x33, 0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x31, 0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x39, 0x34, 0x36, 0x31, 0x37, 0x34,
+  0x36, 0x39, 0x35, 0x37, 0x35, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b,
+  0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x37, 0x2e,
+  0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x39, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x2d, 0x31, 0x2e, 0x33, 0x33, 0x38, 0x30, 0x39, 0x33, 0x30, 0x38,
+  0x37, 0x31, 0x31, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20,
+  0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x2d, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x30, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x31, 0x30, 0x35, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x34,
+  0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x39, 0x30, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x20,
+  0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x39,
+  0x2e, 0x30, 0x29, 0x29, 0x29, 0x20, 0x2f, 0x20, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x36, 0x2e, 0x30, 0x20, 0x2a, 0x20,
+  0x31, 0x2e, 0x37, 0x37, 0x32, 0x34, 0x35, 0x33, 0x38, 0x35, 0x30, 0x39,
+  0x30, 0x35, 0x35, 0x31, 0x36, 0x30, 0x32, 0x37, 0x32, 0x39, 0x38, 0x31,
+  0x36, 0x37, 0x34, 0x38, 0x33, 0x33, 0x34, 0x31, 0x31, 0x34, 0x35, 0x31,
+  0x38, 0x32, 0x37, 0x39, 0x37, 0x35, 0x34, 0x39, 0x34, 0x35, 0x36, 0x31,
+  0x32, 0x32, 0x33, 0x38, 0x37, 0x31, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x31, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x2d, 0x31, 0x2e, 0x33, 0x33, 0x38, 0x30, 0x39, 0x33, 0x30, 0x38, 0x37,
+  0x31, 0x31, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a,
+  0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x2d, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x32, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e,
+  0x34, 0x37, 0x33, 0x30, 0x38, 0x37, 0x33, 0x34, 0x37, 0x38, 0x37, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32,
+  0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x33, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x31, 0x2e, 0x37, 0x37, 0x30, 0x31, 0x33, 0x30, 0x37, 0x36, 0x39, 0x37,
+  0x38, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x32, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x36, 0x32,
+  0x35, 0x38, 0x33, 0x35, 0x37, 0x33, 0x35, 0x34, 0x34, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x34, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x36, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x32, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2b, 0x20, 0x79,
+  0x34, 0x29, 0x29, 0x3b, 0x20, 0x7d, 0x20, 0x77, 0x68, 0x69, 0x6c, 0x65,
+  0x20, 0x28, 0x30, 0x29, 0x3b, 0x20, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74,
+  0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x68, 0x5f, 0x65,
+  0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x66, 0x5f, 0x6c,
+  0x33, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x64, 0x69, 0x72, 0x29,
+  0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x78, 0x20, 0x3d, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x30, 0x5d, 0x3b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x79, 0x20,
+  0x3d, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x64, 0x69, 0x72,
+  0x5b, 0x31, 0x5d, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x20, 0x3d, 0x20, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x32, 0x5d, 0x3b, 0x20,
+  0x64, 0x6f, 0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x65, 0x72, 0x6f, 0x20, 0x3d, 0x20,
+  0x7b, 0x30, 0x7d, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x7a, 0x65, 0x72, 0x6f,
+  0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x30, 0x2e, 0x32, 0x38, 0x32, 0x30, 0x39, 0x34, 0x37, 0x39, 0x31, 0x37,
+  0x37, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38,
+  0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x79, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32,
+  0x35, 0x31, 0x31, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x33, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31,
+  0x31, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20, 0x69,
+  0x66, 0x20, 0x28, 0x28, 0x34, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x32, 0x29,
+  0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x32, 0x20, 0x3d,
+  0x20, 0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x79, 0x32, 0x20, 0x3d, 0x20, 0x79,
+  0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x7a, 0x32, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x34,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33,
+  0x30, 0x35, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20,
+  0x78, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34,
+  0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79,
+  0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x36, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x33, 0x31, 0x35,
+  0x33, 0x39, 0x31, 0x35, 0x36, 0x35, 0x32, 0x35, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33,
+  0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x20, 0x2d, 0x20,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x2e, 0x30,
+  0x29, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x37, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x39, 0x32,
+  0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x35,
+  0x34, 0x36, 0x32, 0x37, 0x34, 0x32, 0x31, 0x35, 0x32, 0x39, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29,
+  0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x34, 0x29, 0x20, 0x3c,
+  0x3d, 0x20, 0x33, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x7a, 0x33, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x39, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x2d, 0x30, 0x2e, 0x35, 0x39, 0x30, 0x30, 0x34, 0x33, 0x35, 0x38, 0x39,
+  0x39, 0x32, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28,
+  0x33, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x31, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x32, 0x2e, 0x38, 0x39, 0x30, 0x36, 0x31, 0x31,
+  0x34, 0x34, 0x32, 0x36, 0x34, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20,
+  0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x31, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x30, 0x2e, 0x36, 0x34, 0x36, 0x33, 0x36, 0x30, 0x33, 0x36, 0x38, 0x32,
+  0x32, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30,
+  0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x33, 0x37, 0x33, 0x31, 0x37,
+  0x36, 0x33, 0x33, 0x32, 0x35, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x35, 0x2e, 0x30,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x33, 0x20, 0x2d, 0x20, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e,
+  0x34, 0x35, 0x37, 0x30, 0x34, 0x35, 0x37, 0x39, 0x39, 0x34, 0x36, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x29,
+  0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x35, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31,
+  0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x31, 0x2e, 0x34, 0x34, 0x35, 0x33, 0x30, 0x35, 0x37,
+  0x32, 0x31, 0x33, 0x32, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32,
+  0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x35,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39, 0x30, 0x30, 0x34, 0x33, 0x35,
+  0x38, 0x39, 0x39, 0x32, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a,
+  0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x34,
+  0x29, 0x20, 0x3c, 0x3d, 0x20, 0x34, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61,
+  0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x78, 0x34, 0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x2a,
+  0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x79, 0x34, 0x20, 0x3d, 0x20, 0x79, 0x2a,
+  0x79, 0x2a, 0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x34, 0x20, 0x3d, 0x20,
+  0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x36, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x32, 0x2e,
+  0x35, 0x30, 0x33, 0x33, 0x34, 0x32, 0x39, 0x34, 0x31, 0x38, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x28,
+  0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x37, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30, 0x31, 0x33, 0x30, 0x37, 0x36, 0x39,
+  0x37, 0x38, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a,
+  0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20,
+  0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x38, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x39,
+  0x34, 0x36, 0x31, 0x37, 0x34, 0x36, 0x39, 0x35, 0x37, 0x35, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e,
+  0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x31, 0x39, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x33, 0x33, 0x38,
+  0x30, 0x39, 0x33, 0x30, 0x38, 0x37, 0x31, 0x31, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x33, 0x2e, 0x30, 0x29,
+  0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x32, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x30, 0x35, 0x2e, 0x30, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x34, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x39, 0x30, 0x2e, 0x30, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x32, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x39, 0x2e, 0x30, 0x29, 0x29, 0x29, 0x20, 0x2f,
+  0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x36,
+  0x2e, 0x30, 0x20, 0x2a, 0x20, 0x31, 0x2e, 0x37, 0x37, 0x32, 0x34, 0x35,
+  0x33, 0x38, 0x35, 0x30, 0x39, 0x30, 0x35, 0x35, 0x31, 0x36, 0x30, 0x32,
+  0x37, 0x32, 0x39, 0x38, 0x31, 0x36, 0x37, 0x34, 0x38, 0x33, 0x33, 0x34,
+  0x31, 0x31, 0x34, 0x35, 0x31, 0x38, 0x32, 0x37, 0x39, 0x37, 0x35, 0x34,
+  0x39, 0x34, 0x35, 0x36, 0x31, 0x32, 0x32, 0x33, 0x38, 0x37, 0x31, 0x29,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x32, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x33, 0x33, 0x38, 0x30,
+  0x39, 0x33, 0x30, 0x38, 0x37, 0x31, 0x31, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x33, 0x2e, 0x30, 0x29, 0x29,
+  0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x37, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32,
+  0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x30, 0x2e, 0x34, 0x37, 0x33, 0x30, 0x38, 0x37, 0x33,
+  0x34, 0x37, 0x38, 0x37, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32,
+  0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29,
+  0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x32, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30, 0x31, 0x33,
+  0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78,
+  0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d,
+  0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33, 0x2e,
+  0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x34, 0x5d,
+  0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x30, 0x2e, 0x36, 0x32, 0x35, 0x38, 0x33, 0x35, 0x37, 0x33, 0x35,
+  0x34, 0x34, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x34, 0x20, 0x2d,
+  0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x36, 0x2e,
+  0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x20, 0x2a, 0x20, 0x78,
+  0x32, 0x20, 0x2b, 0x20, 0x79, 0x34, 0x29, 0x29, 0x3b, 0x20, 0x7d, 0x20,
+  0x77, 0x68, 0x69, 0x6c, 0x65, 0x20, 0x28, 0x30, 0x29, 0x3b, 0x20, 0x7d,
+  0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x76, 0x6f, 0x69, 0x64,
+  0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x66, 0x5f, 0x6c, 0x34, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x2a, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a,
+  0x20, 0x64, 0x69, 0x72, 0x29, 0x20, 0x7b, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x20, 0x3d, 0x20,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x30,
+  0x5d, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x79, 0x20, 0x3d, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x64, 0x69, 0x72, 0x5b, 0x31, 0x5d, 0x3b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x20,
+  0x3d, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x64, 0x69, 0x72,
+  0x5b, 0x32, 0x5d, 0x3b, 0x20, 0x64, 0x6f, 0x20, 0x7b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x65,
+  0x72, 0x6f, 0x20, 0x3d, 0x20, 0x7b, 0x30, 0x7d, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x30, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x7a, 0x65, 0x72, 0x6f, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x32, 0x38, 0x32, 0x30, 0x39,
+  0x34, 0x37, 0x39, 0x31, 0x37, 0x37, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x30, 0x2e, 0x34, 0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x34,
+  0x38, 0x38, 0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x38, 0x38,
+  0x36, 0x30, 0x32, 0x35, 0x31, 0x31, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x78, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28, 0x28, 0x35, 0x29, 0x20,
+  0x3c, 0x3d, 0x20, 0x32, 0x29, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x78, 0x32, 0x20, 0x3d, 0x20, 0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63,
+  0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x79,
+  0x32, 0x20, 0x3d, 0x20, 0x79, 0x2a, 0x79, 0x3b, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x32, 0x20,
+  0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x2e, 0x30, 0x39, 0x32,
+  0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e,
+  0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35, 0x39, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x36, 0x5d, 0x20,
+  0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x30, 0x2e, 0x33, 0x31, 0x35, 0x33, 0x39, 0x31, 0x35, 0x36, 0x35, 0x32,
+  0x35, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x7a, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73,
+  0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x37, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x31, 0x2e, 0x30, 0x39, 0x32, 0x35, 0x34, 0x38, 0x34, 0x33, 0x30, 0x35,
+  0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x29,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x38,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x30, 0x2e, 0x35, 0x34, 0x36, 0x32, 0x37, 0x34, 0x32, 0x31,
+  0x35, 0x32, 0x39, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20,
+  0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x69, 0x66, 0x20, 0x28,
+  0x28, 0x35, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x33, 0x29, 0x20, 0x62, 0x72,
+  0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x20, 0x7a, 0x33, 0x20, 0x3d, 0x20, 0x7a, 0x2a,
+  0x7a, 0x2a, 0x7a, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x39, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39, 0x30, 0x30,
+  0x34, 0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x79, 0x20, 0x2a, 0x20, 0x28, 0x33, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20,
+  0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x32, 0x2e, 0x38,
+  0x39, 0x30, 0x36, 0x31, 0x31, 0x34, 0x34, 0x32, 0x36, 0x34, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a,
+  0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x31, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x36, 0x34, 0x36, 0x33, 0x36,
+  0x30, 0x33, 0x36, 0x38, 0x32, 0x32, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79,
+  0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29,
+  0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x29,
+  0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x32, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e,
+  0x33, 0x37, 0x33, 0x31, 0x37, 0x36, 0x33, 0x33, 0x32, 0x35, 0x39, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x33,
+  0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x29, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x33,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x2d, 0x30, 0x2e, 0x34, 0x35, 0x37, 0x30, 0x34, 0x35, 0x37,
+  0x39, 0x39, 0x34, 0x36, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x31, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x35, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x31, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x2e, 0x34, 0x34,
+  0x35, 0x33, 0x30, 0x35, 0x37, 0x32, 0x31, 0x33, 0x32, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x35, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x30, 0x2e, 0x35, 0x39,
+  0x30, 0x30, 0x34, 0x33, 0x35, 0x38, 0x39, 0x39, 0x32, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x69,
+  0x66, 0x20, 0x28, 0x28, 0x35, 0x29, 0x20, 0x3c, 0x3d, 0x20, 0x34, 0x29,
+  0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x78, 0x34, 0x20, 0x3d,
+  0x20, 0x78, 0x2a, 0x78, 0x2a, 0x78, 0x2a, 0x78, 0x3b, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x79, 0x34,
+  0x20, 0x3d, 0x20, 0x79, 0x2a, 0x79, 0x2a, 0x79, 0x2a, 0x79, 0x3b, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x7a, 0x34, 0x20, 0x3d, 0x20, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a, 0x2a, 0x7a,
+  0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31,
+  0x36, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x32, 0x2e, 0x35, 0x30, 0x33, 0x33, 0x34, 0x32, 0x39,
+  0x34, 0x31, 0x38, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20,
+  0x79, 0x20, 0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32,
+  0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x31, 0x37, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e, 0x37, 0x37, 0x30, 0x31,
+  0x33, 0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x79, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x29, 0x3b,
+  0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x38,
+  0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x30, 0x2e, 0x39, 0x34, 0x36, 0x31, 0x37, 0x34, 0x36, 0x39,
+  0x35, 0x37, 0x35, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20,
+  0x78, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x29, 0x28, 0x2d, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x39, 0x5d, 0x20, 0x3d,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x31, 0x2e, 0x33, 0x33, 0x38, 0x30, 0x39, 0x33, 0x30, 0x38, 0x37, 0x31,
+  0x31, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x7a, 0x20,
+  0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x2d, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x30, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x31, 0x30,
+  0x35, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x34, 0x20, 0x2d,
+  0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x39, 0x30,
+  0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x7a, 0x32, 0x20, 0x2b, 0x20,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x39, 0x2e, 0x30,
+  0x29, 0x29, 0x29, 0x20, 0x2f, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x31, 0x36, 0x2e, 0x30, 0x20, 0x2a, 0x20, 0x31, 0x2e,
+  0x37, 0x37, 0x32, 0x34, 0x35, 0x33, 0x38, 0x35, 0x30, 0x39, 0x30, 0x35,
+  0x35, 0x31, 0x36, 0x30, 0x32, 0x37, 0x32, 0x39, 0x38, 0x31, 0x36, 0x37,
+  0x34, 0x38, 0x33, 0x33, 0x34, 0x31, 0x31, 0x34, 0x35, 0x31, 0x38, 0x32,
+  0x37, 0x39, 0x37, 0x35, 0x34, 0x39, 0x34, 0x35, 0x36, 0x31, 0x32, 0x32,
+  0x33, 0x38, 0x37, 0x31, 0x29, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x31, 0x5d, 0x20, 0x3d, 0x20,
+  0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31,
+  0x2e, 0x33, 0x33, 0x38, 0x30, 0x39, 0x33, 0x30, 0x38, 0x37, 0x31, 0x31,
+  0x29, 0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a,
+  0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d,
+  0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a,
+  0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x32, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28,
+  0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x34, 0x37,
+  0x33, 0x30, 0x38, 0x37, 0x33, 0x34, 0x37, 0x38, 0x37, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x79, 0x32, 0x29, 0x20,
+  0x2a, 0x20, 0x28, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28,
+  0x2d, 0x31, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2b, 0x20, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x37, 0x2e, 0x30, 0x29, 0x29, 0x20,
+  0x2a, 0x20, 0x7a, 0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x28,
+  0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x2d, 0x31, 0x2e,
+  0x37, 0x37, 0x30, 0x31, 0x33, 0x30, 0x37, 0x36, 0x39, 0x37, 0x38, 0x29,
+  0x29, 0x20, 0x2a, 0x20, 0x78, 0x20, 0x2a, 0x20, 0x7a, 0x20, 0x2a, 0x20,
+  0x28, 0x78, 0x32, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x33, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79,
+  0x32, 0x29, 0x29, 0x3b, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x5b, 0x32, 0x34, 0x5d, 0x20, 0x3d, 0x20, 0x28, 0x28, 0x28, 0x66,
+  0x6c, 0x6f, 0x61, 0x74, 0x29, 0x28, 0x30, 0x2e, 0x36, 0x32, 0x35, 0x38,
+  0x33, 0x35, 0x37, 0x33, 0x35, 0x34, 0x34, 0x29, 0x29, 0x20, 0x2a, 0x20,
+  0x28, 0x78, 0x34, 0x20, 0x2d, 0x20, 0x28, 0x28, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x29, 0x28, 0x36, 0x2e, 0x30, 0x29, 0x29, 0x20, 0x2a, 0x20, 0x79,
+  0x32, 0x20, 0x2a, 0x20, 0x78, 0x32, 0x20, 0x2b, 0x20, 0x79, 0x34, 0x29,
+  0x29, 0x3b, 0x20, 0x7d, 0x20, 0x77, 0x68, 0x69, 0x6c, 0x65, 0x20, 0x28,
+  0x30, 0x29, 0x3b, 0x20, 0x7d, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x73,
+  0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x66, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20,
+  0x73, 0x68, 0x5f, 0x6f, 0x72, 0x64, 0x65, 0x72, 0x20, 0x6f, 0x72, 0x64,
+  0x65, 0x72, 0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x2a, 0x20, 0x64, 0x69, 0x72, 0x29, 0x0a, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x73, 0x77, 0x69, 0x74, 0x63, 0x68, 0x20, 0x28,
+  0x6f, 0x72, 0x64, 0x65, 0x72, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20, 0x53, 0x48,
+  0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x5f, 0x4c, 0x31, 0x3a, 0x20, 0x73,
+  0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x66, 0x5f, 0x6c, 0x31, 0x28, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x2c, 0x20, 0x64, 0x69, 0x72, 0x29, 0x3b, 0x20, 0x62, 0x72, 0x65,
+  0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x61, 0x73, 0x65, 0x20, 0x53, 0x48, 0x5f, 0x4f, 0x52, 0x44, 0x45,
+  0x52, 0x5f, 0x4c, 0x32, 0x3a, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61,
+  0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x66, 0x5f, 0x6c, 0x32, 0x28,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x64, 0x69,
+  0x72, 0x29, 0x3b, 0x20, 0x62, 0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x61, 0x73, 0x65, 0x20,
+  0x53, 0x48, 0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x5f, 0x4c, 0x33, 0x3a,
+  0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x66, 0x5f, 0x6c, 0x33, 0x28, 0x73, 0x68, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x2c, 0x20, 0x64, 0x69, 0x72, 0x29, 0x3b, 0x20, 0x62,
+  0x72, 0x65, 0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x64, 0x65, 0x66, 0x61, 0x75, 0x6c, 0x74, 0x3a, 0x20, 0x73,
+  0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x66, 0x5f, 0x6c, 0x34, 0x28, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x2c, 0x20, 0x64, 0x69, 0x72, 0x29, 0x3b, 0x20, 0x62, 0x72, 0x65,
+  0x61, 0x6b, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a,
+  0x76, 0x6f, 0x69, 0x64, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c,
+  0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x35, 0x66, 0x28, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x2a, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x2c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61,
+  0x74, 0x2a, 0x20, 0x64, 0x69, 0x72, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x66, 0x5f, 0x6c, 0x34, 0x28, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x64, 0x69, 0x72, 0x29, 0x3b, 0x0a,
+  0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x66, 0x6f,
+  0x6c, 0x64, 0x5f, 0x63, 0x6f, 0x75, 0x6e, 0x74, 0x28, 0x75, 0x69, 0x6e,
+  0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x7a, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74,
+  0x75, 0x72, 0x6e, 0x20, 0x28, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a,
+  0x20, 0x2b, 0x20, 0x31, 0x29, 0x20, 0x2f, 0x20, 0x32, 0x3b, 0x0a, 0x7d,
+  0x0a, 0x73, 0x74, 0x61, 0x74, 0x69, 0x63, 0x20, 0x75, 0x69, 0x6e, 0x74,
+  0x33, 0x32, 0x5f, 0x74, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x66, 0x6f, 0x6c,
+  0x64, 0x28, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x63,
+  0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72,
+  0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a,
+  0x20, 0x73, 0x69, 0x67, 0x6e, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x69, 0x66, 0x20, 0x28, 0x32, 0x20, 0x2a, 0x20, 0x63, 0x20, 0x2b,
+  0x20, 0x31, 0x20, 0x3c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a,
+  0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x2a, 0x73, 0x69, 0x67, 0x6e, 0x20, 0x3d, 0x20, 0x2d, 0x31, 0x2e, 0x30,
+  0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63,
+  0x20, 0x3d, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x20, 0x2d,
+  0x20, 0x31, 0x20, 0x2d, 0x20, 0x63, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x7d, 0x20, 0x65, 0x6c, 0x73, 0x65, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x2a, 0x73, 0x69, 0x67, 0x6e, 0x20, 0x3d,
+  0x20, 0x31, 0x2e, 0x30, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x72, 0x65, 0x74, 0x75, 0x72, 0x6e, 0x20,
+  0x63, 0x20, 0x2d, 0x20, 0x28, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a,
+  0x20, 0x2d, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x66, 0x6f, 0x6c, 0x64, 0x5f,
+  0x63, 0x6f, 0x75, 0x6e, 0x74, 0x28, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x7a, 0x29, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x73, 0x74, 0x61, 0x74, 0x69,
+  0x63, 0x20, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x73,
+  0x79, 0x6d, 0x6d, 0x65, 0x74, 0x72, 0x69, 0x63, 0x5f, 0x65, 0x78, 0x70,
+  0x61, 0x6e, 0x64, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74,
+  0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x6e, 0x73, 0x61, 0x5b,
+  0x34, 0x5d, 0x2c, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x2a, 0x20, 0x65, 0x2c, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x73, 0x77, 0x61,
+  0x70, 0x70, 0x65, 0x64, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x73, 0x75, 0x2c, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x73, 0x76,
+  0x2c, 0x20, 0x5f, 0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x33, 0x5d, 0x5b, 0x33, 0x5d, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74,
+  0x20, 0x63, 0x75, 0x20, 0x3d, 0x20, 0x73, 0x75, 0x20, 0x2a, 0x20, 0x28,
+  0x73, 0x77, 0x61, 0x70, 0x70, 0x65, 0x64, 0x20, 0x3f, 0x20, 0x65, 0x5b,
+  0x31, 0x5d, 0x20, 0x3a, 0x20, 0x65, 0x5b, 0x30, 0x5d, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x63, 0x76, 0x20, 0x3d, 0x20, 0x73, 0x76, 0x20,
+  0x2a, 0x20, 0x28, 0x73, 0x77, 0x61, 0x70, 0x70, 0x65, 0x64, 0x20, 0x3f,
+  0x20, 0x65, 0x5b, 0x30, 0x5d, 0x20, 0x3a, 0x20, 0x65, 0x5b, 0x31, 0x5d,
+  0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x30,
+  0x5d, 0x20, 0x3d, 0x20, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x30, 0x5d,
+  0x5b, 0x30, 0x5d, 0x20, 0x2a, 0x20, 0x63, 0x75, 0x20, 0x2b, 0x20, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x31, 0x5d, 0x5b, 0x30, 0x5d, 0x20, 0x2a,
+  0x20, 0x63, 0x76, 0x20, 0x2b, 0x20, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b,
+  0x32, 0x5d, 0x5b, 0x30, 0x5d, 0x20, 0x2a, 0x20, 0x65, 0x5b, 0x32, 0x5d,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x31, 0x5d,
+  0x20, 0x3d, 0x20, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x30, 0x5d, 0x5b,
+  0x31, 0x5d, 0x20, 0x2a, 0x20, 0x63, 0x75, 0x20, 0x2b, 0x20, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x31, 0x5d, 0x5b, 0x31, 0x5d, 0x20, 0x2a, 0x20,
+  0x63, 0x76, 0x20, 0x2b, 0x20, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32,
+  0x5d, 0x5b, 0x31, 0x5d, 0x20, 0x2a, 0x20, 0x65, 0x5b, 0x32, 0x5d, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x32, 0x5d, 0x20,
+  0x3d, 0x20, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x30, 0x5d, 0x5b, 0x32,
+  0x5d, 0x20, 0x2a, 0x20, 0x63, 0x75, 0x20, 0x2b, 0x20, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x5b, 0x31, 0x5d, 0x5b, 0x32, 0x5d, 0x20, 0x2a, 0x20, 0x63,
+  0x76, 0x20, 0x2b, 0x20, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x32, 0x5d,
+  0x5b, 0x32, 0x5d, 0x20, 0x2a, 0x20, 0x65, 0x5b, 0x32, 0x5d, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x33, 0x5d, 0x20, 0x3d,
+  0x20, 0x65, 0x5b, 0x33, 0x5d, 0x3b, 0x0a, 0x7d, 0x0a, 0x76, 0x6f, 0x69,
+  0x64, 0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c,
+  0x69, 0x64, 0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64,
+  0x65, 0x78, 0x5f, 0x73, 0x79, 0x6d, 0x6d, 0x65, 0x74, 0x72, 0x69, 0x63,
+  0x5f, 0x66, 0x65, 0x74, 0x63, 0x68, 0x28, 0x5f, 0x5f, 0x70, 0x72, 0x69,
+  0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x6e,
+  0x73, 0x61, 0x5b, 0x34, 0x5d, 0x2c, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f,
+  0x62, 0x61, 0x6c, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x2a, 0x20, 0x69, 0x64, 0x78, 0x2c, 0x20, 0x75, 0x69,
+  0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x73, 0x7a, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f, 0x74, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32,
+  0x5f, 0x74, 0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32,
+  0x5f, 0x74, 0x20, 0x79, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x73, 0x75, 0x2c, 0x20, 0x73, 0x76,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x61, 0x20, 0x3d,
+  0x20, 0x6e, 0x73, 0x61, 0x5f, 0x66, 0x6f, 0x6c, 0x64, 0x28, 0x78, 0x2c,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20, 0x26, 0x73,
+  0x75, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x62,
+  0x20, 0x3d, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x66, 0x6f, 0x6c, 0x64, 0x28,
+  0x79, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20,
+  0x26, 0x73, 0x76, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74,
+  0x20, 0x6c, 0x6f, 0x20, 0x3d, 0x20, 0x61, 0x20, 0x3c, 0x20, 0x62, 0x20,
+  0x3f, 0x20, 0x61, 0x20, 0x3a, 0x20, 0x62, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33,
+  0x32, 0x5f, 0x74, 0x20, 0x68, 0x69, 0x20, 0x3d, 0x20, 0x61, 0x20, 0x3c,
+  0x20, 0x62, 0x20, 0x3f, 0x20, 0x62, 0x20, 0x3a, 0x20, 0x61, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x62, 0x61,
+  0x73, 0x69, 0x73, 0x5b, 0x33, 0x5d, 0x5b, 0x33, 0x5d, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x63, 0x75,
+  0x62, 0x65, 0x5f, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x62, 0x61, 0x73, 0x69,
+  0x73, 0x28, 0x62, 0x61, 0x73, 0x69, 0x73, 0x2c, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5f,
+  0x73, 0x79, 0x6d, 0x6d, 0x65, 0x74, 0x72, 0x69, 0x63, 0x5f, 0x65, 0x78,
+  0x70, 0x61, 0x6e, 0x64, 0x28, 0x6e, 0x73, 0x61, 0x2c, 0x20, 0x69, 0x64,
+  0x78, 0x20, 0x2b, 0x20, 0x28, 0x68, 0x69, 0x20, 0x2a, 0x20, 0x28, 0x68,
+  0x69, 0x20, 0x2b, 0x20, 0x31, 0x29, 0x20, 0x2f, 0x20, 0x32, 0x20, 0x2b,
+  0x20, 0x6c, 0x6f, 0x29, 0x20, 0x2a, 0x20, 0x34, 0x2c, 0x20, 0x61, 0x20,
+  0x3e, 0x20, 0x62, 0x2c, 0x20, 0x73, 0x75, 0x2c, 0x20, 0x73, 0x76, 0x2c,
+  0x20, 0x62, 0x61, 0x73, 0x69, 0x73, 0x29, 0x3b, 0x0a, 0x7d, 0x0a, 0x76,
+  0x6f, 0x69, 0x64, 0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61, 0x6c, 0x5f, 0x73,
+  0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x69,
+  0x6e, 0x64, 0x65, 0x78, 0x5f, 0x66, 0x65, 0x74, 0x63, 0x68, 0x28, 0x5f,
+  0x5f, 0x70, 0x72, 0x69, 0x76, 0x61, 0x74, 0x65, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x34, 0x5d, 0x2c, 0x20, 0x5f,
+  0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x2a, 0x20, 0x69, 0x64, 0x78,
+  0x2c, 0x20, 0x65, 0x6e, 0x75, 0x6d, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x6c,
+  0x61, 0x79, 0x6f, 0x75, 0x74, 0x20, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74,
+  0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x70,
+  0x6c, 0x61, 0x6e, 0x65, 0x5f, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x2c,
+  0x20, 0x75, 0x69, 0x6e, 0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20, 0x75, 0x69, 0x6e, 0x74, 0x38,
+  0x5f, 0x74, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x78, 0x2c, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x79, 0x29, 0x0a, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x75, 0x69, 0x6e,
+  0x74, 0x33, 0x32, 0x5f, 0x74, 0x20, 0x69, 0x20, 0x3d, 0x20, 0x28, 0x66,
+  0x61, 0x63, 0x65, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73,
+  0x7a, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x29,
+  0x20, 0x2b, 0x20, 0x79, 0x20, 0x2a, 0x20, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x73, 0x7a, 0x20, 0x2b, 0x20, 0x78, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x69, 0x66, 0x20, 0x28, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x20, 0x3d,
+  0x3d, 0x20, 0x4e, 0x53, 0x41, 0x5f, 0x4c, 0x41, 0x59, 0x4f, 0x55, 0x54,
+  0x5f, 0x53, 0x4f, 0x41, 0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x30, 0x5d, 0x20, 0x3d,
+  0x20, 0x69, 0x64, 0x78, 0x5b, 0x69, 0x20, 0x2b, 0x20, 0x30, 0x20, 0x2a,
+  0x20, 0x70, 0x6c, 0x61, 0x6e, 0x65, 0x5f, 0x73, 0x74, 0x72, 0x69, 0x64,
+  0x65, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x6e, 0x73, 0x61, 0x5b, 0x31, 0x5d, 0x20, 0x3d, 0x20, 0x69, 0x64, 0x78,
+  0x5b, 0x69, 0x20, 0x2b, 0x20, 0x31, 0x20, 0x2a, 0x20, 0x70, 0x6c, 0x61,
+  0x6e, 0x65, 0x5f, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x5d, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b,
+  0x32, 0x5d, 0x20, 0x3d, 0x20, 0x69, 0x64, 0x78, 0x5b, 0x69, 0x20, 0x2b,
+  0x20, 0x32, 0x20, 0x2a, 0x20, 0x70, 0x6c, 0x61, 0x6e, 0x65, 0x5f, 0x73,
+  0x74, 0x72, 0x69, 0x64, 0x65, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x33, 0x5d, 0x20, 0x3d,
+  0x20, 0x69, 0x64, 0x78, 0x5b, 0x69, 0x20, 0x2b, 0x20, 0x33, 0x20, 0x2a,
+  0x20, 0x70, 0x6c, 0x61, 0x6e, 0x65, 0x5f, 0x73, 0x74, 0x72, 0x69, 0x64,
+  0x65, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x20, 0x65, 0x6c,
+  0x73, 0x65, 0x20, 0x69, 0x66, 0x20, 0x28, 0x6c, 0x61, 0x79, 0x6f, 0x75,
+  0x74, 0x20, 0x3d, 0x3d, 0x20, 0x4e, 0x53, 0x41, 0x5f, 0x4c, 0x41, 0x59,
+  0x4f, 0x55, 0x54, 0x5f, 0x4e, 0x4f, 0x4e, 0x45, 0x29, 0x20, 0x7b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x74, 0x65, 0x78, 0x65,
+  0x6c, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x20, 0x3d, 0x20, 0x31, 0x2e, 0x30,
+  0x66, 0x20, 0x2f, 0x20, 0x28, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x29, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x66, 0x6c,
+  0x6f, 0x61, 0x74, 0x20, 0x76, 0x20, 0x3d, 0x20, 0x32, 0x2e, 0x30, 0x66,
+  0x20, 0x2a, 0x20, 0x28, 0x28, 0x79, 0x20, 0x2b, 0x20, 0x30, 0x2e, 0x35,
+  0x66, 0x29, 0x20, 0x2a, 0x20, 0x74, 0x65, 0x78, 0x65, 0x6c, 0x5f, 0x73,
+  0x69, 0x7a, 0x65, 0x29, 0x20, 0x2d, 0x20, 0x31, 0x2e, 0x30, 0x66, 0x3b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e,
+  0x73, 0x74, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x75, 0x20, 0x3d,
+  0x20, 0x32, 0x2e, 0x30, 0x66, 0x20, 0x2a, 0x20, 0x28, 0x28, 0x78, 0x20,
+  0x2b, 0x20, 0x30, 0x2e, 0x35, 0x66, 0x29, 0x20, 0x2a, 0x20, 0x74, 0x65,
+  0x78, 0x65, 0x6c, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x20, 0x2d, 0x20,
+  0x31, 0x2e, 0x30, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78,
+  0x65, 0x6c, 0x5f, 0x63, 0x6f, 0x6f, 0x72, 0x64, 0x5f, 0x74, 0x6f, 0x5f,
+  0x76, 0x65, 0x63, 0x5f, 0x77, 0x61, 0x72, 0x70, 0x28, 0x6e, 0x73, 0x61,
+  0x2c, 0x20, 0x45, 0x4d, 0x5f, 0x54, 0x59, 0x50, 0x45, 0x5f, 0x48, 0x43,
+  0x52, 0x4f, 0x53, 0x53, 0x2c, 0x20, 0x75, 0x2c, 0x20, 0x76, 0x2c, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x2c, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70,
+  0x5f, 0x77, 0x61, 0x72, 0x70, 0x5f, 0x66, 0x69, 0x78, 0x75, 0x70, 0x5f,
+  0x66, 0x61, 0x63, 0x74, 0x6f, 0x72, 0x28, 0x66, 0x61, 0x63, 0x65, 0x5f,
+  0x73, 0x7a, 0x29, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x74,
+  0x65, 0x78, 0x65, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61,
+  0x6e, 0x67, 0x6c, 0x65, 0x28, 0x75, 0x2c, 0x20, 0x76, 0x2c, 0x20, 0x74,
+  0x65, 0x78, 0x65, 0x6c, 0x5f, 0x73, 0x69, 0x7a, 0x65, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x7d, 0x20, 0x65, 0x6c, 0x73, 0x65, 0x20, 0x69,
+  0x66, 0x20, 0x28, 0x6c, 0x61, 0x79, 0x6f, 0x75, 0x74, 0x20, 0x3d, 0x3d,
+  0x20, 0x4e, 0x53, 0x41, 0x5f, 0x4c, 0x41, 0x59, 0x4f, 0x55, 0x54, 0x5f,
+  0x53, 0x59, 0x4d, 0x4d, 0x45, 0x54, 0x52, 0x49, 0x43, 0x29, 0x20, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x6f, 0x72,
+  0x6d, 0x61, 0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e,
+  0x67, 0x6c, 0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x5f, 0x73, 0x79,
+  0x6d, 0x6d, 0x65, 0x74, 0x72, 0x69, 0x63, 0x5f, 0x66, 0x65, 0x74, 0x63,
+  0x68, 0x28, 0x6e, 0x73, 0x61, 0x2c, 0x20, 0x69, 0x64, 0x78, 0x2c, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x2c, 0x20, 0x78, 0x2c, 0x20, 0x79, 0x29, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x7d, 0x20, 0x65, 0x6c, 0x73, 0x65, 0x20, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x30,
+  0x5d, 0x20, 0x3d, 0x20, 0x69, 0x64, 0x78, 0x5b, 0x69, 0x20, 0x2a, 0x20,
+  0x34, 0x20, 0x2b, 0x20, 0x30, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x31, 0x5d, 0x20, 0x3d,
+  0x20, 0x69, 0x64, 0x78, 0x5b, 0x69, 0x20, 0x2a, 0x20, 0x34, 0x20, 0x2b,
+  0x20, 0x31, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x6e, 0x73, 0x61, 0x5b, 0x32, 0x5d, 0x20, 0x3d, 0x20, 0x69, 0x64,
+  0x78, 0x5b, 0x69, 0x20, 0x2a, 0x20, 0x34, 0x20, 0x2b, 0x20, 0x32, 0x5d,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x73,
+  0x61, 0x5b, 0x33, 0x5d, 0x20, 0x3d, 0x20, 0x69, 0x64, 0x78, 0x5b, 0x69,
+  0x20, 0x2a, 0x20, 0x34, 0x20, 0x2b, 0x20, 0x33, 0x5d, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x7d, 0x0a, 0x7d, 0x0a, 0x23, 0x70, 0x72, 0x61, 0x67,
+  0x6d, 0x61, 0x20, 0x4f, 0x50, 0x45, 0x4e, 0x43, 0x4c, 0x20, 0x45, 0x58,
+  0x54, 0x45, 0x4e, 0x53, 0x49, 0x4f, 0x4e, 0x20, 0x63, 0x6c, 0x5f, 0x6b,
+  0x68, 0x72, 0x5f, 0x66, 0x70, 0x36, 0x34, 0x3a, 0x20, 0x65, 0x6e, 0x61,
+  0x62, 0x6c, 0x65, 0x0a, 0x23, 0x70, 0x72, 0x61, 0x67, 0x6d, 0x61, 0x20,
+  0x4f, 0x50, 0x45, 0x4e, 0x43, 0x4c, 0x20, 0x45, 0x58, 0x54, 0x45, 0x4e,
+  0x53, 0x49, 0x4f, 0x4e, 0x20, 0x63, 0x6c, 0x5f, 0x6b, 0x68, 0x72, 0x5f,
+  0x69, 0x6e, 0x74, 0x36, 0x34, 0x5f, 0x62, 0x61, 0x73, 0x65, 0x5f, 0x61,
+  0x74, 0x6f, 0x6d, 0x69, 0x63, 0x73, 0x3a, 0x20, 0x65, 0x6e, 0x61, 0x62,
+  0x6c, 0x65, 0x0a, 0x76, 0x6f, 0x69, 0x64, 0x20, 0x61, 0x74, 0x6f, 0x6d,
+  0x69, 0x63, 0x5f, 0x61, 0x64, 0x64, 0x5f, 0x64, 0x62, 0x6c, 0x28, 0x5f,
+  0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x64, 0x6f, 0x75, 0x62,
+  0x6c, 0x65, 0x2a, 0x20, 0x76, 0x61, 0x6c, 0x2c, 0x20, 0x64, 0x6f, 0x75,
+  0x62, 0x6c, 0x65, 0x20, 0x64, 0x65, 0x6c, 0x74, 0x61, 0x29, 0x0a, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x75, 0x6e, 0x69, 0x6f, 0x6e, 0x20, 0x7b,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x6f, 0x75,
+  0x62, 0x6c, 0x65, 0x20, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x75, 0x6c, 0x6f, 0x6e, 0x67, 0x20, 0x69, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x7d, 0x20, 0x6f, 0x6c, 0x64, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x75, 0x6e, 0x69, 0x6f, 0x6e, 0x20, 0x7b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c,
+  0x65, 0x20, 0x66, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x75, 0x6c, 0x6f, 0x6e, 0x67, 0x20, 0x69, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x7d, 0x20, 0x6e, 0x65, 0x77, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x64, 0x6f, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x6f, 0x6c, 0x64, 0x2e, 0x66, 0x20, 0x3d, 0x20, 0x2a, 0x76,
+  0x61, 0x6c, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x6e, 0x65, 0x77, 0x2e, 0x66, 0x20, 0x3d, 0x20, 0x6f, 0x6c, 0x64, 0x2e,
+  0x66, 0x20, 0x2b, 0x20, 0x64, 0x65, 0x6c, 0x74, 0x61, 0x3b, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x7d, 0x20, 0x77, 0x68, 0x69, 0x6c, 0x65, 0x20, 0x28,
+  0x61, 0x74, 0x6f, 0x6d, 0x5f, 0x63, 0x6d, 0x70, 0x78, 0x63, 0x68, 0x67,
+  0x20, 0x28, 0x28, 0x76, 0x6f, 0x6c, 0x61, 0x74, 0x69, 0x6c, 0x65, 0x20,
+  0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x6c, 0x6f,
+  0x6e, 0x67, 0x20, 0x2a, 0x29, 0x76, 0x61, 0x6c, 0x2c, 0x20, 0x6f, 0x6c,
+  0x64, 0x2e, 0x69, 0x2c, 0x20, 0x6e, 0x65, 0x77, 0x2e, 0x69, 0x29, 0x20,
+  0x21, 0x3d, 0x20, 0x6f, 0x6c, 0x64, 0x2e, 0x69, 0x29, 0x3b, 0x0a, 0x7d,
+  0x0a, 0x5f, 0x5f, 0x6b, 0x65, 0x72, 0x6e, 0x65, 0x6c, 0x20, 0x76, 0x6f,
+  0x69, 0x64, 0x20, 0x62, 0x6f, 0x6f, 0x6f, 0x28, 0x5f, 0x5f, 0x67, 0x6c,
+  0x6f, 0x62, 0x61, 0x6c, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x2a,
+  0x20, 0x73, 0x68, 0x5f, 0x63, 0x6f, 0x65, 0x66, 0x66, 0x73, 0x2c, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67, 0x6c, 0x6f,
+  0x62, 0x61, 0x6c, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x2a, 0x20,
+  0x77, 0x65, 0x69, 0x67, 0x68, 0x74, 0x5f, 0x61, 0x63, 0x63, 0x75, 0x6d,
+  0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x5f, 0x5f, 0x67,
+  0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x75, 0x6e, 0x73, 0x69, 0x67, 0x6e,
+  0x65, 0x64, 0x20, 0x63, 0x68, 0x61, 0x72, 0x2a, 0x20, 0x69, 0x6d, 0x67,
+  0x5f, 0x69, 0x6e, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x5f, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x20, 0x66, 0x6c, 0x6f,
+  0x61, 0x74, 0x2a, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x69, 0x64, 0x78, 0x2c,
+  0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x75, 0x6e, 0x73, 0x69, 0x67, 0x6e, 0x65, 0x64, 0x20, 0x69,
+  0x6e, 0x74, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79, 0x6f, 0x75,
+  0x74, 0x2c, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x75, 0x6e, 0x73, 0x69, 0x67, 0x6e, 0x65, 0x64,
+  0x20, 0x69, 0x6e, 0x74, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x70, 0x6c, 0x61,
+  0x6e, 0x65, 0x5f, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x2c, 0x0a, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20,
+  0x75, 0x6e, 0x73, 0x69, 0x67, 0x6e, 0x65, 0x64, 0x20, 0x69, 0x6e, 0x74,
+  0x20, 0x66, 0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x75,
+  0x6e, 0x73, 0x69, 0x67, 0x6e, 0x65, 0x64, 0x20, 0x69, 0x6e, 0x74, 0x20,
+  0x65, 0x6d, 0x5f, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x75, 0x6e,
+  0x73, 0x69, 0x67, 0x6e, 0x65, 0x64, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x65,
+  0x6d, 0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x2c, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x75,
+  0x6e, 0x73, 0x69, 0x67, 0x6e, 0x65, 0x64, 0x20, 0x69, 0x6e, 0x74, 0x20,
+  0x66, 0x61, 0x63, 0x65, 0x29, 0x0a, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x75, 0x6e, 0x73, 0x69, 0x67, 0x6e, 0x65, 0x64, 0x20, 0x69, 0x6e, 0x74,
+  0x20, 0x78, 0x64, 0x73, 0x74, 0x20, 0x3d, 0x20, 0x67, 0x65, 0x74, 0x5f,
+  0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c, 0x5f, 0x69, 0x64, 0x28, 0x31, 0x29,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x75, 0x6e, 0x73, 0x69, 0x67, 0x6e,
+  0x65, 0x64, 0x20, 0x69, 0x6e, 0x74, 0x20, 0x79, 0x64, 0x73, 0x74, 0x20,
+  0x3d, 0x20, 0x67, 0x65, 0x74, 0x5f, 0x67, 0x6c, 0x6f, 0x62, 0x61, 0x6c,
+  0x5f, 0x69, 0x64, 0x28, 0x30, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x73, 0x74, 0x72, 0x75, 0x63, 0x74, 0x20, 0x65, 0x6e, 0x76, 0x6d, 0x61,
+  0x70, 0x20, 0x65, 0x6d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6d,
+  0x2e, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x20, 0x3d, 0x20, 0x65, 0x6d,
+  0x5f, 0x66, 0x6f, 0x72, 0x6d, 0x61, 0x74, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x65, 0x6d, 0x2e, 0x64, 0x61, 0x74, 0x61, 0x20, 0x3d, 0x20, 0x69,
+  0x6d, 0x67, 0x5f, 0x69, 0x6e, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x65,
+  0x6d, 0x2e, 0x74, 0x79, 0x70, 0x65, 0x20, 0x3d, 0x20, 0x65, 0x6d, 0x5f,
+  0x74, 0x79, 0x70, 0x65, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x65, 0x6e,
+  0x76, 0x6d, 0x61, 0x70, 0x5f, 0x63, 0x75, 0x62, 0x65, 0x5f, 0x64, 0x69,
+  0x6d, 0x73, 0x28, 0x26, 0x65, 0x6d, 0x2e, 0x77, 0x69, 0x64, 0x74, 0x68,
+  0x2c, 0x20, 0x26, 0x65, 0x6d, 0x2e, 0x68, 0x65, 0x69, 0x67, 0x68, 0x74,
+  0x2c, 0x20, 0x65, 0x6d, 0x2e, 0x74, 0x79, 0x70, 0x65, 0x2c, 0x20, 0x66,
+  0x61, 0x63, 0x65, 0x5f, 0x73, 0x7a, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20, 0x6e, 0x73, 0x61, 0x5b, 0x34,
+  0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x6e, 0x6f, 0x72, 0x6d, 0x61,
+  0x6c, 0x5f, 0x73, 0x6f, 0x6c, 0x69, 0x64, 0x5f, 0x61, 0x6e, 0x67, 0x6c,
+  0x65, 0x5f, 0x69, 0x6e, 0x64, 0x65, 0x78, 0x5f, 0x66, 0x65, 0x74, 0x63,
+  0x68, 0x28, 0x6e, 0x73, 0x61, 0x2c, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x69,
+  0x64, 0x78, 0x2c, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x6c, 0x61, 0x79, 0x6f,
+  0x75, 0x74, 0x2c, 0x20, 0x6e, 0x73, 0x61, 0x5f, 0x70, 0x6c, 0x61, 0x6e,
+  0x65, 0x5f, 0x73, 0x74, 0x72, 0x69, 0x64, 0x65, 0x2c, 0x20, 0x66, 0x61,
+  0x63, 0x65, 0x5f, 0x73, 0x7a, 0x2c, 0x20, 0x66, 0x61, 0x63, 0x65, 0x2c,
+  0x20, 0x78, 0x64, 0x73, 0x74, 0x2c, 0x20, 0x79, 0x64, 0x73, 0x74, 0x29,
+  0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x66, 0x6c, 0x6f, 0x61, 0x74, 0x20,
+  0x63, 0x6f, 0x6c, 0x5b, 0x33, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x65, 0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x74, 0x65, 0x78, 0x65, 0x6c,
+  0x5f, 0x6c, 0x6f, 0x61, 0x64, 0x28, 0x63, 0x6f, 0x6c, 0x2c, 0x20, 0x65,
+  0x6e, 0x76, 0x6d, 0x61, 0x70, 0x5f, 0x70, 0x69, 0x78, 0x65, 0x6c, 0x5f,
+  0x70, 0x74, 0x72, 0x28, 0x26, 0x65, 0x6d, 0x2c, 0x20, 0x78, 0x64, 0x73,
+  0x74, 0x2c, 0x20, 0x79, 0x64, 0x73, 0x74, 0x2c, 0x20, 0x66, 0x61, 0x63,
+  0x65, 0x29, 0x2c, 0x20, 0x65, 0x6d, 0x2e, 0x66, 0x6f, 0x72, 0x6d, 0x61,
+  0x74, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73,
+  0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x72, 0x72, 0x20,
+  0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x29, 0x63, 0x6f,
+  0x6c, 0x5b, 0x30, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f,
+  0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x67,
+  0x67, 0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x29,
+  0x63, 0x6f, 0x6c, 0x5b, 0x31, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x63, 0x6f, 0x6e, 0x73, 0x74, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65,
+  0x20, 0x62, 0x62, 0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c,
+  0x65, 0x29, 0x63, 0x6f, 0x6c, 0x5b, 0x32, 0x5d, 0x3b, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x73, 0x68, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x28, 0x28, 0x53, 0x48, 0x5f, 0x4b,
+  0x45, 0x52, 0x4e, 0x45, 0x4c, 0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x29,
+  0x20, 0x2a, 0x20, 0x28, 0x53, 0x48, 0x5f, 0x4b, 0x45, 0x52, 0x4e, 0x45,
+  0x4c, 0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x29, 0x29, 0x5d, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x73, 0x68, 0x5f, 0x65, 0x76, 0x61, 0x6c, 0x5f,
+  0x62, 0x61, 0x73, 0x69, 0x73, 0x28, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73,
+  0x69, 0x73, 0x2c, 0x20, 0x53, 0x48, 0x5f, 0x4b, 0x45, 0x52, 0x4e, 0x45,
+  0x4c, 0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x2c, 0x20, 0x6e, 0x73, 0x61,
+  0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x63, 0x6f, 0x6e, 0x73, 0x74,
+  0x20, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65, 0x20, 0x77, 0x65, 0x69, 0x67,
+  0x68, 0x74, 0x20, 0x3d, 0x20, 0x28, 0x64, 0x6f, 0x75, 0x62, 0x6c, 0x65,
+  0x29, 0x6e, 0x73, 0x61, 0x5b, 0x33, 0x5d, 0x3b, 0x0a, 0x20, 0x20, 0x20,
+  0x20, 0x66, 0x6f, 0x72, 0x20, 0x28, 0x75, 0x69, 0x6e, 0x74, 0x38, 0x5f,
+  0x74, 0x20, 0x69, 0x69, 0x20, 0x3d, 0x20, 0x30, 0x3b, 0x20, 0x69, 0x69,
+  0x20, 0x3c, 0x20, 0x28, 0x28, 0x53, 0x48, 0x5f, 0x4b, 0x45, 0x52, 0x4e,
+  0x45, 0x4c, 0x5f, 0x4f, 0x52, 0x44, 0x45, 0x52, 0x29, 0x20, 0x2a, 0x20,
+  0x28, 0x53, 0x48, 0x5f, 0x4b, 0x45, 0x52, 0x4e, 0x45, 0x4c, 0x5f, 0x4f,
+  0x52, 0x44, 0x45, 0x52, 0x29, 0x29, 0x3b, 0x20, 0x2b, 0x2b, 0x69, 0x69,
+  0x29, 0x20, 0x7b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+  0x61, 0x74, 0x6f, 0x6d, 0x69, 0x63, 0x5f, 0x61, 0x64, 0x64, 0x5f, 0x64,
+  0x62, 0x6c, 0x28, 0x73, 0x68, 0x5f, 0x63, 0x6f, 0x65, 0x66, 0x66, 0x73,
+  0x20, 0x2b, 0x20, 0x69, 0x69, 0x20, 0x2a, 0x20, 0x33, 0x20, 0x2b, 0x20,
+  0x30, 0x2c, 0x20, 0x72, 0x72, 0x20, 0x2a, 0x20, 0x73, 0x68, 0x5f, 0x62,
+  0x61, 0x73, 0x69, 0x73, 0x5b, 0x69, 0x69, 0x5d, 0x20, 0x2a, 0x20, 0x77,
+  0x65, 0x69, 0x67, 0x68, 0x74, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20,
+  0x20, 0x20, 0x20, 0x20, 0x61, 0x74, 0x6f, 0x6d, 0x69, 0x63, 0x5f, 0x61,
+  0x64, 0x64, 0x5f, 0x64, 0x62, 0x6c, 0x28, 0x73, 0x68, 0x5f, 0x63, 0x6f,
+  0x65, 0x66, 0x66, 0x73, 0x20, 0x2b, 0x20, 0x69, 0x69, 0x20, 0x2a, 0x20,
+  0x33, 0x20, 0x2b, 0x20, 0x31, 0x2c, 0x20, 0x67, 0x67, 0x20, 0x2a, 0x20,
+  0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73, 0x5b, 0x69, 0x69, 0x5d,
+  0x20, 0x2a, 0x20, 0x77, 0x65, 0x69, 0x67, 0x68, 0x74, 0x29, 0x3b, 0x0a,
+  0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x61, 0x74, 0x6f, 0x6d,
+  0x69, 0x63, 0x5f, 0x61, 0x64, 0x64, 0x5f, 0x64, 0x62, 0x6c, 0x28, 0x73,
+  0x68, 0x5f, 0x63, 0x6f, 0x65, 0x66, 0x66, 0x73, 0x20, 0x2b, 0x20, 0x69,
+  0x69, 0x20, 0x2a, 0x20, 0x33, 0x20, 0x2b, 0x20, 0x32, 0x2c, 0x20, 0x62,
+  0x62, 0x20, 0x2a, 0x20, 0x73, 0x68, 0x5f, 0x62, 0x61, 0x73, 0x69, 0x73,
+  0x5b, 0x69, 0x69, 0x5d, 0x20, 0x2a, 0x20, 0x77, 0x65, 0x69, 0x67, 0x68,
+  0x74, 0x29, 0x3b, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x7d, 0x0a, 0x20, 0x20,
+  0x20, 0x20, 0x61, 0x74, 0x6f, 0x6d, 0x69, 0x63, 0x5f, 0x61, 0x64, 0x64,
+  0x5f, 0x64, 0x62, 0x6c, 0x28, 0x77, 0x65, 0x69, 0x67, 0x68, 0x74, 0x5f,
+  0x61, 0x63, 0x63, 0x75, 0x6d, 0x2c, 0x20, 0x77, 0x65, 0x69, 0x67, 0x68,
+  0x74, 0x29, 0x3b, 0x0a, 0x7d, 0x0a
+};
+unsigned int gpush_pp_len = 62250;
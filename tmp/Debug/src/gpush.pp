@@ -0,0 +1,1017 @@
+typedef unsigned char uint8_t;
+typedef unsigned int uint32_t;
+enum envmap_type {
+    EM_TYPE_HCROSS,
+    EM_TYPE_VCROSS,
+    EM_TYPE_LATLONG,
+    EM_TYPE_VSTRIP,
+    EM_TYPE_UNKNOWN
+};
+enum envmap_format {
+    EM_FORMAT_R8G8B8 = 0,
+    EM_FORMAT_R8G8B8A8,
+    EM_FORMAT_RGB16F,
+    EM_FORMAT_RGBA16F,
+    EM_FORMAT_RGB32F,
+    EM_FORMAT_RGBA32F,
+    EM_FORMAT_SRGB8,
+    EM_FORMAT_SRGB8_A8
+};
+struct envmap {
+    enum envmap_type type;
+    uint32_t width, height;
+    enum envmap_format format;
+    __global uint8_t* data;
+};
+enum cubemap_face
+{
+    CM_FACE_POS_X = 0,
+    CM_FACE_NEG_X = 1,
+    CM_FACE_POS_Y = 2,
+    CM_FACE_NEG_Y = 3,
+    CM_FACE_POS_Z = 4,
+    CM_FACE_NEG_Z = 5,
+};
+enum cubemap_edge
+{
+    CM_EDGE_LEFT = 0,
+    CM_EDGE_RIGHT = 1,
+    CM_EDGE_TOP = 2,
+    CM_EDGE_BOTTOM = 3,
+};
+enum envmap_type envmap_detect_type(int width, int height);
+void envmap_vec_to_texel_coord(__private float* u, __private float* v, __private uint8_t* face_idx, enum envmap_type em_type, __private const float* vec);
+float envmap_warp_fixup_factor(float face_size);
+void envmap_texel_coord_to_vec(__private float* out3f, enum envmap_type em_type, float u, float v, uint8_t face_id);
+void envmap_texel_coord_to_vec_warp(__private float* out3f, enum envmap_type em_type, float u, float v, uint8_t face_id, float warp_fixup);
+void envmap_cube_face_basis(__private float basis[3][3], uint8_t face_id);
+uint32_t envmap_face_size(struct envmap* em);
+void envmap_cube_dims(__private uint32_t* width, __private uint32_t* height, enum envmap_type em_type, uint32_t face_size);
+uint32_t envmap_face_width(struct envmap* em);
+uint32_t envmap_face_count(struct envmap* em);
+void envmap_sample(__private float col[3], __private struct envmap* em, __private float vec[3]);
+void envmap_sample_bilinear(__private float col[3], __private struct envmap* em, __private const float vec[3]);
+void envmap_setpixel(__private struct envmap* em, uint32_t x, uint32_t y, enum cubemap_face face, __private float val[3]);
+__global uint8_t* envmap_pixel_ptr(__private struct envmap* em, uint32_t x, uint32_t y, enum cubemap_face face);
+uint32_t envmap_format_channels(enum envmap_format fmt);
+uint32_t envmap_format_size(enum envmap_format fmt);
+void envmap_texel_load(__private float col[3], __global const uint8_t* src, enum envmap_format fmt);
+void envmap_texel_store(__global uint8_t* dst, enum envmap_format fmt, __private const float val[3]);
+void sc_to_vec(__private float vec[3], float theta, float phi);
+void vec_to_sc(__private float* theta, __private float* phi, __private const float vec[3]);
+float texel_solid_angle(float u, float v, float inv_face_size);
+static int fequalse(float a, float b, float epsilon)
+{
+    return fabs(a - b) < epsilon;
+}
+static int image_is_hcross(int width, int height)
+{
+    float aspect = (float)width / (float)height;
+    return fequalse(aspect, 4.0f / 3.0f, 10e-3);
+}
+static int image_is_vcross(int width, int height)
+{
+    float aspect = (float)width / (float)height;
+    return fequalse(aspect, 3.0f / 4.0f, 10e-3);
+}
+static int image_is_latlong(int width, int height)
+{
+    float aspect = (float)width / (float)height;
+    return fequalse(aspect, 2.0f, 10e-4);
+}
+static int image_is_vstrip(int width, int height)
+{
+    float aspect = (float)width / (float)height;
+    return fequalse(aspect, 1.0f / 6.0f, 10e-4);
+}
+enum envmap_type envmap_detect_type(int width, int height)
+{
+    if (image_is_hcross(width, height))
+        return EM_TYPE_HCROSS;
+    else if (image_is_vcross(width, height))
+        return EM_TYPE_VCROSS;
+    else if (image_is_latlong(width, height))
+        return EM_TYPE_LATLONG;
+    else if (image_is_vstrip(width, height))
+        return EM_TYPE_VSTRIP;
+    return EM_TYPE_UNKNOWN;
+}
+static __constant float unorm8_decode_linear[256] = {
+    0.0f, 0.00392156886f, 0.00784313772f, 0.0117647061f, 0.0156862754f, 0.0196078438f, 0.0235294122f, 0.0274509806f,
+    0.0313725509f, 0.0352941193f, 0.0392156877f, 0.0431372561f, 0.0470588244f, 0.0509803928f, 0.0549019612f, 0.0588235296f,
+    0.0627451017f, 0.0666666701f, 0.0705882385f, 0.0745098069f, 0.0784313753f, 0.0823529437f, 0.0862745121f, 0.0901960805f,
+    0.0941176489f, 0.0980392173f, 0.101960786f, 0.105882354f, 0.109803922f, 0.113725491f, 0.117647059f, 0.121568628f,
+    0.125490203f, 0.129411772f, 0.13333334f, 0.137254909f, 0.141176477f, 0.145098045f, 0.149019614f, 0.152941182f,
+    0.156862751f, 0.160784319f, 0.164705887f, 0.168627456f, 0.172549024f, 0.176470593f, 0.180392161f, 0.184313729f,
+    0.188235298f, 0.192156866f, 0.196078435f, 0.200000003f, 0.203921571f, 0.20784314f, 0.211764708f, 0.215686277f,
+    0.219607845f, 0.223529413f, 0.227450982f, 0.23137255f, 0.235294119f, 0.239215687f, 0.243137255f, 0.247058824f,
+    0.250980407f, 0.254901975f, 0.258823544f, 0.262745112f, 0.266666681f, 0.270588249f, 0.274509817f, 0.278431386f,
+    0.282352954f, 0.286274523f, 0.290196091f, 0.294117659f, 0.298039228f, 0.301960796f, 0.305882365f, 0.309803933f,
+    0.313725501f, 0.31764707f, 0.321568638f, 0.325490206f, 0.329411775f, 0.333333343f, 0.337254912f, 0.34117648f,
+    0.345098048f, 0.349019617f, 0.352941185f, 0.356862754f, 0.360784322f, 0.36470589f, 0.368627459f, 0.372549027f,
+    0.376470596f, 0.380392164f, 0.384313732f, 0.388235301f, 0.392156869f, 0.396078438f, 0.400000006f, 0.403921574f,
+    0.407843143f, 0.411764711f, 0.41568628f, 0.419607848f, 0.423529416f, 0.427450985f, 0.431372553f, 0.435294122f,
+    0.43921569f, 0.443137258f, 0.447058827f, 0.450980395f, 0.454901963f, 0.458823532f, 0.4627451f, 0.466666669f,
+    0.470588237f, 0.474509805f, 0.478431374f, 0.482352942f, 0.486274511f, 0.490196079f, 0.494117647f, 0.498039216f,
+    0.501960814f, 0.505882382f, 0.509803951f, 0.513725519f, 0.517647088f, 0.521568656f, 0.525490224f, 0.529411793f,
+    0.533333361f, 0.53725493f, 0.541176498f, 0.545098066f, 0.549019635f, 0.552941203f, 0.556862772f, 0.56078434f,
+    0.564705908f, 0.568627477f, 0.572549045f, 0.576470613f, 0.580392182f, 0.58431375f, 0.588235319f, 0.592156887f,
+    0.596078455f, 0.600000024f, 0.603921592f, 0.607843161f, 0.611764729f, 0.615686297f, 0.619607866f, 0.623529434f,
+    0.627451003f, 0.631372571f, 0.635294139f, 0.639215708f, 0.643137276f, 0.647058845f, 0.650980413f, 0.654901981f,
+    0.65882355f, 0.662745118f, 0.666666687f, 0.670588255f, 0.674509823f, 0.678431392f, 0.68235296f, 0.686274529f,
+    0.690196097f, 0.694117665f, 0.698039234f, 0.701960802f, 0.70588237f, 0.709803939f, 0.713725507f, 0.717647076f,
+    0.721568644f, 0.725490212f, 0.729411781f, 0.733333349f, 0.737254918f, 0.741176486f, 0.745098054f, 0.749019623f,
+    0.752941191f, 0.75686276f, 0.760784328f, 0.764705896f, 0.768627465f, 0.772549033f, 0.776470602f, 0.78039217f,
+    0.784313738f, 0.788235307f, 0.792156875f, 0.796078444f, 0.800000012f, 0.80392158f, 0.807843149f, 0.811764717f,
+    0.815686285f, 0.819607854f, 0.823529422f, 0.827450991f, 0.831372559f, 0.835294127f, 0.839215696f, 0.843137264f,
+    0.847058833f, 0.850980401f, 0.854901969f, 0.858823538f, 0.862745106f, 0.866666675f, 0.870588243f, 0.874509811f,
+    0.87843138f, 0.882352948f, 0.886274517f, 0.890196085f, 0.894117653f, 0.898039222f, 0.90196079f, 0.905882359f,
+    0.909803927f, 0.913725495f, 0.917647064f, 0.921568632f, 0.925490201f, 0.929411769f, 0.933333337f, 0.937254906f,
+    0.941176474f, 0.945098042f, 0.949019611f, 0.952941179f, 0.956862748f, 0.960784316f, 0.964705884f, 0.968627453f,
+    0.972549021f, 0.97647059f, 0.980392158f, 0.984313726f, 0.988235295f, 0.992156863f, 0.996078432f, 1.0f
+};
+static __constant float unorm8_decode_srgb[256] = {
+    0.0f, 0.000303526991f, 0.000607053982f, 0.000910580973f, 0.00121410796f, 0.00151763496f, 0.00182116195f, 0.00212468882f,
+    0.00242821593f, 0.0027317428f, 0.00303526991f, 0.00334653584f, 0.00367650739f, 0.00402471703f, 0.00439144205f, 0.00477695325f,
+    0.00518151652f, 0.00560539169f, 0.00604883302f, 0.00651209056f, 0.00699541019f, 0.00749903219f, 0.00802319311f, 0.00856812578f,
+    0.00913405884f, 0.00972121768f, 0.010329823f, 0.0109600937f, 0.0116122449f, 0.012286488f, 0.0129830325f, 0.0137020834f,
+    0.0144438436f, 0.0152085144f, 0.0159962941f, 0.0168073755f, 0.0176419541f, 0.01850022f, 0.0193823613f, 0.0202885624f,
+    0.0212190095f, 0.0221738853f, 0.0231533665f, 0.0241576321f, 0.0251868591f, 0.0262412224f, 0.0273208916f, 0.02842604f,
+    0.0295568351f, 0.0307134446f, 0.0318960324f, 0.0331047662f, 0.0343398079f, 0.0356013142f, 0.0368894488f, 0.0382043719f,
+    0.0395462364f, 0.0409151986f, 0.0423114114f, 0.043735031f, 0.045186203f, 0.0466650873f, 0.0481718257f, 0.0497065671f,
+    0.0512694567f, 0.0528606474f, 0.054480277f, 0.0561284907f, 0.0578054301f, 0.0595112368f, 0.0612460524f, 0.0630100146f,
+    0.064803265f, 0.0666259378f, 0.0684781671f, 0.0703600943f, 0.0722718537f, 0.0742135718f, 0.0761853829f, 0.078187421f,
+    0.0802198201f, 0.0822827071f, 0.0843762085f, 0.0865004584f, 0.0886555836f, 0.0908417106f, 0.0930589661f, 0.0953074694f,
+    0.097587347f, 0.0998987257f, 0.102241732f, 0.104616486f, 0.107023105f, 0.10946171f, 0.111932427f, 0.114435375f,
+    0.116970666f, 0.119538426f, 0.122138776f, 0.124771819f, 0.127437681f, 0.130136475f, 0.13286832f, 0.135633335f,
+    0.138431609f, 0.141263291f, 0.144128472f, 0.147027269f, 0.149959788f, 0.152926147f, 0.155926466f, 0.158960834f,
+    0.162029371f, 0.165132195f, 0.168269396f, 0.171441108f, 0.174647406f, 0.177888423f, 0.18116425f, 0.18447499f,
+    0.187820777f, 0.191201687f, 0.194617838f, 0.198069319f, 0.20155625f, 0.205078736f, 0.208636865f, 0.212230757f,
+    0.215860501f, 0.219526201f, 0.223227963f, 0.226965874f, 0.230740055f, 0.23455058f, 0.238397568f, 0.242281124f,
+    0.246201321f, 0.25015828f, 0.254152089f, 0.258182853f, 0.262250662f, 0.266355604f, 0.270497799f, 0.274677306f,
+    0.278894275f, 0.283148736f, 0.287440836f, 0.291770637f, 0.296138257f, 0.300543785f, 0.304987311f, 0.309468925f,
+    0.313988715f, 0.318546772f, 0.323143214f, 0.327778101f, 0.332451522f, 0.337163627f, 0.341914415f, 0.346704066f,
+    0.351532608f, 0.356400132f, 0.361306787f, 0.366252601f, 0.371237695f, 0.376262128f, 0.38132602f, 0.386429429f,
+    0.391572475f, 0.396755219f, 0.401977777f, 0.407240212f, 0.412542611f, 0.417885065f, 0.423267663f, 0.428690493f,
+    0.434153646f, 0.439657182f, 0.445201188f, 0.450785786f, 0.456411034f, 0.462076992f, 0.467783809f, 0.473531485f,
+    0.479320168f, 0.48514995f, 0.491020858f, 0.496932983f, 0.502886474f, 0.50888133f, 0.514917672f, 0.520995557f,
+    0.527115107f, 0.533276379f, 0.539479494f, 0.545724452f, 0.55201143f, 0.558340371f, 0.564711511f, 0.571124852f,
+    0.577580452f, 0.584078431f, 0.590618849f, 0.597201765f, 0.603827357f, 0.610495567f, 0.617206573f, 0.623960376f,
+    0.630757153f, 0.637596846f, 0.644479692f, 0.651405632f, 0.658374846f, 0.665387273f, 0.672443151f, 0.679542482f,
+    0.686685324f, 0.693871737f, 0.701101899f, 0.708375752f, 0.715693474f, 0.723055124f, 0.730460763f, 0.73791039f,
+    0.745404184f, 0.752942204f, 0.760524511f, 0.768151164f, 0.775822222f, 0.783537805f, 0.791297913f, 0.799102724f,
+    0.806952238f, 0.814846575f, 0.822785735f, 0.830769897f, 0.838799f, 0.846873224f, 0.854992628f, 0.863157213f,
+    0.871367097f, 0.8796224f, 0.887923121f, 0.896269381f, 0.904661179f, 0.913098633f, 0.921581864f, 0.930110872f,
+    0.938685715f, 0.947306514f, 0.955973327f, 0.964686275f, 0.973445296f, 0.982250571f, 0.991102099f, 1.0f
+};
+static __constant float srgb8_encode_thresholds[255] = {
+    0.000151763496f, 0.000455290487f, 0.000758817478f, 0.00106234441f, 0.0013658714f, 0.00166939839f, 0.00197292538f, 0.00227645249f,
+    0.00257997937f, 0.00288350624f, 0.00318830088f, 0.00350925932f, 0.00384831498f, 0.00420574797f, 0.00458183279f, 0.00497683743f,
+    0.00539102405f, 0.00582465064f, 0.00627796957f, 0.00675122766f, 0.00724466844f, 0.00775853032f, 0.00829304848f, 0.00884845294f,
+    0.00942497049f, 0.0100228256f, 0.010642237f, 0.011283421f, 0.0119465925f, 0.0126319602f, 0.0133397318f, 0.0140701123f,
+    0.0148233026f, 0.0155995032f, 0.0163989104f, 0.0172217153f, 0.0180681143f, 0.0189382937f, 0.0198324434f, 0.0207507443f,
+    0.0216933824f, 0.0226605386f, 0.0236523896f, 0.0246691145f, 0.0257108882f, 0.0267778821f, 0.0278702695f, 0.0289882198f,
+    0.0301319025f, 0.0313014798f, 0.0324971229f, 0.0337189883f, 0.0349672437f, 0.0362420455f, 0.0375435539f, 0.0388719253f,
+    0.04022732f, 0.041609887f, 0.0430197865f, 0.0444571637f, 0.0459221713f, 0.0474149622f, 0.0489356853f, 0.0504844859f,
+    0.0520615056f, 0.0536668971f, 0.055300802f, 0.0569633618f, 0.0586547181f, 0.0603750125f, 0.0621243827f, 0.0639029741f,
+    0.0657109171f, 0.0675483495f, 0.0694154128f, 0.0713122338f, 0.0732389539f, 0.0751957074f, 0.0771826133f, 0.0791998208f,
+    0.0812474415f, 0.0833256245f, 0.085434489f, 0.0875741541f, 0.089744769f, 0.091946438f, 0.0941793025f, 0.0964434743f,
+    0.098739095f, 0.101066269f, 0.10342513f, 0.105815805f, 0.108238399f, 0.110693045f, 0.113179862f, 0.115698971f,
+    0.118250482f, 0.120834522f, 0.123451203f, 0.126100644f, 0.128782958f, 0.131498262f, 0.134246677f, 0.137028307f,
+    0.13984327f, 0.142691687f, 0.145573661f, 0.148489311f, 0.151438728f, 0.15442206f, 0.157439381f, 0.160490826f,
+    0.163576499f, 0.166696489f, 0.169850931f, 0.173039913f, 0.176263571f, 0.179521978f, 0.182815254f, 0.186143503f,
+    0.189506829f, 0.192905352f, 0.196339145f, 0.199808344f, 0.203313038f, 0.206853345f, 0.210429341f, 0.214041144f,
+    0.217688844f, 0.22137256f, 0.225092396f, 0.228848428f, 0.232640758f, 0.236469507f, 0.240334779f, 0.244236633f,
+    0.248175204f, 0.252150565f, 0.256162852f, 0.260212123f, 0.264298469f, 0.268422037f, 0.272582889f, 0.276781112f,
+    0.281016797f, 0.285290092f, 0.289601028f, 0.293949723f, 0.298336297f, 0.30276081f, 0.30722335f, 0.311724037f,
+    0.31626296f, 0.32084018f, 0.325455844f, 0.330109984f, 0.334802747f, 0.339534163f, 0.344304383f, 0.349113464f,
+    0.353961498f, 0.358848572f, 0.363774776f, 0.368740231f, 0.373744965f, 0.378789127f, 0.383872777f, 0.388996005f,
+    0.3941589f, 0.399361521f, 0.404604018f, 0.40988642f, 0.415208817f, 0.420571357f, 0.425974041f, 0.431417018f,
+    0.436900347f, 0.442424119f, 0.447988421f, 0.453593314f, 0.459238917f, 0.464925289f, 0.470652521f, 0.476420701f,
+    0.482229918f, 0.488080233f, 0.493971765f, 0.499904543f, 0.505878687f, 0.511894286f, 0.517951429f, 0.524050117f,
+    0.530190527f, 0.536372721f, 0.542596757f, 0.548862696f, 0.555170655f, 0.561520696f, 0.567912877f, 0.574347317f,
+    0.580824137f, 0.587343335f, 0.593904972f, 0.600509226f, 0.607156098f, 0.613845706f, 0.62057811f, 0.62735337f,
+    0.634171605f, 0.641032875f, 0.647937238f, 0.654884815f, 0.661875665f, 0.668909788f, 0.675987363f, 0.683108449f,
+    0.690273106f, 0.697481334f, 0.704733372f, 0.712029159f, 0.719368815f, 0.72675246f, 0.734180033f, 0.741651773f,
+    0.749167681f, 0.756727815f, 0.764332294f, 0.77198112f, 0.779674411f, 0.787412286f, 0.795194745f, 0.803021908f,
+    0.810893834f, 0.818810523f, 0.826772213f, 0.834778786f, 0.842830479f, 0.850927293f, 0.859069228f, 0.867256522f,
+    0.875489056f, 0.883767068f, 0.892090559f, 0.900459588f, 0.908874214f, 0.917334557f, 0.925840616f, 0.934392571f,
+    0.942990363f, 0.951634169f, 0.960324049f, 0.969060004f, 0.977842152f, 0.986670554f, 0.995545268f
+};
+uint32_t envmap_format_channels(enum envmap_format fmt)
+{
+    switch (fmt) {
+        case EM_FORMAT_R8G8B8A8:
+        case EM_FORMAT_SRGB8_A8:
+        case EM_FORMAT_RGBA16F:
+        case EM_FORMAT_RGBA32F:
+            return 4;
+        default:
+            return 3;
+    }
+}
+uint32_t envmap_format_size(enum envmap_format fmt)
+{
+    switch (fmt) {
+        case EM_FORMAT_R8G8B8: return 3;
+        case EM_FORMAT_R8G8B8A8: return 4;
+        case EM_FORMAT_SRGB8: return 3;
+        case EM_FORMAT_SRGB8_A8: return 4;
+        case EM_FORMAT_RGB16F: return 6;
+        case EM_FORMAT_RGBA16F: return 8;
+        case EM_FORMAT_RGB32F: return 12;
+        case EM_FORMAT_RGBA32F: return 16;
+        default:
+            ;
+            return 0;
+    }
+}
+void envmap_texel_load(__private float col[3], __global const uint8_t* src, enum envmap_format fmt)
+{
+    switch (fmt) {
+        case EM_FORMAT_RGB16F:
+        case EM_FORMAT_RGBA16F:
+            col[0] = vload_half(0, (__global const half*)(src));
+            col[1] = vload_half(1, (__global const half*)(src));
+            col[2] = vload_half(2, (__global const half*)(src));
+            break;
+        case EM_FORMAT_RGB32F:
+        case EM_FORMAT_RGBA32F:
+            col[0] = (((__global const float*)(src))[0]);
+            col[1] = (((__global const float*)(src))[1]);
+            col[2] = (((__global const float*)(src))[2]);
+            break;
+        case EM_FORMAT_R8G8B8A8:
+        case EM_FORMAT_SRGB8_A8: {
+            const uchar4 t = vload4(0, src);
+            __constant float* lut = fmt == EM_FORMAT_SRGB8_A8 ? unorm8_decode_srgb : unorm8_decode_linear;
+            col[0] = lut[t.x];
+            col[1] = lut[t.y];
+            col[2] = lut[t.z];
+            break;
+        }
+        case EM_FORMAT_SRGB8:
+            col[0] = unorm8_decode_srgb[src[0]];
+            col[1] = unorm8_decode_srgb[src[1]];
+            col[2] = unorm8_decode_srgb[src[2]];
+            break;
+        default:
+            col[0] = unorm8_decode_linear[src[0]];
+            col[1] = unorm8_decode_linear[src[1]];
+            col[2] = unorm8_decode_linear[src[2]];
+            break;
+    }
+}
+static uint8_t unorm8_store(float v)
+{
+    return v <= 0.0f ? 0 : v >= 1.0f ? 255 : (uint8_t)(v * 255.0f);
+}
+static uint8_t srgb8_store(float v)
+{
+    uint32_t code = 0;
+    for (uint32_t step = 128; step > 0; step >>= 1)
+        if (v >= srgb8_encode_thresholds[code + step - 1])
+            code += step;
+    return (uint8_t)code;
+}
+void envmap_texel_store(__global uint8_t* dst, enum envmap_format fmt, __private const float val[3])
+{
+    switch (fmt) {
+        case EM_FORMAT_RGB16F:
+        case EM_FORMAT_RGBA16F:
+            vstore_half_rte(val[0], 0, (__global half*)(dst));
+            vstore_half_rte(val[1], 1, (__global half*)(dst));
+            vstore_half_rte(val[2], 2, (__global half*)(dst));
+            if (fmt == EM_FORMAT_RGBA16F)
+                vstore_half_rte(1.0f, 3, (__global half*)(dst));
+            break;
+        case EM_FORMAT_RGB32F:
+        case EM_FORMAT_RGBA32F:
+            (((__global float*)(dst))[0] = (val[0]));
+            (((__global float*)(dst))[1] = (val[1]));
+            (((__global float*)(dst))[2] = (val[2]));
+            if (fmt == EM_FORMAT_RGBA32F)
+                (((__global float*)(dst))[3] = (1.0f));
+            break;
+        case EM_FORMAT_SRGB8:
+        case EM_FORMAT_SRGB8_A8:
+            dst[0] = srgb8_store(val[0]);
+            dst[1] = srgb8_store(val[1]);
+            dst[2] = srgb8_store(val[2]);
+            if (fmt == EM_FORMAT_SRGB8_A8)
+                dst[3] = 255;
+            break;
+        default:
+            dst[0] = unorm8_store(val[0]);
+            dst[1] = unorm8_store(val[1]);
+            dst[2] = unorm8_store(val[2]);
+            if (fmt == EM_FORMAT_R8G8B8A8)
+                dst[3] = 255;
+            break;
+    }
+}
+__constant uint8_t cm_face_neighbours[6][4][2] =
+{
+    {
+        { CM_FACE_POS_Z, CM_EDGE_RIGHT },
+        { CM_FACE_NEG_Z, CM_EDGE_LEFT },
+        { CM_FACE_POS_Y, CM_EDGE_RIGHT },
+        { CM_FACE_NEG_Y, CM_EDGE_RIGHT },
+    },
+    {
+        { CM_FACE_NEG_Z, CM_EDGE_RIGHT },
+        { CM_FACE_POS_Z, CM_EDGE_LEFT },
+        { CM_FACE_POS_Y, CM_EDGE_LEFT },
+        { CM_FACE_NEG_Y, CM_EDGE_LEFT },
+    },
+    {
+        { CM_FACE_NEG_X, CM_EDGE_TOP },
+        { CM_FACE_POS_X, CM_EDGE_TOP },
+        { CM_FACE_NEG_Z, CM_EDGE_TOP },
+        { CM_FACE_POS_Z, CM_EDGE_TOP },
+    },
+    {
+        { CM_FACE_NEG_X, CM_EDGE_BOTTOM },
+        { CM_FACE_POS_X, CM_EDGE_BOTTOM },
+        { CM_FACE_POS_Z, CM_EDGE_BOTTOM },
+        { CM_FACE_NEG_Z, CM_EDGE_BOTTOM },
+    },
+    {
+        { CM_FACE_NEG_X, CM_EDGE_RIGHT },
+        { CM_FACE_POS_X, CM_EDGE_LEFT },
+        { CM_FACE_POS_Y, CM_EDGE_BOTTOM },
+        { CM_FACE_NEG_Y, CM_EDGE_TOP },
+    },
+    {
+        { CM_FACE_POS_X, CM_EDGE_RIGHT },
+        { CM_FACE_NEG_X, CM_EDGE_LEFT },
+        { CM_FACE_POS_Y, CM_EDGE_TOP },
+        { CM_FACE_NEG_Y, CM_EDGE_BOTTOM },
+    }
+};
+static __constant float cm_face_uv_vectors[6][3][3] =
+{
+    {
+        { 0.0f, 0.0f, -1.0f },
+        { 0.0f, -1.0f, 0.0f },
+        { 1.0f, 0.0f, 0.0f },
+    },
+    {
+        { 0.0f, 0.0f, 1.0f },
+        { 0.0f, -1.0f, 0.0f },
+        { -1.0f, 0.0f, 0.0f },
+    },
+    {
+        { 1.0f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, 1.0f },
+        { 0.0f, 1.0f, 0.0f },
+    },
+    {
+        { 1.0f, 0.0f, 0.0f },
+        { 0.0f, 0.0f, -1.0f },
+        { 0.0f, -1.0f, 0.0f },
+    },
+    {
+        { 1.0f, 0.0f, 0.0f },
+        { 0.0f, -1.0f, 0.0f },
+        { 0.0f, 0.0f, 1.0f },
+    },
+    {
+        { -1.0f, 0.0f, 0.0f },
+        { 0.0f, -1.0f, 0.0f },
+        { 0.0f, 0.0f, -1.0f },
+    }
+};
+static void cm_vec_to_texel_coord(__private float* u, __private float* v, __private uint8_t* face_idx, __private const float* vec)
+{
+    const float abs_vec[3] = {
+        fabs(vec[0]),
+        fabs(vec[1]),
+        fabs(vec[2]),
+    };
+    const float max = fmax(fmax(abs_vec[0], abs_vec[1]), abs_vec[2]);
+    if (max == abs_vec[0]) {
+        *face_idx = (vec[0] >= 0.0f) ? (uint8_t)CM_FACE_POS_X : (uint8_t)CM_FACE_NEG_X;
+    } else if (max == abs_vec[1]) {
+        *face_idx = (vec[1] >= 0.0f) ? (uint8_t)CM_FACE_POS_Y : (uint8_t)CM_FACE_NEG_Y;
+    } else {
+        *face_idx = (vec[2] >= 0.0f) ? (uint8_t)CM_FACE_POS_Z : (uint8_t)CM_FACE_NEG_Z;
+    }
+    float face_vec[3];
+    face_vec[0] = vec[0] * (1.0f / max);
+    face_vec[1] = vec[1] * (1.0f / max);
+    face_vec[2] = vec[2] * (1.0f / max);
+    *u = (dot(vload3(0, cm_face_uv_vectors[*face_idx][0]), vload3(0, face_vec)) + 1.0f) * 0.5f;
+    *v = (dot(vload3(0, cm_face_uv_vectors[*face_idx][1]), vload3(0, face_vec)) + 1.0f) * 0.5f;
+}
+static void cm_texel_coord_to_vec(__private float* out3f, float u, float v, uint8_t face_id)
+{
+    out3f[0] = cm_face_uv_vectors[face_id][0][0] * u + cm_face_uv_vectors[face_id][1][0] * v + cm_face_uv_vectors[face_id][2][0];
+    out3f[1] = cm_face_uv_vectors[face_id][0][1] * u + cm_face_uv_vectors[face_id][1][1] * v + cm_face_uv_vectors[face_id][2][1];
+    out3f[2] = cm_face_uv_vectors[face_id][0][2] * u + cm_face_uv_vectors[face_id][1][2] * v + cm_face_uv_vectors[face_id][2][2];
+    const float inv_len = 1.0f / sqrt(out3f[0] * out3f[0] + out3f[1] * out3f[1] + out3f[2] * out3f[2]);
+    out3f[0] *= inv_len;
+    out3f[1] *= inv_len;
+    out3f[2] *= inv_len;
+}
+static void cm_texel_wrap(__private int* face, __private int* x, __private int* y, int face_size)
+{
+    int edge, depth, along;
+    if (*x < 0) {
+        edge = CM_EDGE_LEFT; depth = -1 - *x; along = *y;
+    } else if (*x >= face_size) {
+        edge = CM_EDGE_RIGHT; depth = *x - face_size; along = *y;
+    } else if (*y < 0) {
+        edge = CM_EDGE_TOP; depth = -1 - *y; along = *x;
+    } else if (*y >= face_size) {
+        edge = CM_EDGE_BOTTOM; depth = *y - face_size; along = *x;
+    } else {
+        return;
+    }
+    const int nface = cm_face_neighbours[*face][edge][0];
+    const int nedge = cm_face_neighbours[*face][edge][1];
+    const int axis = edge <= CM_EDGE_RIGHT ? 1 : 0;
+    const int naxis = nedge <= CM_EDGE_RIGHT ? 1 : 0;
+    if (dot(vload3(0, cm_face_uv_vectors[*face][axis]), vload3(0, cm_face_uv_vectors[nface][naxis])) < 0.0f)
+        along = face_size - 1 - along;
+    *face = nface;
+    switch (nedge) {
+        case CM_EDGE_LEFT: *x = depth; *y = along; break;
+        case CM_EDGE_RIGHT: *x = face_size - 1 - depth; *y = along; break;
+        case CM_EDGE_TOP: *x = along; *y = depth; break;
+        case CM_EDGE_BOTTOM: *x = along; *y = face_size - 1 - depth; break;
+    }
+}
+static __constant int hcross_face_map[6][2] = {
+    {2, 1},
+    {0, 1},
+    {1, 0},
+    {1, 2},
+    {1, 1},
+    {3, 1}
+};
+static size_t hcross_face_offset(int face, size_t face_size)
+{
+    size_t stride = 4 * face_size;
+    return hcross_face_map[face][1] * face_size * stride + hcross_face_map[face][0] * face_size;
+}
+static __global uint8_t* hcross_pixel_ptr(__global uint8_t* base, uint32_t x, uint32_t y, int face_size, enum cubemap_face face, int bpp)
+{
+    size_t stride = 4 * face_size;
+    size_t offset = (hcross_face_offset(face, face_size) + y * stride + x) * bpp;
+    __global uint8_t* data = base + offset;
+    return data;
+}
+static void sample_hcross_map(float col[3], __global uint8_t* base, int face_size, enum envmap_format fmt, __private const float vec[3])
+{
+    float u, v;
+    uint8_t face_idx;
+    cm_vec_to_texel_coord(&u, &v, &face_idx, vec);
+    int x = u * (face_size - 1);
+    int y = v * (face_size - 1);
+    size_t stride = 4 * face_size;
+    size_t offset = (hcross_face_offset(face_idx, face_size) + y * stride + x) * envmap_format_size(fmt);
+    __global uint8_t* data = base + offset;
+    envmap_texel_load(col, data, fmt);
+}
+static void hcross_setpixel(__global uint8_t* base, uint32_t face_size, enum envmap_format fmt, uint32_t x, uint32_t y, enum cubemap_face face, float val[3])
+{
+    size_t stride = 4 * face_size;
+    __global uint8_t* dst = base + (hcross_face_offset(face, face_size) + y * stride + x) * envmap_format_size(fmt);
+    envmap_texel_store(dst, fmt, val);
+}
+static __constant int vcross_face_map[6][2] = {
+    {2, 1},
+    {0, 1},
+    {1, 0},
+    {1, 2},
+    {1, 1},
+    {1, 3}
+};
+static size_t vcross_face_offset(int face, size_t face_size)
+{
+    size_t stride = 3 * face_size;
+    return vcross_face_map[face][1] * face_size * stride + vcross_face_map[face][0] * face_size;
+}
+static __global uint8_t* vcross_pixel_ptr(__global uint8_t* base, uint32_t x, uint32_t y, int face_size, enum cubemap_face face, int bpp)
+{
+    if (face == CM_FACE_NEG_Z) {
+        x = face_size - 1 - x;
+        y = face_size - 1 - y;
+    }
+    size_t stride = 3 * face_size;
+    size_t offset = (vcross_face_offset(face, face_size) + y * stride + x) * bpp;
+    __global uint8_t* data = base + offset;
+    return data;
+}
+static void sample_vcross_map(float col[3], __global uint8_t* base, int face_size, enum envmap_format fmt, __private const float vec[3])
+{
+    float u, v;
+    uint8_t face_idx;
+    cm_vec_to_texel_coord(&u, &v, &face_idx, vec);
+    int x = u * (face_size - 1);
+    int y = v * (face_size - 1);
+    __global uint8_t* data = vcross_pixel_ptr(base, x, y, face_size, face_idx, envmap_format_size(fmt));
+    envmap_texel_load(col, data, fmt);
+}
+static void vcross_setpixel(__global uint8_t* base, uint32_t face_size, enum envmap_format fmt, uint32_t x, uint32_t y, enum cubemap_face face, float val[3])
+{
+    __global uint8_t* dst = vcross_pixel_ptr(base, x, y, face_size, face, envmap_format_size(fmt));
+    envmap_texel_store(dst, fmt, val);
+}
+static size_t vstrip_face_offset(int face, size_t face_size)
+{
+    return face_size * face_size * face;
+}
+static __global uint8_t* vstrip_pixel_ptr(__global uint8_t* base, uint32_t x, uint32_t y, int face_size, enum cubemap_face face, int bpp)
+{
+    size_t offset = (vstrip_face_offset(face, face_size) + y * face_size + x) * bpp;
+    __global uint8_t* data = base + offset;
+    return data;
+}
+static void sample_vstrip_map(float col[3], __global uint8_t* base, int face_size, enum envmap_format fmt, __private const float vec[3])
+{
+    float u, v;
+    uint8_t face_idx;
+    cm_vec_to_texel_coord(&u, &v, &face_idx, vec);
+    int x = u * (face_size - 1);
+    int y = v * (face_size - 1);
+    size_t offset = (vstrip_face_offset(face_idx, face_size) + y * face_size + x) * envmap_format_size(fmt);
+    __global uint8_t* data = base + offset;
+    envmap_texel_load(col, data, fmt);
+}
+static void vstrip_setpixel(__global uint8_t* base, uint32_t face_size, enum envmap_format fmt, uint32_t x, uint32_t y, enum cubemap_face face, float val[3])
+{
+    __global uint8_t* dst = base + (vstrip_face_offset(face, face_size) + y * face_size + x) * envmap_format_size(fmt);
+    envmap_texel_store(dst, fmt, val);
+}
+static void latlong_vec_to_texel_coord(__private float* u, __private float* v, __private const float* vec)
+{
+    float theta, phi;
+    vec_to_sc(&theta, &phi, vec);
+    *u = theta * 0.15915494309189533576f + 0.5f;
+    *v = phi * 0.31830988618379067153f;
+}
+static void latlong_texel_coord_to_vec(__private float* out3f, float u, float v)
+{
+    sc_to_vec(out3f, u * 3.14159265358979323846f, (v + 1.0f) * 1.57079632679489661923f);
+}
+static __global uint8_t* latlong_pixel_ptr(__global uint8_t* base, uint32_t x, uint32_t y, uint32_t width, int bpp)
+{
+    return base + ((size_t)y * width + x) * bpp;
+}
+static void sample_latlong_map(float col[3], __global uint8_t* base, uint32_t width, uint32_t height, enum envmap_format fmt, __private const float vec[3])
+{
+    float u, v;
+    latlong_vec_to_texel_coord(&u, &v, vec);
+    uint32_t x = u * width;
+    uint32_t y = v * height;
+    x = x < width ? x : width - 1;
+    y = y < height ? y : height - 1;
+    __global uint8_t* data = latlong_pixel_ptr(base, x, y, width, envmap_format_size(fmt));
+    envmap_texel_load(col, data, fmt);
+}
+static void latlong_setpixel(__global uint8_t* base, uint32_t width, enum envmap_format fmt, uint32_t x, uint32_t y, float val[3])
+{
+    __global uint8_t* dst = latlong_pixel_ptr(base, x, y, width, envmap_format_size(fmt));
+    envmap_texel_store(dst, fmt, val);
+}
+struct bilinear_taps {
+    int face[4], x[4], y[4];
+    float w[4];
+    int corner;
+    int interior;
+};
+static void bilinear_taps_at(__private struct bilinear_taps* t, enum envmap_type type, int face_size, int face_width, float u, float v, int face_idx)
+{
+    const float s = u * face_width - 0.5f;
+    const float r = v * face_size - 0.5f;
+    const float sf = floor(s);
+    const float rf = floor(r);
+    const float fx = s - sf;
+    const float fy = r - rf;
+    const int x0 = (int)sf;
+    const int y0 = (int)rf;
+    t->interior = x0 >= 0 && y0 >= 0 && x0 + 1 < face_width && y0 + 1 < face_size;
+    t->corner = -1;
+    for (int i = 0; i < 4; ++i) {
+        int x = x0 + (i & 1);
+        int y = y0 + (i >> 1);
+        int face = face_idx;
+        if (t->interior) {
+        } else if (type == EM_TYPE_LATLONG) {
+            if (y < 0 || y >= face_size) {
+                y = y < 0 ? 0 : face_size - 1;
+                x += face_width / 2;
+            }
+            x = (x + face_width) % face_width;
+        } else {
+            const int xout = x < 0 || x >= face_size;
+            const int yout = y < 0 || y >= face_size;
+            if (xout && yout)
+                t->corner = i;
+            else
+                cm_texel_wrap(&face, &x, &y, face_size);
+        }
+        t->face[i] = face;
+        t->x[i] = x;
+        t->y[i] = y;
+        t->w[i] = ((i & 1) ? fx : 1.0f - fx) * ((i >> 1) ? fy : 1.0f - fy);
+    }
+}
+static void bilinear_taps_find(__private struct bilinear_taps* t, enum envmap_type type, int face_size, int face_width, __private const float vec[3])
+{
+    float u, v;
+    uint8_t face_idx;
+    envmap_vec_to_texel_coord(&u, &v, &face_idx, type, vec);
+    bilinear_taps_at(t, type, face_size, face_width, u, v, face_idx);
+}
+static void bilinear_taps_blend(__private float col[3], __private const struct bilinear_taps* t, __private float tap[4][3])
+{
+    if (t->corner >= 0) {
+        for (int c = 0; c < 3; ++c) {
+            float sum = 0.0f;
+            for (int i = 0; i < 4; ++i)
+                if (i != t->corner)
+                    sum += tap[i][c];
+            tap[t->corner][c] = sum * (1.0f / 3.0f);
+        }
+    }
+    for (int c = 0; c < 3; ++c)
+        col[c] = t->w[0] * tap[0][c] + t->w[1] * tap[1][c] + t->w[2] * tap[2][c] + t->w[3] * tap[3][c];
+}
+void envmap_vec_to_texel_coord(__private float* u, __private float* v, __private uint8_t* face_idx, enum envmap_type em_type, __private const float* vec)
+{
+    switch(em_type) {
+        case EM_TYPE_HCROSS:
+        case EM_TYPE_VCROSS:
+        case EM_TYPE_VSTRIP:
+            cm_vec_to_texel_coord(u, v, face_idx, vec);
+            break;
+        case EM_TYPE_LATLONG:
+            *face_idx = 0;
+            latlong_vec_to_texel_coord(u, v, vec);
+            break;
+        default:
+            ;
+            break;
+    }
+}
+void envmap_texel_coord_to_vec(__private float* out3f, enum envmap_type em_type, float u, float v, uint8_t face_id)
+{
+    switch(em_type) {
+        case EM_TYPE_HCROSS:
+        case EM_TYPE_VCROSS:
+        case EM_TYPE_VSTRIP:
+            cm_texel_coord_to_vec(out3f, u, v, face_id);
+            break;
+        case EM_TYPE_LATLONG:
+            latlong_texel_coord_to_vec(out3f, u, v);
+            break;
+        default:
+            ;
+            break;
+    }
+}
+float envmap_warp_fixup_factor(float face_size)
+{
+    if (face_size == 1.0f) {
+        return 1.0f;
+    }
+    const float fs = face_size;
+    const float fsmo = fs - 1.0f;
+    return (fs * fs) / (fsmo * fsmo * fsmo);
+}
+void envmap_texel_coord_to_vec_warp(__private float* out3f, enum envmap_type em_type, float u, float v, uint8_t face_id, float warp_fixup)
+{
+    if (em_type != EM_TYPE_LATLONG) {
+        u = (warp_fixup * u*u*u) + u;
+        v = (warp_fixup * v*v*v) + v;
+    }
+    envmap_texel_coord_to_vec(out3f, em_type, u, v, face_id);
+}
+void envmap_cube_face_basis(__private float basis[3][3], uint8_t face_id)
+{
+    for (int i = 0; i < 3; ++i) {
+        basis[i][0] = cm_face_uv_vectors[face_id][i][0];
+        basis[i][1] = cm_face_uv_vectors[face_id][i][1];
+        basis[i][2] = cm_face_uv_vectors[face_id][i][2];
+    }
+}
+uint32_t envmap_face_size(struct envmap* em)
+{
+    switch(em->type) {
+        case EM_TYPE_HCROSS:
+            return em->width / 4.0f;
+        case EM_TYPE_VCROSS:
+            return em->width / 3.0f;
+        case EM_TYPE_VSTRIP:
+            return em->height / 6.0f;
+        case EM_TYPE_LATLONG:
+            return em->height;
+        default:
+            ;
+            break;
+    }
+}
+void envmap_cube_dims(__private uint32_t* width, __private uint32_t* height, enum envmap_type em_type, uint32_t face_size)
+{
+    switch(em_type) {
+        case EM_TYPE_HCROSS:
+            *width = 4 * face_size;
+            *height = 3 * face_size;
+            break;
+        case EM_TYPE_VCROSS:
+            *width = 3 * face_size;
+            *height = 4 * face_size;
+            break;
+        case EM_TYPE_VSTRIP:
+            *width = face_size;
+            *height = 6 * face_size;
+            break;
+        default:
+            ;
+            break;
+    }
+}
+uint32_t envmap_face_width(struct envmap* em)
+{
+    return em->type == EM_TYPE_LATLONG ? em->width : envmap_face_size(em);
+}
+uint32_t envmap_face_count(struct envmap* em)
+{
+    return em->type == EM_TYPE_LATLONG ? 1 : 6;
+}
+void envmap_sample(__private float col[3], struct envmap* em, __private float vec[3])
+{
+    switch(em->type) {
+        case EM_TYPE_HCROSS:
+            sample_hcross_map(col, em->data, envmap_face_size(em), em->format, vec);
+            break;
+        case EM_TYPE_VCROSS:
+            sample_vcross_map(col, em->data, envmap_face_size(em), em->format, vec);
+            break;
+        case EM_TYPE_VSTRIP:
+            sample_vstrip_map(col, em->data, envmap_face_size(em), em->format, vec);
+            break;
+        case EM_TYPE_LATLONG:
+            sample_latlong_map(col, em->data, em->width, em->height, em->format, vec);
+            break;
+        default:
+            ;
+            break;
+    }
+}
+void envmap_sample_bilinear(__private float col[3], __private struct envmap* em, __private const float vec[3])
+{
+    struct bilinear_taps t;
+    bilinear_taps_find(&t, em->type, envmap_face_size(em), envmap_face_width(em), vec);
+    float tap[4][3];
+    for (int i = 0; i < 4; ++i)
+        if (i != t.corner)
+            envmap_texel_load(tap[i], envmap_pixel_ptr(em, t.x[i], t.y[i], t.face[i]), em->format);
+    bilinear_taps_blend(col, &t, tap);
+}
+void envmap_setpixel(__private struct envmap* em, uint32_t x, uint32_t y, enum cubemap_face face, __private float val[3])
+{
+    switch(em->type) {
+        case EM_TYPE_HCROSS:
+            hcross_setpixel(em->data, envmap_face_size(em), em->format, x, y, face, val);
+            break;
+        case EM_TYPE_VCROSS:
+            vcross_setpixel(em->data, envmap_face_size(em), em->format, x, y, face, val);
+            break;
+        case EM_TYPE_VSTRIP:
+            vstrip_setpixel(em->data, envmap_face_size(em), em->format, x, y, face, val);
+            break;
+        case EM_TYPE_LATLONG:
+            latlong_setpixel(em->data, em->width, em->format, x, y, val);
+            break;
+        default:
+            ;
+            break;
+    }
+}
+__global uint8_t* envmap_pixel_ptr(__private struct envmap* em, uint32_t x, uint32_t y, enum cubemap_face face)
+{
+    switch(em->type) {
+        case EM_TYPE_HCROSS:
+            return hcross_pixel_ptr(em->data, x, y, envmap_face_size(em), face, envmap_format_size(em->format));
+        case EM_TYPE_VCROSS:
+            return vcross_pixel_ptr(em->data, x, y, envmap_face_size(em), face, envmap_format_size(em->format));
+        case EM_TYPE_VSTRIP:
+            return vstrip_pixel_ptr(em->data, x, y, envmap_face_size(em), face, envmap_format_size(em->format));
+        case EM_TYPE_LATLONG:
+            return latlong_pixel_ptr(em->data, x, y, em->width, envmap_format_size(em->format));
+        default:
+            ;
+            break;
+    }
+}
+void sc_to_vec(__private float vec[3], float theta, float phi)
+{
+    vec[0] = sin(theta) * sin(phi);
+    vec[1] = cos(phi);
+    vec[2] = cos(theta) * sin(phi);
+}
+void vec_to_sc(__private float* theta, __private float* phi, __private const float vec[3])
+{
+    *theta = atan2(vec[0], vec[2]);
+    *phi = acos(vec[1]);
+}
+static float area_element(float x, float y)
+{
+    return atan2(x * y, sqrt(x * x + y * y + 1.0f));
+}
+float texel_solid_angle(float u, float v, float inv_face_size)
+{
+    const float x0 = u - inv_face_size;
+    const float x1 = u + inv_face_size;
+    const float y0 = v - inv_face_size;
+    const float y1 = v + inv_face_size;
+    const float solid_angle = area_element(x1, y1)
+                            - area_element(x0, y1)
+                            - area_element(x1, y0)
+                            + area_element(x0, y0);
+    return solid_angle;
+}
+enum nsa_layout {
+    NSA_LAYOUT_AOS,
+    NSA_LAYOUT_SOA,
+    NSA_LAYOUT_SYMMETRIC,
+    NSA_LAYOUT_NONE
+};
+size_t normal_solid_angle_index_sz(size_t face_sz, enum nsa_layout layout);
+void normal_solid_angle_index_build(void* mem, size_t face_sz, enum envmap_type em_type, enum nsa_layout layout);
+size_t normal_solid_angle_index_plane_stride(size_t face_sz);
+void* normal_solid_angle_index_alloc(size_t face_sz, enum nsa_layout layout);
+void normal_solid_angle_index_free(void* mem);
+void normal_solid_angle_index_row(const float* planes[4], const void* idx, size_t face_sz, enum nsa_layout layout, int face, size_t row, float* scratch);
+void normal_solid_angle_row_generate(float* planes, size_t face_sz, int face, size_t row);
+void normal_solid_angle_latlong_row_generate(float* planes, size_t width, size_t height, size_t row);
+void normal_solid_angle_index_symmetric_fetch(__private float nsa[4], __global const float* idx, uint32_t face_sz, uint8_t face, uint32_t x, uint32_t y);
+void normal_solid_angle_index_fetch(__private float nsa[4], __global const float* idx, enum nsa_layout layout, uint32_t plane_stride, uint32_t face_sz, uint8_t face, uint32_t x, uint32_t y);
+const float* normal_solid_angle_index_acquire(size_t face_sz, enum envmap_type em_type, enum nsa_layout layout);
+void normal_solid_angle_index_release(const float* idx);
+void normal_solid_angle_index_cache_budget(size_t bytes);
+void normal_solid_angle_index_cache_clear(void);
+enum sh_order {
+    SH_ORDER_L1 = 2,
+    SH_ORDER_L2 = 3,
+    SH_ORDER_L3 = 4,
+    SH_ORDER_L4 = 5
+};
+enum sh_precision {
+    SH_PRECISION_DOUBLE,
+    SH_PRECISION_FLOAT
+};
+void sh_eval_basis(double* sh_basis, enum sh_order order, const float* dir);
+void sh_eval_basisf(float* sh_basis, enum sh_order order, const float* dir);
+void sh_eval_basis5(double* sh_basis, const float* dir);
+void sh_eval_basis5f(float* sh_basis, const float* dir);
+void sh_coeffs(double sh_coeffs[][3], enum sh_order order, struct envmap* em, const float* nsa_idx, enum nsa_layout nsa_layout, enum sh_precision precision);
+void sh_coeffs_gpu(double sh_coeffs[][3], enum sh_order order, struct envmap* em, const float* nsa_idx, enum nsa_layout nsa_layout, enum sh_precision precision);
+void sh_irradiance(float irr[3], double sh_rgb[][3], enum sh_order order, float dir[3]);
+static void sh_eval_basis_l1(double* sh_basis, const float* dir) { const double x = (double)dir[0]; const double y = (double)dir[1]; const double z = (double)dir[2]; do { const double zero = {0}; sh_basis[0] = (zero + (0.28209479177)); sh_basis[1] = ((-0.4886025119) * y); sh_basis[2] = ((0.4886025119) * z); sh_basis[3] = ((-0.4886025119) * x); if ((2) <= 2) break; const double x2 = x*x; const double y2 = y*y; const double z2 = z*z; sh_basis[4] = ((1.09254843059) * y * x); sh_basis[5] = ((-1.09254843059) * y * z); sh_basis[6] = ((0.31539156525) * ((3.0) * z2 - (1.0))); sh_basis[7] = ((-1.09254843059) * x * z); sh_basis[8] = ((0.54627421529) * (x2 - y2)); if ((2) <= 3) break; const double z3 = z*z*z; sh_basis[9] = ((-0.59004358992) * y * (3 * x2 - y2)); sh_basis[10] = ((2.89061144264) * y * x * z); sh_basis[11] = ((-0.64636036822) * y * ((-1.0) + (5.0) * z2)); sh_basis[12] = ((0.37317633259) * ((5.0) * z3 - (3.0) * z)); sh_basis[13] = ((-0.45704579946) * x * ((-1.0) + (5.0) * z2)); sh_basis[14] = ((1.44530572132) * (x2 - y2) * z); sh_basis[15] = ((-0.59004358992) * x * (x2 - (3.0) * y2)); if ((2) <= 4) break; const double x4 = x*x*x*x; const double y4 = y*y*y*y; const double z4 = z*z*z*z; sh_basis[16] = ((2.5033429418) * x * y * (x2 - y2)); sh_basis[17] = ((-1.77013076978) * y * z * ((3.0) * x2 - y2)); sh_basis[18] = ((0.94617469575) * y * x * ((-1.0) + (7.0) * z2)); sh_basis[19] = ((-1.33809308711) * y * z * ((-3.0) + (7.0) * z2)); sh_basis[20] = (((105.0) * z4 - (90.0) * z2 + (9.0)) / (16.0 * 1.7724538509055160272981674833411451827975494561223871)); sh_basis[21] = ((-1.33809308711) * x * z * ((-3.0) + (7.0) * z2)); sh_basis[22] = ((0.47308734787) * (x2 - y2) * ((-1.0) + (7.0) * z2)); sh_basis[23] = ((-1.77013076978) * x * z * (x2 - (3.0) * y2)); sh_basis[24] = ((0.62583573544) * (x4 - (6.0) * y2 * x2 + y4)); } while (0); }
+static void sh_eval_basis_l2(double* sh_basis, const float* dir) { const double x = (double)dir[0]; const double y = (double)dir[1]; const double z = (double)dir[2]; do { const double zero = {0}; sh_basis[0] = (zero + (0.28209479177)); sh_basis[1] = ((-0.4886025119) * y); sh_basis[2] = ((0.4886025119) * z); sh_basis[3] = ((-0.4886025119) * x); if ((3) <= 2) break; const double x2 = x*x; const double y2 = y*y; const double z2 = z*z; sh_basis[4] = ((1.09254843059) * y * x); sh_basis[5] = ((-1.09254843059) * y * z); sh_basis[6] = ((0.31539156525) * ((3.0) * z2 - (1.0))); sh_basis[7] = ((-1.09254843059) * x * z); sh_basis[8] = ((0.54627421529) * (x2 - y2)); if ((3) <= 3) break; const double z3 = z*z*z; sh_basis[9] = ((-0.59004358992) * y * (3 * x2 - y2)); sh_basis[10] = ((2.89061144264) * y * x * z); sh_basis[11] = ((-0.64636036822) * y * ((-1.0) + (5.0) * z2)); sh_basis[12] = ((0.37317633259) * ((5.0) * z3 - (3.0) * z)); sh_basis[13] = ((-0.45704579946) * x * ((-1.0) + (5.0) * z2)); sh_basis[14] = ((1.44530572132) * (x2 - y2) * z); sh_basis[15] = ((-0.59004358992) * x * (x2 - (3.0) * y2)); if ((3) <= 4) break; const double x4 = x*x*x*x; const double y4 = y*y*y*y; const double z4 = z*z*z*z; sh_basis[16] = ((2.5033429418) * x * y * (x2 - y2)); sh_basis[17] = ((-1.77013076978) * y * z * ((3.0) * x2 - y2)); sh_basis[18] = ((0.94617469575) * y * x * ((-1.0) + (7.0) * z2)); sh_basis[19] = ((-1.33809308711) * y * z * ((-3.0) + (7.0) * z2)); sh_basis[20] = (((105.0) * z4 - (90.0) * z2 + (9.0)) / (16.0 * 1.7724538509055160272981674833411451827975494561223871)); sh_basis[21] = ((-1.33809308711) * x * z * ((-3.0) + (7.0) * z2)); sh_basis[22] = ((0.47308734787) * (x2 - y2) * ((-1.0) + (7.0) * z2)); sh_basis[23] = ((-1.77013076978) * x * z * (x2 - (3.0) * y2)); sh_basis[24] = ((0.62583573544) * (x4 - (6.0) * y2 * x2 + y4)); } while (0); }
+static void sh_eval_basis_l3(double* sh_basis, const float* dir) { const double x = (double)dir[0]; const double y = (double)dir[1]; const double z = (double)dir[2]; do { const double zero = {0}; sh_basis[0] = (zero + (0.28209479177)); sh_basis[1] = ((-0.4886025119) * y); sh_basis[2] = ((0.4886025119) * z); sh_basis[3] = ((-0.4886025119) * x); if ((4) <= 2) break; const double x2 = x*x; const double y2 = y*y; const double z2 = z*z; sh_basis[4] = ((1.09254843059) * y * x); sh_basis[5] = ((-1.09254843059) * y * z); sh_basis[6] = ((0.31539156525) * ((3.0) * z2 - (1.0))); sh_basis[7] = ((-1.09254843059) * x * z); sh_basis[8] = ((0.54627421529) * (x2 - y2)); if ((4) <= 3) break; const double z3 = z*z*z; sh_basis[9] = ((-0.59004358992) * y * (3 * x2 - y2)); sh_basis[10] = ((2.89061144264) * y * x * z); sh_basis[11] = ((-0.64636036822) * y * ((-1.0) + (5.0) * z2)); sh_basis[12] = ((0.37317633259) * ((5.0) * z3 - (3.0) * z)); sh_basis[13] = ((-0.45704579946) * x * ((-1.0) + (5.0) * z2)); sh_basis[14] = ((1.44530572132) * (x2 - y2) * z); sh_basis[15] = ((-0.59004358992) * x * (x2 - (3.0) * y2)); if ((4) <= 4) break; const double x4 = x*x*x*x; const double y4 = y*y*y*y; const double z4 = z*z*z*z; sh_basis[16] = ((2.5033429418) * x * y * (x2 - y2)); sh_basis[17] = ((-1.77013076978) * y * z * ((3.0) * x2 - y2)); sh_basis[18] = ((0.94617469575) * y * x * ((-1.0) + (7.0) * z2)); sh_basis[19] = ((-1.33809308711) * y * z * ((-3.0) + (7.0) * z2)); sh_basis[20] = (((105.0) * z4 - (90.0) * z2 + (9.0)) / (16.0 * 1.7724538509055160272981674833411451827975494561223871)); sh_basis[21] = ((-1.33809308711) * x * z * ((-3.0) + (7.0) * z2)); sh_basis[22] = ((0.47308734787) * (x2 - y2) * ((-1.0) + (7.0) * z2)); sh_basis[23] = ((-1.77013076978) * x * z * (x2 - (3.0) * y2)); sh_basis[24] = ((0.62583573544) * (x4 - (6.0) * y2 * x2 + y4)); } while (0); }
+static void sh_eval_basis_l4(double* sh_basis, const float* dir) { const double x = (double)dir[0]; const double y = (double)dir[1]; const double z = (double)dir[2]; do { const double zero = {0}; sh_basis[0] = (zero + (0.28209479177)); sh_basis[1] = ((-0.4886025119) * y); sh_basis[2] = ((0.4886025119) * z); sh_basis[3] = ((-0.4886025119) * x); if ((5) <= 2) break; const double x2 = x*x; const double y2 = y*y; const double z2 = z*z; sh_basis[4] = ((1.09254843059) * y * x); sh_basis[5] = ((-1.09254843059) * y * z); sh_basis[6] = ((0.31539156525) * ((3.0) * z2 - (1.0))); sh_basis[7] = ((-1.09254843059) * x * z); sh_basis[8] = ((0.54627421529) * (x2 - y2)); if ((5) <= 3) break; const double z3 = z*z*z; sh_basis[9] = ((-0.59004358992) * y * (3 * x2 - y2)); sh_basis[10] = ((2.89061144264) * y * x * z); sh_basis[11] = ((-0.64636036822) * y * ((-1.0) + (5.0) * z2)); sh_basis[12] = ((0.37317633259) * ((5.0) * z3 - (3.0) * z)); sh_basis[13] = ((-0.45704579946) * x * ((-1.0) + (5.0) * z2)); sh_basis[14] = ((1.44530572132) * (x2 - y2) * z); sh_basis[15] = ((-0.59004358992) * x * (x2 - (3.0) * y2)); if ((5) <= 4) break; const double x4 = x*x*x*x; const double y4 = y*y*y*y; const double z4 = z*z*z*z; sh_basis[16] = ((2.5033429418) * x * y * (x2 - y2)); sh_basis[17] = ((-1.77013076978) * y * z * ((3.0) * x2 - y2)); sh_basis[18] = ((0.94617469575) * y * x * ((-1.0) + (7.0) * z2)); sh_basis[19] = ((-1.33809308711) * y * z * ((-3.0) + (7.0) * z2)); sh_basis[20] = (((105.0) * z4 - (90.0) * z2 + (9.0)) / (16.0 * 1.7724538509055160272981674833411451827975494561223871)); sh_basis[21] = ((-1.33809308711) * x * z * ((-3.0) + (7.0) * z2)); sh_basis[22] = ((0.47308734787) * (x2 - y2) * ((-1.0) + (7.0) * z2)); sh_basis[23] = ((-1.77013076978) * x * z * (x2 - (3.0) * y2)); sh_basis[24] = ((0.62583573544) * (x4 - (6.0) * y2 * x2 + y4)); } while (0); }
+void sh_eval_basis(double* sh_basis, enum sh_order order, const float* dir)
+{
+    switch (order) {
+        case SH_ORDER_L1: sh_eval_basis_l1(sh_basis, dir); break;
+        case SH_ORDER_L2: sh_eval_basis_l2(sh_basis, dir); break;
+        case SH_ORDER_L3: sh_eval_basis_l3(sh_basis, dir); break;
+        default: sh_eval_basis_l4(sh_basis, dir); break;
+    }
+}
+void sh_eval_basis5(double* sh_basis, const float* dir)
+{
+    sh_eval_basis_l4(sh_basis, dir);
+}
+static void sh_eval_basisf_l1(float* sh_basis, const float* dir) { const float x = (float)dir[0]; const float y = (float)dir[1]; const float z = (float)dir[2]; do { const float zero = {0}; sh_basis[0] = (zero + ((float)(0.28209479177))); sh_basis[1] = (((float)(-0.4886025119)) * y); sh_basis[2] = (((float)(0.4886025119)) * z); sh_basis[3] = (((float)(-0.4886025119)) * x); if ((2) <= 2) break; const float x2 = x*x; const float y2 = y*y; const float z2 = z*z; sh_basis[4] = (((float)(1.09254843059)) * y * x); sh_basis[5] = (((float)(-1.09254843059)) * y * z); sh_basis[6] = (((float)(0.31539156525)) * (((float)(3.0)) * z2 - ((float)(1.0)))); sh_basis[7] = (((float)(-1.09254843059)) * x * z); sh_basis[8] = (((float)(0.54627421529)) * (x2 - y2)); if ((2) <= 3) break; const float z3 = z*z*z; sh_basis[9] = (((float)(-0.59004358992)) * y * (3 * x2 - y2)); sh_basis[10] = (((float)(2.89061144264)) * y * x * z); sh_basis[11] = (((float)(-0.64636036822)) * y * (((float)(-1.0)) + ((float)(5.0)) * z2)); sh_basis[12] = (((float)(0.37317633259)) * (((float)(5.0)) * z3 - ((float)(3.0)) * z)); sh_basis[13] = (((float)(-0.45704579946)) * x * (((float)(-1.0)) + ((float)(5.0)) * z2)); sh_basis[14] = (((float)(1.44530572132)) * (x2 - y2) * z); sh_basis[15] = (((float)(-0.59004358992)) * x * (x2 - ((float)(3.0)) * y2)); if ((2) <= 4) break; const float x4 = x*x*x*x; const float y4 = y*y*y*y; const float z4 = z*z*z*z; sh_basis[16] = (((float)(2.5033429418)) * x * y * (x2 - y2)); sh_basis[17] = (((float)(-1.77013076978)) * y * z * (((float)(3.0)) * x2 - y2)); sh_basis[18] = (((float)(0.94617469575)) * y * x * (((float)(-1.0)) + ((float)(7.0)) * z2)); sh_basis[19] = (((float)(-1.33809308711)) * y * z * (((float)(-3.0)) + ((float)(7.0)) * z2)); sh_basis[20] = ((((float)(105.0)) * z4 - ((float)(90.0)) * z2 + ((float)(9.0))) / ((float)(16.0 * 1.7724538509055160272981674833411451827975494561223871))); sh_basis[21] = (((float)(-1.33809308711)) * x * z * (((float)(-3.0)) + ((float)(7.0)) * z2)); sh_basis[22] = (((float)(0.47308734787)) * (x2 - y2) * (((float)(-1.0)) + ((float)(7.0)) * z2)); sh_basis[23] = (((float)(-1.77013076978)) * x * z * (x2 - ((float)(3.0)) * y2)); sh_basis[24] = (((float)(0.62583573544)) * (x4 - ((float)(6.0)) * y2 * x2 + y4)); } while (0); }
+static void sh_eval_basisf_l2(float* sh_basis, const float* dir) { const float x = (float)dir[0]; const float y = (float)dir[1]; const float z = (float)dir[2]; do { const float zero = {0}; sh_basis[0] = (zero + ((float)(0.28209479177))); sh_basis[1] = (((float)(-0.4886025119)) * y); sh_basis[2] = (((float)(0.4886025119)) * z); sh_basis[3] = (((float)(-0.4886025119)) * x); if ((3) <= 2) break; const float x2 = x*x; const float y2 = y*y; const float z2 = z*z; sh_basis[4] = (((float)(1.09254843059)) * y * x); sh_basis[5] = (((float)(-1.09254843059)) * y * z); sh_basis[6] = (((float)(0.31539156525)) * (((float)(3.0)) * z2 - ((float)(1.0)))); sh_basis[7] = (((float)(-1.09254843059)) * x * z); sh_basis[8] = (((float)(0.54627421529)) * (x2 - y2)); if ((3) <= 3) break; const float z3 = z*z*z; sh_basis[9] = (((float)(-0.59004358992)) * y * (3 * x2 - y2)); sh_basis[10] = (((float)(2.89061144264)) * y * x * z); sh_basis[11] = (((float)(-0.64636036822)) * y * (((float)(-1.0)) + ((float)(5.0)) * z2)); sh_basis[12] = (((float)(0.37317633259)) * (((float)(5.0)) * z3 - ((float)(3.0)) * z)); sh_basis[13] = (((float)(-0.45704579946)) * x * (((float)(-1.0)) + ((float)(5.0)) * z2)); sh_basis[14] = (((float)(1.44530572132)) * (x2 - y2) * z); sh_basis[15] = (((float)(-0.59004358992)) * x * (x2 - ((float)(3.0)) * y2)); if ((3) <= 4) break; const float x4 = x*x*x*x; const float y4 = y*y*y*y; const float z4 = z*z*z*z; sh_basis[16] = (((float)(2.5033429418)) * x * y * (x2 - y2)); sh_basis[17] = (((float)(-1.77013076978)) * y * z * (((float)(3.0)) * x2 - y2)); sh_basis[18] = (((float)(0.94617469575)) * y * x * (((float)(-1.0)) + ((float)(7.0)) * z2)); sh_basis[19] = (((float)(-1.33809308711)) * y * z * (((float)(-3.0)) + ((float)(7.0)) * z2)); sh_basis[20] = ((((float)(105.0)) * z4 - ((float)(90.0)) * z2 + ((float)(9.0))) / ((float)(16.0 * 1.7724538509055160272981674833411451827975494561223871))); sh_basis[21] = (((float)(-1.33809308711)) * x * z * (((float)(-3.0)) + ((float)(7.0)) * z2)); sh_basis[22] = (((float)(0.47308734787)) * (x2 - y2) * (((float)(-1.0)) + ((float)(7.0)) * z2)); sh_basis[23] = (((float)(-1.77013076978)) * x * z * (x2 - ((float)(3.0)) * y2)); sh_basis[24] = (((float)(0.62583573544)) * (x4 - ((float)(6.0)) * y2 * x2 + y4)); } while (0); }
+static void sh_eval_basisf_l3(float* sh_basis, const float* dir) { const float x = (float)dir[0]; const float y = (float)dir[1]; const float z = (float)dir[2]; do { const float zero = {0}; sh_basis[0] = (zero + ((float)(0.28209479177))); sh_basis[1] = (((float)(-0.4886025119)) * y); sh_basis[2] = (((float)(0.4886025119)) * z); sh_basis[3] = (((float)(-0.4886025119)) * x); if ((4) <= 2) break; const float x2 = x*x; const float y2 = y*y; const float z2 = z*z; sh_basis[4] = (((float)(1.09254843059)) * y * x); sh_basis[5] = (((float)(-1.09254843059)) * y * z); sh_basis[6] = (((float)(0.31539156525)) * (((float)(3.0)) * z2 - ((float)(1.0)))); sh_basis[7] = (((float)(-1.09254843059)) * x * z); sh_basis[8] = (((float)(0.54627421529)) * (x2 - y2)); if ((4) <= 3) break; const float z3 = z*z*z; sh_basis[9] = (((float)(-0.59004358992)) * y * (3 * x2 - y2)); sh_basis[10] = (((float)(2.89061144264)) * y * x * z); sh_basis[11] = (((float)(-0.64636036822)) * y * (((float)(-1.0)) + ((float)(5.0)) * z2)); sh_basis[12] = (((float)(0.37317633259)) * (((float)(5.0)) * z3 - ((float)(3.0)) * z)); sh_basis[13] = (((float)(-0.45704579946)) * x * (((float)(-1.0)) + ((float)(5.0)) * z2)); sh_basis[14] = (((float)(1.44530572132)) * (x2 - y2) * z); sh_basis[15] = (((float)(-0.59004358992)) * x * (x2 - ((float)(3.0)) * y2)); if ((4) <= 4) break; const float x4 = x*x*x*x; const float y4 = y*y*y*y; const float z4 = z*z*z*z; sh_basis[16] = (((float)(2.5033429418)) * x * y * (x2 - y2)); sh_basis[17] = (((float)(-1.77013076978)) * y * z * (((float)(3.0)) * x2 - y2)); sh_basis[18] = (((float)(0.94617469575)) * y * x * (((float)(-1.0)) + ((float)(7.0)) * z2)); sh_basis[19] = (((float)(-1.33809308711)) * y * z * (((float)(-3.0)) + ((float)(7.0)) * z2)); sh_basis[20] = ((((float)(105.0)) * z4 - ((float)(90.0)) * z2 + ((float)(9.0))) / ((float)(16.0 * 1.7724538509055160272981674833411451827975494561223871))); sh_basis[21] = (((float)(-1.33809308711)) * x * z * (((float)(-3.0)) + ((float)(7.0)) * z2)); sh_basis[22] = (((float)(0.47308734787)) * (x2 - y2) * (((float)(-1.0)) + ((float)(7.0)) * z2)); sh_basis[23] = (((float)(-1.77013076978)) * x * z * (x2 - ((float)(3.0)) * y2)); sh_basis[24] = (((float)(0.62583573544)) * (x4 - ((float)(6.0)) * y2 * x2 + y4)); } while (0); }
+static void sh_eval_basisf_l4(float* sh_basis, const float* dir) { const float x = (float)dir[0]; const float y = (float)dir[1]; const float z = (float)dir[2]; do { const float zero = {0}; sh_basis[0] = (zero + ((float)(0.28209479177))); sh_basis[1] = (((float)(-0.4886025119)) * y); sh_basis[2] = (((float)(0.4886025119)) * z); sh_basis[3] = (((float)(-0.4886025119)) * x); if ((5) <= 2) break; const float x2 = x*x; const float y2 = y*y; const float z2 = z*z; sh_basis[4] = (((float)(1.09254843059)) * y * x); sh_basis[5] = (((float)(-1.09254843059)) * y * z); sh_basis[6] = (((float)(0.31539156525)) * (((float)(3.0)) * z2 - ((float)(1.0)))); sh_basis[7] = (((float)(-1.09254843059)) * x * z); sh_basis[8] = (((float)(0.54627421529)) * (x2 - y2)); if ((5) <= 3) break; const float z3 = z*z*z; sh_basis[9] = (((float)(-0.59004358992)) * y * (3 * x2 - y2)); sh_basis[10] = (((float)(2.89061144264)) * y * x * z); sh_basis[11] = (((float)(-0.64636036822)) * y * (((float)(-1.0)) + ((float)(5.0)) * z2)); sh_basis[12] = (((float)(0.37317633259)) * (((float)(5.0)) * z3 - ((float)(3.0)) * z)); sh_basis[13] = (((float)(-0.45704579946)) * x * (((float)(-1.0)) + ((float)(5.0)) * z2)); sh_basis[14] = (((float)(1.44530572132)) * (x2 - y2) * z); sh_basis[15] = (((float)(-0.59004358992)) * x * (x2 - ((float)(3.0)) * y2)); if ((5) <= 4) break; const float x4 = x*x*x*x; const float y4 = y*y*y*y; const float z4 = z*z*z*z; sh_basis[16] = (((float)(2.5033429418)) * x * y * (x2 - y2)); sh_basis[17] = (((float)(-1.77013076978)) * y * z * (((float)(3.0)) * x2 - y2)); sh_basis[18] = (((float)(0.94617469575)) * y * x * (((float)(-1.0)) + ((float)(7.0)) * z2)); sh_basis[19] = (((float)(-1.33809308711)) * y * z * (((float)(-3.0)) + ((float)(7.0)) * z2)); sh_basis[20] = ((((float)(105.0)) * z4 - ((float)(90.0)) * z2 + ((float)(9.0))) / ((float)(16.0 * 1.7724538509055160272981674833411451827975494561223871))); sh_basis[21] = (((float)(-1.33809308711)) * x * z * (((float)(-3.0)) + ((float)(7.0)) * z2)); sh_basis[22] = (((float)(0.47308734787)) * (x2 - y2) * (((float)(-1.0)) + ((float)(7.0)) * z2)); sh_basis[23] = (((float)(-1.77013076978)) * x * z * (x2 - ((float)(3.0)) * y2)); sh_basis[24] = (((float)(0.62583573544)) * (x4 - ((float)(6.0)) * y2 * x2 + y4)); } while (0); }
+void sh_eval_basisf(float* sh_basis, enum sh_order order, const float* dir)
+{
+    switch (order) {
+        case SH_ORDER_L1: sh_eval_basisf_l1(sh_basis, dir); break;
+        case SH_ORDER_L2: sh_eval_basisf_l2(sh_basis, dir); break;
+        case SH_ORDER_L3: sh_eval_basisf_l3(sh_basis, dir); break;
+        default: sh_eval_basisf_l4(sh_basis, dir); break;
+    }
+}
+void sh_eval_basis5f(float* sh_basis, const float* dir)
+{
+    sh_eval_basisf_l4(sh_basis, dir);
+}
+static uint32_t nsa_fold_count(uint32_t face_sz)
+{
+    return (face_sz + 1) / 2;
+}
+static uint32_t nsa_fold(uint32_t c, uint32_t face_sz, __private float* sign)
+{
+    if (2 * c + 1 < face_sz) {
+        *sign = -1.0f;
+        c = face_sz - 1 - c;
+    } else {
+        *sign = 1.0f;
+    }
+    return c - (face_sz - nsa_fold_count(face_sz));
+}
+static void nsa_symmetric_expand(__private float nsa[4], __global const float* e, int swapped, float su, float sv, __private float basis[3][3])
+{
+    const float cu = su * (swapped ? e[1] : e[0]);
+    const float cv = sv * (swapped ? e[0] : e[1]);
+    nsa[0] = basis[0][0] * cu + basis[1][0] * cv + basis[2][0] * e[2];
+    nsa[1] = basis[0][1] * cu + basis[1][1] * cv + basis[2][1] * e[2];
+    nsa[2] = basis[0][2] * cu + basis[1][2] * cv + basis[2][2] * e[2];
+    nsa[3] = e[3];
+}
+void normal_solid_angle_index_symmetric_fetch(__private float nsa[4], __global const float* idx, uint32_t face_sz, uint8_t face, uint32_t x, uint32_t y)
+{
+    float su, sv;
+    const uint32_t a = nsa_fold(x, face_sz, &su);
+    const uint32_t b = nsa_fold(y, face_sz, &sv);
+    const uint32_t lo = a < b ? a : b;
+    const uint32_t hi = a < b ? b : a;
+    float basis[3][3];
+    envmap_cube_face_basis(basis, face);
+    nsa_symmetric_expand(nsa, idx + (hi * (hi + 1) / 2 + lo) * 4, a > b, su, sv, basis);
+}
+void normal_solid_angle_index_fetch(__private float nsa[4], __global const float* idx, enum nsa_layout layout, uint32_t plane_stride, uint32_t face_sz, uint8_t face, uint32_t x, uint32_t y)
+{
+    const uint32_t i = (face * face_sz * face_sz) + y * face_sz + x;
+    if (layout == NSA_LAYOUT_SOA) {
+        nsa[0] = idx[i + 0 * plane_stride];
+        nsa[1] = idx[i + 1 * plane_stride];
+        nsa[2] = idx[i + 2 * plane_stride];
+        nsa[3] = idx[i + 3 * plane_stride];
+    } else if (layout == NSA_LAYOUT_NONE) {
+        const float texel_size = 1.0f / (float)face_sz;
+        const float v = 2.0f * ((y + 0.5f) * texel_size) - 1.0f;
+        const float u = 2.0f * ((x + 0.5f) * texel_size) - 1.0f;
+        envmap_texel_coord_to_vec_warp(nsa, EM_TYPE_HCROSS, u, v, face, envmap_warp_fixup_factor(face_sz));
+        nsa[3] = texel_solid_angle(u, v, texel_size);
+    } else if (layout == NSA_LAYOUT_SYMMETRIC) {
+        normal_solid_angle_index_symmetric_fetch(nsa, idx, face_sz, face, x, y);
+    } else {
+        nsa[0] = idx[i * 4 + 0];
+        nsa[1] = idx[i * 4 + 1];
+        nsa[2] = idx[i * 4 + 2];
+        nsa[3] = idx[i * 4 + 3];
+    }
+}
+#pragma OPENCL EXTENSION cl_khr_fp64: enable
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics: enable
+void atomic_add_dbl(__global double* val, double delta)
+{
+    union {
+        double f;
+        ulong i;
+    } old;
+    union {
+        double f;
+        ulong i;
+    } new;
+    do {
+        old.f = *val;
+        new.f = old.f + delta;
+    } while (atom_cmpxchg ((volatile __global ulong *)val, old.i, new.i) != old.i);
+}
+__kernel void booo(__global double* sh_coeffs,
+                   __global double* weight_accum,
+                   __global unsigned char* img_in,
+                   __global float* nsa_idx,
+                   const unsigned int nsa_layout,
+                   const unsigned int nsa_plane_stride,
+                   const unsigned int face_sz,
+                   const unsigned int em_type,
+                   const unsigned int em_format,
+                   const unsigned int face)
+{
+    unsigned int xdst = get_global_id(1);
+    unsigned int ydst = get_global_id(0);
+    struct envmap em;
+    em.format = em_format;
+    em.data = img_in;
+    em.type = em_type;
+    envmap_cube_dims(&em.width, &em.height, em.type, face_sz);
+    float nsa[4];
+    normal_solid_angle_index_fetch(nsa, nsa_idx, nsa_layout, nsa_plane_stride, face_sz, face, xdst, ydst);
+    float col[3];
+    envmap_texel_load(col, envmap_pixel_ptr(&em, xdst, ydst, face), em.format);
+    const double rr = (double)col[0];
+    const double gg = (double)col[1];
+    const double bb = (double)col[2];
+    double sh_basis[((SH_KERNEL_ORDER) * (SH_KERNEL_ORDER))];
+    sh_eval_basis(sh_basis, SH_KERNEL_ORDER, nsa);
+    const double weight = (double)nsa[3];
+    for (uint8_t ii = 0; ii < ((SH_KERNEL_ORDER) * (SH_KERNEL_ORDER)); ++ii) {
+        atomic_add_dbl(sh_coeffs + ii * 3 + 0, rr * sh_basis[ii] * weight);
+        atomic_add_dbl(sh_coeffs + ii * 3 + 1, gg * sh_basis[ii] * weight);
+        atomic_add_dbl(sh_coeffs + ii * 3 + 2, bb * sh_basis[ii] * weight);
+    }
+    atomic_add_dbl(weight_accum, weight);
+}